@@ -0,0 +1,158 @@
+// adv_parse_bench: measures how many adverts per second tracer_parse_adv_data() gets through on a mix of the advert
+// shapes a scan in a city hears, against the parser scan_cb() used before, which copied every advert into a
+// tracer_ble_payload and walked all of its records. checks that both accept the same adverts with the same datapairs.
+
+#include "tracer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CORPUS_LEN  8
+
+typedef struct {
+    const char * name;
+    uint8_t data[31];
+    size_t len;
+} advert;
+
+double now_s() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// parses a payload the way tracer_parse_ble_payload() did before tracer_parse_adv_data(). every record is walked.
+bool parse_old(tracer_ble_payload payload, tracer_datapair * datapair) {
+    size_t payload_len = payload.len < sizeof(payload.value) ? payload.len : sizeof(payload.value);
+
+    bool output_valid = false, payload_valid = false;
+    for (size_t i = 0; i < payload_len;) {
+        uint8_t record_len = payload.value[i++];
+
+        if (record_len == 0) break;
+        if (i + record_len > payload_len) return false;
+
+        uint8_t type = payload.value[i++];
+
+        const uint8_t * data = payload.value + i;
+        uint8_t data_len = record_len - 1;
+
+        switch (type) {
+            case 0x03:
+                payload_valid = data_len >= 2 && data[0] == 0x6f && data[1] == 0xfd;
+            break;
+            case 0x16:
+                if (data_len == 2 + sizeof(datapair->rpi.value) + sizeof(datapair->aem.value)) {
+                    if (datapair) {
+                        memcpy(datapair->rpi.value, data + 2, sizeof(datapair->rpi.value));
+                        memcpy(datapair->aem.value, data + 2 + sizeof(datapair->rpi.value), sizeof(datapair->aem.value));
+                    }
+                    output_valid = true;
+                }
+            break;
+        }
+        i += data_len;
+    }
+
+    return output_valid && payload_valid;
+}
+
+void add_advert(advert * corpus, size_t * len, const char * name, const uint8_t * data, size_t data_len) {
+    corpus[*len].name = name;
+    memcpy(corpus[*len].data, data, data_len);
+    corpus[(*len)++].len = data_len;
+}
+
+int main(int argc, char ** argv) {
+    size_t len = 10000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n': len = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n adverts]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (!tracer_crypto_init()) {
+        fprintf(stderr, "no crypto backend runs on this cpu!\n");
+        return 1;
+    }
+
+    // the shapes of adverts around, with made up payloads. one in eight is an exposure notification.
+    const uint8_t apple_continuity[] = { 0x02, 0x01, 0x1a, 0x0a, 0xff, 0x4c, 0x00, 0x10, 0x05, 0x01, 0x18, 0x1c, 0x7a, 0x3e };
+    const uint8_t ibeacon[] = { 0x02, 0x01, 0x06, 0x1a, 0xff, 0x4c, 0x00, 0x02, 0x15, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 0, 1, 0, 2, 0xc5 };
+    const uint8_t eddystone_url[] = { 0x02, 0x01, 0x06, 0x03, 0x03, 0xaa, 0xfe, 0x11, 0x16, 0xaa, 0xfe, 0x10, 0x00, 0x03, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x07 };
+    const uint8_t tile[] = { 0x02, 0x01, 0x06, 0x03, 0x03, 0xed, 0xfe, 0x0d, 0x16, 0xed, 0xfe, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+    const uint8_t microsoft_cdp[] = { 0x1e, 0xff, 0x06, 0x00, 0x01, 0x09, 0x20, 0x02, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23 };
+    const uint8_t named_sensor[] = { 0x02, 0x01, 0x06, 0x09, 0x09, 'H', 'R', 'M', '-', '1', '2', '3', 0x03, 0x02, 0x0d, 0x18 };
+
+    tracer_datapair datapair;
+    tracer_ble_payload exposure;
+    rng_gen(sizeof(datapair), &datapair);
+    tracer_derive_ble_payload_v2(&datapair, &exposure);
+
+    advert corpus[CORPUS_LEN];
+    size_t corpus_len = 0;
+
+    add_advert(corpus, &corpus_len, "apple continuity", apple_continuity, sizeof(apple_continuity));
+    add_advert(corpus, &corpus_len, "ibeacon", ibeacon, sizeof(ibeacon));
+    add_advert(corpus, &corpus_len, "eddystone url", eddystone_url, sizeof(eddystone_url));
+    add_advert(corpus, &corpus_len, "tile", tile, sizeof(tile));
+    add_advert(corpus, &corpus_len, "microsoft cdp", microsoft_cdp, sizeof(microsoft_cdp));
+    add_advert(corpus, &corpus_len, "named sensor", named_sensor, sizeof(named_sensor));
+    add_advert(corpus, &corpus_len, "exposure, tracer layout", exposure.value, exposure.len);
+    add_advert(corpus, &corpus_len, "exposure, no flags", exposure.value + 3, exposure.len - 3);   // phones leave the flags out
+
+    for (size_t i = 0; i < corpus_len; i++) {
+        tracer_ble_payload payload = { .len = corpus[i].len };
+        tracer_datapair old_pair, new_pair;
+
+        memcpy(payload.value, corpus[i].data, corpus[i].len);
+        bool old_valid = parse_old(payload, &old_pair);
+        bool new_valid = tracer_parse_adv_data(corpus[i].data, corpus[i].len, &new_pair);
+        bool exposure = strncmp(corpus[i].name, "exposure", 8) == 0;
+
+        if (old_valid != exposure || new_valid != exposure || (exposure && (!tracer_compare_datapairs_v2(&old_pair, &datapair)
+            || !tracer_compare_datapairs_v2(&new_pair, &datapair)))) {
+            fprintf(stderr, "the parsers disagree on the %s advert!\n", corpus[i].name);
+            return 1;
+        }
+    }
+
+    printf("%-28s %14s %14s\n", "advert", "new adverts/s", "old adverts/s");
+
+    // each shape alone, then the whole mix
+    for (size_t c = 0; c <= corpus_len; c++) {
+        size_t found = 0;
+        double start = now_s();
+
+        for (size_t i = 0; i < len; i++) {
+            const advert * adv = &corpus[c < corpus_len ? c : i % corpus_len];
+            found += tracer_parse_adv_data(adv->data, adv->len, &datapair);
+        }
+        double new_s = now_s() - start;
+
+        start = now_s();
+        for (size_t i = 0; i < len; i++) {
+            const advert * adv = &corpus[c < corpus_len ? c : i % corpus_len];
+            tracer_ble_payload payload = { .len = adv->len };
+            memcpy(payload.value, adv->data, adv->len);
+            found -= parse_old(payload, &datapair);
+        }
+        double old_s = now_s() - start;
+
+        if (found != 0) {
+            fprintf(stderr, "the parsers found different adverts!\n");
+            return 1;
+        }
+
+        printf("%-28s %14.0f %14.0f\n", c < corpus_len ? corpus[c].name : "mix", len / new_s, len / old_s);
+    }
+
+    return 0;
+}
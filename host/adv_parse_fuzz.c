@@ -0,0 +1,113 @@
+// adv_parse_fuzz: a fuzz target for tracer_parse_adv_data(). every input is copied into a buffer of exactly its own
+// length, so address sanitizer catches any read past the end. an accepted advert has to hold the exposure notification
+// uuid and its service data, and the datapair has to be the 20 bytes after the service data's uuid. built with
+// -DADV_PARSE_LIBFUZZER it is a libfuzzer target, otherwise it mutates generated adverts on its own, after checking that
+// an exposure advert is accepted with its uuid listed after another service's.
+
+#include "tracer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// checks one input. aborts if the parser read out of bounds (through asan) or accepted something it shouldn't have.
+void check_input(const uint8_t * data, size_t len) {
+    uint8_t * copy = malloc(len ? len : 1);
+    memcpy(copy, data, len);
+
+    tracer_datapair datapair;
+    bool valid = tracer_parse_adv_data(copy, len, &datapair);
+
+    if (valid != tracer_parse_adv_data(copy, len, NULL)) {
+        fprintf(stderr, "the parser gave a different answer without a datapair!\n");
+        abort();
+    }
+
+    if (valid) {
+        // the datapair has to come right after a 0x6f 0xfd inside the advert
+        const uint8_t * found = NULL;
+        for (size_t i = 2; i + sizeof(datapair) <= len && found == NULL; i++) {
+            if (copy[i - 2] == 0x6f && copy[i - 1] == 0xfd && memcmp(copy + i, &datapair, sizeof(datapair)) == 0) found = copy + i;
+        }
+
+        if (found == NULL) {
+            fprintf(stderr, "the parser accepted an advert without its datapair in it!\n");
+            abort();
+        }
+    }
+
+    free(copy);
+}
+
+#ifdef ADV_PARSE_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t len) {
+    check_input(data, len);
+    return 0;
+}
+
+#else
+
+int main(int argc, char ** argv) {
+    size_t len = 10000000;
+    unsigned seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+            case 'n': len = strtoul(optarg, NULL, 10); break;
+            case 's': seed = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n inputs] [-s seed]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (!tracer_crypto_init()) {
+        fprintf(stderr, "no crypto backend runs on this cpu!\n");
+        return 1;
+    }
+
+    tracer_datapair datapair, parsed;
+    tracer_ble_payload exposure;
+    size_t accepted = 0;
+
+    srand(seed);
+    rng_gen(sizeof(datapair), &datapair);
+    tracer_derive_ble_payload_v2(&datapair, &exposure);
+
+    // the same advert with the battery service listed before the exposure notification uuid, as some phones send it
+    uint8_t listed_second[TRACER_ADV_FAST_LEN + 2] = { 2, 0x01, 0x1a, 5, 0x03, 0x0f, 0x18, 0x6f, 0xfd };
+    memcpy(listed_second + 9, exposure.value + TRACER_ADV_FAST_OFFSET + 4, TRACER_ADV_FAST_LEN - TRACER_ADV_FAST_OFFSET - 4);
+
+    check_input(listed_second, sizeof(listed_second));
+    if (!tracer_parse_adv_data(listed_second, sizeof(listed_second), &parsed) || !tracer_compare_datapairs_v2(&parsed, &datapair)) {
+        fprintf(stderr, "the parser didn't accept an advert with the exposure notification uuid listed second!\n");
+        return 1;
+    }
+
+    for (size_t n = 0; n < len; n++) {
+        uint8_t input[40];
+        size_t input_len = rand() % sizeof(input);
+
+        if (rand() % 2) {
+            // an exposure advert, with the uuid listed first or second, cut short or run long, with a few bytes flipped
+            const uint8_t * advert = rand() % 2 ? exposure.value : listed_second;
+            size_t advert_len = advert == exposure.value ? exposure.len : sizeof(listed_second);
+
+            for (size_t i = 0; i < input_len; i++) input[i] = i < advert_len ? advert[i] : rand();
+            for (int flips = rand() % 3; flips > 0 && input_len > 0; flips--) input[rand() % input_len] = rand();
+        } else {
+            // random bytes, with plenty of small ones so they look like record lengths and types
+            for (size_t i = 0; i < input_len; i++) input[i] = rand() % 4 == 0 ? rand() % 32 : rand();
+        }
+
+        check_input(input, input_len);
+        accepted += tracer_parse_adv_data(input, input_len, NULL);
+    }
+
+    printf("%zu inputs, %zu accepted, no faults\n", len, accepted);
+    return 0;
+}
+
+#endif
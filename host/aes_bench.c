@@ -0,0 +1,122 @@
+// aes_bench: measures how many aes blocks per second are encrypted when the key is expanded for every block, the way
+// encrypt_aes_block() and tracer_derive_rpi() do, against a reusable aes_ctx that is expanded once. checks that both
+// give the same blocks, then runs each crypto backend built into the binary.
+
+#include "tracer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EPOCH   1600000000
+
+double now_s() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// checks that the keyed functions give the same blocks as the ones that expand the key every time.
+bool check(const uint8_t key[AES128_KEY_SIZE]) {
+    aes_ctx ctx;
+    tracer_rpik rpik;
+    bool ok = true;
+
+    memcpy(rpik.value, key, sizeof(rpik.value));
+    aes_ctx_init(&ctx, key, AES128_KEY_SIZE);
+
+    for (uint32_t i = 0; i < 1000 && ok; i++) {
+        uint8_t data[AES128_BLOCK_SIZE], a[AES128_BLOCK_SIZE], b[AES128_BLOCK_SIZE];
+        rng_gen(sizeof(data), data);
+
+        encrypt_aes_block((void *)key, AES128_KEY_SIZE, data, a);
+        aes_ctx_encrypt_block(&ctx, data, b);
+        ok &= memcmp(a, b, sizeof(a)) == 0;
+
+        decrypt_aes_block((void *)key, AES128_KEY_SIZE, a, a);
+        aes_ctx_decrypt_block(&ctx, b, b);
+        ok &= memcmp(a, data, sizeof(a)) == 0 && memcmp(b, data, sizeof(b)) == 0;
+
+        tracer_rpi rpi_a = tracer_derive_rpi(rpik, EPOCH + i * 60);
+        tracer_rpi rpi_b = tracer_derive_rpi_keyed(&ctx, EPOCH + i * 60);
+        ok &= memcmp(&rpi_a, &rpi_b, sizeof(rpi_a)) == 0;
+    }
+
+    aes_ctx_free(&ctx);
+    return ok;
+}
+
+int main(int argc, char ** argv) {
+    size_t len = 1000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n': len = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n blocks]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (!tracer_crypto_init()) {
+        fprintf(stderr, "no crypto backend runs on this cpu!\n");
+        return 1;
+    }
+
+    uint8_t key[AES128_KEY_SIZE];
+    rng_gen(sizeof(key), key);
+
+    printf("%-8s %-24s %14s\n", "backend", "function", "blocks/s");
+
+    for (size_t b = 0; b < TRACER_CRYPTO_BACKEND_COUNT; b++) {
+        if (!tracer_crypto_set_backend(tracer_crypto_backends[b])) continue;
+        const char * name = tracer_crypto_backends[b]->name;
+
+        if (!check(key)) {
+            fprintf(stderr, "the %s backend's keyed blocks don't match!\n", name);
+            return 1;
+        }
+
+        uint8_t block[AES128_BLOCK_SIZE] = { 0 };
+        tracer_rpik rpik;
+        tracer_rpi rpi;
+        aes_ctx ctx;
+        double start, elapsed;
+
+        memcpy(rpik.value, key, sizeof(rpik.value));
+
+        // every result feeds the next block, so the calls can't be skipped or run out of order
+        start = now_s();
+        for (size_t i = 0; i < len; i++) encrypt_aes_block(key, sizeof(key), block, block);
+        elapsed = now_s() - start;
+        printf("%-8s %-24s %14.0f\n", name, "encrypt_aes_block", len / elapsed);
+
+        start = now_s();
+        aes_ctx_init(&ctx, key, sizeof(key));
+        for (size_t i = 0; i < len; i++) aes_ctx_encrypt_block(&ctx, block, block);
+        aes_ctx_free(&ctx);
+        elapsed = now_s() - start;
+        printf("%-8s %-24s %14.0f\n", name, "aes_ctx_encrypt_block", len / elapsed);
+
+        start = now_s();
+        for (size_t i = 0; i < len; i++) {
+            rpi = tracer_derive_rpi(rpik, EPOCH + i * 60);
+            rpik.value[0] ^= rpi.value[0];
+        }
+        elapsed = now_s() - start;
+        printf("%-8s %-24s %14.0f\n", name, "tracer_derive_rpi", len / elapsed);
+
+        start = now_s();
+        aes_ctx_init(&ctx, rpik.value, sizeof(rpik.value));
+        for (size_t i = 0; i < len; i++) {
+            rpi = tracer_derive_rpi_keyed(&ctx, EPOCH + (i ^ rpi.value[0]) * 60);
+        }
+        aes_ctx_free(&ctx);
+        elapsed = now_s() - start;
+        printf("%-8s %-24s %14.0f\n", name, "tracer_derive_rpi_keyed", len / elapsed);
+    }
+
+    return 0;
+}
@@ -0,0 +1,174 @@
+// alloc_test: checks that the pointer-based tracer api never touches the heap. malloc, calloc and realloc are replaced
+// with versions that count their calls, and every derive, parse and verify function is run many times on each crypto
+// backend built into the binary. fails if any of them allocated.
+
+#define TRACER_KEY_CACHE_SIZE   16  // so the cached verify is checked too. the test runs on one thread.
+
+#include "tracer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define EPOCH   1600000000
+
+// glibc's own allocator, which the counting versions below hand the real work to
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t count, size_t size);
+extern void * __libc_realloc(void * ptr, size_t size);
+
+size_t alloc_count = 0;
+
+void * malloc(size_t size) {
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+void * calloc(size_t count, size_t size) {
+    alloc_count++;
+    return __libc_calloc(count, size);
+}
+
+void * realloc(void * ptr, size_t size) {
+    alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+
+typedef struct {
+    const char * name;
+    bool (*run)(uint32_t i);    // runs the function once. returns false if it gave a wrong result.
+} op;
+
+tracer_tek tek;
+tracer_datapair datapair, parsed;
+tracer_ble_payload payload;
+tracer_datapair batch[TRACER_BATCH_SIZE * 2];
+
+bool run_derive_datapair(uint32_t i) {
+    tracer_derive_datapair_v2(EPOCH + i * 60, -(int8_t)(i % 40), &datapair);
+    return true;
+}
+
+bool run_derive_ble_payload(uint32_t i) {
+    tracer_derive_ble_payload_v2(&datapair, &payload);
+    return payload.len == TRACER_ADV_FAST_LEN;
+}
+
+bool run_parse_ble_payload(uint32_t i) {
+    return tracer_parse_ble_payload_v2(&payload, &parsed) && tracer_compare_datapairs_v2(&parsed, &datapair);
+}
+
+bool run_parse_adv_data(uint32_t i) {
+    // the same records with a name record in front, so the slow path walks them
+    uint8_t adv_data[TRACER_ADV_FAST_LEN + 4] = { 3, 0x09, 't', 'r' };
+    memcpy(adv_data + 4, payload.value, TRACER_ADV_FAST_LEN);
+    return tracer_parse_adv_data(adv_data, sizeof(adv_data), &parsed) && tracer_compare_datapairs_v2(&parsed, &datapair);
+}
+
+bool run_compare_datapairs(uint32_t i) {
+    return tracer_compare_datapairs_v2(&parsed, &datapair);
+}
+
+bool run_verify(uint32_t i) {
+    uint32_t enin;
+    tracer_metadata metadata;
+    return tracer_verify_v2(&datapair, &tek, &enin, &metadata) && enin == tracer_epoch2enin(EPOCH + i * 60);
+}
+
+bool run_verify_batch(uint32_t i) {
+    bool matches[TRACER_BATCH_SIZE * 2];
+    uint32_t enins[TRACER_BATCH_SIZE * 2];
+    return tracer_verify_batch(batch, TRACER_BATCH_SIZE * 2, &tek, matches, enins) == TRACER_BATCH_SIZE;
+}
+
+bool run_derive_keypair(uint32_t i) {
+    tracer_keypair keypair;
+    tracer_derive_keypair_v2(&tek, &keypair);
+    return true;
+}
+
+bool run_b64(uint32_t i) {
+    char name[16];
+    uint32_t decoded;
+    b64_encode_to(&i, sizeof(i), name, sizeof(name));
+    return b64_decode_to(name, &decoded, sizeof(decoded)) == sizeof(decoded) && decoded == i;
+}
+
+const op ops[] = {
+    { "tracer_derive_datapair_v2",      run_derive_datapair },
+    { "tracer_derive_ble_payload_v2",   run_derive_ble_payload },
+    { "tracer_parse_ble_payload_v2",    run_parse_ble_payload },
+    { "tracer_parse_adv_data",          run_parse_adv_data },
+    { "tracer_compare_datapairs_v2",    run_compare_datapairs },
+    { "tracer_verify_v2",               run_verify },
+    { "tracer_verify_batch",            run_verify_batch },
+    { "tracer_derive_keypair_v2",       run_derive_keypair },
+    { "b64_encode_to, b64_decode_to",   run_b64 },
+};
+
+#define OP_COUNT (sizeof(ops) / sizeof(ops[0]))
+
+int main(int argc, char ** argv) {
+    size_t len = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n': len = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n runs]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (!tracer_crypto_init()) {
+        fprintf(stderr, "no crypto backend runs on this cpu!\n");
+        return 1;
+    }
+
+    bool ok = true;
+    printf("%-8s %-30s %12s\n", "backend", "function", "allocations");
+
+    for (size_t b = 0; b < TRACER_CRYPTO_BACKEND_COUNT; b++) {
+        if (!tracer_crypto_set_backend(tracer_crypto_backends[b])) continue;
+
+        // the setup may allocate, but none of the calls after it may
+        tek = *tracer_derive_tek(EPOCH);
+        tracer_key_cache_clear();
+
+        // a backend can keep the contexts of freed aes keys for the next ones to reuse, so set up and free a few
+        aes_ctx warm[4];
+        for (size_t i = 0; i < 4; i++) aes_ctx_init(&warm[i], tek.value, sizeof(tek.value));
+        for (size_t i = 0; i < 4; i++) aes_ctx_free(&warm[i]);
+
+        // every other datapair in the batch is the device's own
+        rng_gen(sizeof(batch), batch);
+        for (size_t i = 0; i < TRACER_BATCH_SIZE * 2; i += 2) tracer_derive_datapair_v2(EPOCH + i * 60, 0, &batch[i]);
+
+        size_t allocs[OP_COUNT] = { 0 };
+        bool correct[OP_COUNT];
+        memset(correct, true, sizeof(correct));
+
+        // the ops run in order, so the later ones work on the datapair and payload the earlier ones derived this run
+        for (uint32_t i = 1; i <= len; i++) {
+            for (size_t o = 0; o < OP_COUNT; o++) {
+                size_t before = alloc_count;
+                correct[o] &= ops[o].run(i);
+                allocs[o] += alloc_count - before;
+            }
+        }
+
+        for (size_t o = 0; o < OP_COUNT; o++) {
+            printf("%-8s %-30s %12zu%s\n", tracer_crypto_backends[b]->name, ops[o].name, allocs[o], correct[o] ? "" : "  wrong result!");
+            ok &= allocs[o] == 0 && correct[o];
+        }
+    }
+
+    if (!ok) {
+        fprintf(stderr, "a function allocated or gave a wrong result!\n");
+        return 1;
+    }
+
+    printf("no allocations in %zu runs of each function\n", len);
+    return 0;
+}
@@ -0,0 +1,192 @@
+// crypto_bench: checks that every crypto backend built into the binary gives bit-identical results, then measures
+// each of them. every backend is checked against the rfc 5869 and fips-197 test vectors, and against the mbedtls
+// backend on random hkdf, aes-ecb and aes-ctr inputs and on the rpis and aems derived from random teks.
+
+#include "tracer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EPOCH       1600000000
+#define CTR_LEN     4096    // how big the buffers the aes-ctr benchmark flips are
+
+double now_s() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// checks a backend against the first test case of rfc 5869 and the aes-128 example of fips-197.
+bool check_vectors() {
+    uint8_t ikm[22], salt[13], info[10], okm[42];
+    const uint8_t expected_okm[42] = {
+        0x3c, 0xb2, 0x5f, 0x25, 0xfa, 0xac, 0xd5, 0x7a, 0x90, 0x43, 0x4f, 0x64, 0xd0, 0x36, 0x2f, 0x2a, 0x2d, 0x2d, 0x0a, 0x90, 0xcf,
+        0x1a, 0x5a, 0x4c, 0x5d, 0xb0, 0x2d, 0x56, 0xec, 0xc4, 0xc5, 0xbf, 0x34, 0x00, 0x72, 0x08, 0xd5, 0xb8, 0x87, 0x18, 0x58, 0x65,
+    };
+
+    memset(ikm, 0x0b, sizeof(ikm));
+    for (size_t i = 0; i < sizeof(salt); i++) salt[i] = i;
+    for (size_t i = 0; i < sizeof(info); i++) info[i] = 0xf0 + i;
+    hkdf(ikm, sizeof(ikm), salt, sizeof(salt), info, sizeof(info), sizeof(okm), okm);
+
+    uint8_t key[16], plaintext[16], ciphertext[16];
+    const uint8_t expected_ciphertext[16] = { 0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a };
+
+    for (size_t i = 0; i < sizeof(key); i++) {
+        key[i] = i;
+        plaintext[i] = i * 0x11;
+    }
+    encrypt_aes_block(key, sizeof(key), plaintext, ciphertext);
+
+    return memcmp(okm, expected_okm, sizeof(okm)) == 0 && memcmp(ciphertext, expected_ciphertext, sizeof(ciphertext)) == 0;
+}
+
+// runs one random case on a backend. everything it derives is written to out, so two backends can be compared.
+size_t run_case(const tracer_crypto_backend * backend, uint32_t seed, uint8_t * out) {
+    uint8_t key[32], salt[100], info[80], data[300], iv[16];
+    size_t key_len = 16 + 8 * (seed % 3), data_len = seed % sizeof(data), salt_len = seed % sizeof(salt), info_len = seed % sizeof(info);
+    size_t len = 0;
+
+    // the inputs come from rand(), so every backend gets the same ones for a seed
+    srand(seed);
+    for (size_t i = 0; i < sizeof(key); i++) key[i] = rand();
+    for (size_t i = 0; i < sizeof(salt); i++) salt[i] = rand();
+    for (size_t i = 0; i < sizeof(info); i++) info[i] = rand();
+    for (size_t i = 0; i < sizeof(data); i++) data[i] = rand();
+    for (size_t i = 0; i < sizeof(iv); i++) iv[i] = rand();
+    if (seed % 7 == 0) memset(iv + 8, 0xff, 8);     // so the counter carries into the top half
+
+    tracer_crypto_set_backend(backend);
+
+    hkdf(key, key_len, salt_len ? salt : NULL, salt_len, info, info_len, 1 + seed % 100, out + len);
+    len += 1 + seed % 100;
+
+    aes_ctx ctx;
+    aes_ctx_init(&ctx, key, key_len);
+    aes_ctx_encrypt_blocks(&ctx, data, out + len, data_len / 16);
+    aes_ctx_decrypt_blocks(&ctx, out + len, out + len + data_len / 16 * 16, data_len / 16);
+    len += data_len / 16 * 32;
+    aes_ctx_flip_ctr(&ctx, iv, data, data_len, out + len);
+    len += data_len;
+    aes_ctx_free(&ctx);
+
+    tracer_tek tek = { .epoch = EPOCH + seed * 600 };
+    tracer_keypair keypair;
+    tracer_keypair_ctx keypair_ctx;
+    tracer_metadata metadata = { { 0x40, (uint8_t)seed, 0, 0 } };
+
+    memcpy(tek.value, key, sizeof(tek.value));
+    tracer_derive_keypair_v2(&tek, &keypair);
+    tracer_keypair_ctx_init(&keypair_ctx, keypair);
+
+    tracer_rpi rpi = tracer_derive_rpi_keyed(&keypair_ctx.rpik, tek.epoch);
+    tracer_aem aem = tracer_derive_aem_keyed(&keypair_ctx.aemk, rpi, metadata);
+    tracer_keypair_ctx_free(&keypair_ctx);
+
+    memcpy(out + len, &keypair, sizeof(keypair));
+    len += sizeof(keypair);
+    memcpy(out + len, &rpi, sizeof(rpi));
+    len += sizeof(rpi);
+    memcpy(out + len, &aem, sizeof(aem));
+    len += sizeof(aem);
+
+    return len;
+}
+
+int main(int argc, char ** argv) {
+    size_t cases = 1000;
+    size_t len = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:")) != -1) {
+        switch (opt) {
+            case 'c': cases = strtoul(optarg, NULL, 10); break;
+            case 'n': len = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-c random cases] [-n operations]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (!tracer_crypto_init()) {
+        fprintf(stderr, "no crypto backend runs on this cpu!\n");
+        return 1;
+    }
+
+    fprintf(stderr, "%zu backends built, %s picked\n", TRACER_CRYPTO_BACKEND_COUNT, tracer_crypto_get_backend()->name);
+
+    for (size_t b = 0; b < TRACER_CRYPTO_BACKEND_COUNT; b++) {
+        const tracer_crypto_backend * backend = tracer_crypto_backends[b];
+
+        if (!tracer_crypto_set_backend(backend)) {
+            fprintf(stderr, "the %s backend doesn't run on this cpu, skipping it\n", backend->name);
+            continue;
+        }
+
+        if (!check_vectors()) {
+            fprintf(stderr, "the %s backend fails the test vectors!\n", backend->name);
+            return 1;
+        }
+
+        for (uint32_t seed = 0; seed < cases; seed++) {
+            uint8_t expected[2048], actual[2048];
+            size_t expected_len = run_case(&tracer_crypto_mbedtls, seed, expected);
+            size_t actual_len = run_case(backend, seed, actual);
+
+            if (actual_len != expected_len || memcmp(actual, expected, expected_len) != 0) {
+                fprintf(stderr, "the %s backend differs from mbedtls on case %u!\n", backend->name, seed);
+                return 1;
+            }
+        }
+    }
+
+    fprintf(stderr, "every backend matches mbedtls on %zu random cases\n\n", cases);
+    printf("%-8s %14s %14s %14s %14s\n", "backend", "keypairs/s", "ecb blocks/s", "ctr MB/s", "verify rpis/s");
+
+    tracer_datapair * datapairs = malloc(len * sizeof(tracer_datapair));
+    bool * matches = malloc(len * sizeof(bool));
+    uint8_t * buffer = malloc(len * AES128_BLOCK_SIZE > CTR_LEN ? len * AES128_BLOCK_SIZE : CTR_LEN);
+    tracer_tek tek = { .epoch = EPOCH };
+
+    rng_gen(len * sizeof(tracer_datapair), datapairs);
+    memset(buffer, 0, len * AES128_BLOCK_SIZE > CTR_LEN ? len * AES128_BLOCK_SIZE : CTR_LEN);     // so page faults aren't timed
+    rng_gen(sizeof(tek.value), tek.value);
+
+    for (size_t b = 0; b < TRACER_CRYPTO_BACKEND_COUNT; b++) {
+        if (!tracer_crypto_set_backend(tracer_crypto_backends[b])) continue;
+
+        tracer_keypair keypair;
+        aes_ctx ctx;
+        uint8_t iv[16] = { 0 };
+        double keypairs, blocks, ctr, rpis, start;
+
+        // a keypair is two hkdf expands of one extracted tek
+        start = now_s();
+        for (size_t i = 0; i < len / 10; i++) tracer_derive_keypair_v2(&tek, &keypair);
+        keypairs = len / 10 / (now_s() - start);
+
+        aes_ctx_init(&ctx, keypair.rpik.value, sizeof(keypair.rpik.value));
+
+        start = now_s();
+        aes_ctx_encrypt_blocks(&ctx, buffer, buffer, len);
+        blocks = len / (now_s() - start);
+
+        start = now_s();
+        for (size_t i = 0; i < len * AES128_BLOCK_SIZE / CTR_LEN; i++) aes_ctx_flip_ctr(&ctx, iv, buffer, CTR_LEN, buffer);
+        ctr = len * AES128_BLOCK_SIZE / CTR_LEN * CTR_LEN / (now_s() - start) / 1e6;
+
+        start = now_s();
+        tracer_verify_batch_keyed(datapairs, len, &ctx, matches, NULL);
+        rpis = len / (now_s() - start);
+
+        aes_ctx_free(&ctx);
+        printf("%-8s %14.0f %14.0f %14.1f %14.0f\n", tracer_crypto_backends[b]->name, keypairs, blocks, ctr, rpis);
+    }
+
+    free(buffer);
+    free(matches);
+    free(datapairs);
+    return 0;
+}
@@ -0,0 +1,136 @@
+// http_bench: runs the firmware's http client in http.h against a server on the host. sends a number of requests over
+// one kept-alive connection, then the same number with a new connection each, which is what the firmware used to do.
+// reports how long each request took and how many bytes came back. with -c, it talks https, checking the server against
+// a ca certificate, and also runs the requests with a new connection and a full handshake each, so resumed tls sessions
+// can be compared with full handshakes.
+
+#include "http.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    size_t bytes;
+    size_t responses;
+} bench_body;
+
+typedef enum {
+    BENCH_KEEP_ALIVE,
+    BENCH_CLOSE,            // a new connection each request, resuming the tls session if there is one
+    BENCH_CLOSE_FULL,       // a new connection and a full tls handshake each request
+} bench_mode;
+
+double now_us() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+void count_body(char * data, size_t len, void * user_data) {
+    bench_body * body = (bench_body *)user_data;
+    body->bytes += len;
+    body->responses += len == 0;
+}
+
+// sends requests, closing the connection after each one unless the mode keeps it alive. returns the number that failed.
+size_t run(http_conn * conn, const char * method, const char * path, size_t requests, bench_mode mode, double * us, bench_body * body) {
+    size_t failed = 0;
+    size_t connects = 0, resumed = 0;
+    uint32_t handshake_ms = 0;
+    double start = now_us();
+
+    for (size_t i = 0; i < requests; i++) {
+        bool connecting = conn->socket < 0;
+        if (connecting && mode == BENCH_CLOSE_FULL) http_tls_forget(conn->host, conn->port);
+
+        http_begin(conn, method, path);
+        int status = http_send(conn, NULL, 0, count_body, body);
+        if (status < 200 || status >= 300) failed++;
+
+        if (connecting) {
+            connects++;
+            resumed += conn->resumed;
+            handshake_ms += conn->handshake_ms;
+        }
+
+        if (mode != BENCH_KEEP_ALIVE) http_conn_close(conn);
+    }
+
+    *us = (now_us() - start) / requests;
+    http_conn_close(conn);
+
+    const char * names[] = { "keep-alive", "close", "close, full" };
+    printf("%-11s %8zu %8zu %8zu %12.1f %12zu", names[mode], requests, connects, failed, *us, body->bytes / requests);
+    if (conn->ca_pem) printf(" %8zu %13.1f", resumed, connects ? (double)handshake_ms / connects : 0);
+    printf("\n");
+    return failed;
+}
+
+// reads a ca certificate. returns NULL if it can't be read.
+char * read_pem(const char * path) {
+    FILE * file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    char * pem = calloc(1, 16384);
+    fread(pem, 1, 16383, file);
+    fclose(file);
+    return pem;
+}
+
+int main(int argc, char ** argv) {
+    size_t requests = 100;
+    int port = 80;
+    const char * method = "GET";
+    char * ca_pem = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:p:m:c:")) != -1) {
+        switch (opt) {
+            case 'n': requests = strtoul(optarg, NULL, 10); break;
+            case 'p': port = atoi(optarg); break;
+            case 'm': method = optarg; break;
+            case 'c':
+                if ((ca_pem = read_pem(optarg)) == NULL) {
+                    fprintf(stderr, "couldn't read %s.\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                optind = argc + 1;
+        }
+    }
+
+    if (optind >= argc || requests == 0) {
+        fprintf(stderr, "usage: %s [-n requests] [-p port] [-m method] [-c ca.pem] host [path]\n", argv[0]);
+        return 1;
+    }
+
+    const char * host = argv[optind];
+    const char * path = optind + 1 < argc ? argv[optind + 1] : "/";
+
+    http_conn conn;
+    if (ca_pem) {
+        http_conn_init_tls(&conn, host, port, ca_pem);
+    } else {
+        http_conn_init(&conn, host, port);
+    }
+
+    printf("%-11s %8s %8s %8s %12s %12s", "mode", "requests", "connects", "failed", "us/request", "body bytes");
+    if (ca_pem) printf(" %8s %13s", "resumed", "handshake ms");
+    printf("\n");
+
+    double us[3];
+    bench_body bodies[3] = { 0 };
+    size_t failed = 0;
+    for (bench_mode mode = BENCH_KEEP_ALIVE; mode <= (ca_pem ? BENCH_CLOSE_FULL : BENCH_CLOSE); mode++) {
+        failed += run(&conn, method, path, requests, mode, &us[mode], &bodies[mode]);
+    }
+
+    printf("keep-alive is %.2fx as fast.\n", us[BENCH_CLOSE] / us[BENCH_KEEP_ALIVE]);
+    if (ca_pem) printf("resuming tls sessions is %.2fx as fast as full handshakes.\n", us[BENCH_CLOSE_FULL] / us[BENCH_CLOSE]);
+
+    free(ca_pem);
+    return failed > 0;
+}
@@ -0,0 +1,418 @@
+// journal_bench: compares how the scan journal, written a block per scan or through the buffer main.c uses, and the
+// one-file-per-scan layout it replaced wear the spiffs partition, over a month of simulated scans. there is no spiffs
+// on a host, so both run against a model of what spiffs does to the flash: the journal runs on the ram disk behind a
+// file_store backend that feeds every open, write, close and remove through the model, and the old layout feeds the
+// model directly. reports the payload, the bytes and pages programmed and the blocks erased over the last day, once the
+// store period is full, and the pages read walking the files to expire scans and to test a batch of teks.
+
+#define _GNU_SOURCE
+
+#include "scan_journal.h"
+#include "file_store_ram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+#define SCANS_PER_DAY       (TRACER_MINUTES_PER_DAY / TRACER_SCAN_INTERVAL)
+#define FIRST_SCANIN        (1600000000 / 60 / TRACER_SCAN_INTERVAL)
+#define RAM_DISK_SIZE       (256 * 1024 * 1024)
+
+#define SPIFFS_PAGE_LEN         256
+#define SPIFFS_PAGE_HEADER_LEN  5       // the object id, span index and flags at the start of every page
+#define SPIFFS_PAGE_DATA_LEN    (SPIFFS_PAGE_LEN - SPIFFS_PAGE_HEADER_LEN)
+#define SPIFFS_LOOKUP_ENTRY_LEN 2       // every page has an entry in the lookup page at the start of its block
+#define SPIFFS_PAGES_PER_BLOCK  15      // 16 pages of 256 bytes in a 4096 byte block, less the lookup page
+#define SPIFFS_HEADER_ENTRIES   102     // the data pages a file's index header lists, after its name and size
+#define SPIFFS_INDEX_ENTRIES    124     // the data pages each further index page lists
+#define PARTITION_LEN           (1024 * 1024)   // the files partition in esp_partitions.csv
+#define PAGE_READ_US            26      // reading a page over spi at 40 MHz in dio mode
+
+// what spiffs has done to the flash so far. there is no cache in the model, so page reads are an upper bound.
+typedef struct {
+    size_t payload;         // the bytes written to files
+    size_t programmed;      // the bytes spiffs programs for them, with page headers, index pages and lookup entries
+    size_t allocated;       // the pages taken from free space. each of them costs a 15th of a block erase to get back.
+    size_t page_reads;
+    size_t files;
+    size_t live_pages;
+} spiffs_model;
+
+typedef struct {
+    spiffs_model written;   // over the last day
+    size_t expiry_reads;    // the pages read to expire scans over the last day
+    size_t match_reads;     // the pages read to test one batch of teks against every stored scan
+} bench_result;
+
+// an open file on the modelled backend.
+typedef struct {
+    FILE * file;                    // the same file, on the ram disk
+    _file_store_ram_file * ram_file;
+    size_t open_len;                // how long the file was after opening it
+    bool created;
+    long cached_page;               // the last data page read, which spiffs keeps in its file descriptor
+} _model_cookie;
+
+static file_store ram_store;
+static spiffs_model model;
+
+size_t data_pages(size_t len) {
+    return (len + SPIFFS_PAGE_DATA_LEN - 1) / SPIFFS_PAGE_DATA_LEN;
+}
+
+// the index pages a file needs besides its index header.
+size_t index_pages(size_t len) {
+    size_t pages = data_pages(len);
+    return pages > SPIFFS_HEADER_ENTRIES ? (pages - SPIFFS_HEADER_ENTRIES + SPIFFS_INDEX_ENTRIES - 1) / SPIFFS_INDEX_ENTRIES : 0;
+}
+
+// the index page a data page is listed in, counting the index header as 0.
+size_t index_page_of(size_t data_page) {
+    return data_page < SPIFFS_HEADER_ENTRIES ? 0 : 1 + (data_page - SPIFFS_HEADER_ENTRIES) / SPIFFS_INDEX_ENTRIES;
+}
+
+size_t model_blocks(const spiffs_model * m) {
+    size_t blocks = m->live_pages / SPIFFS_PAGES_PER_BLOCK + 1;
+    return blocks > PARTITION_LEN / 4096 ? blocks : PARTITION_LEN / 4096;
+}
+
+void model_allocate(spiffs_model * m, size_t pages, size_t bytes) {
+    m->allocated += pages;
+    m->live_pages += pages;
+    m->programmed += bytes + pages * SPIFFS_LOOKUP_ENTRY_LEN;
+}
+
+// deleting a page clears a flag in its header and its lookup entry.
+void model_delete(spiffs_model * m, size_t pages) {
+    m->live_pages -= pages;
+    m->programmed += pages * (1 + SPIFFS_LOOKUP_ENTRY_LEN);
+}
+
+// spiffs finds a file by reading the lookup page of every block, and the index header of every file it passes, until
+// the name matches. a file that doesn't exist takes the whole walk.
+void model_find(spiffs_model * m, bool exists) {
+    size_t pages = model_blocks(m) + m->files;
+    m->page_reads += exists ? pages / 2 : pages;
+}
+
+// readdir() reads every lookup page, and the index header of every file for its name.
+void model_walk(spiffs_model * m) {
+    m->page_reads += model_blocks(m) + m->files;
+}
+
+// a write session grows a file from old_len to new_len bytes. the rest of a partial last page is programmed in place,
+// and every index page listing a new data page is written again to a fresh page. so is the index header, for the size.
+void model_write(spiffs_model * m, size_t old_len, size_t new_len, bool created) {
+    if (created) {
+        m->files++;
+        model_allocate(m, 1, SPIFFS_PAGE_LEN);
+    }
+
+    if (new_len <= old_len) return;
+
+    size_t appended = new_len - old_len;
+    size_t partial = old_len % SPIFFS_PAGE_DATA_LEN ? SPIFFS_PAGE_DATA_LEN - old_len % SPIFFS_PAGE_DATA_LEN : 0;
+    size_t filled = partial < appended ? partial : appended;
+    size_t old_pages = data_pages(old_len), new_pages = data_pages(new_len);
+
+    m->payload += appended;
+    m->programmed += filled;
+    model_allocate(m, new_pages - old_pages, appended - filled + (new_pages - old_pages) * SPIFFS_PAGE_HEADER_LEN);
+
+    if (new_pages > old_pages) {
+        // the index pages besides the header that list the new data pages, and how many of them already existed
+        size_t first = index_page_of(old_pages) > 0 ? index_page_of(old_pages) : 1, last = index_page_of(new_pages - 1);
+        size_t old_last = index_pages(old_len) < last ? index_pages(old_len) : last;
+        size_t rewritten = last >= first ? last - first + 1 : 0;
+        size_t replaced = old_last >= first ? old_last - first + 1 : 0;
+
+        model_allocate(m, rewritten, rewritten * SPIFFS_PAGE_LEN);
+        model_delete(m, replaced);
+    }
+
+    model_allocate(m, 1, SPIFFS_PAGE_LEN);
+    model_delete(m, 1);
+}
+
+// truncating a file deletes its data and index pages. the header is written again by the next write.
+void model_truncate(spiffs_model * m, size_t len) {
+    model_delete(m, data_pages(len) + index_pages(len));
+}
+
+void model_remove(spiffs_model * m, size_t len) {
+    model_delete(m, data_pages(len) + index_pages(len) + 1);
+    m->files--;
+}
+
+ssize_t _model_read(void * cookie, char * buf, size_t size) {
+    _model_cookie * c = (_model_cookie *)cookie;
+    long pos = ftell(c->file);
+    size_t len = fread(buf, 1, size, c->file);
+
+    for (long page = pos / SPIFFS_PAGE_DATA_LEN; len > 0 && page <= (long)((pos + len - 1) / SPIFFS_PAGE_DATA_LEN); page++) {
+        if (page != c->cached_page) model.page_reads++;
+        c->cached_page = page;
+    }
+
+    return len;
+}
+
+ssize_t _model_write(void * cookie, const char * buf, size_t size) {
+    _model_cookie * c = (_model_cookie *)cookie;
+    return fwrite(buf, 1, size, c->file) == size ? (ssize_t)size : -1;
+}
+
+int _model_seek(void * cookie, off64_t * offset, int whence) {
+    _model_cookie * c = (_model_cookie *)cookie;
+    if (fseek(c->file, *offset, whence) != 0) return -1;
+
+    *offset = ftell(c->file);
+    return 0;
+}
+
+int _model_close(void * cookie) {
+    _model_cookie * c = (_model_cookie *)cookie;
+    int result = fclose(c->file);
+
+    model_write(&model, c->open_len, c->ram_file->len, c->created);
+    free(c);
+    return result;
+}
+
+bool _model_mount(file_store * store) {
+    return file_store_mount(&ram_store, &file_store_ram, store->root, NULL);
+}
+
+void _model_unmount(file_store * store) {
+}
+
+bool _model_format(file_store * store) {
+    memset(&model, 0, sizeof(model));
+    return file_store_format(&ram_store);
+}
+
+bool _model_info(file_store * store, size_t * total, size_t * used) {
+    return file_store_info(&ram_store, total, used);
+}
+
+FILE * _model_open(file_store * store, const char * name, const char * mode) {
+    _file_store_ram_file * ram_file = _file_store_ram_find((file_store_ram_disk *)ram_store.state, name);
+
+    model_find(&model, ram_file != NULL);
+    if (ram_file == NULL && mode[0] == 'r') return NULL;
+    if (ram_file != NULL && mode[0] == 'w') model_truncate(&model, ram_file->len);
+
+    _model_cookie * cookie = (_model_cookie *)malloc(sizeof(_model_cookie));
+    cookie->created = ram_file == NULL;
+    cookie->open_len = ram_file != NULL && mode[0] != 'w' ? ram_file->len : 0;
+    cookie->cached_page = -1;
+    cookie->file = file_store_open(&ram_store, name, mode);
+    cookie->ram_file = _file_store_ram_find((file_store_ram_disk *)ram_store.state, name);
+
+    cookie_io_functions_t io = {
+        .read = _model_read,
+        .write = _model_write,
+        .seek = _model_seek,
+        .close = _model_close,
+    };
+
+    return fopencookie(cookie, mode, io);
+}
+
+bool _model_remove(file_store * store, const char * name) {
+    _file_store_ram_file * ram_file = _file_store_ram_find((file_store_ram_disk *)ram_store.state, name);
+
+    model_find(&model, ram_file != NULL);
+    if (ram_file == NULL) return false;
+
+    model_remove(&model, ram_file->len);
+    return file_store_remove(&ram_store, name);
+}
+
+bool _model_rename(file_store * store, const char * from, const char * to) {
+    model_find(&model, true);
+    model_find(&model, false);
+    model_allocate(&model, 1, SPIFFS_PAGE_LEN);     // the index header, with the new name
+    model_delete(&model, 1);
+    return file_store_rename(&ram_store, from, to);
+}
+
+// the ram disk, with every operation fed through the spiffs model.
+const file_store_backend file_store_model = {
+    .name = "spiffs model",
+    .mount = _model_mount,
+    .unmount = _model_unmount,
+    .format = _model_format,
+    .info = _model_info,
+    .open = _model_open,
+    .remove = _model_remove,
+    .rename = _model_rename,
+};
+
+// the number of peers heard in a scan, roughly poisson around mean.
+size_t peers_heard(double mean) {
+    size_t n = 0;
+    for (double p = (double)rand() / RAND_MAX; p > exp(-mean); p *= (double)rand() / RAND_MAX) n++;
+    return n;
+}
+
+void diff_model(const spiffs_model * now, const spiffs_model * then, spiffs_model * out) {
+    *out = *now;
+    out->payload -= then->payload;
+    out->programmed -= then->programmed;
+    out->allocated -= then->allocated;
+    out->page_reads -= then->page_reads;
+}
+
+// the layout scan_for_peers() and free_spiffs() used before the journal: a file of datapairs for every scan with peers,
+// named after its scan interval, and a walk of every file each scan to remove the expired ones.
+void run_files(size_t days, double mean_peers, bench_result * r) {
+    static size_t file_len[TRACER_SCAN_EXPIRY + 2];     // by scan interval, the files still stored
+    spiffs_model day_start = { 0 };
+
+    memset(&model, 0, sizeof(model));
+    memset(file_len, 0, sizeof(file_len));
+    memset(r, 0, sizeof(*r));
+    srand(days);
+
+    for (size_t scan = 0; scan < days * SCANS_PER_DAY; scan++) {
+        uint32_t scanin = FIRST_SCANIN + scan;
+        size_t len = peers_heard(mean_peers);
+        if (len > 64) len = 64;
+
+        if (scan == (days - 1) * SCANS_PER_DAY) day_start = model;
+
+        if (len > 0) {
+            model_find(&model, false);
+            model_write(&model, 0, len * sizeof(tracer_datapair), true);
+            file_len[scanin % (TRACER_SCAN_EXPIRY + 2)] = len * sizeof(tracer_datapair);
+        }
+
+        size_t before = model.page_reads;
+        model_walk(&model);
+
+        uint32_t expired = scanin - TRACER_SCAN_EXPIRY - 1;
+        if (file_len[expired % (TRACER_SCAN_EXPIRY + 2)] > 0) {
+            model_find(&model, true);
+            model_remove(&model, file_len[expired % (TRACER_SCAN_EXPIRY + 2)]);
+            file_len[expired % (TRACER_SCAN_EXPIRY + 2)] = 0;
+        }
+
+        if (scan >= (days - 1) * SCANS_PER_DAY) r->expiry_reads += model.page_reads - before;
+    }
+
+    diff_model(&model, &day_start, &r->written);
+
+    // test_teks() walked the files, opened each one by name and read it
+    size_t before = model.page_reads;
+    model_walk(&model);
+    for (size_t i = 0; i < TRACER_SCAN_EXPIRY + 2; i++) {
+        if (file_len[i] == 0) continue;
+        model_find(&model, true);
+        model.page_reads += data_pages(file_len[i]);
+    }
+    r->match_reads = model.page_reads - before;
+}
+
+// the journal, written a block at a time as main.c did before it buffered sightings, or through a buffer as it does now.
+bool run_journal(size_t days, double mean_peers, bool buffered, bench_result * r) {
+    static scan_journal_buffer buffer;
+    file_store store = { 0 };
+    scan_journal journal;
+    spiffs_model day_start = { 0 };
+    tracer_sighting sightings[64] = { 0 };
+
+    memset(r, 0, sizeof(*r));
+    srand(days);
+
+    if (!file_store_mount(&store, &file_store_model, "", NULL) || !file_store_format(&store)) return false;
+    ((file_store_ram_disk *)ram_store.state)->size = RAM_DISK_SIZE;
+    if (!scan_journal_init(&journal, &store)) return false;
+
+    scan_journal_buffer_reset(&buffer);
+
+    for (size_t scan = 0; scan < days * SCANS_PER_DAY; scan++) {
+        uint32_t scanin = FIRST_SCANIN + scan;
+        size_t len = peers_heard(mean_peers);
+        if (len > 64) len = 64;
+
+        if (scan == (days - 1) * SCANS_PER_DAY) day_start = model;
+
+        if (buffered) {
+            uint32_t epoch = scanin * 60 * TRACER_SCAN_INTERVAL;
+            if (!scan_journal_buffer_append(&journal, &buffer, scanin, sightings, len, epoch)) return false;
+            if (scan_journal_buffer_due(&buffer, epoch) && !scan_journal_buffer_flush(&journal, &buffer)) return false;
+        } else if (!scan_journal_append(&journal, scanin, sightings, len)) {
+            return false;
+        }
+
+        size_t before = model.page_reads;
+        scan_journal_expire(&journal, scan_journal_scanin2day(scanin - TRACER_SCAN_EXPIRY));
+        if (scan >= (days - 1) * SCANS_PER_DAY) r->expiry_reads += model.page_reads - before;
+    }
+
+    diff_model(&model, &day_start, &r->written);
+
+    // test_teks() flushes the buffer before it reads
+    if (!scan_journal_buffer_flush(&journal, &buffer)) return false;
+
+    static tracer_sighting run_buffer[64];
+    scan_journal_reader reader;
+    size_t before = model.page_reads;
+
+    scan_journal_reader_open(&reader, &journal, 0);
+    while (scan_journal_read_run(&reader, run_buffer, 64, NULL) > 0);
+    r->match_reads = model.page_reads - before;
+
+    file_store_ram_free(&ram_store);
+    return true;
+}
+
+void print_result(const char * name, const bench_result * r) {
+    const spiffs_model * w = &r->written;
+
+    printf("%-16s %10zu %12zu %10zu %10.1f %8.1f %12zu %12zu %10.0f %8zu %8zu\n", name, w->payload, w->programmed, w->allocated,
+        (double)w->allocated / SPIFFS_PAGES_PER_BLOCK, w->payload ? (double)w->allocated * SPIFFS_PAGE_LEN / w->payload : 0, r->expiry_reads,
+        r->match_reads, r->match_reads * PAGE_READ_US / 1e3, w->files, w->live_pages * SPIFFS_PAGE_LEN / 1024);
+}
+
+int main(int argc, char ** argv) {
+    size_t days = TRACER_SCAN_STORE_PERIOD + 2;
+    double mean_peers = 2;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:p:")) != -1) {
+        switch (opt) {
+            case 'd': days = strtoul(optarg, NULL, 10); break;
+            case 'p': mean_peers = strtod(optarg, NULL); break;
+            default:
+                fprintf(stderr, "usage: %s [-d days] [-p mean peers per scan]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (days == 0) {
+        fprintf(stderr, "there has to be at least a day of scans!\n");
+        return 1;
+    }
+
+    bench_result r;
+
+    printf("%zu days of scans, %.1f peers per scan. writes and expiry over the last day, match reads for one batch of teks.\n\n", days, mean_peers);
+    printf("%-16s %10s %12s %10s %10s %8s %12s %12s %10s %8s %8s\n", "layout", "payload B", "programmed B", "pages", "erases",
+        "amp", "expiry reads", "match reads", "match ms", "files", "used KB");
+
+    run_files(days, mean_peers, &r);
+    print_result("file per scan", &r);
+
+    for (int buffered = 0; buffered <= 1; buffered++) {
+        if (!run_journal(days, mean_peers, buffered, &r)) {
+            fprintf(stderr, "the journal failed to write!\n");
+            return 1;
+        }
+        print_result(buffered ? "buffered journal" : "journal", &r);
+    }
+
+    return 0;
+}
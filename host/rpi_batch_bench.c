@@ -0,0 +1,132 @@
+// rpi_batch_bench: measures how many rpis per second are derived and verified one block at a time, against the batch
+// functions that hand TRACER_BATCH_SIZE blocks to the backend at once. checks that both give the same rpis and the
+// same matches, then runs each crypto backend built into the binary.
+
+#include "tracer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FIRST_ENIN  (1600000000 / 60)
+
+double now_s() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// checks that the batch functions agree with the single-block ones, for every length up to a few batches.
+bool check(aes_ctx * rpik_ctx, const tracer_datapair * datapairs, size_t len) {
+    tracer_rpi * rpis = malloc(len * sizeof(tracer_rpi));
+    bool * matches = malloc(len * sizeof(bool));
+    uint32_t * enins = malloc(len * sizeof(uint32_t));
+    bool ok = true;
+
+    for (size_t n = 0; n <= 3 * TRACER_BATCH_SIZE && n <= len; n++) {
+        tracer_derive_rpi_batch(rpik_ctx, FIRST_ENIN, n, rpis);
+        for (size_t i = 0; i < n; i++) {
+            tracer_rpi rpi = tracer_derive_rpi_keyed(rpik_ctx, tracer_enin2epoch(FIRST_ENIN + i));
+            ok &= memcmp(&rpi, &rpis[i], sizeof(rpi)) == 0;
+        }
+
+        size_t match_count = tracer_verify_batch_keyed(datapairs, n, rpik_ctx, matches, enins);
+        for (size_t i = 0; i < n; i++) {
+            uint32_t enin;
+            bool match = tracer_verify_keyed(&datapairs[i], rpik_ctx, NULL, &enin, NULL);
+
+            ok &= matches[i] == match && (!match || enins[i] == enin);
+            match_count -= match;
+        }
+        ok &= match_count == 0;
+    }
+
+    free(enins);
+    free(matches);
+    free(rpis);
+    return ok;
+}
+
+int main(int argc, char ** argv) {
+    size_t len = 1000000;
+    size_t repeats = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        switch (opt) {
+            case 'n': len = strtoul(optarg, NULL, 10); break;
+            case 'r': repeats = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n rpis] [-r repeats]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (!tracer_crypto_init()) {
+        fprintf(stderr, "no crypto backend runs on this cpu!\n");
+        return 1;
+    }
+
+    tracer_tek tek = { .epoch = tracer_enin2epoch(FIRST_ENIN) };
+    tracer_rpik rpik;
+    tracer_datapair * datapairs = malloc(len * sizeof(tracer_datapair));
+    tracer_rpi * rpis = malloc(len * sizeof(tracer_rpi));
+    bool * matches = malloc(len * sizeof(bool));
+    uint32_t * enins = malloc(len * sizeof(uint32_t));
+
+    rng_gen(sizeof(tek.value), tek.value);
+    rng_gen(len * sizeof(tracer_datapair), datapairs);
+    printf("%-8s %-28s %14s\n", "backend", "function", "rpis/s");
+
+    for (size_t b = 0; b < TRACER_CRYPTO_BACKEND_COUNT; b++) {
+        if (!tracer_crypto_set_backend(tracer_crypto_backends[b])) continue;
+        const char * name = tracer_crypto_backends[b]->name;
+
+        aes_ctx rpik_ctx;
+        tracer_derive_rpik_v2(&tek, &rpik);
+        aes_ctx_init(&rpik_ctx, rpik.value, sizeof(rpik.value));
+
+        // one in a hundred scanned datapairs is from the tek, the way a busy day's scans look against an export
+        for (size_t i = 0; i < len; i += 100) datapairs[i].rpi = tracer_derive_rpi_keyed(&rpik_ctx, tracer_enin2epoch(FIRST_ENIN + i));
+
+        if (!check(&rpik_ctx, datapairs, len)) {
+            fprintf(stderr, "the %s backend's batches don't match its single blocks!\n", name);
+            return 1;
+        }
+
+        size_t found = 0;
+        double start = now_s();
+        for (size_t r = 0; r < repeats; r++) {
+            for (size_t i = 0; i < len; i++) rpis[i] = tracer_derive_rpi_keyed(&rpik_ctx, tracer_enin2epoch(FIRST_ENIN + i));
+        }
+        printf("%-8s %-28s %14.0f\n", name, "tracer_derive_rpi_keyed", len * repeats / (now_s() - start));
+
+        start = now_s();
+        for (size_t r = 0; r < repeats; r++) tracer_derive_rpi_batch(&rpik_ctx, FIRST_ENIN, len, rpis);
+        printf("%-8s %-28s %14.0f\n", name, "tracer_derive_rpi_batch", len * repeats / (now_s() - start));
+
+        start = now_s();
+        for (size_t r = 0; r < repeats; r++) {
+            for (size_t i = 0; i < len; i++) found += tracer_verify_keyed(&datapairs[i], &rpik_ctx, NULL, &enins[i], NULL);
+        }
+        printf("%-8s %-28s %14.0f\n", name, "tracer_verify_keyed", len * repeats / (now_s() - start));
+
+        start = now_s();
+        for (size_t r = 0; r < repeats; r++) found += tracer_verify_batch_keyed(datapairs, len, &rpik_ctx, matches, enins);
+        printf("%-8s %-28s %14.0f\n", name, "tracer_verify_batch_keyed", len * repeats / (now_s() - start));
+
+        if (found != 2 * repeats * ((len + 99) / 100)) {
+            fprintf(stderr, "the %s backend found %zu matches instead of %zu!\n", name, found, 2 * repeats * ((len + 99) / 100));
+            return 1;
+        }
+
+        aes_ctx_free(&rpik_ctx);
+    }
+
+    free(enins);
+    free(matches);
+    free(rpis);
+    free(datapairs);
+    return 0;
+}
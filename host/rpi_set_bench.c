@@ -0,0 +1,110 @@
+// rpi_set_bench: feeds windows of synthetic adverts from a crowd of peers into tracer_rpi_set.h, and into the linear
+// cvec dedupe scan_cb() used to run, which compared every advert against every sighting so far. checks that both keep
+// the same sightings, and reports the time per advert for crowds of several sizes.
+
+#include "tracer.h"
+#include "tracer_rpi_set.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EPOCH           1600000000
+#define SET_CAPACITY    512     // the same as SCAN_SET_CAPACITY in main.c
+
+double now_s() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// dedupes the way scan_cb() did before the rpi set: a linear search of the sightings so far for every advert. late is
+// set to the number of adverts whose sighting came after the first SET_CAPACITY, which a full set would have dropped.
+size_t linear_dedupe(const tracer_datapair * adverts, size_t len, tracer_datapair * sightings, size_t * late) {
+    size_t sighting_len = 0;
+    *late = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        size_t j = 0;
+        while (j < sighting_len && !tracer_compare_datapairs_v2(&adverts[i], &sightings[j])) j++;
+        if (j == sighting_len) sightings[sighting_len++] = adverts[i];
+        *late += j >= SET_CAPACITY;
+    }
+
+    return sighting_len;
+}
+
+int main(int argc, char ** argv) {
+    size_t len = 10000;
+    size_t windows = 100;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:w:")) != -1) {
+        switch (opt) {
+            case 'n': len = strtoul(optarg, NULL, 10); break;
+            case 'w': windows = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n adverts per window] [-w windows]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (!tracer_crypto_init()) {
+        fprintf(stderr, "no crypto backend runs on this cpu!\n");
+        return 1;
+    }
+
+    const size_t crowds[] = { 10, 100, 500, 2000 };
+    tracer_datapair * adverts = malloc(len * sizeof(tracer_datapair));
+    tracer_datapair * peers = malloc(len * sizeof(tracer_datapair));
+    tracer_datapair * sightings = malloc(len * sizeof(tracer_datapair));
+    tracer_rpi_set set;
+
+    if (!tracer_rpi_set_init(&set, SET_CAPACITY)) {
+        fprintf(stderr, "couldn't allocate the rpi set!\n");
+        return 1;
+    }
+
+    srand(1);
+    printf("%zu adverts per window, a set of %d sightings\n\n", len, SET_CAPACITY);
+    printf("%8s %10s %10s %14s %14s\n", "peers", "stored", "dropped", "set ns/advert", "cvec ns/advert");
+
+    for (size_t c = 0; c < sizeof(crowds) / sizeof(crowds[0]); c++) {
+        size_t crowd = crowds[c] < len ? crowds[c] : len;
+
+        // every peer's adverts carry the same datapair within a window, in a random order
+        rng_gen(crowd * sizeof(tracer_datapair), peers);
+        for (size_t i = 0; i < len; i++) adverts[i] = peers[rand() % crowd];
+
+        double start = now_s();
+        for (size_t w = 0; w < windows; w++) {
+            tracer_rpi_set_clear(&set);
+            for (size_t i = 0; i < len; i++) tracer_rpi_set_add(&set, &adverts[i], EPOCH + i / 100, -40 - (int8_t)(i % 50));
+        }
+        double set_s = (now_s() - start) / windows;
+
+        start = now_s();
+        size_t late;
+        size_t sighting_len = linear_dedupe(adverts, len, sightings, &late);
+        double linear_s = now_s() - start;
+
+        // the set keeps the first SET_CAPACITY distinct datapairs, in the order they were first seen, and drops every advert of the rest
+        size_t stored = sighting_len < SET_CAPACITY ? sighting_len : SET_CAPACITY;
+        bool ok = set.len == stored && set.dropped == late;
+        for (size_t i = 0; i < set.len && ok; i++) ok = tracer_compare_datapairs_v2(&set.items[i].pair, &sightings[i]);
+
+        if (!ok) {
+            fprintf(stderr, "the rpi set kept different sightings than the linear dedupe with %zu peers!\n", crowd);
+            return 1;
+        }
+
+        printf("%8zu %10zu %10u %14.1f %14.1f\n", crowd, set.len, set.dropped, set_s / len * 1e9, linear_s / len * 1e9);
+    }
+
+    tracer_rpi_set_free(&set);
+    free(sightings);
+    free(peers);
+    free(adverts);
+    return 0;
+}
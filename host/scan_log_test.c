@@ -0,0 +1,192 @@
+// scan_log_test: runs random appends and expiries against scan_log.h on a file standing in for the scan log partition,
+// cutting the flash off at a random byte of a write or an erase every so often, as a power loss would. after every cut,
+// and every so often without one, the log is recovered from the file as a boot would, and read back with both readers.
+// every sighting carries its number in every byte, so the test can tell that the sightings read back are whole, in
+// order, and that none that was acknowledged went missing. reports how many reads a recovery takes.
+
+#include "scan_log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MAX_BATCH_LEN   200
+#define SIGHTINGS_PER_SCANIN    10      // so several appends share a scan interval, like a scan's sightings do
+
+typedef struct {
+    uint32_t next_id;       // the number of the next sighting appended
+    uint32_t acked;         // every sighting before this was appended without the flash being cut off
+    uint32_t lost_before;   // sightings before this could have been lost to a cut, or expired
+} test_state;
+
+void make_sighting(uint32_t id, tracer_sighting * sighting) {
+    for (size_t i = 0; i < sizeof(sighting->pair); i++) ((uint8_t *)&sighting->pair)[i] = id * 31 + i;
+    sighting->first_seen = id;
+    sighting->duration = id >> 16;
+    sighting->count = id;
+    sighting->rssi_min = sighting->rssi_max = sighting->rssi_mean = -(int8_t)(id % 100);
+    sighting->reserved = 0;
+}
+
+bool check_sighting(const tracer_sighting * sighting) {
+    tracer_sighting expected;
+    make_sighting(sighting->first_seen, &expected);
+    return memcmp(sighting, &expected, sizeof(expected)) == 0;
+}
+
+// checks the sightings read back. they have to be whole and in order, and the only gaps allowed are where a cut could
+// have lost sightings. everything acknowledged since the last cut has to be there.
+bool check_sightings(const test_state * state, const tracer_sighting * sightings, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        uint32_t id = sightings[i].first_seen;
+
+        if (!check_sighting(&sightings[i])) {
+            fprintf(stderr, "sighting %zu came back torn!\n", i);
+            return false;
+        }
+        if (i > 0 && id <= sightings[i - 1].first_seen) {
+            fprintf(stderr, "sighting %u came back after %u!\n", id, sightings[i - 1].first_seen);
+            return false;
+        }
+        if (i > 0 && id != sightings[i - 1].first_seen + 1 && id > state->lost_before) {
+            fprintf(stderr, "sightings %u to %u went missing!\n", sightings[i - 1].first_seen + 1, id - 1);
+            return false;
+        }
+    }
+
+    if (state->acked > state->lost_before && (len == 0 || sightings[len - 1].first_seen + 1 < state->acked)) {
+        fprintf(stderr, "acknowledged sightings went missing from the end of the log!\n");
+        return false;
+    }
+
+    return true;
+}
+
+// recovers the log from the partition as a boot would, and checks it. unless the flash was cut off, the recovered state
+// has to be the state the log was left in.
+bool recover(scan_log * log, const test_state * state, bool cut, tracer_sighting * read, tracer_sighting * read_runs, size_t capacity) {
+    scan_log recovered;
+
+    if (!scan_log_init(&recovered, NULL)) {
+        fprintf(stderr, "couldn't open the log!\n");
+        return false;
+    }
+
+    if (!cut && (recovered.head != log->head || recovered.tail != log->tail || recovered.head_slot != log->head_slot
+        || recovered.head_seq != log->head_seq || recovered.empty != log->empty)) {
+        fprintf(stderr, "recovered head %zu, tail %zu, slot %zu, seq %u instead of head %zu, tail %zu, slot %zu, seq %u!\n",
+            recovered.head, recovered.tail, recovered.head_slot, recovered.head_seq, log->head, log->tail, log->head_slot, log->head_seq);
+        return false;
+    }
+
+    scan_log_reader reader;
+    size_t len = 0, runs_len = 0, run_len;
+    const tracer_sighting * run;
+
+    scan_log_reader_open(&reader, &recovered);
+    while (len < capacity && scan_log_read(&reader, &read[len])) len++;
+    scan_log_reader_close(&reader);
+
+    // runs read in place out of the mapped file
+    scan_log_reader_open(&reader, &recovered);
+    while ((run_len = scan_log_read_run(&reader, read_runs + runs_len, capacity - runs_len, &run)) > 0 && runs_len + run_len <= capacity) {
+        memmove(read_runs + runs_len, run, run_len * sizeof(tracer_sighting));
+        runs_len += run_len;
+    }
+    scan_log_reader_close(&reader);
+
+    if (len != runs_len || memcmp(read, read_runs, len * sizeof(tracer_sighting)) != 0) {
+        fprintf(stderr, "the two readers read back different sightings!\n");
+        return false;
+    }
+
+    *log = recovered;
+    return check_sightings(state, read, len);
+}
+
+int main(int argc, char ** argv) {
+    const char * path = "scan_log_test.bin";
+    size_t len = 200000;
+    size_t sector_count = 128;      // the 512K scanlog partition in esp_partitions.csv
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:n:s:")) != -1) {
+        switch (opt) {
+            case 'f': path = optarg; break;
+            case 'n': len = strtoul(optarg, NULL, 10); break;
+            case 's': sector_count = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-f partition file] [-n operations] [-s sectors]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    unlink(path);
+    if (sector_count < 2 || !esp_partition_host_open(path, SCAN_LOG_PARTITION_LABEL, sector_count * SCAN_LOG_SECTOR_SIZE)) {
+        fprintf(stderr, "couldn't create a partition of %zu sectors in %s!\n", sector_count, path);
+        return 1;
+    }
+
+    size_t capacity = sector_count * SCAN_LOG_SLOTS;
+    tracer_sighting * read = malloc(capacity * sizeof(tracer_sighting));
+    tracer_sighting * read_runs = malloc(capacity * sizeof(tracer_sighting));
+    test_state state = { .next_id = 1, .acked = 1, .lost_before = 1 };
+    size_t appends = 0, expiries = 0, cuts = 0;
+    scan_log log;
+
+    if (!scan_log_init(&log, NULL) || !log.empty) {
+        fprintf(stderr, "a new partition didn't give an empty log!\n");
+        return 1;
+    }
+
+    srand(16);
+
+    for (size_t i = 0; i < len; i++) {
+        bool cut = rand() % 50 == 0;
+        esp_partition_host_cut_after(cut ? rand() % 6000 : -1);
+
+        if (rand() % 40 == 0) {
+            // keep about the newest 90% of what has been written
+            uint32_t min_scanin = state.next_id / SIGHTINGS_PER_SCANIN / 10;
+            scan_log_expire(&log, min_scanin);
+            expiries++;
+
+            // the sectors expired were all from before min_scanin, and nothing after it can go missing without a cut
+            uint32_t min_id = min_scanin * SIGHTINGS_PER_SCANIN;
+            if (min_id > state.lost_before) state.lost_before = min_id;
+        } else {
+            tracer_sighting batch[MAX_BATCH_LEN];
+            size_t batch_len = 1 + rand() % (rand() % 8 ? 20 : MAX_BATCH_LEN);
+
+            for (size_t j = 0; j < batch_len; j++) make_sighting(state.next_id + j, &batch[j]);
+            bool ok = scan_log_append(&log, state.next_id / SIGHTINGS_PER_SCANIN, batch, batch_len);
+
+            state.next_id += batch_len;
+            if (ok) state.acked = state.next_id;
+            appends++;
+        }
+
+        cut = esp_partition_host_flash.cut;
+        cuts += cut;
+        esp_partition_host_reset();
+
+        if ((cut || i % 97 == 0) && !recover(&log, &state, cut, read, read_runs, capacity)) {
+            fprintf(stderr, "failed after %zu operations and %zu cuts!\n", i + 1, cuts);
+            return 1;
+        }
+
+        if (cut) state.lost_before = state.next_id;
+    }
+
+    printf("%zu appends, %zu expiries, %zu cuts, %u sightings, none torn, reordered or lost\n", appends, expiries, cuts, state.next_id - 1);
+
+    size_t reads = esp_partition_host_flash.reads;
+    scan_log_init(&log, NULL);
+    printf("recovering %zu sectors took %zu reads\n", sector_count, esp_partition_host_flash.reads - reads);
+
+    esp_partition_host_close();
+    unlink(path);
+    free(read_runs);
+    free(read);
+    return 0;
+}
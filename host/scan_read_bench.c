@@ -0,0 +1,215 @@
+// scan_read_bench: measures how many stored sightings per second each read path test_teks() can use gets through, with
+// and without looking every sighting up in a tracer_index of a batch of 128 teks. the same sightings are written to a
+// scan journal in a host directory, and to a scan log on a file standing in for the scanlog partition. the journal is
+// read a sighting per fread, as test_teks() did before, and in runs. the log is read a sighting per partition read, in
+// runs read into a buffer, and in runs read in place out of the mapped partition. every path has to find the same
+// planted matches.
+
+#include "tracer_index.h"
+#include "scan_journal.h"
+#include "scan_log.h"
+#include "file_store_host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EPOCH           1600000000
+#define TEK_BATCH_LEN   128     // the same as the tek batches test_teks() is called with
+#define MATCH_EVERY     500     // plant a sighting of a tek in the batch every this many sightings
+#define BLOCK_LEN       20      // the sightings per scan
+#define READ_RUN_LEN    64      // the same as SCAN_READ_RUN_LEN in main.c
+#define LOG_SECTORS     128     // the 512K scanlog partition in esp_partitions.csv
+
+typedef enum {
+    JOURNAL_PER_RECORD,
+    JOURNAL_RUNS,
+    LOG_PER_RECORD,
+    LOG_RUNS,
+    LOG_MAPPED_RUNS,
+    READ_PATH_COUNT,
+} read_path;
+
+const char * read_path_names[READ_PATH_COUNT] = {
+    "journal, per sighting",
+    "journal, runs",
+    "log, per sighting",
+    "log, runs",
+    "log, mapped runs",
+};
+
+double now_s() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// counts the sightings that match the index, if there is one.
+size_t test_run(const tracer_index * index, const tracer_sighting * sightings, size_t len) {
+    size_t matches = 0;
+    for (size_t i = 0; index && i < len; i++) matches += tracer_index_lookup(index, &sightings[i].pair, NULL, NULL);
+    return matches;
+}
+
+// reads every stored sighting down one path. returns the number read, and adds the matches to *matches.
+size_t read_all(read_path path, const scan_journal * journal, const scan_log * log, const tracer_index * index, size_t * matches) {
+    static tracer_sighting buffer[READ_RUN_LEN];
+    const tracer_sighting * run;
+    tracer_sighting sighting;
+    size_t len = 0, run_len;
+
+    if (path == JOURNAL_PER_RECORD || path == JOURNAL_RUNS) {
+        scan_journal_reader reader;
+        scan_journal_reader_open(&reader, journal, 0);
+
+        if (path == JOURNAL_PER_RECORD) {
+            for (; scan_journal_read(&reader, &sighting, NULL); len++) *matches += test_run(index, &sighting, 1);
+        } else {
+            for (; (run_len = scan_journal_read_run(&reader, buffer, READ_RUN_LEN, NULL)) > 0; len += run_len) *matches += test_run(index, buffer, run_len);
+        }
+
+        scan_journal_reader_close(&reader);
+    } else {
+        scan_log_reader reader;
+        esp_partition_host_flash.map_fails = path != LOG_MAPPED_RUNS;
+        scan_log_reader_open(&reader, log);
+
+        if (path == LOG_PER_RECORD) {
+            for (; scan_log_read(&reader, &sighting); len++) *matches += test_run(index, &sighting, 1);
+        } else {
+            for (; (run_len = scan_log_read_run(&reader, buffer, READ_RUN_LEN, &run)) > 0; len += run_len) *matches += test_run(index, run, run_len);
+        }
+
+        scan_log_reader_close(&reader);
+    }
+
+    return len;
+}
+
+int main(int argc, char ** argv) {
+    const char * dir = "scan_read_bench.tmp";
+    size_t len = 16000;     // about what the scanlog partition holds
+    size_t repeats = 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:n:r:")) != -1) {
+        switch (opt) {
+            case 'd': dir = optarg; break;
+            case 'n': len = strtoul(optarg, NULL, 10); break;
+            case 'r': repeats = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-d directory] [-n sightings] [-r repeats]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (len == 0 || len > LOG_SECTORS * SCAN_LOG_SLOTS || repeats == 0) {
+        fprintf(stderr, "the scan log holds from 1 to %zu sightings, and there has to be at least one repeat!\n", LOG_SECTORS * SCAN_LOG_SLOTS);
+        return 1;
+    }
+
+    if (!tracer_crypto_init()) {
+        fprintf(stderr, "no crypto backend runs on this cpu!\n");
+        return 1;
+    }
+
+    tracer_tek teks[TEK_BATCH_LEN];
+    tracer_sighting * sightings = calloc(len, sizeof(tracer_sighting));
+    size_t planted = 0;
+
+    srand(17);
+    for (size_t i = 0; i < TEK_BATCH_LEN; i++) {
+        rng_gen(sizeof(teks[i].value), teks[i].value);
+        teks[i].epoch = EPOCH + (i % 14) * 24 * 60 * 60;
+    }
+
+    // random sightings, with a sighting of a tek's rpi from some interval of its day planted every so often
+    rng_gen(len * sizeof(tracer_sighting), sightings);
+    for (size_t i = 0; i < len; i++) {
+        sightings[i].first_seen = EPOCH + i * 60 / BLOCK_LEN;
+        sightings[i].reserved = 0;
+
+        if (i % MATCH_EVERY == 0) {
+            const tracer_tek * tek = &teks[i / MATCH_EVERY % TEK_BATCH_LEN];
+            tracer_rpik rpik;
+            aes_ctx ctx;
+
+            tracer_derive_rpik_v2(tek, &rpik);
+            aes_ctx_init(&ctx, rpik.value, sizeof(rpik.value));
+            sightings[i].pair.rpi = tracer_derive_rpi_keyed(&ctx, tek->epoch + i % TRACER_ENINS_PER_DAY * TRACER_ENIN_INTERVAL * 60);
+            aes_ctx_free(&ctx);
+            planted++;
+        }
+    }
+
+    file_store store = { 0 };
+    scan_journal journal;
+    scan_log log;
+    char log_path[FILE_STORE_PATH_LEN];
+
+    if (!file_store_mount(&store, &file_store_host, dir, NULL) || !file_store_format(&store) || !scan_journal_init(&journal, &store)) {
+        fprintf(stderr, "couldn't make a scan journal in %s!\n", dir);
+        return 1;
+    }
+
+    file_store_path(&store, "scanlog.bin", log_path);
+    if (!esp_partition_host_open(log_path, SCAN_LOG_PARTITION_LABEL, LOG_SECTORS * SCAN_LOG_SECTOR_SIZE) || !scan_log_init(&log, NULL)) {
+        fprintf(stderr, "couldn't make a scan log in %s!\n", log_path);
+        return 1;
+    }
+
+    for (size_t i = 0; i < len; i += BLOCK_LEN) {
+        size_t block_len = len - i < BLOCK_LEN ? len - i : BLOCK_LEN;
+        uint32_t scanin = tracer_epoch2scanin(sightings[i].first_seen);
+
+        if (!scan_journal_append(&journal, scanin, sightings + i, block_len) || !scan_log_append(&log, scanin, sightings + i, block_len)) {
+            fprintf(stderr, "couldn't store the sightings!\n");
+            return 1;
+        }
+    }
+
+    tracer_index index;
+    if (!tracer_index_init(&index, teks, TEK_BATCH_LEN)) {
+        fprintf(stderr, "couldn't allocate the rpi index!\n");
+        return 1;
+    }
+
+    printf("%zu sightings, %zu of them matching a batch of %d teks\n\n", len, planted, TEK_BATCH_LEN);
+    printf("%-22s %14s %14s %18s\n", "read path", "scan rec/s", "match rec/s", "reads per 1k rec");
+
+    for (read_path path = 0; path < READ_PATH_COUNT; path++) {
+        size_t matches = 0, read = 0, reads = esp_partition_host_flash.reads;
+
+        double start = now_s();
+        for (size_t r = 0; r < repeats; r++) read += read_all(path, &journal, &log, NULL, &matches);
+        double scan_s = (now_s() - start) / repeats;
+
+        reads = esp_partition_host_flash.reads - reads;
+
+        start = now_s();
+        for (size_t r = 0; r < repeats; r++) read += read_all(path, &journal, &log, &index, &matches);
+        double match_s = (now_s() - start) / repeats;
+
+        if (read != 2 * repeats * len || matches != repeats * planted) {
+            fprintf(stderr, "the %s path read %zu of %zu sightings and found %zu of %zu matches!\n", read_path_names[path],
+                read / 2 / repeats, len, matches / repeats, planted);
+            return 1;
+        }
+
+        // the journal's reads go through stdio, so only the log's partition reads are counted
+        if (path == JOURNAL_PER_RECORD || path == JOURNAL_RUNS) {
+            printf("%-22s %14.0f %14.0f %18s\n", read_path_names[path], len / scan_s, len / match_s, "-");
+        } else {
+            printf("%-22s %14.0f %14.0f %18.1f\n", read_path_names[path], len / scan_s, len / match_s, reads * 1000.0 / repeats / len);
+        }
+    }
+
+    tracer_index_free(&index);
+    esp_partition_host_close();
+    file_store_format(&store);
+    file_store_unmount(&store);
+    rmdir(dir);
+    free(sightings);
+    return 0;
+}
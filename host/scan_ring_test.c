@@ -0,0 +1,158 @@
+// scan_ring_test: stress tests scan_ring.h with two threads standing in for the bluetooth task and the main task.
+// the producer pushes numbered adverts whose every byte is derived from their number, and the consumer pops them in
+// batches of random sizes and checks that each one arrives whole, once and in order. runs once with a producer that
+// waits for room, so every advert must arrive, and once with one that drops adverts when the ring is full, like the gap
+// callback does. reports how often a push found the ring full, the adverts per second and the slowest push.
+
+#include "scan_ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_CAPACITY   64      // the same as SCAN_RING_CAPACITY in main.c
+#define MAX_BATCH_LEN   32
+
+typedef struct {
+    scan_ring ring;
+    uint32_t len;           // how many adverts the producer sends
+    bool wait;              // whether the producer waits for room instead of dropping adverts
+    uint32_t pushed;        // how many adverts made it into the ring
+    double slowest_push_s;  // the longest a single push took
+    _Atomic bool done;      // set once the producer has pushed its last advert
+} test_ctx;
+
+double now_s() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// fills an advert from its number, so the consumer can tell a torn or stale record from a whole one.
+size_t make_advert(uint32_t seq, uint8_t adv_data[SCAN_RING_ADV_LEN], uint8_t mac_addr[6], int8_t * rssi) {
+    size_t len = sizeof(seq) + seq % (SCAN_RING_ADV_LEN - sizeof(seq) + 1);
+
+    memcpy(adv_data, &seq, sizeof(seq));
+    for (size_t i = sizeof(seq); i < len; i++) adv_data[i] = seq * 31 + i;
+    for (size_t i = 0; i < 6; i++) mac_addr[i] = seq >> (i * 4);
+    *rssi = -(int8_t)(seq % 100);
+
+    return len;
+}
+
+bool check_advert(const scan_ring_record * record, uint32_t * seq) {
+    uint8_t adv_data[SCAN_RING_ADV_LEN], mac_addr[6];
+    int8_t rssi;
+
+    if (record->adv_data_len < sizeof(*seq)) return false;
+    memcpy(seq, record->adv_data, sizeof(*seq));
+
+    size_t len = make_advert(*seq, adv_data, mac_addr, &rssi);
+    return record->adv_data_len == len && memcmp(record->adv_data, adv_data, len) == 0
+        && memcmp(record->mac_addr, mac_addr, sizeof(mac_addr)) == 0 && record->rssi == rssi;
+}
+
+void * produce(void * arg) {
+    test_ctx * ctx = (test_ctx *)arg;
+
+    for (uint32_t seq = 0; seq < ctx->len; seq++) {
+        uint8_t adv_data[SCAN_RING_ADV_LEN], mac_addr[6];
+        int8_t rssi;
+        size_t len = make_advert(seq, adv_data, mac_addr, &rssi);
+        bool pushed;
+
+        do {
+            double start = now_s();
+            pushed = scan_ring_push(&ctx->ring, adv_data, len, mac_addr, rssi);
+            double elapsed = now_s() - start;
+            if (elapsed > ctx->slowest_push_s) ctx->slowest_push_s = elapsed;
+
+            if (!pushed) sched_yield();     // the ring is full, so let the consumer run, even on a single core
+        } while (!pushed && ctx->wait);
+
+        ctx->pushed += pushed;
+    }
+
+    atomic_store(&ctx->done, true);
+    return NULL;
+}
+
+// runs a producer thread against a consumer on this thread. returns false if an advert arrived torn, twice or out of order.
+bool run(test_ctx * ctx, double * elapsed) {
+    scan_ring_record batch[MAX_BATCH_LEN];
+    uint32_t popped = 0, next_seq = 0;
+    pthread_t producer;
+    bool ok = true;
+
+    scan_ring_init(&ctx->ring, RING_CAPACITY);
+    atomic_init(&ctx->done, false);
+    ctx->pushed = 0;
+    ctx->slowest_push_s = 0;
+
+    double start = now_s();
+    pthread_create(&producer, NULL, produce, ctx);
+
+    for (bool done = false; !done;) {
+        done = atomic_load(&ctx->done);     // read before popping, so nothing pushed before it was set is missed
+
+        for (size_t len; (len = scan_ring_pop(&ctx->ring, batch, 1 + rand() % MAX_BATCH_LEN)) > 0;) {
+            for (size_t i = 0; i < len; i++) {
+                uint32_t seq = 0;
+
+                // a dropping producer skips adverts, but the ones that arrive still have to be in order
+                if (!check_advert(&batch[i], &seq) || seq < next_seq || (ctx->wait && seq != next_seq)) ok = false;
+                next_seq = seq + 1;
+                popped++;
+            }
+        }
+
+        sched_yield();      // the ring is empty, so let the producer run on a single core
+    }
+
+    pthread_join(producer, NULL);
+    *elapsed = now_s() - start;
+
+    uint32_t dropped = scan_ring_take_dropped(&ctx->ring);
+    if (popped != ctx->pushed || (!ctx->wait && ctx->pushed + dropped != ctx->len) || (ctx->wait && popped != ctx->len)) ok = false;
+
+    printf("%-10s %10u %10u %10u %14.0f %12.1f\n", ctx->wait ? "waiting" : "dropping", ctx->len, popped, dropped,
+        popped / *elapsed, ctx->slowest_push_s * 1e6);
+
+    scan_ring_free(&ctx->ring);
+    return ok;
+}
+
+int main(int argc, char ** argv) {
+    test_ctx ctx = { .len = 10000000 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n': ctx.len = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n adverts]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    double elapsed;
+    bool ok = true;
+
+    srand(1);
+    printf("%-10s %10s %10s %10s %14s %12s\n", "producer", "sent", "received", "full", "adverts/s", "slowest push us");
+
+    for (int wait = 1; wait >= 0; wait--) {
+        ctx.wait = wait;
+        ok &= run(&ctx, &elapsed);
+    }
+
+    if (!ok) {
+        fprintf(stderr, "an advert arrived torn, twice, out of order or not at all!\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+// scan_sim: simulates a day of contacts and compares the adaptive scan scheduler against the old fixed
+// schedule (600 ms every minute) by radio-on time and missed contacts.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "tracer.h"
+#include "scan_sched.h"
+
+#define DAY_S               (24 * 60 * 60)
+#define ADV_INTERVAL_MS     300     // ble_adapter_adv_params.adv_int_min * 0.625 ms
+#define ADV_RECEIVE_RATE    0.9     // the chance an advert sent during a scan window is received
+#define MAX_CONTACTS        65536
+
+// the same bounds as main.c
+#define SCAN_MIN_WINDOW_MS  300
+#define SCAN_MAX_WINDOW_MS  600
+#define SCAN_MIN_INTERVAL_S 15
+#define SCAN_MAX_INTERVAL_S (4 * 60)
+#define SCAN_MAX_DUTY       20
+
+// a stretch of the day with a steady rate of new contacts.
+typedef struct {
+    const char * name;
+    uint32_t start, end;        // seconds since midnight
+    double arrivals_per_min;    // how many contacts start per minute
+    double mean_duration_s;     // the mean length of a contact
+    uint32_t crowd;             // contacts that are already there at the start
+} phase;
+
+static const phase day[] = {
+    { "home",    0,          8 * 3600,   0.0,  0,    0  },
+    { "commute", 8 * 3600,   9 * 3600,   2.0,  90,   0  },
+    { "lecture", 9 * 3600,   12 * 3600,  0.2,  600,  60 },
+    { "lunch",   12 * 3600,  13 * 3600,  1.0,  600,  0  },
+    { "office",  13 * 3600,  17 * 3600,  0.1,  1200, 5  },
+    { "commute", 17 * 3600,  18 * 3600,  2.0,  90,   0  },
+    { "home",    18 * 3600,  DAY_S,      0.0,  0,    0  },
+};
+
+typedef struct {
+    uint32_t start, end;
+    uint32_t seen_enin;         // the last eninterval the contact was heard in, plus one
+    bool seen;
+} contact;
+
+typedef struct {
+    uint64_t radio_on_ms;
+    size_t scans;
+    size_t missed, missed_5min, missed_15min;
+    size_t total, total_5min, total_15min;
+} sim_result;
+
+static contact contacts[MAX_CONTACTS];
+static size_t contact_len;
+
+double rand_unit() {
+    return (rand() + 1.0) / (RAND_MAX + 2.0);
+}
+
+void generate_day(unsigned seed) {
+    srand(seed);
+    contact_len = 0;
+
+    for (size_t p = 0; p < sizeof(day) / sizeof(day[0]); p++) {
+        const phase * ph = &day[p];
+
+        for (uint32_t i = 0; i < ph->crowd && contact_len < MAX_CONTACTS; i++) {
+            contacts[contact_len++] = (contact){ .start = ph->start, .end = ph->end };
+        }
+
+        if (ph->arrivals_per_min <= 0) continue;
+
+        for (double t = ph->start; contact_len < MAX_CONTACTS; ) {
+            t += -log(rand_unit()) * 60.0 / ph->arrivals_per_min;
+            if (t >= ph->end) break;
+
+            uint32_t end = t + 1 + -log(rand_unit()) * ph->mean_duration_s;
+            if (end > ph->end && ph->crowd == 0) end = ph->end;
+            contacts[contact_len++] = (contact){ .start = t, .end = end };
+        }
+    }
+}
+
+// scans every contact in range for window_ms. returns the number of contacts heard for the first time this eninterval.
+size_t scan(uint32_t now, uint32_t window_ms) {
+    size_t new_rpis = 0;
+    uint32_t enin = tracer_epoch2enin(now) + 1;   // the same enintervals as the firmware's rpi set
+
+    for (size_t i = 0; i < contact_len; i++) {
+        contact * c = &contacts[i];
+        if (now < c->start || now >= c->end) continue;
+
+        // the number of adverts the contact sends during the window, with a random phase
+        double adverts = (double)window_ms / ADV_INTERVAL_MS;
+        size_t sent = (size_t)adverts + (rand_unit() < adverts - (size_t)adverts);
+
+        bool heard = false;
+        for (size_t k = 0; k < sent && !heard; k++) heard = rand_unit() < ADV_RECEIVE_RATE;
+        if (!heard) continue;
+
+        c->seen = true;
+        if (c->seen_enin != enin) {
+            c->seen_enin = enin;
+            new_rpis++;
+        }
+    }
+
+    return new_rpis;
+}
+
+sim_result run(bool adaptive, unsigned seed) {
+    sim_result r = { 0 };
+    scan_sched sched;
+    scan_sched_bounds bounds = {
+        .min_window_ms = SCAN_MIN_WINDOW_MS,
+        .max_window_ms = SCAN_MAX_WINDOW_MS,
+        .min_interval_s = SCAN_MIN_INTERVAL_S,
+        .max_interval_s = SCAN_MAX_INTERVAL_S,
+        .max_duty_permille = SCAN_MAX_DUTY,
+    };
+
+    generate_day(seed);
+    srand(seed + 1);
+    scan_sched_init(&sched, &bounds);
+
+    for (uint32_t now = 0; now < DAY_S; ) {
+        uint32_t window_ms = adaptive ? sched.window_ms : 600;
+        size_t new_rpis = scan(now, window_ms);
+
+        r.radio_on_ms += window_ms;
+        r.scans++;
+
+        if (adaptive) {
+            scan_sched_update(&sched, new_rpis);
+            now += sched.interval_s;
+        } else {
+            now += 60;
+        }
+    }
+
+    for (size_t i = 0; i < contact_len; i++) {
+        uint32_t len = contacts[i].end - contacts[i].start;
+        bool missed = !contacts[i].seen;
+
+        r.total++;
+        r.missed += missed;
+        if (len >= 5 * 60) { r.total_5min++; r.missed_5min += missed; }
+        if (len >= 15 * 60) { r.total_15min++; r.missed_15min += missed; }
+    }
+
+    return r;
+}
+
+void print_result(const char * name, const sim_result * r, size_t days) {
+    printf("%-9s %7zu %10.1f %6.2f%% %9.1f%% %9.1f%% %9.1f%%\n", name, r->scans, r->radio_on_ms / 1000.0,
+        100.0 * r->radio_on_ms / (days * DAY_S * 1000.0),
+        r->total ? 100.0 * r->missed / r->total : 0.0,
+        r->total_5min ? 100.0 * r->missed_5min / r->total_5min : 0.0,
+        r->total_15min ? 100.0 * r->missed_15min / r->total_15min : 0.0);
+}
+
+int main(int argc, char ** argv) {
+    unsigned seed = 1;
+    size_t days = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:d:")) != -1) {
+        switch (opt) {
+            case 's': seed = strtoul(optarg, NULL, 10); break;
+            case 'd': days = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-s seed] [-d days]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    sim_result fixed = { 0 }, adaptive = { 0 };
+
+    for (size_t d = 0; d < days; d++) {
+        sim_result f = run(false, seed + d), a = run(true, seed + d);
+
+        fixed.radio_on_ms += f.radio_on_ms; fixed.scans += f.scans;
+        fixed.missed += f.missed; fixed.missed_5min += f.missed_5min; fixed.missed_15min += f.missed_15min;
+        fixed.total += f.total; fixed.total_5min += f.total_5min; fixed.total_15min += f.total_15min;
+
+        adaptive.radio_on_ms += a.radio_on_ms; adaptive.scans += a.scans;
+        adaptive.missed += a.missed; adaptive.missed_5min += a.missed_5min; adaptive.missed_15min += a.missed_15min;
+        adaptive.total += a.total; adaptive.total_5min += a.total_5min; adaptive.total_15min += a.total_15min;
+    }
+
+    printf("%zu contacts over %zu days (%zu of 5+ min, %zu of 15+ min)\n\n", fixed.total, days, fixed.total_5min, fixed.total_15min);
+    printf("%-9s %7s %10s %7s %10s %10s %10s\n", "policy", "scans", "radio on s", "duty", "missed", "missed 5m", "missed 15m");
+    print_result("fixed", &fixed, days);
+    print_result("adaptive", &adaptive, days);
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+// store_bench: benchmarks the scan journal on each file_store backend that runs on a host, at 1, 7 and 28 days of
+// stored scans. reports how long mounting takes, how long each scan's write takes, and how fast a full scan reads back.
+
+#define _GNU_SOURCE
+
+#include "scan_journal.h"
+#include "file_store_host.h"
+#include "file_store_ram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SCANS_PER_DAY       (TRACER_MINUTES_PER_DAY / TRACER_SCAN_INTERVAL)
+#define FIRST_SCANIN        (1600000000 / 60 / TRACER_SCAN_INTERVAL)
+#define RAM_DISK_SIZE       (256 * 1024 * 1024)     // big enough for any number of days, unlike the real partition
+#define MOUNT_REPEATS       100
+#define READ_RUN_LEN        64                      // the same as SCAN_READ_RUN_LEN in main.c
+
+typedef struct {
+    double mount_us;
+    double append_mean_us, append_p99_us, append_max_us;
+    size_t bytes, sightings;
+    double scan_records_per_s;
+} bench_result;
+
+static double append_us[SCANS_PER_DAY];
+
+double now_us() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+int compare_double(const void * a, const void * b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// the number of peers heard in a scan, roughly poisson around mean.
+size_t peers_heard(double mean) {
+    size_t n = 0;
+    for (double p = (double)rand() / RAND_MAX; p > exp(-mean); p *= (double)rand() / RAND_MAX) n++;
+    return n;
+}
+
+// writes days of scans through the same buffered path main.c uses, timing the writes of the last day.
+bool fill(scan_journal * journal, size_t days, double mean_peers, bench_result * r) {
+    static scan_journal_buffer buffer;
+    tracer_sighting sightings[64];
+
+    scan_journal_buffer_reset(&buffer);
+
+    for (size_t scan = 0; scan < days * SCANS_PER_DAY; scan++) {
+        uint32_t scanin = FIRST_SCANIN + scan;
+        uint32_t epoch = scanin * 60 * TRACER_SCAN_INTERVAL;
+        size_t len = peers_heard(mean_peers);
+        if (len > 64) len = 64;
+
+        for (size_t i = 0; i < len; i++) {
+            for (size_t k = 0; k < sizeof(tracer_datapair); k++) ((uint8_t *)&sightings[i].pair)[k] = rand();
+            sightings[i].first_seen = epoch;
+            sightings[i].duration = 0;
+            sightings[i].count = 1;
+            sightings[i].rssi_min = sightings[i].rssi_max = sightings[i].rssi_mean = -70;
+            sightings[i].reserved = 0;
+        }
+
+        double start = now_us();
+        bool ok = scan_journal_buffer_append(journal, &buffer, scanin, sightings, len, epoch);
+        if (ok && scan_journal_buffer_due(&buffer, epoch)) ok = scan_journal_buffer_flush(journal, &buffer);
+        double elapsed = now_us() - start;
+
+        if (!ok) return false;
+        if (scan >= (days - 1) * SCANS_PER_DAY) append_us[scan - (days - 1) * SCANS_PER_DAY] = elapsed;
+
+        r->sightings += len;
+    }
+
+    if (!scan_journal_buffer_flush(journal, &buffer)) return false;
+
+    double sum = 0;
+    qsort(append_us, SCANS_PER_DAY, sizeof(double), compare_double);
+    for (size_t i = 0; i < SCANS_PER_DAY; i++) sum += append_us[i];
+
+    r->append_mean_us = sum / SCANS_PER_DAY;
+    r->append_p99_us = append_us[SCANS_PER_DAY * 99 / 100];
+    r->append_max_us = append_us[SCANS_PER_DAY - 1];
+    return true;
+}
+
+bool run(const file_store_backend * backend, const char * root, size_t days, double mean_peers, bench_result * r) {
+    file_store store = { 0 };
+    scan_journal journal;
+    size_t total;
+
+    memset(r, 0, sizeof(*r));
+    srand(days);
+
+    if (!file_store_mount(&store, backend, root, NULL) || !file_store_format(&store)) return false;
+    if (backend == &file_store_ram) ((file_store_ram_disk *)store.state)->size = RAM_DISK_SIZE;
+    if (!scan_journal_init(&journal, &store) || !fill(&journal, days, mean_peers, r)) return false;
+
+    file_store_info(&store, &total, &r->bytes);
+
+    // a mount is what a boot does: mount the store, then load the journal's manifest
+    double start = now_us();
+    for (size_t i = 0; i < MOUNT_REPEATS; i++) {
+        file_store_unmount(&store);
+        if (!file_store_mount(&store, backend, root, NULL) || !scan_journal_init(&journal, &store)) return false;
+    }
+    r->mount_us = (now_us() - start) / MOUNT_REPEATS;
+
+    static tracer_sighting run_buffer[READ_RUN_LEN];
+    scan_journal_reader reader;
+    size_t read = 0, len;
+
+    start = now_us();
+    scan_journal_reader_open(&reader, &journal, 0);
+    while ((len = scan_journal_read_run(&reader, run_buffer, READ_RUN_LEN, NULL)) > 0) read += len;
+    r->scan_records_per_s = read / ((now_us() - start) / 1e6);
+
+    if (read != r->sightings) {
+        fprintf(stderr, "read back %zu of %zu sightings!\n", read, r->sightings);
+        return false;
+    }
+
+    file_store_format(&store);
+    if (backend == &file_store_ram) file_store_ram_free(&store);
+    else file_store_unmount(&store);
+
+    return true;
+}
+
+int main(int argc, char ** argv) {
+    const char * dir = "store_bench.tmp";
+    double mean_peers = 2;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:p:")) != -1) {
+        switch (opt) {
+            case 'd': dir = optarg; break;
+            case 'p': mean_peers = strtod(optarg, NULL); break;
+            default:
+                fprintf(stderr, "usage: %s [-d directory] [-p mean peers per scan]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    const file_store_backend * backends[] = { &file_store_ram, &file_store_host };
+    const size_t day_counts[] = { 1, 7, 28 };
+
+    printf("%-8s %4s %10s %10s %9s %11s %11s %11s %14s\n", "backend", "days", "sightings", "bytes", "mount us", "append us", "p99 us", "max us", "scan rec/s");
+
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        for (size_t d = 0; d < sizeof(day_counts) / sizeof(day_counts[0]); d++) {
+            bench_result r;
+
+            if (!run(backends[b], dir, day_counts[d], mean_peers, &r)) {
+                fprintf(stderr, "%s failed at %zu days!\n", backends[b]->name, day_counts[d]);
+                return 1;
+            }
+
+            printf("%-8s %4zu %10zu %10zu %9.1f %11.2f %11.2f %11.2f %14.0f\n", backends[b]->name, day_counts[d], r.sightings, r.bytes,
+                r.mount_us, r.append_mean_us, r.append_p99_us, r.append_max_us, r.scan_records_per_s);
+        }
+    }
+
+    rmdir(dir);
+    return 0;
+}
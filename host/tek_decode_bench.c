@@ -0,0 +1,299 @@
+// tek_decode_bench: measures how fast a tek download is decoded, from the bytes of the http response to batches of
+// teks. compares http_parser.h and tek_stream.h, fed a tcp segment at a time, against the byte-at-a-time streamop
+// decoder main.c used to run on 64-byte blocks, and tek_export.h on the compact tekx export, plain and deflated.
+// checks that every decoder gets back exactly the teks that were sent, and prints how big each export is.
+
+#include "http_parser.h"
+#include "tek_stream.h"
+#include "tek_export.h"
+#include "streamop.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SEGMENT_LEN     1460    // the most a read gets from the socket, the same as HTTP_HEADER_LEN in http.h
+#define OLD_BLOCK_LEN   64      // what the old http_req_ip() read at a time
+#define CHUNK_LEN       4096    // how big the chunks of a chunked response are
+
+typedef struct {
+    tracer_tek * teks;      // where the decoded teks go
+    size_t len;
+} decoded;
+
+double now_s() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void collect(tracer_tek * teks, size_t len, void * user_data) {
+    decoded * out = (decoded *)user_data;
+    memcpy(out->teks + out->len, teks, len * sizeof(tracer_tek));
+    out->len += len;
+}
+
+// builds a whole response holding the teks, either with a Content-Length or in chunks. returns its length.
+size_t build_response(const tracer_tek * teks, size_t len, bool chunked, char * out) {
+    size_t body_len = len * sizeof(tracer_tek), head;
+
+    if (!chunked) {
+        head = sprintf(out, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %zu\r\n\r\n", body_len);
+        memcpy(out + head, teks, body_len);
+        return head + body_len;
+    }
+
+    head = sprintf(out, "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nTransfer-Encoding: chunked\r\n\r\n");
+    for (size_t offset = 0; offset < body_len; offset += CHUNK_LEN) {
+        size_t chunk = body_len - offset < CHUNK_LEN ? body_len - offset : CHUNK_LEN;
+        head += sprintf(out + head, "%zx\r\n", chunk);
+        memcpy(out + head, (const uint8_t *)teks + offset, chunk);
+        head += chunk;
+        head += sprintf(out + head, "\r\n");
+    }
+    return head + sprintf(out + head, "0\r\n\r\n");
+}
+
+size_t put_varint(uint32_t value, uint8_t * out) {
+    size_t len = 0;
+    for (; value > 0x7f; value >>= 7) out[len++] = (value & 0x7f) | 0x80;
+    out[len++] = value;
+    return len;
+}
+
+// builds a tekx export of the teks, which must be sorted, the way the keyserver's pack_export() does. returns its length.
+size_t build_tekx(const tracer_tek * teks, size_t len, bool deflated, uint8_t * out) {
+    size_t body_len = 0;
+    uint8_t * body = malloc(len * 24 + 16);
+
+    for (size_t start = 0; start < len; start += 1024) {
+        size_t count = len - start < 1024 ? len - start : 1024;
+        uint32_t previous = tracer_epoch2enin(teks[start].epoch);
+
+        body_len += put_varint(count, body + body_len);
+        body_len += put_varint(previous, body + body_len);
+        for (size_t i = start; i < start + count; i++) {
+            uint32_t rolling_start = tracer_epoch2enin(teks[i].epoch);
+            body_len += put_varint(rolling_start - previous, body + body_len);
+            memcpy(body + body_len, teks[i].value, 16);
+            body_len += 16;
+            previous = rolling_start;
+        }
+    }
+    body_len += put_varint(0, body + body_len);
+
+    memcpy(out, TEK_EXPORT_MAGIC, 4);
+    out[4] = TEK_EXPORT_VERSION;
+    out[5] = deflated ? TEK_EXPORT_FLAG_DEFLATE : 0;
+
+    if (!deflated) {
+        memcpy(out + TEK_EXPORT_HEADER_LEN, body, body_len);
+    } else {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        deflateInit2(&stream, 9, Z_DEFLATED, TEK_EXPORT_WINDOW_BITS, 9, Z_DEFAULT_STRATEGY);
+        stream.next_in = body;
+        stream.avail_in = body_len;
+        stream.next_out = out + TEK_EXPORT_HEADER_LEN;
+        stream.avail_out = len * 24 + 16;
+        deflate(&stream, Z_FINISH);
+        body_len = stream.total_out;
+        deflateEnd(&stream);
+    }
+
+    free(body);
+    return TEK_EXPORT_HEADER_LEN + body_len;
+}
+
+// decodes a tekx export with tek_export, reading at most read_len bytes at a time, or a random amount up to it.
+bool decode_tekx(const uint8_t * export, size_t len, size_t read_len, bool random_reads, decoded * out) {
+    static tek_stream stream;
+    tek_export_decoder decoder;
+
+    tek_stream_init(&stream, collect, out);
+    tek_export_init(&decoder, &stream);
+
+    for (size_t offset = 0; offset < len;) {
+        size_t read = random_reads ? 1 + rand() % read_len : read_len;
+        if (read > len - offset) read = len - offset;
+
+        if (!tek_export_feed(&decoder, export + offset, read)) {
+            tek_export_end(&decoder);
+            return false;
+        }
+        offset += read;
+    }
+
+    return tek_export_end(&decoder);
+}
+
+// decodes a response with http_parser and tek_stream, reading at most read_len bytes at a time, or a random amount up
+// to it if random_reads is set.
+bool decode_new(const char * response, size_t len, size_t read_len, bool random_reads, decoded * out) {
+    static tek_stream stream;
+    http_parser parser;
+
+    http_parser_init(&parser, false);
+    tek_stream_init(&stream, collect, out);
+
+    for (size_t offset = 0; offset < len && !http_parser_done(&parser);) {
+        size_t read = random_reads ? 1 + rand() % read_len : read_len;
+        if (read > len - offset) read = len - offset;
+
+        for (size_t used = 0; used < read && !http_parser_done(&parser);) {
+            const char * body;
+            size_t body_len;
+
+            used += http_parser_feed(&parser, response + offset + used, read - used, &body, &body_len);
+            if (http_parser_failed(&parser)) return false;
+            if (body_len > 0) tek_stream_feed(&stream, body, body_len);
+        }
+
+        offset += read;
+    }
+
+    return tek_stream_end(&stream) && http_parser_done(&parser) && parser.status == 200;
+}
+
+// decodes a response the way validate_tek_http_stream() did before http_parser.h. it doesn't understand chunks.
+bool decode_old(const char * response, size_t len, decoded * out) {
+    struct {
+        tracer_tek tek_buffer[128];
+        size_t tek_buffer_head;
+        tracer_tek current_tek;
+        streamop_token chunker;
+        streamop_token http_end;
+        bool body_valid;
+    } ctx;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.chunker = streamop_create_chunk_token(&ctx.current_tek, sizeof(tracer_tek));
+    ctx.http_end = streamop_create_token_from_str("\r\n\r\n");
+
+    char block[OLD_BLOCK_LEN];
+
+    for (size_t offset = 0; offset < len; offset += OLD_BLOCK_LEN) {
+        size_t block_len = len - offset < OLD_BLOCK_LEN ? len - offset : OLD_BLOCK_LEN;
+
+        memset(block, 0, OLD_BLOCK_LEN);
+        memcpy(block, response + offset, block_len);
+
+        for (size_t i = 0; i < block_len; i++) {
+            char c = block[i];
+            if (ctx.body_valid && streamop_chunk_character(&ctx.chunker, c) == STREAMOP_CHUNK_OK) {
+                ctx.tek_buffer[ctx.tek_buffer_head++] = ctx.current_tek;
+                if (ctx.tek_buffer_head == 128) {
+                    collect(ctx.tek_buffer, ctx.tek_buffer_head, out);
+                    ctx.tek_buffer_head = 0;
+                }
+            }
+            ctx.body_valid |= streamop_match_character(&ctx.http_end, c) == STREAMOP_MATCH;
+        }
+    }
+
+    collect(ctx.tek_buffer, ctx.tek_buffer_head, out);
+    return true;
+}
+
+bool check(const tracer_tek * teks, size_t len, const decoded * out) {
+    return out->len == len && memcmp(out->teks, teks, len * sizeof(tracer_tek)) == 0;
+}
+
+int main(int argc, char ** argv) {
+    size_t len = 100000;
+    size_t repeats = 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        switch (opt) {
+            case 'n': len = strtoul(optarg, NULL, 10); break;
+            case 'r': repeats = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n teks] [-r repeats]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    tracer_tek * teks = malloc(len * sizeof(tracer_tek));
+    decoded out = { malloc(len * sizeof(tracer_tek)), 0 };
+    char * responses[2];
+    size_t response_lens[2];
+
+    srand(1);
+    for (size_t i = 0; i < len; i++) {
+        teks[i].epoch = (1600000000 / 600 + i) * 600;     // on an eninterval, since tekx only keeps the rolling start number
+        for (size_t k = 0; k < 16; k++) teks[i].value[k] = rand();
+    }
+
+    for (int chunked = 0; chunked < 2; chunked++) {
+        responses[chunked] = malloc(len * sizeof(tracer_tek) * 2 + 256);
+        response_lens[chunked] = build_response(teks, len, chunked, responses[chunked]);
+
+        // reads of every size, so teks, chunk lines and the header are split at every point
+        for (size_t i = 0; i < 20; i++) {
+            out.len = 0;
+            if (!decode_new(responses[chunked], response_lens[chunked], i < 10 ? 1 + i : 3000, true, &out) || !check(teks, len, &out)) {
+                fprintf(stderr, "http_parser decoded the %s response wrong!\n", chunked ? "chunked" : "whole");
+                return 1;
+            }
+        }
+    }
+
+    out.len = 0;
+    if (!decode_old(responses[0], response_lens[0], &out) || !check(teks, len, &out)) {
+        fprintf(stderr, "streamop decoded the response wrong!\n");
+        return 1;
+    }
+
+    uint8_t * exports[2];
+    size_t export_lens[2];
+
+    for (int deflated = 0; deflated < 2; deflated++) {
+        exports[deflated] = malloc(len * 24 + 32);
+        export_lens[deflated] = build_tekx(teks, len, deflated, exports[deflated]);
+
+        for (size_t i = 0; i < 20; i++) {
+            out.len = 0;
+            if (!decode_tekx(exports[deflated], export_lens[deflated], i < 10 ? 1 + i : 3000, true, &out) || !check(teks, len, &out)) {
+                fprintf(stderr, "tek_export decoded the %s export wrong!\n", deflated ? "deflated" : "plain");
+                return 1;
+            }
+        }
+
+        // a cut short export is never taken as whole
+        out.len = 0;
+        if (decode_tekx(exports[deflated], export_lens[deflated] - 1, SEGMENT_LEN, false, &out)) {
+            fprintf(stderr, "tek_export took a cut short %s export as whole!\n", deflated ? "deflated" : "plain");
+            return 1;
+        }
+    }
+
+    printf("%-28s %14s %14s\n", "decoder", "teks/s", "body bytes");
+
+    for (int d = 0; d < 5; d++) {
+        double start = now_s();
+
+        for (size_t r = 0; r < repeats; r++) {
+            out.len = 0;
+            if (d == 0) decode_old(responses[0], response_lens[0], &out);
+            else if (d < 3) decode_new(responses[d - 1], response_lens[d - 1], SEGMENT_LEN, false, &out);
+            else decode_tekx(exports[d - 3], export_lens[d - 3], SEGMENT_LEN, false, &out);
+        }
+
+        double elapsed = now_s() - start;
+        const char * names[] = { "streamop, 64-byte blocks", "http_parser, content-length", "http_parser, chunked", "tek_export, tekx",
+            "tek_export, tekx deflated" };
+        size_t bytes = d < 3 ? len * sizeof(tracer_tek) : export_lens[d - 3];
+        printf("%-28s %14.0f %14zu\n", names[d], len * repeats / elapsed, bytes);
+    }
+
+    free(exports[0]);
+    free(exports[1]);
+
+    free(responses[0]);
+    free(responses[1]);
+    free(out.teks);
+    free(teks);
+    return 0;
+}
@@ -0,0 +1,598 @@
+// matches scanfiles pulled off of tracer devices against a tek export, on a host machine.
+// see readme.md for building and usage.
+
+#define _GNU_SOURCE
+
+#include "tracer_index.h"
+#include "scan_journal.h"
+#include "tek_log.h"
+#include "tek_sync.h"
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MATCHFILE_NAME          "matches"   // the same name main.c uses on the device
+
+#define DEFAULT_BATCH_SIZE      4096        // how many teks go into each rpi index
+#define SCANFILE_CHUNK_LEN      256         // how many sightings a task copies out of a spiffs image at once
+#define TASKS_PER_THREAD        256         // roughly how many match tasks each thread gets, so stealing has something to balance
+
+// spiffs on-flash layout, as configured by esp-idf
+#define SPIFFS_DEFAULT_PAGE_SIZE    256
+#define SPIFFS_DEFAULT_BLOCK_SIZE   4096
+#define SPIFFS_PAGE_HEADER_SIZE     5       // obj_id (u16), span_ix (u16), flags (u8)
+#define SPIFFS_OBJ_SIZE_OFFSET      8       // the object size (u32) follows the page header, aligned to 4 bytes
+#define SPIFFS_OBJ_NAME_OFFSET      13      // the object name follows the size and type (u8)
+#define SPIFFS_OBJ_NAME_LEN         32
+#define SPIFFS_OBJ_ID_IX_FLAG       0x8000  // set on the obj_id of index pages
+#define SPIFFS_UNDEFINED_LEN        UINT32_MAX
+
+// page flags are cleared to mark them
+#define SPIFFS_PH_FLAG_USED         (1 << 0)
+#define SPIFFS_PH_FLAG_FINAL        (1 << 1)
+#define SPIFFS_PH_FLAG_INDEX        (1 << 2)
+#define SPIFFS_PH_FLAG_IXDELE       (1 << 6)
+#define SPIFFS_PH_FLAG_DELET        (1 << 7)
+
+// a scanfile from one of the sources, either contiguous (extracted into a directory) or split across spiffs pages.
+typedef struct {
+    const char * source;        // the directory or image the scanfile came from
+    const uint8_t * data;       // the scanfile's data if contiguous, or the start of the image
+    uint32_t * pages;           // the page numbers of the scanfile's data pages, or NULL if contiguous
+    size_t len;                 // the number of sightings, or datapairs if legacy, in the scanfile
+    uint32_t scanin;            // the scan interval number from the scanfile's name or journal block
+    size_t offset;              // where the sightings start in the file, past any journal block header
+    bool legacy;                // holds bare datapairs, as written before the scan journal, instead of sightings
+} scanfile;
+
+// a spiffs data page, used to reassemble files from an image.
+typedef struct {
+    uint16_t obj_id;
+    uint16_t span_ix;
+    uint32_t page;
+} spiffs_data_page;
+
+// a range of task numbers owned by a worker, packed as (tail << 32) | head so it can be stolen with a single cas.
+typedef struct {
+    _Atomic uint64_t range;
+} task_queue;
+
+// a pool of workers running one function over a range of task numbers.
+typedef struct {
+    task_queue * queues;
+    size_t thread_count;
+    void (*run)(size_t task, void * arg);
+    void * arg;
+} task_pool;
+
+typedef struct {
+    task_pool * pool;
+    size_t id;
+} task_worker;
+
+// the state shared by every matching task.
+typedef struct {
+    const tracer_tek * teks;
+    size_t tek_len;
+    size_t batch_size;
+    tracer_index * indices;
+    size_t index_len;
+    scanfile * scanfiles;
+    size_t scanfile_len;
+    size_t files_per_task;
+    size_t file_task_len;
+    size_t page_size;
+    _Atomic size_t match_count;
+    _Atomic size_t sighting_count;
+    pthread_mutex_t out_lock;
+} match_ctx;
+
+scanfile * scanfiles = NULL;
+size_t scanfile_len = 0, scanfile_cap = 0;
+
+size_t page_size = SPIFFS_DEFAULT_PAGE_SIZE;
+size_t block_size = SPIFFS_DEFAULT_BLOCK_SIZE;
+
+// maps a whole file into memory. returns NULL if the file is empty or can't be mapped.
+const uint8_t * map_file(const char * path, size_t * len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    const uint8_t * out = NULL;
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_WILLNEED);
+            out = (const uint8_t *)map;
+            *len = st.st_size;
+        }
+    }
+
+    close(fd);
+    return out;
+}
+
+// decodes a legacy scanfile name into its scan interval number. returns false if the name is not a scanfile.
+bool parse_scanfile_name(const char * name, uint32_t * scanin) {
+    if (strcmp(name, TEK_LOG_LEGACY_NAME) == 0 || strcmp(name, TEK_LOG_NAME) == 0 || strcmp(name, TEK_SYNC_NAME) == 0 || strcmp(name, MATCHFILE_NAME) == 0 || strcmp(name, SCAN_JOURNAL_MANIFEST_NAME) == 0) return false;
+    if (strlen(name) != b64_encoded_size(sizeof(uint32_t)) - 1) return false;
+    return b64_decode_to(name, scanin, sizeof(uint32_t)) == sizeof(uint32_t);
+}
+
+// checks if a file is a scan journal segment.
+bool is_segment_name(const char * name) {
+    return strncmp(name, SCAN_JOURNAL_SEGMENT_PREFIX, strlen(SCAN_JOURNAL_SEGMENT_PREFIX)) == 0;
+}
+
+// copies len bytes starting at offset out of a scanfile's file, gathering them out of the pages if it is split across them.
+void read_scanfile(const scanfile * file, size_t page_size, size_t offset, void * output, size_t len) {
+    if (file->pages == NULL) {
+        memcpy(output, file->data + offset, len);
+        return;
+    }
+
+    size_t page_data_len = page_size - SPIFFS_PAGE_HEADER_SIZE;
+    uint8_t * out = (uint8_t *)output;
+
+    while (len) {
+        size_t span = offset / page_data_len, in_page = offset % page_data_len;
+        size_t copy_len = page_data_len - in_page < len ? page_data_len - in_page : len;
+        memcpy(out, file->data + file->pages[span] * page_size + SPIFFS_PAGE_HEADER_SIZE + in_page, copy_len);
+        out += copy_len;
+        offset += copy_len;
+        len -= copy_len;
+    }
+}
+
+void add_scanfile(scanfile file) {
+    if (file.len == 0) return;
+    if (scanfile_len == scanfile_cap) {
+        scanfile_cap = scanfile_cap ? scanfile_cap * 2 : 64;
+        scanfiles = (scanfile *)realloc(scanfiles, scanfile_cap * sizeof(scanfile));
+    }
+    scanfiles[scanfile_len++] = file;
+}
+
+// splits a scan journal segment of size bytes into one scanfile per block. a torn block ends the segment.
+size_t add_segment(scanfile file, size_t size) {
+    size_t found = 0;
+
+    for (size_t offset = 0; offset + sizeof(scan_journal_block) <= size;) {
+        scan_journal_block block;
+        read_scanfile(&file, page_size, offset, &block, sizeof(block));
+        if (block.magic != SCAN_JOURNAL_MAGIC) break;
+
+        offset += sizeof(block);
+
+        scanfile out = file;
+        out.offset = offset;
+        out.scanin = block.scanin;
+        out.len = (size - offset) / sizeof(tracer_sighting) < block.len ? (size - offset) / sizeof(tracer_sighting) : block.len;
+        add_scanfile(out);
+        found++;
+
+        offset += (size_t)block.len * sizeof(tracer_sighting);
+    }
+
+    return found;
+}
+
+// adds a per-minute scanfile from firmware older than the scan journal. those hold bare 20 byte datapairs with no
+// header, so a file that isn't a whole number of them can't be one and is skipped. returns whether it was added.
+bool add_legacy_scanfile(scanfile file, size_t size, const char * name) {
+    if (size % sizeof(tracer_datapair) != 0) {
+        fprintf(stderr, "%s: %s isn't a whole number of datapairs, skipping.\n", file.source, name);
+        return false;
+    }
+
+    file.legacy = true;
+    file.len = size / sizeof(tracer_datapair);
+    add_scanfile(file);
+    return true;
+}
+
+int compare_data_pages(const void * a, const void * b) {
+    const spiffs_data_page * x = (const spiffs_data_page *)a, * y = (const spiffs_data_page *)b;
+    if (x->obj_id != y->obj_id) return x->obj_id < y->obj_id ? -1 : 1;
+    if (x->span_ix != y->span_ix) return x->span_ix < y->span_ix ? -1 : 1;
+    return 0;
+}
+
+// finds every scanfile in a raw spiffs partition image. the image stays mapped for the life of the program.
+size_t load_image(const char * path) {
+    size_t image_len;
+    const uint8_t * image = map_file(path, &image_len);
+    if (image == NULL) {
+        fprintf(stderr, "couldn't map image %s!\n", path);
+        return 0;
+    }
+
+    size_t page_count = image_len / page_size;
+    size_t pages_per_block = block_size / page_size;
+    size_t lookup_pages = (pages_per_block * sizeof(uint16_t)) / page_size;
+    if (lookup_pages == 0) lookup_pages = 1;
+
+    spiffs_data_page * data_pages = (spiffs_data_page *)malloc(page_count * sizeof(spiffs_data_page));
+    uint32_t * header_pages = (uint32_t *)malloc(page_count * sizeof(uint32_t));
+    size_t data_len = 0, header_len = 0;
+
+    // sort the live pages into object headers and data pages
+    for (size_t page = 0; page < page_count; page++) {
+        if (page % pages_per_block < lookup_pages) continue;
+
+        const uint8_t * header = image + page * page_size;
+        uint16_t obj_id, span_ix;
+        uint8_t flags = header[4];
+        memcpy(&obj_id, header, sizeof(obj_id));
+        memcpy(&span_ix, header + 2, sizeof(span_ix));
+
+        if ((flags & (SPIFFS_PH_FLAG_USED | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_DELET)) != SPIFFS_PH_FLAG_DELET) continue;
+
+        if ((flags & SPIFFS_PH_FLAG_INDEX) == 0) {
+            if (span_ix == 0 && (flags & SPIFFS_PH_FLAG_IXDELE)) header_pages[header_len++] = page;
+        } else {
+            data_pages[data_len++] = (spiffs_data_page){ obj_id, span_ix, page };
+        }
+    }
+
+    qsort(data_pages, data_len, sizeof(spiffs_data_page), compare_data_pages);
+
+    size_t page_data_len = page_size - SPIFFS_PAGE_HEADER_SIZE;
+    size_t found = 0;
+
+    for (size_t i = 0; i < header_len; i++) {
+        const uint8_t * header = image + header_pages[i] * page_size;
+        uint16_t obj_id;
+        uint32_t size;
+        char name[SPIFFS_OBJ_NAME_LEN + 1] = "";
+
+        memcpy(&obj_id, header, sizeof(obj_id));
+        memcpy(&size, header + SPIFFS_OBJ_SIZE_OFFSET, sizeof(size));
+        memcpy(name, header + SPIFFS_OBJ_NAME_OFFSET, SPIFFS_OBJ_NAME_LEN);
+        obj_id &= ~SPIFFS_OBJ_ID_IX_FLAG;
+
+        const char * base_name = name[0] == '/' ? name + 1 : name;
+        scanfile file = { path, image, NULL, 0, 0, 0, false };
+        bool segment = is_segment_name(base_name);
+        if (size == SPIFFS_UNDEFINED_LEN || (!segment && !parse_scanfile_name(base_name, &file.scanin))) continue;
+
+        // find the object's data pages, which must cover every span
+        spiffs_data_page key = { obj_id, 0, 0 };
+        spiffs_data_page * first = (spiffs_data_page *)bsearch(&key, data_pages, data_len, sizeof(spiffs_data_page), compare_data_pages);
+        size_t span_count = (size + page_data_len - 1) / page_data_len;
+
+        if (first == NULL || (size_t)(data_pages + data_len - first) < span_count) continue;
+
+        file.pages = (uint32_t *)malloc(span_count * sizeof(uint32_t));
+        bool complete = true;
+
+        for (size_t span = 0; span < span_count && complete; span++) {
+            complete = first[span].obj_id == obj_id && first[span].span_ix == span;
+            file.pages[span] = first[span].page;
+        }
+
+        if (!complete) {
+            fprintf(stderr, "%s: %s is missing data pages, skipping.\n", path, name);
+            free(file.pages);
+            continue;
+        }
+
+        if (segment) {
+            found += add_segment(file, size);
+        } else if (add_legacy_scanfile(file, size, name)) {
+            found++;
+        } else {
+            free(file.pages);
+        }
+    }
+
+    free(data_pages);
+    free(header_pages);
+
+    return found;
+}
+
+// finds every scanfile in a directory. subdirectories and spiffs images inside it are loaded as separate sources.
+size_t load_directory(const char * path) {
+    DIR * dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "couldn't open directory %s!\n", path);
+        return 0;
+    }
+
+    struct dirent * de;
+    size_t found = 0;
+
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+
+        char * full_path;
+        if (asprintf(&full_path, "%s/%s", path, de->d_name) < 0) continue;
+
+        struct stat st;
+        scanfile file = { full_path, NULL, NULL, 0, 0, 0, false };
+        size_t file_len = 0;
+
+        if (stat(full_path, &st) != 0) {
+            free(full_path);
+        } else if (S_ISDIR(st.st_mode)) {
+            found += load_directory(full_path);
+        } else if (is_segment_name(de->d_name) || parse_scanfile_name(de->d_name, &file.scanin)) {
+            file.source = strdup(path);
+            file.data = map_file(full_path, &file_len);
+            if (file.data && is_segment_name(de->d_name)) {
+                found += add_segment(file, file_len);
+            } else if (file.data && add_legacy_scanfile(file, file_len, de->d_name)) {
+                found++;
+            } else if (file.data) {
+                munmap((void *)file.data, file_len);
+            }
+            free(full_path);
+        } else if (st.st_size >= 2 * block_size && st.st_size % block_size == 0) {
+            found += load_image(full_path);
+        } else {
+            free(full_path);
+        }
+    }
+
+    closedir(dir);
+
+    return found;
+}
+
+// pops the next task off of a worker's own queue.
+bool task_pop(task_queue * queue, size_t * task) {
+    uint64_t range = atomic_load(&queue->range);
+    for (;;) {
+        uint32_t head = range, tail = range >> 32;
+        if (head >= tail) return false;
+        if (atomic_compare_exchange_weak(&queue->range, &range, ((uint64_t)tail << 32) | (head + 1))) {
+            *task = head;
+            return true;
+        }
+    }
+}
+
+// steals the back half of another worker's queue into an empty queue, and returns the first stolen task.
+bool task_steal(task_queue * victim, task_queue * queue, size_t * task) {
+    uint64_t range = atomic_load(&victim->range);
+    for (;;) {
+        uint32_t head = range, tail = range >> 32;
+        if (head >= tail) return false;
+
+        uint32_t split = head + (tail - head) / 2;
+        if (atomic_compare_exchange_weak(&victim->range, &range, ((uint64_t)split << 32) | head)) {
+            atomic_store(&queue->range, ((uint64_t)tail << 32) | (split + 1));
+            *task = split;
+            return true;
+        }
+    }
+}
+
+void * task_worker_main(void * arg) {
+    task_worker * worker = (task_worker *)arg;
+    task_pool * pool = worker->pool;
+    task_queue * queue = &pool->queues[worker->id];
+    size_t task;
+
+    for (;;) {
+        if (task_pop(queue, &task)) {
+            pool->run(task, pool->arg);
+            continue;
+        }
+
+        bool stolen = false;
+        for (size_t i = 1; i < pool->thread_count && !stolen; i++) {
+            stolen = task_steal(&pool->queues[(worker->id + i) % pool->thread_count], queue, &task);
+        }
+
+        if (!stolen) break;     // tasks are never added once the pool starts, so every queue is empty
+        pool->run(task, pool->arg);
+    }
+
+    return NULL;
+}
+
+// runs a function over every task number in [0, task_count) on a pool of threads, and waits for them to finish.
+void task_pool_run(size_t thread_count, size_t task_count, void (*run)(size_t task, void * arg), void * arg) {
+    if (thread_count > task_count) thread_count = task_count;
+    if (thread_count == 0) return;
+
+    task_pool pool = { calloc(thread_count, sizeof(task_queue)), thread_count, run, arg };
+    pthread_t threads[thread_count];
+    task_worker workers[thread_count];
+
+    // split the tasks evenly. idle workers steal from the others as the load evens out.
+    for (size_t i = 0; i < thread_count; i++) {
+        uint64_t head = task_count * i / thread_count, tail = task_count * (i + 1) / thread_count;
+        atomic_init(&pool.queues[i].range, (tail << 32) | head);
+    }
+
+    for (size_t i = 0; i < thread_count; i++) {
+        workers[i] = (task_worker){ &pool, i };
+        pthread_create(&threads[i], NULL, task_worker_main, &workers[i]);
+    }
+
+    for (size_t i = 0; i < thread_count; i++) pthread_join(threads[i], NULL);
+
+    free(pool.queues);
+}
+
+// builds the rpi index of one tek batch.
+void build_index_task(size_t task, void * arg) {
+    match_ctx * ctx = (match_ctx *)arg;
+    size_t first = task * ctx->batch_size;
+    size_t len = ctx->tek_len - first < ctx->batch_size ? ctx->tek_len - first : ctx->batch_size;
+
+    if (!tracer_index_init(&ctx->indices[task], &ctx->teks[first], len)) {
+        fprintf(stderr, "couldn't allocate the index for teks %zu-%zu!\n", first, first + len);
+        ctx->indices[task].capacity = 0;
+    }
+}
+
+// matches a scanfile against an rpi index.
+size_t match_scanfile(const match_ctx * ctx, const tracer_index * index, const scanfile * file) {
+    tracer_sighting chunk[SCANFILE_CHUNK_LEN];
+    tracer_datapair pairs[SCANFILE_CHUNK_LEN];
+    size_t matches = 0;
+
+    for (size_t head = 0; head < file->len; head += SCANFILE_CHUNK_LEN) {
+        size_t chunk_len = file->len - head < SCANFILE_CHUNK_LEN ? file->len - head : SCANFILE_CHUNK_LEN;
+        size_t offset = file->offset + head * sizeof(tracer_sighting);
+        const tracer_sighting * sightings;
+
+        if (file->legacy) {
+            // a legacy datapair was heard at some point in the scan interval the file is named after. how often, how
+            // long for and how strongly weren't recorded.
+            read_scanfile(file, ctx->page_size, head * sizeof(tracer_datapair), pairs, chunk_len * sizeof(tracer_datapair));
+            for (size_t i = 0; i < chunk_len; i++) {
+                chunk[i] = (tracer_sighting){ .pair = pairs[i], .first_seen = tracer_scanin2epoch(file->scanin), .count = 1 };
+            }
+            sightings = chunk;
+        } else if (file->pages == NULL && offset % _Alignof(tracer_sighting) == 0) {
+            sightings = (const tracer_sighting *)(file->data + offset);
+        } else {
+            // gather the sightings out of the pages, since they straddle page boundaries
+            read_scanfile(file, ctx->page_size, offset, chunk, chunk_len * sizeof(tracer_sighting));
+            sightings = chunk;
+        }
+
+        for (size_t i = 0; i < chunk_len; i++) {
+            uint32_t enin;
+            const tracer_tek * tek;
+
+            const tracer_sighting * sighting = &sightings[i];
+
+            if (!tracer_index_lookup(index, &sighting->pair, &enin, &tek)) continue;
+
+            char tek_b64[b64_encoded_size(sizeof(tek->value))];
+            b64_encode_to(tek->value, sizeof(tek->value), tek_b64, sizeof(tek_b64));
+
+            pthread_mutex_lock((pthread_mutex_t *)&ctx->out_lock);
+            printf("%s,%u,%u,%u,%s,%u,%u,%d,%d,%d\n", file->source, sighting->first_seen, enin, tek->epoch, tek_b64,
+                sighting->duration, sighting->count, sighting->rssi_min, sighting->rssi_max, sighting->rssi_mean);
+            pthread_mutex_unlock((pthread_mutex_t *)&ctx->out_lock);
+
+            matches++;
+        }
+    }
+
+    return matches;
+}
+
+// matches a run of scanfiles against one tek batch. tasks for the same batch are adjacent, so a worker's
+// contiguous run of tasks keeps the same index in cache while streaming through the scanfiles.
+void match_task(size_t task, void * arg) {
+    match_ctx * ctx = (match_ctx *)arg;
+    size_t batch = task / ctx->file_task_len;
+    size_t first = (task % ctx->file_task_len) * ctx->files_per_task;
+    size_t last = first + ctx->files_per_task < ctx->scanfile_len ? first + ctx->files_per_task : ctx->scanfile_len;
+    size_t matches = 0, sightings = 0;
+
+    for (size_t i = first; i < last; i++) {
+        matches += match_scanfile(ctx, &ctx->indices[batch], &ctx->scanfiles[i]);
+        sightings += ctx->scanfiles[i].len;
+    }
+
+    atomic_fetch_add(&ctx->match_count, matches);
+    if (batch == 0) atomic_fetch_add(&ctx->sighting_count, sightings);
+}
+
+void usage(const char * name) {
+    fprintf(stderr,
+        "usage: %s [-j threads] [-b batch size] [-p page size] [-B block size] tekfile source...\n"
+        "\n"
+        "  tekfile   a tek export, as served by the keyserver (20 bytes per tek)\n"
+        "  source    a raw spiffs partition image, or a directory of scanfiles, images and more directories\n"
+        "\n"
+        "matches are written to stdout as: source,first seen,enin,tek epoch,tek,duration,count,rssi min,rssi max,rssi mean\n", name);
+}
+
+int main(int argc, char ** argv) {
+    size_t thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t batch_size = DEFAULT_BATCH_SIZE;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:b:p:B:h")) != -1) {
+        switch (opt) {
+            case 'j': thread_count = strtoul(optarg, NULL, 0); break;
+            case 'b': batch_size = strtoul(optarg, NULL, 0); break;
+            case 'p': page_size = strtoul(optarg, NULL, 0); break;
+            case 'B': block_size = strtoul(optarg, NULL, 0); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    if (argc - optind < 2 || thread_count == 0 || batch_size == 0 || batch_size > TRACER_INDEX_MAX_TEKS ||
+        page_size <= SPIFFS_OBJ_NAME_OFFSET + SPIFFS_OBJ_NAME_LEN || block_size % page_size != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    tracer_crypto_init();
+
+    size_t tekfile_len = 0;
+    const tracer_tek * teks = (const tracer_tek *)map_file(argv[optind], &tekfile_len);
+    if (teks == NULL) {
+        fprintf(stderr, "couldn't map tekfile %s!\n", argv[optind]);
+        return 1;
+    }
+
+    // an empty tekfile can't be mapped at all, but one shorter than a tek maps and holds nothing to match
+    if (tekfile_len < sizeof(tracer_tek)) {
+        fprintf(stderr, "tekfile %s doesn't hold a whole tek!\n", argv[optind]);
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (int i = optind + 1; i < argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st) != 0) fprintf(stderr, "couldn't find %s!\n", argv[i]);
+        else if (S_ISDIR(st.st_mode)) load_directory(argv[i]);
+        else load_image(argv[i]);
+    }
+
+    match_ctx ctx = {
+        .teks = teks,
+        .tek_len = tekfile_len / sizeof(tracer_tek),
+        .batch_size = batch_size,
+        .scanfiles = scanfiles,
+        .scanfile_len = scanfile_len,
+        .page_size = page_size,
+    };
+    ctx.index_len = (ctx.tek_len + batch_size - 1) / batch_size;
+    ctx.indices = (tracer_index *)calloc(ctx.index_len, sizeof(tracer_index));
+    atomic_init(&ctx.match_count, 0);
+    atomic_init(&ctx.sighting_count, 0);
+    pthread_mutex_init(&ctx.out_lock, NULL);
+
+    fprintf(stderr, "indexing %zu teks in %zu batches on %zu threads with the %s backend...\n",
+        ctx.tek_len, ctx.index_len, thread_count, tracer_crypto_get_backend()->name);
+
+    task_pool_run(thread_count, ctx.index_len, build_index_task, &ctx);
+
+    // group the scanfiles so there are about TASKS_PER_THREAD tasks per thread, no matter how many scanfiles there are
+    ctx.files_per_task = scanfile_len * ctx.index_len / (thread_count * TASKS_PER_THREAD);
+    if (ctx.files_per_task == 0) ctx.files_per_task = 1;
+    ctx.file_task_len = (scanfile_len + ctx.files_per_task - 1) / ctx.files_per_task;
+
+    fprintf(stderr, "matching %zu scanfiles...\n", scanfile_len);
+
+    task_pool_run(thread_count, ctx.index_len * ctx.file_task_len, match_task, &ctx);
+
+    fprintf(stderr, "found %zu matches in %zu sightings.\n", atomic_load(&ctx.match_count), atomic_load(&ctx.sighting_count));
+
+    for (size_t i = 0; i < ctx.index_len; i++) tracer_index_free(&ctx.indices[i]);
+    free(ctx.indices);
+    pthread_mutex_destroy(&ctx.out_lock);
+
+    return 0;
+}
@@ -0,0 +1,207 @@
+#include "stdio.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "string.h"
+#include "stdlib.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a host stand-in for the parts of the esp_partition api the scan log uses, for tests and benchmarks. the partition is a
+// file, read and written like nor flash: an erase sets a sector to all ones, and a write can only clear bits. a test can
+// cut the flash off after some number of bytes, as a reset in the middle of a write or an erase would. an erase cut off
+// leaves the sector in an unknown state, so it is filled with random bytes. esp_partition_mmap() maps the file.
+
+#ifndef _ESP_PARTITION_HOST_H_
+#define _ESP_PARTITION_HOST_H_
+
+#define ESP_OK                  0
+#define ESP_FAIL                -1
+#define ESP_ERR_INVALID_ARG     0x102
+#define ESP_ERR_INVALID_SIZE    0x104
+#define SPI_FLASH_SEC_SIZE      4096
+
+typedef int esp_err_t;
+typedef int esp_partition_type_t;
+typedef int esp_partition_subtype_t;
+typedef uint32_t spi_flash_mmap_handle_t;
+typedef enum { SPI_FLASH_MMAP_DATA, SPI_FLASH_MMAP_INST } spi_flash_mmap_memory_t;
+
+typedef struct {
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+    bool encrypted;
+} esp_partition_t;
+
+// the one emulated partition.
+typedef struct {
+    esp_partition_t partition;
+    int fd;                 // the file standing in for the partition, or -1 if there is none
+    long budget;            // how many more bytes can be written before the flash is cut off, counting an erase as one, or -1 for no limit
+    bool cut;               // set once the flash is cut off. every write and erase fails until esp_partition_host_reset().
+    size_t reads;           // the number of reads so far
+    size_t writes;
+    size_t erases;          // the number of sectors erased so far
+    const void * map;       // the mapped file, or NULL
+    bool map_fails;         // makes esp_partition_mmap() fail, as it does on the device when the mmu has no pages free
+} esp_partition_host;
+
+esp_partition_host esp_partition_host_flash = { .fd = -1, .budget = -1 };
+
+// opens the file backing a partition of size bytes, creating it erased if it doesn't exist. an existing file keeps its
+// contents, so a log can be recovered from it.
+bool esp_partition_host_open(const char * path, const char * label, size_t size) {
+    esp_partition_host * flash = &esp_partition_host_flash;
+    struct stat st;
+
+    if (flash->fd >= 0 || size % SPI_FLASH_SEC_SIZE != 0 || strlen(label) >= sizeof(flash->partition.label)) return false;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+
+    if (fstat(fd, &st) != 0 || ((size_t)st.st_size != size && ftruncate(fd, 0) != 0)) {
+        close(fd);
+        return false;
+    }
+
+    if ((size_t)st.st_size != size) {
+        uint8_t erased[SPI_FLASH_SEC_SIZE];
+        memset(erased, 0xff, sizeof(erased));
+
+        for (size_t offset = 0; offset < size; offset += sizeof(erased)) {
+            if (pwrite(fd, erased, sizeof(erased), offset) != sizeof(erased)) {
+                close(fd);
+                return false;
+            }
+        }
+    }
+
+    memset(flash, 0, sizeof(*flash));
+    flash->partition.size = size;
+    strcpy(flash->partition.label, label);
+    flash->fd = fd;
+    flash->budget = -1;
+    return true;
+}
+
+void esp_partition_host_close() {
+    if (esp_partition_host_flash.fd >= 0) close(esp_partition_host_flash.fd);
+    esp_partition_host_flash.fd = -1;
+}
+
+// cuts the flash off once budget more bytes have been written, counting an erase as one. -1 never cuts it off.
+void esp_partition_host_cut_after(long budget) {
+    esp_partition_host_flash.budget = budget;
+    esp_partition_host_flash.cut = false;
+}
+
+// powers the flash back on after it was cut off.
+void esp_partition_host_reset() {
+    esp_partition_host_cut_after(-1);
+}
+
+// takes one byte or erase from the budget. returns false once the flash is cut off.
+bool _esp_partition_host_spend() {
+    esp_partition_host * flash = &esp_partition_host_flash;
+
+    if (flash->cut) return false;
+    if (flash->budget == 0) {
+        flash->cut = true;
+        return false;
+    }
+    if (flash->budget > 0) flash->budget--;
+
+    return true;
+}
+
+const esp_partition_t * esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char * label) {
+    esp_partition_host * flash = &esp_partition_host_flash;
+    if (flash->fd < 0 || (label && strcmp(label, flash->partition.label) != 0)) return NULL;
+    return &flash->partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t * partition, size_t offset, void * dst, size_t size) {
+    if (offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+
+    esp_partition_host_flash.reads++;
+    return pread(esp_partition_host_flash.fd, dst, size, offset) == (ssize_t)size ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t * partition, size_t offset, const void * src, size_t size) {
+    if (offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+
+    uint8_t data[256];
+    esp_partition_host_flash.writes++;
+
+    // written in chunks, so a cut off write leaves its first bytes programmed
+    for (size_t done = 0; done < size;) {
+        size_t len = size - done < sizeof(data) ? size - done : sizeof(data);
+        if (pread(esp_partition_host_flash.fd, data, len, offset + done) != (ssize_t)len) return ESP_FAIL;
+
+        size_t programmed = 0;
+        while (programmed < len && _esp_partition_host_spend()) {
+            data[programmed] &= ((const uint8_t *)src)[done + programmed];     // nor flash only clears bits
+            programmed++;
+        }
+
+        if (pwrite(esp_partition_host_flash.fd, data, programmed, offset + done) != (ssize_t)programmed) return ESP_FAIL;
+        if (programmed < len) return ESP_FAIL;
+
+        done += len;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t * partition, size_t offset, size_t size) {
+    if (offset % SPI_FLASH_SEC_SIZE != 0 || size % SPI_FLASH_SEC_SIZE != 0) return ESP_ERR_INVALID_ARG;
+    if (offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+
+    uint8_t sector[SPI_FLASH_SEC_SIZE];
+
+    for (size_t done = 0; done < size; done += sizeof(sector)) {
+        bool whole = _esp_partition_host_spend();
+
+        if (whole) {
+            memset(sector, 0xff, sizeof(sector));
+        } else {
+            for (size_t i = 0; i < sizeof(sector); i++) sector[i] = rand();
+        }
+
+        if (pwrite(esp_partition_host_flash.fd, sector, sizeof(sector), offset + done) != sizeof(sector) || !whole) return ESP_FAIL;
+        esp_partition_host_flash.erases++;
+    }
+
+    return ESP_OK;
+}
+
+// maps the whole file, so what the partition api writes shows up in the mapping.
+esp_err_t esp_partition_mmap(const esp_partition_t * partition, size_t offset, size_t size, spi_flash_mmap_memory_t memory,
+    const void ** out, spi_flash_mmap_handle_t * handle) {
+    esp_partition_host * flash = &esp_partition_host_flash;
+
+    if (offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+    if (flash->map || flash->map_fails) return ESP_FAIL;    // one mapping at a time is enough for the scan log
+
+    void * map = mmap(NULL, partition->size, PROT_READ, MAP_SHARED, flash->fd, 0);
+    if (map == MAP_FAILED) return ESP_FAIL;
+
+    flash->map = map;
+    *out = (const uint8_t *)map + offset;
+    *handle = 1;
+    return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle) {
+    esp_partition_host * flash = &esp_partition_host_flash;
+
+    if (flash->map) munmap((void *)flash->map, flash->partition.size);
+    flash->map = NULL;
+}
+
+#endif
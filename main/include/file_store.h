@@ -0,0 +1,113 @@
+#include "stdio.h"
+#include "stdint.h"
+#include "stdbool.h"
+#include "string.h"
+
+// a small interface over the filesystem the scan journal, tek store and matchfile live on. a backend mounts a store and
+// opens its files as stdio streams, so everything above it keeps using fread() and fwrite(). the backends are:
+//  - spiffs (file_store_spiffs.h) and littlefs (file_store_littlefs.h), on the esp32.
+//  - a host directory (file_store_host.h) and a ram disk (file_store_ram.h), for tests and benchmarks on a host.
+
+#ifndef _FILE_STORE_H_
+#define _FILE_STORE_H_
+
+#define FILE_STORE_ROOT_LEN     32      // the longest mount point or directory, with the terminator
+#define FILE_STORE_NAME_LEN     32      // the longest file name, with the terminator. spiffs' own limit.
+#define FILE_STORE_PATH_LEN     (FILE_STORE_ROOT_LEN + FILE_STORE_NAME_LEN)
+#define FILE_STORE_MAX_FILES    2       // the most files the esp32 backends keep open at once
+
+typedef struct file_store file_store;
+
+// the operations a backend provides. names are relative to the root of the store.
+typedef struct {
+    const char * name;                                                          // a short name for the backend, used in logs
+    bool (*mount)(file_store * store);                                          // mounts the store, formatting it if it can't be mounted
+    void (*unmount)(file_store * store);
+    bool (*format)(file_store * store);                                         // deletes every file. the store stays mounted.
+    bool (*info)(file_store * store, size_t * total, size_t * used);            // gets the size of the store and how much of it is used, in bytes
+    FILE * (*open)(file_store * store, const char * name, const char * mode);   // opens a file like fopen()
+    bool (*remove)(file_store * store, const char * name);                      // deletes a file
+    bool (*rename)(file_store * store, const char * from, const char * to);     // renames a file. fails if to exists, since spiffs can't replace files.
+} file_store_backend;
+
+struct file_store {
+    const file_store_backend * backend;
+    char root[FILE_STORE_ROOT_LEN];     // the vfs mount point, or the host directory
+    const char * partition_label;       // the partition the store is on, for the esp32 backends
+    void * state;                       // owned by the backend
+};
+
+// writes the full path of a file in a store mounted in a directory into out.
+void file_store_path(const file_store * store, const char * name, char out[FILE_STORE_PATH_LEN]) {
+    snprintf(out, FILE_STORE_PATH_LEN, "%s/%s", store->root, name);
+}
+
+// opens a file by its path in the vfs. shared by the backends that mount into a directory.
+FILE * _file_store_vfs_open(file_store * store, const char * name, const char * mode) {
+    char path[FILE_STORE_PATH_LEN];
+    file_store_path(store, name, path);
+    return fopen(path, mode);
+}
+
+// removes a file by its path in the vfs. shared by the backends that mount into a directory.
+bool _file_store_vfs_remove(file_store * store, const char * name) {
+    char path[FILE_STORE_PATH_LEN];
+    file_store_path(store, name, path);
+    return remove(path) == 0;
+}
+
+// renames a file by its path in the vfs. shared by the backends that mount into a directory.
+bool _file_store_vfs_rename(file_store * store, const char * from, const char * to) {
+    char from_path[FILE_STORE_PATH_LEN], to_path[FILE_STORE_PATH_LEN];
+    file_store_path(store, from, from_path);
+    file_store_path(store, to, to_path);
+
+    FILE * existing = fopen(to_path, "r");     // posix would replace it, spiffs would refuse
+    if (existing) {
+        fclose(existing);
+        return false;
+    }
+
+    return rename(from_path, to_path) == 0;
+}
+
+// mounts a store with a backend. root is where it is mounted, and partition_label the partition it is on, if any. a store
+// has to start out zeroed, since backends keep their state in it across mounts.
+bool file_store_mount(file_store * store, const file_store_backend * backend, const char * root, const char * partition_label) {
+    if (strlen(root) >= sizeof(store->root)) return false;
+
+    store->backend = backend;
+    strcpy(store->root, root);
+    store->partition_label = partition_label;
+    if (store->backend->mount(store)) return true;
+
+    store->backend = NULL;
+    return false;
+}
+
+void file_store_unmount(file_store * store) {
+    if (store->backend) store->backend->unmount(store);
+    store->backend = NULL;
+}
+
+bool file_store_format(file_store * store) {
+    return store->backend && store->backend->format(store);
+}
+
+bool file_store_info(file_store * store, size_t * total, size_t * used) {
+    return store->backend && store->backend->info(store, total, used);
+}
+
+FILE * file_store_open(file_store * store, const char * name, const char * mode) {
+    return store->backend ? store->backend->open(store, name, mode) : NULL;
+}
+
+bool file_store_remove(file_store * store, const char * name) {
+    return store->backend && store->backend->remove(store, name);
+}
+
+bool file_store_rename(file_store * store, const char * from, const char * to) {
+    return store->backend && store->backend->rename(store, from, to);
+}
+
+#endif
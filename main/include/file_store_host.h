@@ -0,0 +1,70 @@
+#include "file_store.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+// the host directory backend. the store is a directory on the host's own filesystem, which is handy for checking what
+// the firmware writes, and for benchmarking the code above the filesystem without a device.
+
+#ifndef _FILE_STORE_HOST_H_
+#define _FILE_STORE_HOST_H_
+
+bool _file_store_host_mount(file_store * store) {
+    struct stat st;
+    if (mkdir(store->root, 0755) != 0 && (stat(store->root, &st) != 0 || !S_ISDIR(st.st_mode))) return false;
+    return true;
+}
+
+void _file_store_host_unmount(file_store * store) {
+}
+
+bool _file_store_host_format(file_store * store) {
+    DIR * dir = opendir(store->root);
+    if (dir == NULL) return false;
+
+    bool ok = true;
+    for (struct dirent * entry; (entry = readdir(dir)) != NULL;) {
+        if (entry->d_name[0] == '.') continue;
+        ok &= _file_store_vfs_remove(store, entry->d_name);
+    }
+
+    closedir(dir);
+    return ok;
+}
+
+bool _file_store_host_info(file_store * store, size_t * total, size_t * used) {
+    struct statvfs vfs;
+    DIR * dir = opendir(store->root);
+    if (dir == NULL || statvfs(store->root, &vfs) != 0) {
+        if (dir) closedir(dir);
+        return false;
+    }
+
+    *total = vfs.f_blocks * vfs.f_frsize;
+    *used = 0;
+
+    for (struct dirent * entry; (entry = readdir(dir)) != NULL;) {
+        char path[FILE_STORE_PATH_LEN];
+        struct stat st;
+
+        file_store_path(store, entry->d_name, path);
+        if (entry->d_name[0] != '.' && stat(path, &st) == 0) *used += st.st_size;
+    }
+
+    closedir(dir);
+    return true;
+}
+
+const file_store_backend file_store_host = {
+    .name = "host",
+    .mount = _file_store_host_mount,
+    .unmount = _file_store_host_unmount,
+    .format = _file_store_host_format,
+    .info = _file_store_host_info,
+    .open = _file_store_vfs_open,
+    .remove = _file_store_vfs_remove,
+    .rename = _file_store_vfs_rename,
+};
+
+#endif
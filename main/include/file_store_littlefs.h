@@ -0,0 +1,47 @@
+#include "file_store.h"
+
+#include "esp_littlefs.h"
+
+// the littlefs backend. littlefs keeps real directories and metadata pairs, so it mounts in a few reads however full
+// the partition is, and seeks don't walk page indices like spiffs does. it needs the esp_littlefs component
+// (https://github.com/joltwallet/esp_littlefs) in the project's components directory, and main.c picks it when
+// FILE_STORE_LITTLEFS is defined. switching an existing device over formats the files partition on the first boot.
+
+#ifndef _FILE_STORE_LITTLEFS_H_
+#define _FILE_STORE_LITTLEFS_H_
+
+bool _file_store_littlefs_mount(file_store * store) {
+    esp_vfs_littlefs_conf_t conf = {
+        .base_path = store->root,
+        .partition_label = store->partition_label,
+        .format_if_mount_failed = true,
+        .dont_mount = false,
+    };
+
+    return esp_vfs_littlefs_register(&conf) == ESP_OK;
+}
+
+void _file_store_littlefs_unmount(file_store * store) {
+    esp_vfs_littlefs_unregister(store->partition_label);
+}
+
+bool _file_store_littlefs_format(file_store * store) {
+    return esp_littlefs_format(store->partition_label) == ESP_OK;
+}
+
+bool _file_store_littlefs_info(file_store * store, size_t * total, size_t * used) {
+    return esp_littlefs_info(store->partition_label, total, used) == ESP_OK;
+}
+
+const file_store_backend file_store_littlefs = {
+    .name = "littlefs",
+    .mount = _file_store_littlefs_mount,
+    .unmount = _file_store_littlefs_unmount,
+    .format = _file_store_littlefs_format,
+    .info = _file_store_littlefs_info,
+    .open = _file_store_vfs_open,
+    .remove = _file_store_vfs_remove,
+    .rename = _file_store_vfs_rename,
+};
+
+#endif
@@ -0,0 +1,218 @@
+#if !defined(_GNU_SOURCE)
+#error "file_store_ram.h needs fopencookie(), so define _GNU_SOURCE before including anything"
+#endif
+
+#include "file_store.h"
+
+#include "stdlib.h"
+#include <sys/types.h>
+
+// the ram disk backend, for tests and benchmarks on a host. files live in memory and are opened as stdio streams with
+// fopencookie(), so the code above sees the same FILE * it would on the device. the disk has a fixed size like a
+// partition, and keeps its files across unmounts until file_store_ram_free(). files have to be closed before they
+// are removed.
+
+#ifndef _FILE_STORE_RAM_H_
+#define _FILE_STORE_RAM_H_
+
+#define FILE_STORE_RAM_MAX_FILES    64
+#define FILE_STORE_RAM_DEFAULT_SIZE (1024 * 1024)   // the same size as the files partition
+
+typedef struct {
+    char name[FILE_STORE_NAME_LEN];     // empty if the entry is unused
+    uint8_t * data;
+    size_t len;
+    size_t capacity;
+} _file_store_ram_file;
+
+typedef struct {
+    _file_store_ram_file files[FILE_STORE_RAM_MAX_FILES];
+    size_t size;    // the most bytes the files can hold together
+    size_t used;
+} file_store_ram_disk;
+
+// an open file.
+typedef struct {
+    file_store_ram_disk * disk;
+    _file_store_ram_file * file;
+    size_t pos;
+    bool append;
+} _file_store_ram_cookie;
+
+ssize_t _file_store_ram_read(void * cookie, char * buf, size_t size) {
+    _file_store_ram_cookie * c = (_file_store_ram_cookie *)cookie;
+
+    if (c->pos >= c->file->len) return 0;
+    if (size > c->file->len - c->pos) size = c->file->len - c->pos;
+
+    memcpy(buf, c->file->data + c->pos, size);
+    c->pos += size;
+    return size;
+}
+
+ssize_t _file_store_ram_write(void * cookie, const char * buf, size_t size) {
+    _file_store_ram_cookie * c = (_file_store_ram_cookie *)cookie;
+    _file_store_ram_file * file = c->file;
+
+    if (c->append) c->pos = file->len;
+
+    size_t end = c->pos + size;
+    if (end > file->len && end - file->len > c->disk->size - c->disk->used) return -1;  // out of space
+
+    if (end > file->capacity) {
+        size_t capacity = file->capacity ? file->capacity : 256;
+        while (capacity < end) capacity *= 2;
+
+        uint8_t * data = (uint8_t *)realloc(file->data, capacity);
+        if (data == NULL) return -1;
+
+        file->data = data;
+        file->capacity = capacity;
+    }
+
+    if (c->pos > file->len) memset(file->data + file->len, 0, c->pos - file->len);     // a seek past the end leaves a hole
+    memcpy(file->data + c->pos, buf, size);
+
+    if (end > file->len) {
+        c->disk->used += end - file->len;
+        file->len = end;
+    }
+
+    c->pos = end;
+    return size;
+}
+
+int _file_store_ram_seek(void * cookie, off64_t * offset, int whence) {
+    _file_store_ram_cookie * c = (_file_store_ram_cookie *)cookie;
+    off64_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? (off64_t)c->pos : (off64_t)c->file->len;
+
+    if (base + *offset < 0) return -1;
+
+    c->pos = base + *offset;
+    *offset = c->pos;
+    return 0;
+}
+
+int _file_store_ram_close(void * cookie) {
+    free(cookie);
+    return 0;
+}
+
+_file_store_ram_file * _file_store_ram_find(file_store_ram_disk * disk, const char * name) {
+    for (size_t i = 0; i < FILE_STORE_RAM_MAX_FILES; i++) {
+        if (disk->files[i].name[0] != '\0' && strcmp(disk->files[i].name, name) == 0) return &disk->files[i];
+    }
+    return NULL;
+}
+
+bool _file_store_ram_mount(file_store * store) {
+    if (store->state) return true;     // the files are still there from the last mount
+
+    file_store_ram_disk * disk = (file_store_ram_disk *)calloc(1, sizeof(file_store_ram_disk));
+    if (disk == NULL) return false;
+
+    disk->size = FILE_STORE_RAM_DEFAULT_SIZE;
+    store->state = disk;
+    return true;
+}
+
+void _file_store_ram_unmount(file_store * store) {
+}
+
+bool _file_store_ram_remove(file_store * store, const char * name) {
+    file_store_ram_disk * disk = (file_store_ram_disk *)store->state;
+    _file_store_ram_file * file = _file_store_ram_find(disk, name);
+    if (file == NULL) return false;
+
+    disk->used -= file->len;
+    free(file->data);
+    memset(file, 0, sizeof(*file));
+    return true;
+}
+
+bool _file_store_ram_rename(file_store * store, const char * from, const char * to) {
+    file_store_ram_disk * disk = (file_store_ram_disk *)store->state;
+    _file_store_ram_file * file = _file_store_ram_find(disk, from);
+    if (file == NULL || strlen(to) >= FILE_STORE_NAME_LEN || _file_store_ram_find(disk, to) != NULL) return false;
+
+    strcpy(file->name, to);
+    return true;
+}
+
+bool _file_store_ram_format(file_store * store) {
+    file_store_ram_disk * disk = (file_store_ram_disk *)store->state;
+
+    for (size_t i = 0; i < FILE_STORE_RAM_MAX_FILES; i++) free(disk->files[i].data);
+    memset(disk->files, 0, sizeof(disk->files));
+    disk->used = 0;
+
+    return true;
+}
+
+bool _file_store_ram_info(file_store * store, size_t * total, size_t * used) {
+    file_store_ram_disk * disk = (file_store_ram_disk *)store->state;
+
+    *total = disk->size;
+    *used = disk->used;
+    return true;
+}
+
+FILE * _file_store_ram_open(file_store * store, const char * name, const char * mode) {
+    file_store_ram_disk * disk = (file_store_ram_disk *)store->state;
+    _file_store_ram_file * file = _file_store_ram_find(disk, name);
+
+    if (strlen(name) >= FILE_STORE_NAME_LEN) return NULL;
+
+    if (file == NULL) {
+        if (mode[0] == 'r') return NULL;
+
+        for (size_t i = 0; i < FILE_STORE_RAM_MAX_FILES && file == NULL; i++) {
+            if (disk->files[i].name[0] == '\0') file = &disk->files[i];
+        }
+        if (file == NULL) return NULL;  // out of entries
+
+        strcpy(file->name, name);
+    } else if (mode[0] == 'w') {
+        disk->used -= file->len;
+        file->len = 0;
+    }
+
+    _file_store_ram_cookie * cookie = (_file_store_ram_cookie *)malloc(sizeof(_file_store_ram_cookie));
+    if (cookie == NULL) return NULL;
+
+    *cookie = (_file_store_ram_cookie){ disk, file, 0, mode[0] == 'a' };
+
+    cookie_io_functions_t io = {
+        .read = _file_store_ram_read,
+        .write = _file_store_ram_write,
+        .seek = _file_store_ram_seek,
+        .close = _file_store_ram_close,
+    };
+
+    FILE * stream = fopencookie(cookie, mode, io);
+    if (stream == NULL) free(cookie);
+    return stream;
+}
+
+// frees a ram disk and its files. the store has to be mounted again before it is used.
+void file_store_ram_free(file_store * store) {
+    if (store->state == NULL) return;
+
+    _file_store_ram_format(store);
+    free(store->state);
+    store->state = NULL;
+    store->backend = NULL;
+}
+
+const file_store_backend file_store_ram = {
+    .name = "ram",
+    .mount = _file_store_ram_mount,
+    .unmount = _file_store_ram_unmount,
+    .format = _file_store_ram_format,
+    .info = _file_store_ram_info,
+    .open = _file_store_ram_open,
+    .remove = _file_store_ram_remove,
+    .rename = _file_store_ram_rename,
+};
+
+#endif
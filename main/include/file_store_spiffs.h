@@ -0,0 +1,45 @@
+#include "file_store.h"
+
+#include "esp_spiffs.h"
+
+// the spiffs backend. this is what the files partition has always been formatted with.
+// spiffs keeps no directory, so mounting scans every page and gets slower as the partition fills.
+
+#ifndef _FILE_STORE_SPIFFS_H_
+#define _FILE_STORE_SPIFFS_H_
+
+bool _file_store_spiffs_mount(file_store * store) {
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = store->root,
+        .partition_label = store->partition_label,
+        .max_files = FILE_STORE_MAX_FILES,
+        .format_if_mount_failed = true,
+    };
+
+    return esp_vfs_spiffs_register(&conf) == ESP_OK;
+}
+
+void _file_store_spiffs_unmount(file_store * store) {
+    esp_vfs_spiffs_unregister(store->partition_label);
+}
+
+bool _file_store_spiffs_format(file_store * store) {
+    return esp_spiffs_format(store->partition_label) == ESP_OK;
+}
+
+bool _file_store_spiffs_info(file_store * store, size_t * total, size_t * used) {
+    return esp_spiffs_info(store->partition_label, total, used) == ESP_OK;
+}
+
+const file_store_backend file_store_spiffs = {
+    .name = "spiffs",
+    .mount = _file_store_spiffs_mount,
+    .unmount = _file_store_spiffs_unmount,
+    .format = _file_store_spiffs_format,
+    .info = _file_store_spiffs_info,
+    .open = _file_store_vfs_open,
+    .remove = _file_store_vfs_remove,
+    .rename = _file_store_vfs_rename,
+};
+
+#endif
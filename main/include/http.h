@@ -1,7 +1,9 @@
+#ifdef ESP_PLATFORM
 #include "utils.h"
 #include "wifi_adapter.h"
 
 #include "esp_wifi.h"
+#include "esp_attr.h"
 #include "tcpip_adapter.h"
 
 #include "lwip/err.h"
@@ -10,331 +12,702 @@
 #include "lwip/dns.h"
 #include "lwip/netdb.h"
 
-#include "esp_tls.h"
-
+#include "esp_timer.h"
+#include "nvs.h"
+#else
+#include "stdio.h"
+#include "string.h"
+#include "strings.h"
+#include "stdlib.h"
+#include "stdbool.h"
+#include "stdint.h"
+#include "errno.h"
+
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+#include "stdarg.h"
 #include "time.h"
 
+#include "mbedtls/version.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/net_sockets.h"
+
+#include "http_parser.h"
+
+// an http/1.1 client. a connection to a server is kept open between requests, so everything sent to the same server
+// in one wake shares one tcp session. requests and responses go through one buffer in the connection, and
+// nothing is allocated per request.
+//
+//  http_conn conn;
+//  http_conn_init(&conn, "10.0.0.173", 80);
+//  http_begin(&conn, "GET", "/");
+//  int status = http_send(&conn, NULL, 0, callback, user_data);
+//  ...more requests...
+//  http_conn_close(&conn);
+//
+// response bodies are handed to the callback as they arrive, without the header. the callback is called once more
+// with a length of 0 when the body is over. responses are read with http_parser.h, and can be chunked.
+//
+// connections opened with http_conn_init_tls() go over tls (mbedtls), checked against a ca certificate. the tls
+// session is cached per server after a full handshake, and offered again the next time the server is connected to,
+// so later connections skip the certificate exchange and key agreement. http_tls_cache_load() and
+// http_tls_cache_save() keep the cache in nvs across wakes. https_req() keeps a small pool of tls connections open
+// for one-off requests.
+//
+// this builds on a linux host too, where it uses the host's sockets, so it can be tried against a local server.
+
 #ifndef _HTTP_H
 #define _HTTP_H
 
 #define TAG "http_lib"
 
-#define DATA_BLOCK_SIZE 64
+#ifndef ESP_PLATFORM
+#define RTC_DATA_ATTR
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) fprintf(stderr, "I (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...)
+#endif
+
+#define HTTP_HOST_LEN       64
+#define HTTP_HEADER_LEN     1460        // the request header has to fit in this. responses are read through it too, a tcp segment at a time.
+#define HTTP_TIMEOUT_S      5
+#define HTTP_DNS_CACHE_LEN  4
+#define HTTP_DNS_TTL_S      (60 * 60)   // getaddrinfo() doesn't give the real ttl, so addresses are kept for an hour
+#define HTTP_TLS_CACHE_LEN  2           // the number of servers tls sessions are cached for
+#define HTTP_TLS_SESSION_LEN 2048       // a saved session holds the ticket and the server's certificate
+#define HTTP_TLS_NVS_NAMESPACE "http"
+#define HTTP_TLS_NVS_KEY    "tls"
+#ifndef HTTP_TLS_CACHE_FILE
+#define HTTP_TLS_CACHE_FILE "http_tls_cache.bin"    // where the cache is kept on a host, which has no nvs
+#endif
+#define HTTPS_POOL_LEN      2           // the number of connections https_req() keeps open
+#ifndef HTTPS_PORT
+#define HTTPS_PORT          443
+#endif
+
+// mbedtls_ssl_session_save() is only in mbedtls 2.21 and later. older ones do a full handshake every time.
+#if MBEDTLS_VERSION_NUMBER >= 0x02150000
+#define HTTP_TLS_SAVE_SESSIONS
+#endif
+
+typedef void (*http_body_cb)(char * data, size_t len, void * user_data);
+
+// an http header, built up a line at a time.
+typedef struct {
+    char data[HTTP_HEADER_LEN];
+    size_t len;
+    bool full;      // a line didn't fit, so the header can't be sent
+} http_header;
+
+// the tls state of an open connection. it is big, so it is only allocated while the connection is open.
+typedef struct {
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    mbedtls_x509_crt ca;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_entropy_context entropy;
+    bool verified;          // whether the server's certificate was checked, which only happens in a full handshake
+} _http_tls;
+
+typedef struct {
+    char host[HTTP_HOST_LEN];
+    uint16_t port;
+    int socket;             // -1 while closed
+    const char * ca_pem;    // the ca certificate the server is checked against, or NULL for plain http
+    _http_tls * tls;
+    uint32_t handshake_ms;  // how long the last tls handshake took
+    bool resumed;           // whether it resumed a cached session
+    http_header header;
+} http_conn;
+
+// a cached tls session, serialized with mbedtls_ssl_session_save()
+typedef struct {
+    char host[HTTP_HOST_LEN];   // empty if the entry is unused
+    uint16_t port;
+    size_t len;
+    uint8_t data[HTTP_TLS_SESSION_LEN];
+} _http_tls_session;
+
+typedef struct {
+    char host[HTTP_HOST_LEN];   // empty if the entry is unused
+    struct sockaddr_in addr;
+    uint32_t expires;
+} _http_dns_entry;
+
+// kept in rtc memory, so the keyserver is only looked up once an hour, not on every wake
+RTC_DATA_ATTR _http_dns_entry _http_dns_cache[HTTP_DNS_CACHE_LEN];
+
+_http_tls_session _http_tls_cache[HTTP_TLS_CACHE_LEN];
+size_t _http_tls_cache_next;        // the entry replaced when a new server is cached
+bool _http_tls_cache_loaded;
+bool _http_tls_cache_dirty;         // whether the cache has changed since it was loaded
+
+uint32_t _http_now_ms() {
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time() / 1000;
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000 + t.tv_nsec / 1000000;
+#endif
+}
+
+// appends a line to a header, formatted like printf.
+void http_header_printf(http_header * header, const char * fmt, ...) __attribute__((format(printf, 2, 3)));
+
+void http_header_printf(http_header * header, const char * fmt, ...) {
+    if (header->full) return;
 
-// terminates an http header
-void http_terminate_header(char ** src) {
-    *src = realloc(*src, strlen(*src) + 3);
-    strcat(*src, "\r\n");
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(header->data + header->len, HTTP_HEADER_LEN - header->len, fmt, args);
+    va_end(args);
+
+    if (len < 0 || (size_t)len >= HTTP_HEADER_LEN - header->len) {
+        header->full = true;
+    } else {
+        header->len += len;
+    }
 }
 
-// adds a header to an http header string
-void http_add_header(char ** src, const char * key, char * value) {
-    *src = realloc(*src, strlen(*src) + strlen(key) + strlen(value) + 4);
-    strcat(*src, key);
-    strcat(*src, ":");
-    strcat(*src, value);
-    strcat(*src, "\r\n");
+// starts a request header. append more headers with http_header_add().
+void http_header_begin(http_header * header, const char * method, const char * url, const char * host) {
+    header->len = 0;
+    header->full = false;
+    http_header_printf(header, "%s %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: tracer\r\n", method, url, host);
 }
 
-// generates the first line of an http header. append subsequent headers using http_add_header()
-char * http_gen_header(const char * method, const char * url) {
-    const char * fmt = "%s %s HTTP/1.0\r\n";
-    size_t len = snprintf(NULL, 0, fmt, method, url) + 1;
-    char * out = malloc(len);
-    snprintf(out, len, fmt, method, url);
-    return out;
+// adds a header
+void http_header_add(http_header * header, const char * key, const char * value) {
+    http_header_printf(header, "%s: %s\r\n", key, value);
 }
 
-// gets an http header string. be sure to free this after use!
-char * http_get_header(const char * method, const char * url, const char * server) {
-    const char * fmt = "%s %s HTTP/1.0\r\n"
-        "Host: %s\r\n"
-        "User-Agent:\r\n"
-        "\r\n";
-    size_t len = snprintf(NULL, 0, fmt, method, url, server) + 1;
-    char * out = malloc(len);
-    snprintf(out, len, fmt, method, url, server);
-
-    return out;
+// terminates a header, adding the headers that describe the body. returns false if the header didn't fit.
+bool http_header_end(http_header * header, size_t body_len) {
+    if (body_len) {
+        http_header_printf(header, "Content-Length: %u\r\nContent-Type: application/octet-stream\r\n", (unsigned)body_len);
+    }
+    http_header_printf(header, "\r\n");
+
+    if (header->full) ESP_LOGE(TAG, "http header longer than %u bytes!", HTTP_HEADER_LEN);
+    return !header->full;
 }
 
-// performs an http request at the given server and address. assumes all body data is binary.
-int http_req(const char * method, const char * server, const char * url, char * body, size_t body_len, void (*callback)(char * data, size_t head, void * user_data), void * user_data) {
+// looks up a host, using the cache when it can. numeric addresses are never looked up.
+bool http_resolve(const char * host, uint16_t port, struct sockaddr_in * addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
 
-    if (!GET_FLAG(wifi_adapter_flags, WIFI_ADAPTER_CONNECTED_FLAG) || !callback) return;
+    if (inet_aton(host, &addr->sin_addr)) return true;
+
+    uint32_t now = time(NULL);
+    _http_dns_entry * slot = &_http_dns_cache[0];
+
+    for (size_t i = 0; i < HTTP_DNS_CACHE_LEN; i++) {
+        _http_dns_entry * entry = &_http_dns_cache[i];
+
+        if (entry->host[0] != '\0' && strcmp(entry->host, host) == 0 && now < entry->expires) {
+            addr->sin_addr = entry->addr.sin_addr;
+            return true;
+        }
+        if (entry->expires < slot->expires) slot = entry;   // replace the entry closest to expiring
+    }
 
     const struct addrinfo hints = {
         .ai_family = AF_INET,
         .ai_socktype = SOCK_STREAM,
     };
-
-    struct addrinfo *res;
-    struct in_addr *addr;
-    int http_socket, bytes_read;
-    char recv_block[DATA_BLOCK_SIZE];
+    struct addrinfo * res;
 
     ESP_LOGD(TAG, "performing dns lookup");
-    int err = getaddrinfo(server, "80", &hints, &res);
+    int err = getaddrinfo(host, NULL, &hints, &res);
 
     if (err || res == NULL) {
         ESP_LOGE(TAG, "dns lookup failed with code %d", err);
-        return -1;
+        return false;
     }
 
-    ESP_LOGD(TAG, "allocating socket");
-    http_socket = socket(res->ai_family, res->ai_socktype, 0);
-    if (http_socket < 0) {
-        ESP_LOGE(TAG, "failed to allocate socket");
-        freeaddrinfo(res);
-        return -1;
+    addr->sin_addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+
+    if (strlen(host) < HTTP_HOST_LEN) {
+        strcpy(slot->host, host);
+        slot->addr = *addr;
+        slot->expires = now + HTTP_DNS_TTL_S;
     }
 
-    ESP_LOGD(TAG, "attempting socket connect");
-    if (connect(http_socket, res->ai_addr, res->ai_addrlen)) {
-        ESP_LOGE(TAG, "socket connect failed with code %d", errno);
-        close(http_socket);
-        freeaddrinfo(res);
-        return -1;
+    return true;
+}
+
+// drops a host from the dns cache, so it is looked up again next time.
+void http_forget(const char * host) {
+    for (size_t i = 0; i < HTTP_DNS_CACHE_LEN; i++) {
+        if (strcmp(_http_dns_cache[i].host, host) == 0) memset(&_http_dns_cache[i], 0, sizeof(_http_dns_entry));
     }
+}
 
-    ESP_LOGI(TAG, "connected, sending data...");
-    freeaddrinfo(res);
+void http_conn_init(http_conn * conn, const char * host, uint16_t port) {
+    memset(conn, 0, sizeof(*conn));
+    strncpy(conn->host, host, HTTP_HOST_LEN - 1);
+    conn->port = port;
+    conn->socket = -1;
+}
 
-    ESP_LOGD(TAG, "getting request string");
-    char * header_str = http_gen_header(method, url);
-    http_add_header(&header_str, "Host", server);
-    http_add_header(&header_str, "User-Agent", "");
+// like http_conn_init(), but the connection goes over tls, and the server has to have a certificate signed by ca_pem.
+// ca_pem has to stay around for as long as the connection.
+void http_conn_init_tls(http_conn * conn, const char * host, uint16_t port, const char * ca_pem) {
+    http_conn_init(conn, host, port);
+    conn->ca_pem = ca_pem;
+}
 
-    if (body_len && body) {
-        char strbuf[16];
-        sprintf(strbuf, "%u", body_len);
-        http_add_header(&header_str, "Content-Length", strbuf);
-        http_add_header(&header_str, "Content-Type", "application/octet-stream");
+// finds the cached tls session for a server, or NULL.
+_http_tls_session * _http_tls_cache_find(const char * host, uint16_t port) {
+    for (size_t i = 0; i < HTTP_TLS_CACHE_LEN; i++) {
+        _http_tls_session * entry = &_http_tls_cache[i];
+        if (entry->len > 0 && entry->port == port && strcmp(entry->host, host) == 0) return entry;
     }
+    return NULL;
+}
 
-    http_terminate_header(&header_str);
+// drops the cached tls session for a server, so the next connection to it does a full handshake.
+void http_tls_forget(const char * host, uint16_t port) {
+    _http_tls_session * entry = _http_tls_cache_find(host, port);
+    if (entry == NULL) return;
 
-    if (write(http_socket, header_str, strlen(header_str)) < 0) {
-        ESP_LOGE(TAG, "failed to send headers");
-        close(http_socket);
-        free(header_str);
-        return -1;
+    memset(entry, 0, sizeof(_http_tls_session));
+    _http_tls_cache_dirty = true;
+}
+
+// reads the tls session cache from nvs, unless it has already been read this wake. returns whether there was one.
+bool http_tls_cache_load() {
+    if (_http_tls_cache_loaded) return true;
+    _http_tls_cache_loaded = true;
+
+    size_t len = sizeof(_http_tls_cache);
+    bool ok;
+
+#ifdef ESP_PLATFORM
+    nvs_handle_t handle;
+    ok = nvs_open(HTTP_TLS_NVS_NAMESPACE, NVS_READONLY, &handle) == ESP_OK;
+    if (ok) {
+        ok = nvs_get_blob(handle, HTTP_TLS_NVS_KEY, _http_tls_cache, &len) == ESP_OK;
+        nvs_close(handle);
     }
+#else
+    FILE * file = fopen(HTTP_TLS_CACHE_FILE, "rb");
+    ok = file != NULL;
+    if (ok) {
+        len = fread(_http_tls_cache, 1, sizeof(_http_tls_cache), file);
+        fclose(file);
+    }
+#endif
 
-    free(header_str);
-    
-    if (body && body_len) {
-        if (write(http_socket, body, body_len) < 0) {
-            ESP_LOGE(TAG, "failed to send body.");
-            close(http_socket);
-            return -1;
-        }
+    if (!ok || len != sizeof(_http_tls_cache)) {    // missing, or saved by a build with a different layout
+        memset(_http_tls_cache, 0, sizeof(_http_tls_cache));
+        return false;
     }
+    return true;
+}
 
-    struct timeval recv_timeout;
-    recv_timeout.tv_sec = 5;
-    recv_timeout.tv_usec = 0;
+// writes the tls session cache to nvs, if a new session was cached since it was loaded.
+bool http_tls_cache_save() {
+    if (!_http_tls_cache_dirty) return true;
 
-    ESP_LOGD(TAG, "setting timeout");
-    if (setsockopt(http_socket, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout, sizeof(recv_timeout)) < 0) {
-        ESP_LOGE(TAG, "failed to set timeout");
-        close(http_socket);
-        return -1;
+    bool ok;
+
+#ifdef ESP_PLATFORM
+    nvs_handle_t handle;
+    ok = nvs_open(HTTP_TLS_NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK;
+    if (ok) {
+        ok = nvs_set_blob(handle, HTTP_TLS_NVS_KEY, _http_tls_cache, sizeof(_http_tls_cache)) == ESP_OK && nvs_commit(handle) == ESP_OK;
+        nvs_close(handle);
+    }
+#else
+    FILE * file = fopen(HTTP_TLS_CACHE_FILE, "wb");
+    ok = file != NULL;
+    if (ok) {
+        ok = fwrite(_http_tls_cache, 1, sizeof(_http_tls_cache), file) == sizeof(_http_tls_cache);
+        fclose(file);
     }
+#endif
 
-    ESP_LOGD(TAG, "reading from socket");
-    size_t head = 0;
-    do {
-        memset(recv_block, 0, DATA_BLOCK_SIZE);
-        bytes_read = read(http_socket, recv_block, DATA_BLOCK_SIZE);
-        callback(recv_block, bytes_read, user_data);
-        head += bytes_read;
-    } while (bytes_read > 0);
-
-    ESP_LOGD(TAG, "http GET request complete.");
-    close(http_socket);
+    if (!ok) {
+        ESP_LOGE(TAG, "couldn't save the tls session cache.");
+        return false;
+    }
+    _http_tls_cache_dirty = false;
+    return true;
+}
+
+// caches the session of a connection that has just done a full handshake.
+void _http_tls_cache_store(http_conn * conn) {
+#ifdef HTTP_TLS_SAVE_SESSIONS
+    _http_tls_session * entry = _http_tls_cache_find(conn->host, conn->port);
+    if (entry == NULL) {
+        entry = &_http_tls_cache[_http_tls_cache_next];
+        _http_tls_cache_next = (_http_tls_cache_next + 1) % HTTP_TLS_CACHE_LEN;
+    }
+
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+
+    if (strlen(conn->host) >= HTTP_HOST_LEN || mbedtls_ssl_get_session(&conn->tls->ssl, &session) != 0 ||
+        mbedtls_ssl_session_save(&session, entry->data, HTTP_TLS_SESSION_LEN, &entry->len) != 0) {
+        ESP_LOGW(TAG, "couldn't cache the tls session with %s.", conn->host);
+        entry->len = 0;
+    } else {
+        strcpy(entry->host, conn->host);
+        entry->port = conn->port;
+    }
+
+    mbedtls_ssl_session_free(&session);
+    _http_tls_cache_dirty = true;
+#endif
+}
+
+// offers the cached session for the server, if there is one, so the handshake can resume it.
+void _http_tls_cache_offer(http_conn * conn) {
+#ifdef HTTP_TLS_SAVE_SESSIONS
+    _http_tls_session * entry = _http_tls_cache_find(conn->host, conn->port);
+    if (entry == NULL) return;
+
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+
+    if (mbedtls_ssl_session_load(&session, entry->data, entry->len) != 0 || mbedtls_ssl_set_session(&conn->tls->ssl, &session) != 0) {
+        ESP_LOGW(TAG, "dropping unusable tls session with %s.", conn->host);
+        entry->len = 0;
+        _http_tls_cache_dirty = true;
+    }
+
+    mbedtls_ssl_session_free(&session);
+#endif
+}
+
+int _http_tls_send(void * ctx, const unsigned char * data, size_t len) {
+    int ret = send(*(int *)ctx, data, len, MSG_NOSIGNAL);
+    return ret < 0 ? MBEDTLS_ERR_NET_SEND_FAILED : ret;
+}
+
+int _http_tls_recv(void * ctx, unsigned char * data, size_t len) {
+    int ret = recv(*(int *)ctx, data, len, 0);
+    return ret < 0 ? MBEDTLS_ERR_NET_RECV_FAILED : ret;
+}
+
+// only called while the server's certificate chain is checked, so a handshake that never calls it was resumed.
+int _http_tls_verify(void * ctx, mbedtls_x509_crt * crt, int depth, uint32_t * flags) {
+    ((_http_tls *)ctx)->verified = true;
     return 0;
 }
 
-// performs an http request given an ip
-int http_req_ip(const char * method, const char * server, const char * url, char * body, size_t body_len, void (*callback)(char * data, size_t head, void * user_data), void * user_data) {
+void _http_tls_free(http_conn * conn) {
+    _http_tls * tls = conn->tls;
+    if (tls == NULL) return;
+
+    mbedtls_ssl_free(&tls->ssl);
+    mbedtls_ssl_config_free(&tls->conf);
+    mbedtls_x509_crt_free(&tls->ca);
+    mbedtls_ctr_drbg_free(&tls->drbg);
+    mbedtls_entropy_free(&tls->entropy);
+    free(tls);
+    conn->tls = NULL;
+}
 
-    if (!GET_FLAG(wifi_adapter_flags, WIFI_ADAPTER_CONNECTED_FLAG) || !callback) return;
+// does the tls handshake on a connection that has just connected, resuming the cached session if there is one.
+bool _http_tls_connect(http_conn * conn) {
+    _http_tls * tls = (_http_tls *)malloc(sizeof(_http_tls));
+    if (tls == NULL) {
+        ESP_LOGE(TAG, "out of memory for tls.");
+        return false;
+    }
+    conn->tls = tls;
+
+    mbedtls_ssl_init(&tls->ssl);
+    mbedtls_ssl_config_init(&tls->conf);
+    mbedtls_x509_crt_init(&tls->ca);
+    mbedtls_ctr_drbg_init(&tls->drbg);
+    mbedtls_entropy_init(&tls->entropy);
+    tls->verified = false;
+
+    int ret;
+    if ((ret = mbedtls_ctr_drbg_seed(&tls->drbg, mbedtls_entropy_func, &tls->entropy, (const unsigned char *)TAG, strlen(TAG))) != 0 ||
+        (ret = mbedtls_x509_crt_parse(&tls->ca, (const unsigned char *)conn->ca_pem, strlen(conn->ca_pem) + 1)) != 0 ||
+        (ret = mbedtls_ssl_config_defaults(&tls->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
+        ESP_LOGE(TAG, "tls setup failed with -0x%x", -ret);
+        return false;
+    }
 
-    struct sockaddr_in addr = {0};
-    int http_socket, bytes_read;
-    char recv_block[DATA_BLOCK_SIZE];
+    mbedtls_ssl_conf_authmode(&tls->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&tls->conf, &tls->ca, NULL);
+    mbedtls_ssl_conf_rng(&tls->conf, mbedtls_ctr_drbg_random, &tls->drbg);
+    mbedtls_ssl_conf_verify(&tls->conf, _http_tls_verify, tls);
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+    mbedtls_ssl_conf_session_tickets(&tls->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+
+    if ((ret = mbedtls_ssl_setup(&tls->ssl, &tls->conf)) != 0 || (ret = mbedtls_ssl_set_hostname(&tls->ssl, conn->host)) != 0) {
+        ESP_LOGE(TAG, "tls setup failed with -0x%x", -ret);
+        return false;
+    }
+    mbedtls_ssl_set_bio(&tls->ssl, &conn->socket, _http_tls_send, _http_tls_recv, NULL);
+
+    http_tls_cache_load();
+    _http_tls_cache_offer(conn);
+
+    uint32_t start = _http_now_ms();
+    do {
+        ret = mbedtls_ssl_handshake(&tls->ssl);
+    } while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+
+    conn->handshake_ms = _http_now_ms() - start;
+
+    if (ret != 0) {
+        ESP_LOGE(TAG, "tls handshake with %s failed with -0x%x", conn->host, -ret);
+        return false;
+    }
+
+    conn->resumed = !tls->verified;
+    if (!conn->resumed) _http_tls_cache_store(conn);
+
+    ESP_LOGI(TAG, "%s handshake with %s took %u ms (%s, %s).", conn->resumed ? "resumed" : "full", conn->host, conn->handshake_ms,
+        mbedtls_ssl_get_version(&tls->ssl), mbedtls_ssl_get_ciphersuite(&tls->ssl));
+    return true;
+}
+
+void http_conn_close(http_conn * conn) {
+    if (conn->socket < 0) return;
+
+    if (conn->tls) {
+        mbedtls_ssl_close_notify(&conn->tls->ssl);  // best effort, the server may be gone already
+        _http_tls_free(conn);
+    }
+
+    close(conn->socket);
+    conn->socket = -1;
+}
+
+// connects to the server, unless the connection is already open.
+bool http_conn_connect(http_conn * conn) {
+    if (conn->socket >= 0) return true;
+
+#ifdef ESP_PLATFORM
+    if (!GET_FLAG(wifi_adapter_flags, WIFI_ADAPTER_CONNECTED_FLAG)) return false;
+#endif
 
-    addr.sin_len = sizeof(addr);
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(80);
-    addr.sin_addr.s_addr = inet_addr(server);
+    struct sockaddr_in addr;
+    if (!http_resolve(conn->host, conn->port, &addr)) return false;
 
     ESP_LOGD(TAG, "allocating socket");
-    http_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
-    if (http_socket < 0) {
+    conn->socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (conn->socket < 0) {
         ESP_LOGE(TAG, "failed to allocate socket");
-        return -1;
+        return false;
     }
 
     ESP_LOGD(TAG, "attempting socket connect");
-    if (connect(http_socket, (struct sockaddr*)&addr, sizeof(addr))) {
+    if (connect(conn->socket, (struct sockaddr *)&addr, sizeof(addr))) {
         ESP_LOGE(TAG, "socket connect failed with code %d", errno);
-        close(http_socket);
-        return -1;
+        http_forget(conn->host);    // the server may have moved
+        http_conn_close(conn);
+        return false;
     }
 
-    ESP_LOGI(TAG, "connected, sending data...");
+    struct timeval timeout = { .tv_sec = HTTP_TIMEOUT_S };
+    int nodelay = 1;    // the header and body go out in one write, so there is nothing for nagle to merge
 
-    ESP_LOGD(TAG, "getting request string");
-    char * header_str = http_gen_header(method, url);
-    http_add_header(&header_str, "Host", server);
-    http_add_header(&header_str, "User-Agent", "");
+    if (setsockopt(conn->socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0 ||
+        setsockopt(conn->socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0 ||
+        setsockopt(conn->socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) < 0) {
+        ESP_LOGE(TAG, "failed to set socket options");
+        http_conn_close(conn);
+        return false;
+    }
 
-    if (body_len && body) {
-        char strbuf[16];
-        sprintf(strbuf, "%u", body_len);
-        http_add_header(&header_str, "Content-Length", strbuf);
-        http_add_header(&header_str, "Content-Type", "application/octet-stream");
+    if (conn->ca_pem && !_http_tls_connect(conn)) {
+        _http_tls_free(conn);   // the handshake never finished, so there is nothing to close_notify
+        http_conn_close(conn);
+        return false;
     }
 
-    http_terminate_header(&header_str);
+    ESP_LOGI(TAG, "connected to %s:%u.", conn->host, conn->port);
+    return true;
+}
 
-    if (write(http_socket, header_str, strlen(header_str)) < 0) {
-        ESP_LOGE(TAG, "failed to send headers");
-        close(http_socket);
-        free(header_str);
-        return -1;
-    }
+// starts a request on a connection. add headers with http_add_header(), then send it with http_send().
+void http_begin(http_conn * conn, const char * method, const char * url) {
+    http_header_begin(&conn->header, method, url, conn->host);
+}
 
-    free(header_str);
-    
-    if (body && body_len) {
-        if (write(http_socket, body, body_len) < 0) {
-            ESP_LOGE(TAG, "failed to send body.");
-            close(http_socket);
-            return -1;
-        }
-    }
+void http_add_header(http_conn * conn, const char * key, const char * value) {
+    http_header_add(&conn->header, key, value);
+}
 
-    struct timeval recv_timeout;
-    recv_timeout.tv_sec = 5;
-    recv_timeout.tv_usec = 0;
+bool _http_write_all(http_conn * conn, const char * data, size_t len) {
+    while (len > 0) {
+        int ret = conn->tls ? mbedtls_ssl_write(&conn->tls->ssl, (const unsigned char *)data, len) : send(conn->socket, data, len, MSG_NOSIGNAL);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) continue;
+        if (ret <= 0) return false;
 
-    ESP_LOGD(TAG, "setting timeout");
-    if (setsockopt(http_socket, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout, sizeof(recv_timeout)) < 0) {
-        ESP_LOGE(TAG, "failed to set timeout");
-        close(http_socket);
-        return -1;
+        data += ret;
+        len -= ret;
     }
+    return true;
+}
 
-    ESP_LOGD(TAG, "reading from socket");
-    size_t head = 0;
+// reads what has arrived on a connection, decrypting it if it is tls. returns 0 once the server has closed it, and -1
+// on an error.
+int _http_read(http_conn * conn, char * data, size_t len) {
+    if (!conn->tls) return read(conn->socket, data, len);
+
+    int ret;
     do {
-        memset(recv_block, 0, DATA_BLOCK_SIZE);
-        bytes_read = read(http_socket, recv_block, DATA_BLOCK_SIZE);
-        callback(recv_block, bytes_read, user_data);
-        head += bytes_read;
-    } while (bytes_read > 0);
-
-    ESP_LOGD(TAG, "http GET request complete.");
-    close(http_socket);
-    return 0;
+        ret = mbedtls_ssl_read(&conn->tls->ssl, (unsigned char *)data, len);
+    } while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+
+    if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) return 0;
+    return ret < 0 ? -1 : ret;
 }
 
-// performs an https transaction at the given server
-int https_req(const char * method, const char * server, const char * url, char * body, size_t body_len, void * pem_cert, void (*callback)(char data[DATA_BLOCK_SIZE], size_t length, void * user_data), void * user_data) {
-    char recv_buf[DATA_BLOCK_SIZE];
-    int ret, len;
+// reads a response through the connection's buffer. returns its status code, or -1 if it couldn't be read. sets
+// answered once anything at all was read.
+int _http_read_response(http_conn * conn, bool head, http_body_cb callback, void * user_data, bool * answered) {
+    char * data = conn->header.data;
+    http_parser parser;
+    http_parser_init(&parser, head);
 
-    esp_tls_cfg_t tls_cfg = {
-        .cacert_pem_buf =   (const unsigned char*)pem_cert,
-        .cacert_pem_bytes = strlen((const char *)pem_cert)+1,
-    };
+    while (!http_parser_done(&parser)) {
+        int ret = _http_read(conn, data, HTTP_HEADER_LEN);
+        if (ret < 0) break;
 
-    struct esp_tls * tls = esp_tls_conn_http_new(url, &tls_cfg);
+        if (ret == 0) {
+            http_parser_finish(&parser);
+            break;
+        }
+        *answered = true;
 
-    if (!tls) {
-        ESP_LOGE(TAG, "https connection to %s failed.", url);
-        goto https_get_free;
-    }
+        size_t used = 0;
+        while (used < (size_t)ret && !http_parser_done(&parser) && !http_parser_failed(&parser)) {
+            const char * body;
+            size_t body_len;
 
+            used += http_parser_feed(&parser, data + used, ret - used, &body, &body_len);
+            if (body_len > 0) callback((char *)body, body_len, user_data);
+        }
 
-    char * header_str = http_gen_header(method, url);
-    http_add_header(&header_str, "Host", server);
-    http_add_header(&header_str, "User-Agent", "");
+        if (http_parser_failed(&parser)) break;
+        if (used < (size_t)ret) parser.keep_alive = false;  // the server sent more than it said, so its next response can't be trusted
+    }
 
-    if (body_len && body) {
-        char strbuf[16];
-        sprintf(strbuf, "%u", body_len);
-        http_add_header(&header_str, "Content-Length", strbuf);
-        http_add_header(&header_str, "Content-Type", "application/octet-stream");
+    if (!http_parser_done(&parser)) {
+        ESP_LOGE(TAG, "http response from %s cut short or malformed.", conn->host);
+        return -1;
     }
 
-    http_terminate_header(&header_str);
+    callback(data, 0, user_data);
+
+    if (!parser.keep_alive) http_conn_close(conn);
+    return parser.status;
+}
 
-    size_t bytes_written = 0, header_len = strlen(header_str);
+// checks whether the server has closed a kept-alive connection while it sat idle. a tls server sends a close_notify
+// before it closes, so any bytes waiting on an idle connection mean the same.
+bool _http_conn_alive(http_conn * conn) {
+    char c;
+    int ret = recv(conn->socket, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
 
-    ESP_LOGD(TAG, "http header: %s", header_str);
+// sends the request started with http_begin(), along with a body if there is one, and reads the response. the body
+// of the response is given to the callback. returns the status code of the response, or -1 if the request failed.
+int http_send(http_conn * conn, const char * body, size_t body_len, http_body_cb callback, void * user_data) {
+    http_header * header = &conn->header;
+    bool head = strncmp(header->data, "HEAD ", 5) == 0;
 
-    do {
-        ret = esp_tls_conn_write(tls, header_str + bytes_written, header_len - bytes_written);
-
-        if (ret >= 0) {
-            ESP_LOGI(TAG, "wrote %d bytes (header)", ret);
-            bytes_written += ret;
-        } else if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
-            ESP_LOGE(TAG, "tls write error 0x%x", ret);
-            goto https_get_free;
-        }
+    if (!http_header_end(header, body_len)) return -1;
 
-    } while (bytes_written < header_len);
+    // a server can close a kept-alive connection whenever it likes
+    if (conn->socket >= 0 && !_http_conn_alive(conn)) {
+        ESP_LOGD(TAG, "kept-alive connection was closed, reconnecting");
+        http_conn_close(conn);
+    }
+
+    // small bodies go out in the same segment as the header
+    size_t len = header->len;
+    if (body_len && body_len <= HTTP_HEADER_LEN - len) {
+        memcpy(header->data + len, body, body_len);
+        len += body_len;
+        body_len = 0;
+    }
 
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused = conn->socket >= 0, answered = false;
+        if (!http_conn_connect(conn)) return -1;
 
-    if (body && body_len) {
-        bytes_written = 0;
+        int status = -1;
+        if (_http_write_all(conn, header->data, len) && (!body_len || _http_write_all(conn, body, body_len))) {
+            status = _http_read_response(conn, head, callback, user_data, &answered);
+        }
 
-        do {
-            ret = esp_tls_conn_write(tls, body + bytes_written, body_len - bytes_written);
+        if (status >= 0) return status;
 
-            if (ret >= 0) {
-                ESP_LOGI(TAG, "wrote %d bytes (body)", ret);
-                bytes_written += ret;
-            } else if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
-                ESP_LOGE(TAG, "tls write error 0x%x", ret);
-                goto https_get_free;
-            }
+        http_conn_close(conn);
 
-        } while (bytes_written < body_len);
+        // the server closed a kept-alive connection just as the request went out. nothing of the request was read back
+        // into the buffer, so it can be sent again as it is. a request on a new connection is never sent twice, since
+        // the server may have acted on it.
+        if (!reused || answered) break;
+        ESP_LOGD(TAG, "kept-alive connection was closed, sending again");
     }
 
-    do {
-        len = DATA_BLOCK_SIZE;
-        memset(recv_buf, 0, DATA_BLOCK_SIZE);
-        
-        ret = esp_tls_conn_read(tls, recv_buf, len);
+    ESP_LOGE(TAG, "http request to %s failed.", conn->host);
+    return -1;
+}
 
-        if (ret == MBEDTLS_ERR_SSL_WANT_WRITE || ret == MBEDTLS_ERR_SSL_WANT_READ) continue;
+http_conn _https_pool[HTTPS_POOL_LEN];
+size_t _https_pool_next;    // the connection replaced when a new server is connected to
 
-        if (ret < 0) {
-            ESP_LOGE(TAG, "tls read error -0x%x", -ret);
-            break;
-        }
-        if (ret == 0) {
-            ESP_LOGI(TAG, "tls connection closed.");
-            break;
-        }
-        
-        callback(recv_buf, ret, user_data);
-    } while (true);
+// performs an https request to a server, checking it against pem_cert. the connection is kept open in a pool, so more
+// requests to the same server reuse it, and the tls session is cached, so reconnecting is quick. the body of the
+// response is given to the callback, which is called once more with a length of 0 when it is over. returns the status
+// code of the response, or -1 if the request failed.
+int https_req(const char * method, const char * server, const char * url, char * body, size_t body_len, const char * pem_cert, http_body_cb callback, void * user_data) {
+    http_conn * conn = NULL;
 
+    for (size_t i = 0; i < HTTPS_POOL_LEN && conn == NULL; i++) {
+        if (strcmp(_https_pool[i].host, server) == 0 && _https_pool[i].ca_pem == pem_cert) conn = &_https_pool[i];
+    }
 
-https_get_free:
-    free(header_str);
-    esp_tls_conn_delete(tls);
-    return -1;
+    if (conn == NULL) {
+        conn = &_https_pool[_https_pool_next];
+        _https_pool_next = (_https_pool_next + 1) % HTTPS_POOL_LEN;
+
+        if (conn->host[0] != '\0') http_conn_close(conn);
+        http_conn_init_tls(conn, server, HTTPS_PORT, pem_cert);
+    }
+
+    http_begin(conn, method, url);
+    return http_send(conn, body, body_len, callback, user_data);
+}
+
+// closes the connections https_req() has kept open, and saves the tls session cache.
+void https_close_all() {
+    for (size_t i = 0; i < HTTPS_POOL_LEN; i++) {
+        if (_https_pool[i].host[0] != '\0') http_conn_close(&_https_pool[i]);
+    }
+    http_tls_cache_save();
 }
 
 #undef TAG
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,199 @@
+#include "stdint.h"
+#include "stddef.h"
+#include "stdbool.h"
+#include "string.h"
+#include "strings.h"
+#include "stdlib.h"
+#include "stdio.h"
+
+// an incremental http/1.x response parser. the response is fed in as it arrives, in pieces of any size, and the body
+// comes back out as spans of the pieces it was fed, so it is never copied. understands bodies with a Content-Length,
+// chunked bodies, and bodies that run until the server closes the connection.
+// the header is read a line at a time with memchr(), and only the lines the parser cares about are looked at.
+
+#ifndef _HTTP_PARSER_H_
+#define _HTTP_PARSER_H_
+
+#define HTTP_PARSER_LINE_LEN    128     // header lines longer than this are cut short, which leaves enough of the ones read here
+
+typedef enum {
+    HTTP_PARSER_STATUS,         // reading the status line
+    HTTP_PARSER_HEADER,         // reading header lines
+    HTTP_PARSER_BODY,           // in a body that isn't chunked
+    HTTP_PARSER_CHUNK_SIZE,     // reading the line before a chunk
+    HTTP_PARSER_CHUNK_DATA,     // in a chunk
+    HTTP_PARSER_CHUNK_END,      // reading the line break after a chunk
+    HTTP_PARSER_TRAILER,        // reading the header lines after the last chunk
+    HTTP_PARSER_DONE,
+    HTTP_PARSER_ERROR,
+} http_parser_state;
+
+typedef struct {
+    http_parser_state state;
+    int status;             // the status code, once the status line has been read
+    bool head;              // whether the response is to a HEAD request, which never has a body
+    bool keep_alive;        // whether the connection can be used again afterwards
+    bool chunked;
+    bool has_len;           // whether the body has a Content-Length. if it isn't chunked either, it runs until the connection closes.
+    size_t body_len;        // the Content-Length
+    size_t remaining;       // the bytes left in the body or the current chunk
+    char line[HTTP_PARSER_LINE_LEN];
+    size_t line_len;
+} http_parser;
+
+void http_parser_init(http_parser * parser, bool head) {
+    memset(parser, 0, sizeof(*parser));
+    parser->state = HTTP_PARSER_STATUS;
+    parser->head = head;
+}
+
+bool http_parser_done(const http_parser * parser) {
+    return parser->state == HTTP_PARSER_DONE;
+}
+
+bool http_parser_failed(const http_parser * parser) {
+    return parser->state == HTTP_PARSER_ERROR;
+}
+
+// reads up to the end of a line into the line buffer. returns whether the line is whole, and sets used to the number
+// of bytes used up.
+bool _http_parser_read_line(http_parser * parser, const char * data, size_t len, size_t * used) {
+    const char * end = (const char *)memchr(data, '\n', len);
+    size_t line_len = end ? (size_t)(end - data) : len;
+    size_t copy = line_len < HTTP_PARSER_LINE_LEN - 1 - parser->line_len ? line_len : HTTP_PARSER_LINE_LEN - 1 - parser->line_len;
+
+    memcpy(parser->line + parser->line_len, data, copy);
+    parser->line_len += copy;
+    *used = end ? line_len + 1 : len;
+
+    if (!end) return false;
+
+    if (parser->line_len > 0 && parser->line[parser->line_len - 1] == '\r') parser->line_len--;
+    parser->line[parser->line_len] = '\0';
+    return true;
+}
+
+// compares a header line's name, and returns its value, or NULL if the name doesn't match.
+const char * _http_parser_header_value(const char * line, const char * name) {
+    size_t name_len = strlen(name);
+    if (strncasecmp(line, name, name_len) != 0 || line[name_len] != ':') return NULL;
+
+    const char * value = line + name_len + 1;
+    while (*value == ' ' || *value == '\t') value++;
+    return value;
+}
+
+// picks how the body is read once the header is over.
+void _http_parser_begin_body(http_parser * parser) {
+    if (parser->status >= 100 && parser->status < 200) {
+        parser->state = HTTP_PARSER_STATUS;     // an interim response, so the real one follows
+        parser->has_len = parser->chunked = false;
+    } else if (parser->head || parser->status == 204 || parser->status == 304) {
+        parser->state = HTTP_PARSER_DONE;
+    } else if (parser->chunked) {
+        parser->state = HTTP_PARSER_CHUNK_SIZE;
+    } else if (parser->has_len) {
+        parser->remaining = parser->body_len;
+        parser->state = parser->remaining ? HTTP_PARSER_BODY : HTTP_PARSER_DONE;
+    } else {
+        parser->remaining = SIZE_MAX;
+        parser->keep_alive = false;
+        parser->state = HTTP_PARSER_BODY;
+    }
+}
+
+// handles a whole line, in any of the states that read lines.
+void _http_parser_line(http_parser * parser) {
+    const char * line = parser->line;
+    const char * value;
+    int minor;
+
+    switch (parser->state) {
+        case HTTP_PARSER_STATUS:
+            if (sscanf(line, "HTTP/1.%d %d", &minor, &parser->status) != 2) {
+                parser->state = HTTP_PARSER_ERROR;
+                break;
+            }
+            parser->keep_alive = minor >= 1;    // http/1.0 closes after every response unless the server says otherwise
+            parser->state = HTTP_PARSER_HEADER;
+            break;
+
+        case HTTP_PARSER_HEADER:
+            if (line[0] == '\0') {
+                _http_parser_begin_body(parser);
+            } else if ((value = _http_parser_header_value(line, "content-length"))) {
+                parser->body_len = strtoul(value, NULL, 10);
+                parser->has_len = true;
+            } else if ((value = _http_parser_header_value(line, "transfer-encoding"))) {
+                size_t value_len = strlen(value);
+                parser->chunked = value_len >= 7 && strncasecmp(value + value_len - 7, "chunked", 7) == 0;
+            } else if ((value = _http_parser_header_value(line, "connection"))) {
+                if (strncasecmp(value, "close", 5) == 0) parser->keep_alive = false;
+                if (strncasecmp(value, "keep-alive", 10) == 0) parser->keep_alive = true;
+            }
+            break;
+
+        case HTTP_PARSER_CHUNK_SIZE: {
+            char * end;
+            parser->remaining = strtoul(line, &end, 16);
+
+            if (end == line) {
+                parser->state = HTTP_PARSER_ERROR;
+            } else {
+                parser->state = parser->remaining ? HTTP_PARSER_CHUNK_DATA : HTTP_PARSER_TRAILER;
+            }
+            break;
+        }
+
+        case HTTP_PARSER_CHUNK_END:
+            parser->state = line[0] == '\0' ? HTTP_PARSER_CHUNK_SIZE : HTTP_PARSER_ERROR;
+            break;
+
+        case HTTP_PARSER_TRAILER:
+            if (line[0] == '\0') parser->state = HTTP_PARSER_DONE;
+            break;
+
+        default:
+            break;
+    }
+
+    parser->line_len = 0;
+}
+
+// feeds the parser the next piece of a response. stops after the first span of body, and sets body and body_len to it.
+// returns the number of bytes used up, so call it again with what is left until it has all been used, or the parser
+// is done or has failed. bytes after the end of the response are left unused.
+size_t http_parser_feed(http_parser * parser, const char * data, size_t len, const char ** body, size_t * body_len) {
+    size_t used = 0;
+    *body_len = 0;
+
+    while (used < len && parser->state != HTTP_PARSER_DONE && parser->state != HTTP_PARSER_ERROR) {
+        if (parser->state == HTTP_PARSER_BODY || parser->state == HTTP_PARSER_CHUNK_DATA) {
+            size_t span = len - used < parser->remaining ? len - used : parser->remaining;
+
+            *body = data + used;
+            *body_len = span;
+            parser->remaining -= span;
+
+            if (parser->remaining == 0) parser->state = parser->state == HTTP_PARSER_BODY ? HTTP_PARSER_DONE : HTTP_PARSER_CHUNK_END;
+            return used + span;
+        }
+
+        size_t line_used;
+        if (_http_parser_read_line(parser, data + used, len - used, &line_used)) _http_parser_line(parser);
+        used += line_used;
+    }
+
+    return used;
+}
+
+// tells the parser the connection has closed. returns whether the response was whole, which it is if it was done, or
+// if its body ran until the connection closed.
+bool http_parser_finish(http_parser * parser) {
+    if (parser->state == HTTP_PARSER_BODY && !parser->has_len) parser->state = HTTP_PARSER_DONE;
+    if (parser->state != HTTP_PARSER_DONE) parser->state = HTTP_PARSER_ERROR;
+
+    return parser->state == HTTP_PARSER_DONE;
+}
+
+#endif
@@ -0,0 +1,103 @@
+#include "stdint.h"
+#include "stddef.h"
+#include "stdbool.h"
+#include "string.h"
+
+// encodes the epochs in the matchfile for the /matches endpoint. epochs outside of [since, until) are skipped.
+// two formats are supported:
+//  - raw: every epoch as a little-endian uint32, the same bytes as the matchfile.
+//  - delta: every epoch as the zigzag-encoded difference from the one before it (starting from 0), in a little-endian
+//    base-128 varint. matches are written a run at a time, so most take 1 or 2 bytes instead of 4.
+// encoding works a buffer at a time and keeps its place between calls, so the matchfile can be streamed through it.
+
+#ifndef _MATCH_EXPORT_H_
+#define _MATCH_EXPORT_H_
+
+#define MATCH_EXPORT_MAX_ITEM_LEN   5   // the longest an encoded epoch can be, a 32-bit varint
+
+typedef enum {
+    MATCH_EXPORT_RAW,
+    MATCH_EXPORT_DELTA,
+} match_export_format;
+
+typedef struct {
+    uint32_t since;         // the first epoch to send
+    uint32_t until;         // the first epoch not to send
+    match_export_format format;
+    uint32_t prev;          // the last epoch encoded, which the next delta is taken from
+    size_t sent;            // the number of epochs encoded so far
+} match_export;
+
+void match_export_init(match_export * ex, uint32_t since, uint32_t until, match_export_format format) {
+    ex->since = since;
+    ex->until = until;
+    ex->format = format;
+    ex->prev = 0;
+    ex->sent = 0;
+}
+
+// parses a format name, leaving format untouched if it isn't one.
+bool match_export_parse_format(const char * name, match_export_format * format) {
+    if (strcmp(name, "raw") == 0) {
+        *format = MATCH_EXPORT_RAW;
+    } else if (strcmp(name, "delta") == 0) {
+        *format = MATCH_EXPORT_DELTA;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// encodes epochs into out until either runs out. returns the number of bytes written, and sets consumed to the number of
+// epochs used up, including the ones that were filtered out.
+size_t match_export_encode(match_export * ex, const uint32_t * epochs, size_t len, uint8_t * out, size_t out_len, size_t * consumed) {
+    size_t written = 0, i = 0;
+
+    for (; i < len && written + MATCH_EXPORT_MAX_ITEM_LEN <= out_len; i++) {
+        uint32_t epoch = epochs[i];
+        if (epoch < ex->since || epoch >= ex->until) continue;
+
+        if (ex->format == MATCH_EXPORT_RAW) {
+            for (size_t k = 0; k < sizeof(uint32_t); k++) out[written++] = epoch >> (8 * k);
+        } else {
+            int32_t delta = (int32_t)(epoch - ex->prev);
+            uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+
+            do {
+                out[written++] = (zigzag & 0x7f) | (zigzag > 0x7f ? 0x80 : 0);
+                zigzag >>= 7;
+            } while (zigzag);
+        }
+
+        ex->prev = epoch;
+        ex->sent++;
+    }
+
+    *consumed = i;
+    return written;
+}
+
+// decodes a delta-encoded response into out, for clients. prev carries the last epoch between calls, and starts at 0.
+// returns the number of epochs decoded, and sets used to the number of bytes used up. a varint cut off at the end of
+// data is left for the next call.
+size_t match_export_decode_delta(uint32_t * prev, const uint8_t * data, size_t len, uint32_t * out, size_t out_len, size_t * used) {
+    size_t decoded = 0, offset = 0;
+
+    while (decoded < out_len) {
+        uint32_t zigzag = 0;
+        size_t shift = 0, end = offset;
+
+        while (end < len && (data[end] & 0x80) && shift < 28) zigzag |= (uint32_t)(data[end++] & 0x7f) << shift, shift += 7;
+        if (end == len) break;
+        zigzag |= (uint32_t)(data[end++] & 0x7f) << shift;
+
+        *prev += (uint32_t)((zigzag >> 1) ^ -(zigzag & 1));
+        out[decoded++] = *prev;
+        offset = end;
+    }
+
+    *used = offset;
+    return decoded;
+}
+
+#endif
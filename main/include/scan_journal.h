@@ -0,0 +1,357 @@
+#include "tracer.h"
+
+#include "crc32.h"
+#include "file_store.h"
+
+// an append-only scan journal. sightings are appended to one segment file per day, in blocks headed by the scan interval
+// number they were written in. a small manifest lists the segments, so nothing has to walk the directory, and expiring
+// a day of scans is a single file removal. blocks can be gathered in a buffer first, so flash sees a few large writes
+// instead of one small write per scan.
+// goes through a file_store, so the same code runs against spiffs or littlefs on the device, and against a directory or
+// a ram disk on a host.
+
+#ifndef _SCAN_JOURNAL_H_
+#define _SCAN_JOURNAL_H_
+
+#define SCAN_JOURNAL_MAGIC          0x4a435354  // "TSCJ", starts every block and the manifest
+#define SCAN_JOURNAL_MANIFEST_NAME  "manifest"
+#define SCAN_JOURNAL_SEGMENT_PREFIX "seg_"      // followed by the day number in decimal
+#define SCAN_JOURNAL_MAX_DAYS       (TRACER_SCAN_STORE_PERIOD + 2)  // every stored day, plus today and a day of slack for clock jumps
+#define SCAN_JOURNAL_NAME_LEN       16
+#define SCAN_JOURNAL_SCANINS_PER_DAY    (TRACER_MINUTES_PER_DAY / TRACER_SCAN_INTERVAL)
+
+#define SCAN_JOURNAL_PAGE_DATA_LEN  251     // the data in one spiffs page (256 bytes, less the 5 byte page header)
+#define SCAN_JOURNAL_BUFFER_LEN     (12 * SCAN_JOURNAL_PAGE_DATA_LEN)
+#define SCAN_JOURNAL_FLUSH_LEN      (8 * SCAN_JOURNAL_PAGE_DATA_LEN)   // flush once this much is buffered, so only the last page of a flush is partial
+#define SCAN_JOURNAL_FLUSH_AGE      (30 * 60)   // flush once the oldest buffered block is this many seconds old, bounding what a power loss can take
+
+// the header of a block of sightings in a segment. the sightings follow it directly.
+typedef struct {
+    uint32_t magic;     // SCAN_JOURNAL_MAGIC
+    uint32_t scanin;    // the scan interval number the sightings were written in
+    uint32_t len;       // the number of sightings in the block
+} scan_journal_block;
+
+// the persisted list of segments, oldest first.
+typedef struct {
+    uint32_t magic;
+    uint32_t len;
+    uint32_t days[SCAN_JOURNAL_MAX_DAYS];
+} scan_journal_manifest;
+
+typedef struct {
+    file_store * store;     // where the journal lives
+    scan_journal_manifest manifest;
+} scan_journal;
+
+// blocks waiting to be written to the journal. can be placed in memory that survives a reset, and checked with
+// scan_journal_buffer_valid() after it.
+typedef struct {
+    uint32_t magic;         // SCAN_JOURNAL_MAGIC
+    uint32_t len;           // the number of bytes of blocks in data
+    uint32_t first_epoch;   // when the oldest buffered block was added
+    uint32_t crc;           // the crc32 of data
+    uint8_t data[SCAN_JOURNAL_BUFFER_LEN];
+} scan_journal_buffer;
+
+// reads sightings out of a journal, oldest first.
+typedef struct {
+    const scan_journal * journal;
+    FILE * segment;             // the open segment, or NULL between segments
+    size_t day_index;           // the manifest entry of the next segment to open
+    uint32_t min_scanin;        // blocks written before this are skipped
+    scan_journal_block block;   // the current block
+    uint32_t block_left;        // the number of sightings left in the current block
+} scan_journal_reader;
+
+// gets the day a scan interval number falls on.
+uint32_t scan_journal_scanin2day(uint32_t scanin) {
+    return scanin / SCAN_JOURNAL_SCANINS_PER_DAY;
+}
+
+// writes the name of the segment of a day into out.
+void _scan_journal_segment_name(uint32_t day, char out[SCAN_JOURNAL_NAME_LEN]) {
+    snprintf(out, SCAN_JOURNAL_NAME_LEN, SCAN_JOURNAL_SEGMENT_PREFIX "%u", day);
+}
+
+// writes the manifest back to the journal.
+bool _scan_journal_save(const scan_journal * journal) {
+    FILE * file = file_store_open(journal->store, SCAN_JOURNAL_MANIFEST_NAME, "w");
+    if (file == NULL) return false;
+
+    size_t len = sizeof(journal->manifest) - sizeof(journal->manifest.days) + journal->manifest.len * sizeof(uint32_t);
+    bool ok = fwrite(&journal->manifest, len, 1, file) == 1;
+
+    return (fclose(file) == 0) && ok;
+}
+
+// opens the journal in a store, creating an empty one if there is no manifest.
+bool scan_journal_init(scan_journal * journal, file_store * store) {
+    journal->store = store;
+    memset(&journal->manifest, 0, sizeof(journal->manifest));
+
+    FILE * file = file_store_open(store, SCAN_JOURNAL_MANIFEST_NAME, "r");
+    if (file) {
+        size_t read_len = fread(&journal->manifest, 1, sizeof(journal->manifest), file);
+        fclose(file);
+
+        size_t header_len = sizeof(journal->manifest) - sizeof(journal->manifest.days);
+        if (read_len >= header_len && journal->manifest.magic == SCAN_JOURNAL_MAGIC
+            && journal->manifest.len <= SCAN_JOURNAL_MAX_DAYS && read_len == header_len + journal->manifest.len * sizeof(uint32_t)) {
+            return true;
+        }
+    }
+
+    // no manifest, or a corrupt one. the segments it listed are lost to the journal and have to be erased with the partition.
+    memset(&journal->manifest, 0, sizeof(journal->manifest));
+    journal->manifest.magic = SCAN_JOURNAL_MAGIC;
+
+    return _scan_journal_save(journal);
+}
+
+// makes sure a day is in the manifest, keeping it sorted. returns false if the manifest is full of newer days.
+bool _scan_journal_add_day(scan_journal * journal, uint32_t day) {
+    scan_journal_manifest * m = &journal->manifest;
+
+    if (m->len > 0 && m->days[m->len - 1] == day) return true;     // the usual case: still the same day
+
+    size_t i = m->len;
+    while (i > 0 && m->days[i - 1] > day) i--;
+    if (i > 0 && m->days[i - 1] == day) return true;
+
+    if (m->len == SCAN_JOURNAL_MAX_DAYS) {
+        if (i == 0) return false;   // older than everything stored
+
+        char name[SCAN_JOURNAL_NAME_LEN];       // the oldest day has to go
+        _scan_journal_segment_name(m->days[0], name);
+        file_store_remove(journal->store, name);
+
+        memmove(m->days, m->days + 1, --m->len * sizeof(uint32_t));
+        i--;
+    }
+
+    memmove(m->days + i + 1, m->days + i, (m->len - i) * sizeof(uint32_t));
+    m->days[i] = day;
+    m->len++;
+
+    return _scan_journal_save(journal);
+}
+
+// appends whole blocks to the segment of a day, in a single write.
+bool _scan_journal_append_raw(scan_journal * journal, uint32_t day, const void * blocks, size_t len) {
+    if (!_scan_journal_add_day(journal, day)) return false;
+
+    char name[SCAN_JOURNAL_NAME_LEN];
+    _scan_journal_segment_name(day, name);
+
+    FILE * file = file_store_open(journal->store, name, "a");
+    if (file == NULL) return false;
+
+    bool ok = fwrite(blocks, 1, len, file) == len;
+
+    return (fclose(file) == 0) && ok;
+}
+
+// appends a block of sightings to the segment of the day the scan interval number falls on.
+bool scan_journal_append(scan_journal * journal, uint32_t scanin, const tracer_sighting * sightings, size_t len) {
+    if (len == 0) return true;
+
+    uint32_t day = scan_journal_scanin2day(scanin);
+    if (!_scan_journal_add_day(journal, day)) return false;
+
+    char name[SCAN_JOURNAL_NAME_LEN];
+    _scan_journal_segment_name(day, name);
+
+    FILE * file = file_store_open(journal->store, name, "a");
+    if (file == NULL) return false;
+
+    scan_journal_block block = { SCAN_JOURNAL_MAGIC, scanin, len };
+    bool ok = fwrite(&block, sizeof(block), 1, file) == 1 && fwrite(sightings, sizeof(tracer_sighting), len, file) == len;
+
+    return (fclose(file) == 0) && ok;
+}
+
+// empties a buffer.
+void scan_journal_buffer_reset(scan_journal_buffer * buffer) {
+    buffer->magic = SCAN_JOURNAL_MAGIC;
+    buffer->len = 0;
+    buffer->first_epoch = 0;
+    buffer->crc = 0;
+}
+
+// checks if a buffer holds intact blocks, as it should after a reset if it was kept in memory that survives one.
+bool scan_journal_buffer_valid(const scan_journal_buffer * buffer) {
+    return buffer->magic == SCAN_JOURNAL_MAGIC && buffer->len <= sizeof(buffer->data) && crc32_update(0, buffer->data, buffer->len) == buffer->crc;
+}
+
+// drops the first len bytes of blocks from a buffer, keeping the rest.
+void _scan_journal_buffer_consume(scan_journal_buffer * buffer, size_t len) {
+    buffer->len -= len;
+    memmove(buffer->data, buffer->data + len, buffer->len);
+    buffer->crc = crc32_update(0, buffer->data, buffer->len);
+    if (buffer->len == 0) buffer->first_epoch = 0;
+}
+
+// writes every buffered block to the journal, one write per day, and empties the buffer. if a write fails, the blocks
+// from that day on are kept in the buffer for the next flush.
+bool scan_journal_buffer_flush(scan_journal * journal, scan_journal_buffer * buffer) {
+    size_t run_start = 0, offset = 0;
+    uint32_t run_day = 0;
+
+    while (offset + sizeof(scan_journal_block) <= buffer->len) {
+        scan_journal_block block;
+        memcpy(&block, buffer->data + offset, sizeof(block));
+
+        uint32_t day = scan_journal_scanin2day(block.scanin);
+        if (offset > run_start && day != run_day) {
+            if (!_scan_journal_append_raw(journal, run_day, buffer->data + run_start, offset - run_start)) {
+                _scan_journal_buffer_consume(buffer, run_start);
+                return false;
+            }
+            run_start = offset;
+        }
+
+        run_day = day;
+        offset += sizeof(block) + block.len * sizeof(tracer_sighting);
+    }
+
+    if (offset > run_start && !_scan_journal_append_raw(journal, run_day, buffer->data + run_start, buffer->len - run_start)) {
+        _scan_journal_buffer_consume(buffer, run_start);
+        return false;
+    }
+
+    scan_journal_buffer_reset(buffer);
+    return true;
+}
+
+// checks if a buffer should be flushed, because it is big enough to fill whole pages or its oldest block is too old.
+bool scan_journal_buffer_due(const scan_journal_buffer * buffer, uint32_t epoch) {
+    return buffer->len >= SCAN_JOURNAL_FLUSH_LEN || (buffer->len > 0 && epoch - buffer->first_epoch >= SCAN_JOURNAL_FLUSH_AGE);
+}
+
+// adds a block of sightings to a buffer, flushing it first if the block doesn't fit. blocks that still don't fit go straight to the journal.
+bool scan_journal_buffer_append(scan_journal * journal, scan_journal_buffer * buffer, uint32_t scanin, const tracer_sighting * sightings, size_t len, uint32_t epoch) {
+    if (len == 0) return true;
+
+    size_t block_len = sizeof(scan_journal_block) + len * sizeof(tracer_sighting);
+    bool ok = true;
+
+    if (buffer->len + block_len > sizeof(buffer->data)) ok = scan_journal_buffer_flush(journal, buffer);
+    if (buffer->len + block_len > sizeof(buffer->data)) return scan_journal_append(journal, scanin, sightings, len) && ok;   // too big, or the flush failed
+
+    scan_journal_block block = { SCAN_JOURNAL_MAGIC, scanin, len };
+    uint8_t * out = buffer->data + buffer->len;
+    memcpy(out, &block, sizeof(block));
+    memcpy(out + sizeof(block), sightings, len * sizeof(tracer_sighting));
+
+    if (buffer->len == 0) buffer->first_epoch = epoch;
+    buffer->crc = crc32_update(buffer->crc, out, block_len);
+    buffer->len += block_len;   // only count the block once the crc covers it
+
+    return ok;
+}
+
+// removes every segment from before min_day. returns the number of segments removed.
+size_t scan_journal_expire(scan_journal * journal, uint32_t min_day) {
+    scan_journal_manifest * m = &journal->manifest;
+    size_t expired = 0;
+
+    while (expired < m->len && m->days[expired] < min_day) {
+        char name[SCAN_JOURNAL_NAME_LEN];
+        _scan_journal_segment_name(m->days[expired], name);
+        file_store_remove(journal->store, name);
+        expired++;
+    }
+
+    if (expired > 0) {
+        m->len -= expired;
+        memmove(m->days, m->days + expired, m->len * sizeof(uint32_t));
+        _scan_journal_save(journal);
+    }
+
+    return expired;
+}
+
+// starts reading the sightings written in or after min_scanin. whole days before it are skipped using the manifest.
+void scan_journal_reader_open(scan_journal_reader * reader, const scan_journal * journal, uint32_t min_scanin) {
+    memset(reader, 0, sizeof(*reader));
+    reader->journal = journal;
+    reader->min_scanin = min_scanin;
+
+    uint32_t min_day = scan_journal_scanin2day(min_scanin);
+    while (reader->day_index < journal->manifest.len && journal->manifest.days[reader->day_index] < min_day) reader->day_index++;
+}
+
+// moves on to the next block that has sightings left. returns false once there are no more.
+bool _scan_journal_next_block(scan_journal_reader * reader) {
+    while (reader->block_left == 0) {
+        if (reader->segment == NULL) {
+            if (reader->day_index == reader->journal->manifest.len) return false;
+
+            char name[SCAN_JOURNAL_NAME_LEN];
+            _scan_journal_segment_name(reader->journal->manifest.days[reader->day_index++], name);
+            reader->segment = file_store_open(reader->journal->store, name, "r");
+            continue;
+        }
+
+        // a missing header or a bad magic means the end of the segment, or a block torn by a reset
+        if (fread(&reader->block, sizeof(reader->block), 1, reader->segment) != 1 || reader->block.magic != SCAN_JOURNAL_MAGIC) {
+            fclose(reader->segment);
+            reader->segment = NULL;
+        } else if (reader->block.scanin < reader->min_scanin) {
+            fseek(reader->segment, reader->block.len * sizeof(tracer_sighting), SEEK_CUR);     // the block headers double as an index
+        } else {
+            reader->block_left = reader->block.len;
+        }
+    }
+
+    return true;
+}
+
+// reads up to max sightings from one block into buffer with a single read, so the vfs is crossed once per run instead
+// of once per sighting. returns the number read, and 0 once there are no more.
+size_t scan_journal_read_run(scan_journal_reader * reader, tracer_sighting * buffer, size_t max, uint32_t * scanin) {
+    while (_scan_journal_next_block(reader)) {
+        size_t want = reader->block_left < max ? reader->block_left : max;
+        size_t len = fread(buffer, sizeof(tracer_sighting), want, reader->segment);
+
+        // a block cut short by a reset ends its segment
+        reader->block_left = len < want ? 0 : reader->block_left - len;
+
+        if (len == 0) {
+            fclose(reader->segment);
+            reader->segment = NULL;
+            continue;
+        }
+
+        if (scanin) *scanin = reader->block.scanin;
+        return len;
+    }
+
+    return 0;
+}
+
+// reads the next sighting. returns false once there are no more.
+bool scan_journal_read(scan_journal_reader * reader, tracer_sighting * sighting, uint32_t * scanin) {
+    if (!_scan_journal_next_block(reader)) return false;
+
+    if (fread(sighting, sizeof(tracer_sighting), 1, reader->segment) != 1) {
+        fclose(reader->segment);
+        reader->segment = NULL;
+        reader->block_left = 0;
+        return scan_journal_read(reader, sighting, scanin);
+    }
+
+    reader->block_left--;
+    if (scanin) *scanin = reader->block.scanin;
+
+    return true;
+}
+
+// stops reading early.
+void scan_journal_reader_close(scan_journal_reader * reader) {
+    if (reader->segment) fclose(reader->segment);
+    reader->segment = NULL;
+}
+
+#endif
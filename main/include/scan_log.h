@@ -0,0 +1,327 @@
+#ifdef ESP_PLATFORM
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#else
+#include "esp_partition_host.h"
+#endif
+
+#include "tracer.h"
+#include "crc32.h"
+
+// a circular log of sightings written straight to a raw data partition, without a filesystem.
+// the partition is a ring of flash sectors. each sector starts with a header holding a sequence number, which goes up by one
+// for every sector started, and the scan interval number of its first sighting. the sightings follow it in fixed-size slots.
+// once the ring is full, the oldest sector is erased and reused. at boot, the newest and oldest sectors are found with
+// binary searches over the sector headers, and the write position with a binary search over the newest sector's slots.
+// only uses the esp_partition api, so it can be tested on a host against a file standing in for the partition, with
+// esp_partition_host.h.
+
+#ifndef _SCAN_LOG_H_
+#define _SCAN_LOG_H_
+
+#define SCAN_LOG_PARTITION_TYPE     0x40        // a custom partition type, see esp_partitions.csv
+#define SCAN_LOG_PARTITION_SUBTYPE  0x00
+#define SCAN_LOG_PARTITION_LABEL    "scanlog"
+
+#define SCAN_LOG_MAGIC          0x4c435354      // "TSCL"
+#define SCAN_LOG_SECTOR_SIZE    SPI_FLASH_SEC_SIZE
+#define SCAN_LOG_HEADER_SIZE    32              // the header is padded, so the slots stay aligned to their size
+#define SCAN_LOG_SLOTS          ((SCAN_LOG_SECTOR_SIZE - SCAN_LOG_HEADER_SIZE) / sizeof(tracer_sighting))
+#define SCAN_LOG_LIVE           UINT32_MAX      // the erased value of scan_log_header.expired
+
+// the header at the start of every used sector.
+typedef struct {
+    uint32_t magic;         // SCAN_LOG_MAGIC
+    uint32_t seq;           // the sequence number of the sector
+    uint32_t first_scanin;  // the scan interval number of the first sighting in the sector
+    uint32_t crc;           // the crc32 of the fields above
+    uint32_t expired;       // SCAN_LOG_LIVE until the sector expires, then 0. not covered by the crc, since it is cleared in place.
+} scan_log_header;
+
+typedef struct {
+    const esp_partition_t * partition;
+    size_t sector_count;
+    size_t head;            // the sector being written to
+    size_t tail;            // the oldest live sector
+    size_t head_slot;       // the next free slot in the head sector
+    uint32_t head_seq;      // the sequence number of the head sector
+    bool empty;             // whether nothing has been written yet
+} scan_log;
+
+// reads sightings out of a log, oldest first.
+typedef struct {
+    const scan_log * log;
+    size_t sector;          // the sector being read
+    size_t slot;            // the next slot to read in it
+    bool done;
+    const uint8_t * map;    // the partition mapped into the data cache, or NULL if it couldn't be
+    spi_flash_mmap_handle_t map_handle;
+} scan_log_reader;
+
+size_t _scan_log_sector_offset(size_t sector) {
+    return sector * SCAN_LOG_SECTOR_SIZE;
+}
+
+size_t _scan_log_slot_offset(size_t sector, size_t slot) {
+    return sector * SCAN_LOG_SECTOR_SIZE + SCAN_LOG_HEADER_SIZE + slot * sizeof(tracer_sighting);
+}
+
+// reads the header of a sector. returns false if the sector has no intact header, such as when it is erased or was torn.
+bool _scan_log_read_header(const scan_log * log, size_t sector, scan_log_header * header) {
+    if (esp_partition_read(log->partition, _scan_log_sector_offset(sector), header, sizeof(*header)) != ESP_OK) return false;
+    return header->magic == SCAN_LOG_MAGIC && header->crc == crc32_update(0, header, offsetof(scan_log_header, crc));
+}
+
+// checks if a slot is still all ones, so it can be written without clearing bits that are set in the data.
+bool _scan_log_slot_erased(const scan_log * log, size_t sector, size_t slot) {
+    uint8_t raw[sizeof(tracer_sighting)];
+    if (esp_partition_read(log->partition, _scan_log_slot_offset(sector, slot), raw, sizeof(raw)) != ESP_OK) return true;
+
+    for (size_t i = 0; i < sizeof(raw); i++) {
+        if (raw[i] != 0xff) return false;
+    }
+
+    return true;
+}
+
+// checks if a slot holds a whole sighting. flash is written front to back, and the last byte of a sighting is always 0,
+// so a write cut short by a reset leaves it erased.
+bool _scan_log_slot_complete(const tracer_sighting * sighting) {
+    return sighting->reserved != 0xff;
+}
+
+// checks if a sector is part of the run of live sectors ending at the head, back distance sectors from it.
+bool _scan_log_live_at(const scan_log * log, size_t distance) {
+    scan_log_header header;
+    size_t sector = (log->head + log->sector_count - distance) % log->sector_count;
+    return _scan_log_read_header(log, sector, &header) && header.seq == log->head_seq - distance && header.expired == SCAN_LOG_LIVE;
+}
+
+// finds the head, tail and write position of the log.
+void _scan_log_recover(scan_log * log) {
+    scan_log_header first, last;
+    log->empty = false;
+
+    if (_scan_log_read_header(log, 0, &first)) {
+        // sectors written after sector 0 in the same lap have consecutive sequence numbers, so the head is the last of them
+        size_t lo = 0, hi = log->sector_count - 1;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo + 1) / 2;
+            scan_log_header header;
+            if (_scan_log_read_header(log, mid, &header) && header.seq == first.seq + mid) lo = mid; else hi = mid - 1;
+        }
+        log->head = lo;
+        log->head_seq = first.seq + lo;
+    } else if (_scan_log_read_header(log, log->sector_count - 1, &last)) {
+        log->head = log->sector_count - 1;      // sector 0 was being erased to wrap around
+        log->head_seq = last.seq;
+    } else {
+        log->head = 0;                          // nothing written yet
+        log->head_seq = 0;
+        log->head_slot = 0;
+        log->tail = 0;
+        log->empty = true;
+        return;
+    }
+
+    // expired sectors are always the oldest ones, so the live sectors behind the head form one run
+    size_t lo = 0, hi = log->sector_count - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        if (_scan_log_live_at(log, mid)) lo = mid; else hi = mid - 1;
+    }
+    log->tail = (log->head + log->sector_count - lo) % log->sector_count;
+
+    // slots are filled in order, so the first erased one is the write position. a torn slot before it is skipped when reading.
+    size_t slot_lo = 0, slot_hi = SCAN_LOG_SLOTS;
+    while (slot_lo < slot_hi) {
+        size_t mid = slot_lo + (slot_hi - slot_lo) / 2;
+        if (_scan_log_slot_erased(log, log->head, mid)) slot_hi = mid; else slot_lo = mid + 1;
+    }
+    log->head_slot = slot_lo;
+}
+
+// opens the log on its partition and recovers its state. returns false if there is no scan log partition.
+bool scan_log_init(scan_log * log, const esp_partition_t * partition) {
+    if (partition == NULL) partition = esp_partition_find_first(SCAN_LOG_PARTITION_TYPE, SCAN_LOG_PARTITION_SUBTYPE, SCAN_LOG_PARTITION_LABEL);
+    if (partition == NULL || partition->size < 2 * SCAN_LOG_SECTOR_SIZE) return false;
+
+    log->partition = partition;
+    log->sector_count = partition->size / SCAN_LOG_SECTOR_SIZE;
+    _scan_log_recover(log);
+
+    return true;
+}
+
+// erases the whole partition, leaving an empty log.
+bool scan_log_erase(scan_log * log) {
+    if (esp_partition_erase_range(log->partition, 0, log->sector_count * SCAN_LOG_SECTOR_SIZE) != ESP_OK) return false;
+    _scan_log_recover(log);
+    return true;
+}
+
+// erases a sector and writes a new header to it.
+bool _scan_log_start_sector(scan_log * log, size_t sector, uint32_t seq, uint32_t first_scanin) {
+    if (esp_partition_erase_range(log->partition, _scan_log_sector_offset(sector), SCAN_LOG_SECTOR_SIZE) != ESP_OK) return false;
+
+    uint8_t raw[SCAN_LOG_HEADER_SIZE];
+    scan_log_header header = { SCAN_LOG_MAGIC, seq, first_scanin, 0, SCAN_LOG_LIVE };
+    header.crc = crc32_update(0, &header, offsetof(scan_log_header, crc));
+
+    memset(raw, 0xff, sizeof(raw));
+    memcpy(raw, &header, sizeof(header));
+
+    return esp_partition_write(log->partition, _scan_log_sector_offset(sector), raw, sizeof(raw)) == ESP_OK;
+}
+
+// appends sightings to the log, all from the same scan interval. once the ring is full, the oldest sector is overwritten.
+bool scan_log_append(scan_log * log, uint32_t scanin, const tracer_sighting * sightings, size_t len) {
+    while (len > 0) {
+        if (log->empty || log->head_slot == SCAN_LOG_SLOTS) {
+            size_t next = log->empty ? 0 : (log->head + 1) % log->sector_count;
+            uint32_t seq = log->empty ? 0 : log->head_seq + 1;
+
+            if (!log->empty && next == log->tail) log->tail = (log->tail + 1) % log->sector_count;     // the oldest sector is dropped
+            if (!_scan_log_start_sector(log, next, seq, scanin)) return false;
+
+            if (log->empty) log->tail = next;
+            log->head = next;
+            log->head_seq = seq;
+            log->head_slot = 0;
+            log->empty = false;
+        }
+
+        size_t write_len = SCAN_LOG_SLOTS - log->head_slot < len ? SCAN_LOG_SLOTS - log->head_slot : len;
+        if (esp_partition_write(log->partition, _scan_log_slot_offset(log->head, log->head_slot), sightings, write_len * sizeof(tracer_sighting)) != ESP_OK) return false;
+
+        log->head_slot += write_len;
+        sightings += write_len;
+        len -= write_len;
+    }
+
+    return true;
+}
+
+// expires every sector whose sightings are all from before min_scanin. their sightings are zeroed in place, which
+// unlike an erase doesn't wear the flash, and keeps the headers intact for recovery. returns the number of sectors expired.
+size_t scan_log_expire(scan_log * log, uint32_t min_scanin) {
+    size_t expired = 0;
+
+    while (!log->empty && log->tail != log->head) {
+        scan_log_header next;
+        size_t next_sector = (log->tail + 1) % log->sector_count;
+
+        // a sector only holds sightings up to the next sector's first one
+        if (!_scan_log_read_header(log, next_sector, &next) || next.first_scanin >= min_scanin) break;
+
+        // marked first, so a reset while zeroing can't leave zeroed sightings in a live sector
+        uint8_t zeros[256] = { 0 };
+        esp_partition_write(log->partition, _scan_log_sector_offset(log->tail) + offsetof(scan_log_header, expired), zeros, sizeof(uint32_t));
+
+        for (size_t offset = SCAN_LOG_HEADER_SIZE; offset < SCAN_LOG_SECTOR_SIZE; offset += sizeof(zeros)) {
+            size_t write_len = SCAN_LOG_SECTOR_SIZE - offset < sizeof(zeros) ? SCAN_LOG_SECTOR_SIZE - offset : sizeof(zeros);
+            esp_partition_write(log->partition, _scan_log_sector_offset(log->tail) + offset, zeros, write_len);
+        }
+
+        log->tail = next_sector;
+        expired++;
+    }
+
+    return expired;
+}
+
+// starts reading the log from its oldest sighting. the partition is mapped into memory if it can be, so runs of sightings
+// can be read in place. call scan_log_reader_close() after, to unmap it.
+void scan_log_reader_open(scan_log_reader * reader, const scan_log * log) {
+    const void * map = NULL;
+
+    reader->log = log;
+    reader->sector = log->tail;
+    reader->slot = 0;
+    reader->done = log->empty;
+
+    if (esp_partition_mmap(log->partition, 0, log->sector_count * SCAN_LOG_SECTOR_SIZE, SPI_FLASH_MMAP_DATA, &map, &reader->map_handle) != ESP_OK) map = NULL;
+    reader->map = (const uint8_t *)map;
+}
+
+// reads the next run of whole sightings, which never crosses a sector. if the partition is mapped, *run points into it and
+// nothing is copied. otherwise up to max sightings are read into buffer with a single read. returns the number of
+// sightings in the run, and 0 once there are no more.
+size_t scan_log_read_run(scan_log_reader * reader, tracer_sighting * buffer, size_t max, const tracer_sighting ** run) {
+    const scan_log * log = reader->log;
+
+    while (!reader->done) {
+        size_t slot_end = reader->sector == log->head ? log->head_slot : SCAN_LOG_SLOTS;
+
+        if (reader->slot < slot_end) {
+            const tracer_sighting * sightings;
+            size_t len = slot_end - reader->slot;
+
+            if (reader->map) {
+                sightings = (const tracer_sighting *)(reader->map + _scan_log_slot_offset(reader->sector, reader->slot));
+            } else {
+                if (len > max) len = max;
+                if (esp_partition_read(log->partition, _scan_log_slot_offset(reader->sector, reader->slot), buffer, len * sizeof(tracer_sighting)) != ESP_OK) {
+                    reader->done = true;
+                    break;
+                }
+                sightings = buffer;
+            }
+
+            // torn slots, and the rest of a sector that was never filled, split the sector into runs
+            size_t skip = 0;
+            while (skip < len && !_scan_log_slot_complete(&sightings[skip])) skip++;
+
+            size_t run_len = 0;
+            while (skip + run_len < len && _scan_log_slot_complete(&sightings[skip + run_len])) run_len++;
+
+            reader->slot += skip + run_len;
+            if (run_len == 0) continue;
+
+            *run = sightings + skip;
+            return run_len;
+        }
+
+        if (reader->sector == log->head) {
+            reader->done = true;
+        } else {
+            reader->sector = (reader->sector + 1) % log->sector_count;
+            reader->slot = 0;
+        }
+    }
+
+    return 0;
+}
+
+// reads the next sighting. returns false once there are no more.
+bool scan_log_read(scan_log_reader * reader, tracer_sighting * sighting) {
+    const scan_log * log = reader->log;
+
+    while (!reader->done) {
+        size_t slot_end = reader->sector == log->head ? log->head_slot : SCAN_LOG_SLOTS;
+
+        if (reader->slot < slot_end) {
+            esp_partition_read(log->partition, _scan_log_slot_offset(reader->sector, reader->slot++), sighting, sizeof(*sighting));
+            if (!_scan_log_slot_complete(sighting)) continue;   // torn by a reset, or the rest of a sector that was never filled
+            return true;
+        }
+
+        if (reader->sector == log->head) {
+            reader->done = true;
+        } else {
+            reader->sector = (reader->sector + 1) % log->sector_count;
+            reader->slot = 0;
+        }
+    }
+
+    return false;
+}
+
+// stops reading, and unmaps the partition.
+void scan_log_reader_close(scan_log_reader * reader) {
+    if (reader->map) spi_flash_munmap(reader->map_handle);
+    reader->map = NULL;
+    reader->done = true;
+}
+
+#endif
@@ -0,0 +1,101 @@
+#include "stdint.h"
+#include "stdbool.h"
+#include "stdlib.h"
+#include "string.h"
+#include <stdatomic.h>
+
+// a lock-free single-producer, single-consumer ring of raw ble adverts.
+// the bluetooth task pushes adverts as they arrive and the main task pops them in batches, so the scan callback never allocates or blocks.
+// only depends on c11 atomics, so it can be tested on a host with two threads standing in for the tasks.
+
+#ifndef _SCAN_RING_H_
+#define _SCAN_RING_H_
+
+#define SCAN_RING_ADV_LEN   31      // the longest legacy advertising payload (ESP_BLE_ADV_DATA_LEN_MAX)
+
+typedef struct {
+    uint8_t adv_data[SCAN_RING_ADV_LEN];    // the raw advertising data
+    uint8_t adv_data_len;                   // the length of the advertising data
+    uint8_t mac_addr[6];                    // the address of the advertiser
+    int8_t rssi;                            // the signal strength of the advert
+} scan_ring_record;
+
+typedef struct {
+    scan_ring_record * records;     // the slots of the ring
+    uint32_t mask;                  // the number of slots minus one. the number of slots is always a power of two.
+    _Atomic uint32_t head;          // the number of records ever pushed. only written by the producer.
+    _Atomic uint32_t tail;          // the number of records ever popped. only written by the consumer.
+    _Atomic uint32_t dropped;       // the number of adverts dropped because the ring was full
+} scan_ring;
+
+// allocates a ring. capacity is rounded up to a power of two. returns false if allocation fails.
+bool scan_ring_init(scan_ring * ring, size_t capacity) {
+    uint32_t slot_count = 1;
+    while (slot_count < capacity) slot_count <<= 1;
+
+    ring->records = (scan_ring_record *)malloc(slot_count * sizeof(scan_ring_record));
+    if (ring->records == NULL) return false;
+
+    ring->mask = slot_count - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+
+    return true;
+}
+
+// frees a ring. neither side may use it afterwards.
+void scan_ring_free(scan_ring * ring) {
+    free(ring->records);
+    ring->records = NULL;
+}
+
+// copies an advert into the ring. only call this from the producer. returns false and counts the advert as dropped if the ring is full.
+bool scan_ring_push(scan_ring * ring, const uint8_t * adv_data, size_t adv_data_len, const uint8_t mac_addr[6], int8_t rssi) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);    // the consumer is done with every slot before tail
+
+    if (head - tail > ring->mask) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+
+    if (adv_data_len > SCAN_RING_ADV_LEN) adv_data_len = SCAN_RING_ADV_LEN;
+
+    scan_ring_record * record = &ring->records[head & ring->mask];
+    memcpy(record->adv_data, adv_data, adv_data_len);
+    record->adv_data_len = adv_data_len;
+    memcpy(record->mac_addr, mac_addr, sizeof(record->mac_addr));
+    record->rssi = rssi;
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);      // publishes the record to the consumer
+
+    return true;
+}
+
+// copies up to max_len of the oldest adverts into output and removes them from the ring. only call this from the consumer. returns the number of adverts copied.
+size_t scan_ring_pop(scan_ring * ring, scan_ring_record * output, size_t max_len) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    size_t len = head - tail;
+    if (len > max_len) len = max_len;
+
+    for (size_t i = 0; i < len; i++) output[i] = ring->records[(tail + i) & ring->mask];
+
+    atomic_store_explicit(&ring->tail, tail + len, memory_order_release);   // hands the slots back to the producer
+
+    return len;
+}
+
+// throws away every advert in the ring. only call this from the consumer.
+void scan_ring_clear(scan_ring * ring) {
+    atomic_store_explicit(&ring->tail, atomic_load_explicit(&ring->head, memory_order_acquire), memory_order_release);
+}
+
+// returns and resets the number of dropped adverts.
+uint32_t scan_ring_take_dropped(scan_ring * ring) {
+    return atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+}
+
+#endif
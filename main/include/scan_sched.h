@@ -0,0 +1,70 @@
+#include "stdint.h"
+#include "stddef.h"
+
+// an adaptive scan scheduler. scans get longer and more frequent while new rpis keep showing up, and back off when nothing new is heard.
+// it only does arithmetic, so it can be simulated on a host.
+
+#ifndef _SCAN_SCHED_H_
+#define _SCAN_SCHED_H_
+
+#define SCAN_SCHED_NOVELTY_ONE  16  // the fixed point scale of the novelty average
+
+typedef struct {
+    uint32_t min_window_ms;     // the shortest scan window
+    uint32_t max_window_ms;     // the longest scan window
+    uint32_t min_interval_s;    // the shortest time between the starts of two scans
+    uint32_t max_interval_s;    // the longest time between the starts of two scans. any contact at least this long overlaps a scan.
+    uint32_t max_duty_permille; // the most of the time the radio may spend scanning, in thousandths. the energy bound.
+} scan_sched_bounds;
+
+typedef struct {
+    scan_sched_bounds bounds;
+    uint32_t window_ms;         // the length of the next scan window
+    uint32_t interval_s;        // the time until the next scan
+    uint32_t novelty;           // an exponential moving average of new rpis per window, in 1/SCAN_SCHED_NOVELTY_ONE
+} scan_sched;
+
+// keeps the window under the energy bound by stretching the interval, without breaking the coverage bound.
+void _scan_sched_clamp(scan_sched * sched) {
+    const scan_sched_bounds * b = &sched->bounds;
+
+    if (sched->window_ms < b->min_window_ms) sched->window_ms = b->min_window_ms;
+    if (sched->window_ms > b->max_window_ms) sched->window_ms = b->max_window_ms;
+    if (sched->interval_s < b->min_interval_s) sched->interval_s = b->min_interval_s;
+    if (sched->interval_s > b->max_interval_s) sched->interval_s = b->max_interval_s;
+
+    uint32_t min_interval_s = (sched->window_ms + b->max_duty_permille - 1) / b->max_duty_permille;   // window_ms <= interval_s * max_duty_permille
+    if (sched->interval_s < min_interval_s) sched->interval_s = min_interval_s <= b->max_interval_s ? min_interval_s : b->max_interval_s;
+
+    uint32_t max_window_ms = sched->interval_s * b->max_duty_permille;
+    if (sched->window_ms > max_window_ms) sched->window_ms = max_window_ms > b->min_window_ms ? max_window_ms : b->min_window_ms;
+}
+
+// starts a scheduler at its most relaxed schedule.
+void scan_sched_init(scan_sched * sched, const scan_sched_bounds * bounds) {
+    sched->bounds = *bounds;
+    sched->window_ms = bounds->min_window_ms;
+    sched->interval_s = bounds->max_interval_s;
+    sched->novelty = 0;
+    _scan_sched_clamp(sched);
+}
+
+// plans the next scan from the number of rpis the last window heard for the first time.
+void scan_sched_update(scan_sched * sched, size_t new_rpis) {
+    if (new_rpis > UINT16_MAX) new_rpis = UINT16_MAX;
+    sched->novelty = (sched->novelty * 3 + new_rpis * SCAN_SCHED_NOVELTY_ONE) / 4;
+
+    if (new_rpis > 0) {
+        // churn: ramp up fast, so the rest of a crowd is heard
+        sched->window_ms *= 2;
+        sched->interval_s /= 2;
+    } else if (sched->novelty == 0) {
+        // nothing new for a while: back off slowly, so a lull in a crowd doesn't drop straight to the slowest schedule
+        sched->window_ms -= sched->window_ms / 4;
+        sched->interval_s += sched->interval_s / 4 + 1;
+    }
+
+    _scan_sched_clamp(sched);
+}
+
+#endif
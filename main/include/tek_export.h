@@ -0,0 +1,245 @@
+#include "tek_stream.h"
+
+#include "stdlib.h"
+
+#ifdef ESP_PLATFORM
+#include "esp32/rom/miniz.h"
+#else
+#include <zlib.h>
+#endif
+
+// decodes the keyserver's compact tek export (?format=tekx) as it is downloaded, and hands the teks to a tek_stream.
+// the export starts with a 6-byte header: "TEKX", a version, and flags. the rest, deflated if TEK_EXPORT_FLAG_DEFLATE is
+// set, is a run of batches:
+//  - varint count          the number of teks in the batch. a count of 0 ends the export.
+//  - varint base           the rolling start number (eninterval) of the first tek
+//  - count times:
+//      - varint delta      the rolling start number of the tek, less the one before it. teks are sorted, so it is never negative.
+//      - 16 bytes          the tek
+// varints are little-endian base-128. only the rolling start number of a tek is sent, not its epoch, since that is all
+// tracer_index.h uses. most teks take 17 bytes instead of 20.
+// deflated exports are compressed with a 4 KB window, and inflated through a buffer that size (the rom's miniz on the
+// device, zlib on a host), which is only allocated while a deflated export is being decoded.
+
+#ifndef _TEK_EXPORT_H_
+#define _TEK_EXPORT_H_
+
+#define TEK_EXPORT_MAGIC            "TEKX"
+#define TEK_EXPORT_VERSION          1
+#define TEK_EXPORT_HEADER_LEN       6
+#define TEK_EXPORT_FLAG_DEFLATE     0x01
+#define TEK_EXPORT_WINDOW_BITS      12
+#define TEK_EXPORT_WINDOW_LEN       (1 << TEK_EXPORT_WINDOW_BITS)
+
+typedef enum {
+    TEK_EXPORT_HEADER,
+    TEK_EXPORT_COUNT,
+    TEK_EXPORT_BASE,
+    TEK_EXPORT_DELTA,
+    TEK_EXPORT_KEY,
+    TEK_EXPORT_DONE,
+    TEK_EXPORT_ERROR,
+} tek_export_state;
+
+typedef struct {
+#ifdef ESP_PLATFORM
+    tinfl_decompressor inflator;
+    size_t window_head;     // where the next inflated byte goes. the window wraps, and keeps the history back-references need.
+#else
+    z_stream stream;
+#endif
+    uint8_t window[TEK_EXPORT_WINDOW_LEN];
+} _tek_export_inflater;
+
+typedef struct {
+    tek_export_state state;
+    uint8_t header[TEK_EXPORT_HEADER_LEN];
+    size_t header_len;
+    uint32_t varint;                // the varint being read
+    size_t varint_shift;
+    uint32_t count;                 // the teks left in the batch
+    uint32_t rolling_start;         // the rolling start number of the last tek
+    tracer_tek tek;                 // the tek being read
+    size_t key_len;                 // the bytes of its key read so far
+    bool deflated;
+    bool inflated;                  // whether the deflate stream has ended, and its checksum matched
+    _tek_export_inflater * inflater;
+    tek_stream * out;
+} tek_export_decoder;
+
+void tek_export_init(tek_export_decoder * decoder, tek_stream * out) {
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->state = TEK_EXPORT_HEADER;
+    decoder->out = out;
+}
+
+void _tek_export_free_inflater(tek_export_decoder * decoder) {
+    if (decoder->inflater == NULL) return;
+
+#ifndef ESP_PLATFORM
+    inflateEnd(&decoder->inflater->stream);
+#endif
+    free(decoder->inflater);
+    decoder->inflater = NULL;
+}
+
+bool _tek_export_alloc_inflater(tek_export_decoder * decoder) {
+    decoder->inflater = (_tek_export_inflater *)malloc(sizeof(_tek_export_inflater));
+    if (decoder->inflater == NULL) return false;
+
+#ifdef ESP_PLATFORM
+    tinfl_init(&decoder->inflater->inflator);
+    decoder->inflater->window_head = 0;
+#else
+    memset(&decoder->inflater->stream, 0, sizeof(z_stream));
+    if (inflateInit2(&decoder->inflater->stream, TEK_EXPORT_WINDOW_BITS) != Z_OK) {
+        free(decoder->inflater);
+        decoder->inflater = NULL;
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+// reads a byte of a varint. returns true once the varint is whole.
+bool _tek_export_varint(tek_export_decoder * decoder, uint8_t byte) {
+    if (decoder->varint_shift > 28) {
+        decoder->state = TEK_EXPORT_ERROR;
+        return false;
+    }
+
+    decoder->varint |= (uint32_t)(byte & 0x7f) << decoder->varint_shift;
+    decoder->varint_shift += 7;
+    return !(byte & 0x80);
+}
+
+// decodes the export's batches, after they have been inflated.
+void _tek_export_parse(tek_export_decoder * decoder, const uint8_t * data, size_t len) {
+    for (size_t i = 0; i < len && decoder->state < TEK_EXPORT_DONE;) {
+        if (decoder->state == TEK_EXPORT_KEY) {
+            size_t copy = sizeof(decoder->tek.value) - decoder->key_len;
+            if (copy > len - i) copy = len - i;
+
+            memcpy(decoder->tek.value + decoder->key_len, data + i, copy);
+            decoder->key_len += copy;
+            i += copy;
+
+            if (decoder->key_len == sizeof(decoder->tek.value)) {
+                decoder->tek.epoch = tracer_enin2epoch(decoder->rolling_start);
+                tek_stream_feed(decoder->out, &decoder->tek, sizeof(tracer_tek));
+
+                decoder->state = --decoder->count ? TEK_EXPORT_DELTA : TEK_EXPORT_COUNT;
+            }
+            continue;
+        }
+
+        if (!_tek_export_varint(decoder, data[i++])) continue;
+
+        uint32_t value = decoder->varint;
+        decoder->varint = 0;
+        decoder->varint_shift = 0;
+
+        switch (decoder->state) {
+            case TEK_EXPORT_COUNT:
+                decoder->count = value;
+                decoder->state = value ? TEK_EXPORT_BASE : TEK_EXPORT_DONE;
+                break;
+            case TEK_EXPORT_BASE:
+                decoder->rolling_start = value;
+                decoder->state = TEK_EXPORT_DELTA;
+                break;
+            case TEK_EXPORT_DELTA:
+                decoder->rolling_start += value;
+                decoder->key_len = 0;
+                decoder->state = TEK_EXPORT_KEY;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// inflates a piece of a deflated export, and decodes what comes out.
+void _tek_export_inflate(tek_export_decoder * decoder, const uint8_t * data, size_t len) {
+    _tek_export_inflater * inflater = decoder->inflater;
+
+#ifdef ESP_PLATFORM
+    while (decoder->state != TEK_EXPORT_ERROR && !decoder->inflated) {
+        size_t in_len = len, out_len = TEK_EXPORT_WINDOW_LEN - inflater->window_head;
+        tinfl_status status = tinfl_decompress(&inflater->inflator, data, &in_len, inflater->window, inflater->window + inflater->window_head,
+            &out_len, TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+
+        _tek_export_parse(decoder, inflater->window + inflater->window_head, out_len);
+        inflater->window_head = (inflater->window_head + out_len) & (TEK_EXPORT_WINDOW_LEN - 1);
+        data += in_len;
+        len -= in_len;
+
+        if (status < TINFL_STATUS_DONE) decoder->state = TEK_EXPORT_ERROR;
+        decoder->inflated = status == TINFL_STATUS_DONE;
+        if (status != TINFL_STATUS_HAS_MORE_OUTPUT && (status != TINFL_STATUS_NEEDS_MORE_INPUT || len == 0)) break;
+    }
+#else
+    z_stream * stream = &inflater->stream;
+    stream->next_in = (Bytef *)data;
+    stream->avail_in = len;
+
+    while (decoder->state != TEK_EXPORT_ERROR && !decoder->inflated) {
+        stream->next_out = inflater->window;
+        stream->avail_out = TEK_EXPORT_WINDOW_LEN;
+
+        int ret = inflate(stream, Z_NO_FLUSH);
+        _tek_export_parse(decoder, inflater->window, TEK_EXPORT_WINDOW_LEN - stream->avail_out);
+
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) decoder->state = TEK_EXPORT_ERROR;
+        decoder->inflated = ret == Z_STREAM_END;
+        if (ret != Z_OK || (stream->avail_in == 0 && stream->avail_out > 0)) break;
+    }
+#endif
+}
+
+// feeds the decoder the next piece of an export. returns false once the export is found to be malformed.
+bool tek_export_feed(tek_export_decoder * decoder, const void * data, size_t len) {
+    const uint8_t * bytes = (const uint8_t *)data;
+
+    if (decoder->state == TEK_EXPORT_HEADER) {
+        size_t copy = TEK_EXPORT_HEADER_LEN - decoder->header_len;
+        if (copy > len) copy = len;
+
+        memcpy(decoder->header + decoder->header_len, bytes, copy);
+        decoder->header_len += copy;
+        bytes += copy;
+        len -= copy;
+
+        if (decoder->header_len < TEK_EXPORT_HEADER_LEN) return true;
+
+        uint8_t flags = decoder->header[5];
+        decoder->deflated = flags & TEK_EXPORT_FLAG_DEFLATE;
+        if (memcmp(decoder->header, TEK_EXPORT_MAGIC, 4) != 0 || decoder->header[4] != TEK_EXPORT_VERSION ||
+            (flags & ~TEK_EXPORT_FLAG_DEFLATE) || ((flags & TEK_EXPORT_FLAG_DEFLATE) && !_tek_export_alloc_inflater(decoder))) {
+            decoder->state = TEK_EXPORT_ERROR;
+            return false;
+        }
+
+        decoder->state = TEK_EXPORT_COUNT;
+    }
+
+    if (decoder->inflater) {
+        _tek_export_inflate(decoder, bytes, len);
+    } else {
+        _tek_export_parse(decoder, bytes, len);
+    }
+
+    return decoder->state != TEK_EXPORT_ERROR;
+}
+
+// hands on the last batch of teks, and frees the inflater. returns whether the whole export was decoded. can be called
+// again, or after an error.
+bool tek_export_end(tek_export_decoder * decoder) {
+    _tek_export_free_inflater(decoder);
+
+    bool whole = tek_stream_end(decoder->out);
+    return whole && decoder->state == TEK_EXPORT_DONE && (!decoder->deflated || decoder->inflated);
+}
+
+#endif
@@ -0,0 +1,163 @@
+#include "tracer.h"
+
+#include "crc32.h"
+#include "file_store.h"
+
+// an append-only log of the device's own teks. every rollover appends one record holding the tek, a sequence number and
+// a crc, instead of rewriting all of them. a boot only reads the last TRACER_TEK_STORE_PERIOD records, however long the
+// log has grown. a record torn by a reset fails its crc and is dropped, and the teks before it are never touched.
+// once the log grows to TEK_LOG_COMPACT_LEN records it is rewritten with just the live teks, which happens every
+// few weeks with daily rollovers.
+// the teks live in a ring like tracer_tek_array, with the tek of sequence number seq in slot seq % TRACER_TEK_STORE_PERIOD.
+
+#ifndef _TEK_LOG_H_
+#define _TEK_LOG_H_
+
+#define TEK_LOG_NAME            "teklog"
+#define TEK_LOG_COMPACT_NAME    "teklog.new"    // where a compacted log is written before it replaces the old one
+#define TEK_LOG_LEGACY_NAME     "tekfile"       // the whole tek array, as save_teks() used to write it
+#define TEK_LOG_COMPACT_LEN     (4 * TRACER_TEK_STORE_PERIOD)
+
+typedef struct {
+    uint32_t seq;       // goes up by one for every tek appended
+    tracer_tek tek;
+    uint32_t crc;       // the crc32 of the fields above
+} tek_log_record;
+
+typedef struct {
+    file_store * store;
+    uint32_t next_seq;  // the sequence number of the next tek. next_seq % TRACER_TEK_STORE_PERIOD is the head of the ring.
+    size_t len;         // the number of records in the log file
+} tek_log;
+
+void _tek_log_seal(tek_log_record * record) {
+    record->crc = crc32_update(0, record, offsetof(tek_log_record, crc));
+}
+
+bool _tek_log_record_valid(const tek_log_record * record) {
+    return record->crc == crc32_update(0, record, offsetof(tek_log_record, crc));
+}
+
+// rewrites the log with only the teks in the ring. the new log is written next to the old one and renamed over it, so
+// a reset at any point leaves one whole log behind.
+bool tek_log_compact(tek_log * log, const tracer_tek teks[TRACER_TEK_STORE_PERIOD]) {
+    FILE * file = file_store_open(log->store, TEK_LOG_COMPACT_NAME, "w");
+    if (file == NULL) return false;
+
+    bool ok = true;
+    size_t len = 0;
+
+    // oldest first, skipping the slots that were never filled
+    for (uint32_t seq = log->next_seq < TRACER_TEK_STORE_PERIOD ? 0 : log->next_seq - TRACER_TEK_STORE_PERIOD; seq < log->next_seq; seq++) {
+        const tracer_tek * tek = &teks[seq % TRACER_TEK_STORE_PERIOD];
+        if (tek->epoch == 0) continue;
+
+        tek_log_record record = { .seq = seq, .tek = *tek };
+        _tek_log_seal(&record);
+
+        ok &= fwrite(&record, sizeof(record), 1, file) == 1;
+        len++;
+    }
+
+    ok &= fclose(file) == 0;
+    if (!ok) return false;
+
+    file_store_remove(log->store, TEK_LOG_NAME);
+    if (!file_store_rename(log->store, TEK_LOG_COMPACT_NAME, TEK_LOG_NAME)) return false;
+
+    log->len = len;
+    return true;
+}
+
+// reads the tail of the log, which holds every live tek. returns the number of records that were read whole.
+size_t _tek_log_read_tail(tek_log * log, tracer_tek teks[TRACER_TEK_STORE_PERIOD], bool * damaged) {
+    FILE * file = file_store_open(log->store, TEK_LOG_NAME, "r");
+    if (file == NULL) return 0;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+
+    log->len = size / sizeof(tek_log_record);
+    *damaged = size % sizeof(tek_log_record) != 0;     // a record was cut short by a reset
+
+    size_t tail_len = log->len < TRACER_TEK_STORE_PERIOD ? log->len : TRACER_TEK_STORE_PERIOD;
+    tek_log_record records[TRACER_TEK_STORE_PERIOD];
+
+    fseek(file, (log->len - tail_len) * sizeof(tek_log_record), SEEK_SET);
+    tail_len = fread(records, sizeof(tek_log_record), tail_len, file);
+    fclose(file);
+
+    size_t read = 0;
+    for (size_t i = 0; i < tail_len; i++) {
+        if (!_tek_log_record_valid(&records[i]) || (read > 0 && records[i].seq != log->next_seq)) {
+            *damaged = true;
+            continue;
+        }
+
+        teks[records[i].seq % TRACER_TEK_STORE_PERIOD] = records[i].tek;
+        log->next_seq = records[i].seq + 1;
+        read++;
+    }
+
+    return read;
+}
+
+// loads the teks into a ring, and sets head to the slot the next tek goes in. a device that still has a tekfile from
+// before the log is moved over to it.
+bool tek_log_load(tek_log * log, file_store * store, tracer_tek teks[TRACER_TEK_STORE_PERIOD], size_t * head) {
+    bool damaged = false;
+
+    log->store = store;
+    log->next_seq = 0;
+    log->len = 0;
+    memset(teks, 0, TRACER_TEK_STORE_PERIOD * sizeof(tracer_tek));
+
+    // a reset between removing the old log and renaming the compacted one over it leaves only the compacted one. if the
+    // old log is still there, the compacted one may not have been finished.
+    if (!file_store_rename(store, TEK_LOG_COMPACT_NAME, TEK_LOG_NAME)) file_store_remove(store, TEK_LOG_COMPACT_NAME);
+
+    if (_tek_log_read_tail(log, teks, &damaged) == 0) {
+        FILE * legacy = file_store_open(store, TEK_LOG_LEGACY_NAME, "r");
+
+        if (legacy) {
+            size_t legacy_len = fread(teks, sizeof(tracer_tek), TRACER_TEK_STORE_PERIOD, legacy);
+            fclose(legacy);
+
+            // the newest tek was the last one written, so the head is the slot after it
+            size_t newest = 0;
+            for (size_t i = 1; i < legacy_len; i++) {
+                if (teks[i].epoch > teks[newest].epoch) newest = i;
+            }
+            log->next_seq = TRACER_TEK_STORE_PERIOD + newest + 1;    // keeps seq % TRACER_TEK_STORE_PERIOD on the same slots
+
+            if (!tek_log_compact(log, teks)) return false;
+            file_store_remove(store, TEK_LOG_LEGACY_NAME);
+        }
+    } else if (damaged) {
+        tek_log_compact(log, teks);     // so the next record lines up, and the damage isn't read again
+    }
+
+    *head = log->next_seq % TRACER_TEK_STORE_PERIOD;
+    return true;
+}
+
+// appends a new tek, which has to be the one in the head slot of the ring. the log is compacted if it has grown too long.
+bool tek_log_append(tek_log * log, const tracer_tek teks[TRACER_TEK_STORE_PERIOD]) {
+    tek_log_record record = { .seq = log->next_seq, .tek = teks[log->next_seq % TRACER_TEK_STORE_PERIOD] };
+    _tek_log_seal(&record);
+
+    log->next_seq++;
+
+    if (log->len + 1 >= TEK_LOG_COMPACT_LEN) return tek_log_compact(log, teks);
+
+    FILE * file = file_store_open(log->store, TEK_LOG_NAME, "a");
+    if (file == NULL) return false;
+
+    bool ok = fwrite(&record, sizeof(record), 1, file) == 1;
+    ok &= fclose(file) == 0;
+
+    if (ok) log->len++;
+    return ok;
+}
+
+#endif
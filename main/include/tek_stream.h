@@ -0,0 +1,66 @@
+#include "tracer.h"
+
+#include "string.h"
+
+// splits a downloaded tek export (20 bytes per tek, as the keyserver sends it) into teks. each span of body is copied
+// straight into a batch of teks with one memcpy, and only a tek cut in two by the end of a span is carried over to the
+// next. full batches are handed to a callback.
+
+#ifndef _TEK_STREAM_H_
+#define _TEK_STREAM_H_
+
+#define TEK_STREAM_BATCH_LEN    128
+
+typedef void (*tek_stream_cb)(tracer_tek * teks, size_t len, void * user_data);
+
+typedef struct {
+    tracer_tek batch[TEK_STREAM_BATCH_LEN];
+    size_t batch_len;       // the number of whole teks in the batch
+    size_t partial_len;     // the bytes of the next tek already in the batch
+    size_t total;           // the number of teks decoded so far
+    tek_stream_cb callback;
+    void * user_data;
+} tek_stream;
+
+void tek_stream_init(tek_stream * stream, tek_stream_cb callback, void * user_data) {
+    stream->batch_len = 0;
+    stream->partial_len = 0;
+    stream->total = 0;
+    stream->callback = callback;
+    stream->user_data = user_data;
+}
+
+void tek_stream_feed(tek_stream * stream, const void * data, size_t len) {
+    const uint8_t * bytes = (const uint8_t *)data;
+
+    while (len > 0) {
+        size_t space = (TEK_STREAM_BATCH_LEN - stream->batch_len) * sizeof(tracer_tek) - stream->partial_len;
+        size_t copy = len < space ? len : space;
+
+        memcpy((uint8_t *)&stream->batch[stream->batch_len] + stream->partial_len, bytes, copy);
+        bytes += copy;
+        len -= copy;
+
+        size_t filled = stream->partial_len + copy;
+        stream->batch_len += filled / sizeof(tracer_tek);
+        stream->total += filled / sizeof(tracer_tek);
+        stream->partial_len = filled % sizeof(tracer_tek);
+
+        if (stream->batch_len == TEK_STREAM_BATCH_LEN) {
+            stream->callback(stream->batch, stream->batch_len, stream->user_data);
+            stream->batch_len = 0;
+        }
+    }
+}
+
+// hands on the last batch. returns false if the body ended partway through a tek, which is dropped.
+bool tek_stream_end(tek_stream * stream) {
+    if (stream->batch_len > 0) stream->callback(stream->batch, stream->batch_len, stream->user_data);
+
+    bool whole = stream->partial_len == 0;
+    stream->batch_len = 0;
+    stream->partial_len = 0;
+    return whole;
+}
+
+#endif
@@ -0,0 +1,41 @@
+#include "crc32.h"
+#include "file_store.h"
+
+// the tek sync cursor: how many of the keyserver's teks have been downloaded and tested. the keyserver numbers its teks
+// in the order they were committed, so a sync asks for the ones from the cursor on (?since=), and only downloads and
+// tests the teks it hasn't seen, instead of all of them. the cursor is stored with a crc, and a cursor that fails it
+// starts the sync over from 0, which is slow but loses nothing.
+
+#ifndef _TEK_SYNC_H_
+#define _TEK_SYNC_H_
+
+#define TEK_SYNC_NAME   "tekcursor"
+
+typedef struct {
+    uint32_t next;      // the number of the next tek to download
+    uint32_t crc;
+} tek_sync_cursor;
+
+uint32_t tek_sync_load(file_store * store) {
+    tek_sync_cursor cursor;
+    FILE * file = file_store_open(store, TEK_SYNC_NAME, "r");
+    if (file == NULL) return 0;
+
+    bool ok = fread(&cursor, sizeof(cursor), 1, file) == 1;
+    fclose(file);
+
+    if (!ok || cursor.crc != crc32_update(0, &cursor.next, sizeof(cursor.next))) return 0;
+    return cursor.next;
+}
+
+bool tek_sync_save(file_store * store, uint32_t next) {
+    tek_sync_cursor cursor = { .next = next, .crc = crc32_update(0, &next, sizeof(next)) };
+    FILE * file = file_store_open(store, TEK_SYNC_NAME, "w");
+    if (file == NULL) return false;
+
+    bool ok = fwrite(&cursor, sizeof(cursor), 1, file) == 1;
+    ok &= fclose(file) == 0;
+    return ok;
+}
+
+#endif
@@ -28,6 +28,12 @@
 #define TRACER_MAJOR_VERSION    1       // standard major version x.0
 #define TRACER_MINOR_VERSION    0       // standard minor version 0.x
 
+// settings (performance)
+#define TRACER_BATCH_SIZE       32      // how many rpis the batch functions decrypt at once. each one takes 16 bytes of stack.
+#ifndef TRACER_KEY_CACHE_SIZE
+#define TRACER_KEY_CACHE_SIZE   0       // how many teks' expanded keys tracer_verify_v2() keeps, or 0 for no cache. each entry holds two aes contexts (about 1.2kB of static ram with mbedtls). the cache is global and unlocked, so only define this for programs that verify from one thread.
+#endif
+
 // constants
 #define RPI_STRING  "EN-RPI"
 #define RPIK_STRING "EN-RPIK"
@@ -89,6 +95,23 @@ typedef struct {
     tracer_aem aem;     /** The Rolling Proximity Identifier's associated metadata */
 } tracer_datapair;
 
+/**
+ * @brief Every reception of one datapair within one ENIntervalNumber, merged into a single record.
+ *
+ * Sightings are only stored in scan journal blocks and scan log sectors, whose headers carry a magic number. The
+ * per-minute scanfiles written before them hold bare tracer_datapair records instead, and must not be read as these.
+ */
+typedef struct {
+    tracer_datapair pair;   /** The received datapair */
+    uint32_t first_seen;    /** The unix epoch the datapair was first received at */
+    uint16_t duration;      /** The number of seconds between the first and last reception of the datapair */
+    uint16_t count;         /** The number of times the datapair was received. Saturates at UINT16_MAX. */
+    int8_t rssi_min;        /** The weakest RSSI the datapair was received with, in dBm */
+    int8_t rssi_max;        /** The strongest RSSI the datapair was received with, in dBm */
+    int8_t rssi_mean;       /** The mean RSSI the datapair was received with, in dBm */
+    uint8_t reserved;
+} tracer_sighting;
+
 /**
  * @brief An RPIK and AEMK pair
  */
@@ -97,6 +120,14 @@ typedef struct {
     tracer_aemk aemk;   /** The Associated Encrypted Metadata Key */
 } tracer_keypair;
 
+/**
+ * @brief An RPIK and AEMK pair with their AES key schedules already expanded
+ */
+typedef struct {
+    aes_ctx rpik;       /** The Rolling Proximity Identifier Key's AES context */
+    aes_ctx aemk;       /** The Associated Encrypted Metadata Key's AES context */
+} tracer_keypair_ctx;
+
 /**
  * @brief A raw BLE advertising payload
  */
@@ -109,6 +140,7 @@ tracer_tek tracer_tek_array[TRACER_TEK_STORE_PERIOD];
 size_t tracer_tek_array_head = 0;
 
 tracer_keypair tracer_current_keypair;
+tracer_keypair_ctx tracer_current_keypair_ctx;
 
 /**
  * @brief Adds a record to the BLE payload
@@ -166,33 +198,55 @@ uint32_t tracer_scanin2epoch(uint32_t scanin) {
 }
 
 /**
- * @brief Derives a new Rolling Proximity Identifier Key from a Temporary Exposure Key
+ * @brief Expands a Rolling Proximity Identifier Key from a Temporary Exposure Key's extracted HKDF key
  * 
- * @param tek The Temporary Exposure Key to derive the RPI from
+ * @param prk A pointer to the TEK's pseudorandom key, as extracted by hkdf_extract()
  * @return The output Rolling Proximity Identifier Key
  */
-tracer_rpik tracer_derive_rpik(tracer_tek tek) {
-    char salt[16] = RPIK_STRING;
+tracer_rpik tracer_expand_rpik(const hkdf_prk * prk) {
+    char info[16] = RPIK_STRING;
 
     tracer_rpik out;
 
-    hkdf(tek.value, AES128_KEY_SIZE,
-        NULL, 0, 
-        salt, 16,
-        16, 
-        out.value);
+    hkdf_expand(prk, info, sizeof(info), sizeof(out.value), out.value);
 
     return out;
 }
 
 /**
- * @brief Encrypts a Rolling Proximity Identifier from an RPIK and UNIX epoch
+ * @brief Derives a new Rolling Proximity Identifier Key from a Temporary Exposure Key without copying either
  * 
- * @param rpik The Temporary Exposure Key to encrypt the RPI
+ * @param tek A pointer to the Temporary Exposure Key to derive the RPIK from
+ * @param out A pointer to the Rolling Proximity Identifier Key to overwrite
+ */
+void tracer_derive_rpik_v2(const tracer_tek * tek, tracer_rpik * out) {
+    hkdf_prk prk;
+
+    hkdf_extract(tek->value, sizeof(tek->value), &prk);
+    *out = tracer_expand_rpik(&prk);
+    hkdf_prk_free(&prk);
+}
+
+/**
+ * @brief Derives a new Rolling Proximity Identifier Key from a Temporary Exposure Key
+ * 
+ * @param tek The Temporary Exposure Key to derive the RPI from
+ * @return The output Rolling Proximity Identifier Key
+ */
+tracer_rpik tracer_derive_rpik(tracer_tek tek) {
+    tracer_rpik out;
+    tracer_derive_rpik_v2(&tek, &out);
+    return out;
+}
+
+/**
+ * @brief Encrypts a Rolling Proximity Identifier from an RPIK's AES context and UNIX epoch
+ * 
+ * @param rpik_ctx A pointer to an AES context initialized with the Rolling Proximity Identifier Key
  * @param epoch The current UNIX epoch time
  * @return An encrypted Tracer Rolling Proximity Identifier
  */
-tracer_rpi tracer_derive_rpi(tracer_rpik rpik, uint32_t epoch) {
+tracer_rpi tracer_derive_rpi_keyed(aes_ctx * rpik_ctx, uint32_t epoch) {
     tracer_rpi out;
 
     uint8_t padded_data[AES128_BLOCK_SIZE] = RPI_STRING;                             // just a note, the rest of the char array will be initialized to 0
@@ -201,11 +255,61 @@ tracer_rpi tracer_derive_rpi(tracer_rpik rpik, uint32_t epoch) {
 
     memcpy(&padded_data[sizeof(padded_data) - sizeof(enin)], &enin, sizeof(enin));   // set the last 4 bytes of the padded date to the epoch
 
-    encrypt_aes_block(rpik.value, AES128_KEY_SIZE, &padded_data, out.value);
+    aes_ctx_encrypt_block(rpik_ctx, padded_data, out.value);
 
     return out;
 }
 
+/**
+ * @brief Derives the Rolling Proximity Identifiers of a run of consecutive ENIntervalNumbers
+ * 
+ * The RPIs are encrypted in a single batched AES call, which keeps several blocks in flight where the platform allows it.
+ * 
+ * @param rpik_ctx A pointer to an AES context initialized with the Rolling Proximity Identifier Key
+ * @param first_enin The ENIntervalNumber of the first RPI
+ * @param len The number of RPIs to derive
+ * @param out A pointer to an array of @p len RPIs to overwrite
+ */
+void tracer_derive_rpi_batch(aes_ctx * rpik_ctx, uint32_t first_enin, size_t len, tracer_rpi * out) {
+    for (size_t i = 0; i < len; i++) {
+        uint32_t enin = first_enin + i;
+
+        memset(out[i].value, 0, sizeof(out[i].value));
+        memcpy(out[i].value, RPI_STRING, sizeof(RPI_STRING));
+        memcpy(&out[i].value[sizeof(out[i].value) - sizeof(enin)], &enin, sizeof(enin));
+    }
+
+    aes_ctx_encrypt_blocks(rpik_ctx, out, out, len);
+}
+
+/**
+ * @brief Encrypts a Rolling Proximity Identifier from an RPIK and UNIX epoch
+ * 
+ * @param rpik The Temporary Exposure Key to encrypt the RPI
+ * @param epoch The current UNIX epoch time
+ * @return An encrypted Tracer Rolling Proximity Identifier
+ */
+tracer_rpi tracer_derive_rpi(tracer_rpik rpik, uint32_t epoch) {
+    aes_ctx rpik_ctx;
+
+    aes_ctx_init(&rpik_ctx, rpik.value, sizeof(rpik.value));
+    tracer_rpi out = tracer_derive_rpi_keyed(&rpik_ctx, epoch);
+    aes_ctx_free(&rpik_ctx);
+
+    return out;
+}
+
+/**
+ * @brief Compares the value of two datapairs without copying them
+ * 
+ * @param a A pointer to a datapair to compare
+ * @param b A pointer to a datapair to compare
+ * @return Whether or not the datapairs match
+ */
+bool tracer_compare_datapairs_v2(const tracer_datapair * a, const tracer_datapair * b) {
+    return memcmp(a->aem.value, b->aem.value, sizeof(a->aem.value)) == 0 && memcmp(a->rpi.value, b->rpi.value, sizeof(a->rpi.value)) == 0;
+}
+
 /**
  * @brief Compares the value of two datapairs
  * 
@@ -214,7 +318,7 @@ tracer_rpi tracer_derive_rpi(tracer_rpik rpik, uint32_t epoch) {
  * @return Whether or not the datapairs match
  */
 bool tracer_compare_datapairs(tracer_datapair a, tracer_datapair b) {
-    return memcmp(&a.aem.value, &b.aem.value, sizeof(a.aem.value)) == 0 && memcmp(&a.rpi.value, &b.rpi.value, sizeof(a.rpi.value)) == 0;
+    return tracer_compare_datapairs_v2(&a, &b);
 }
 
 /**
@@ -235,6 +339,36 @@ tracer_metadata tracer_derive_metadata(int8_t tx_power) {
     return out;
 }
 
+/**
+ * @brief Expands an Associated Encrypted Metadata Key from a Temporary Exposure Key's extracted HKDF key
+ * 
+ * @param prk A pointer to the TEK's pseudorandom key, as extracted by hkdf_extract()
+ * @return The TEK's corresponding AEMK
+ */
+tracer_aemk tracer_expand_aemk(const hkdf_prk * prk) {
+    tracer_aemk out;
+
+    uint8_t info[AES128_BLOCK_SIZE] = AEMK_STRING;
+
+    hkdf_expand(prk, info, sizeof(info), sizeof(out.value), out.value);
+
+    return out;
+}
+
+/**
+ * @brief Derives an corresponding Associated Encrypted Metadata Key from a Temporary Exposure Key without copying either
+ * 
+ * @param tek A pointer to the TEK to derive the AEMK from
+ * @param out A pointer to the AEMK to overwrite
+ */
+void tracer_derive_aemk_v2(const tracer_tek * tek, tracer_aemk * out) {
+    hkdf_prk prk;
+
+    hkdf_extract(tek->value, sizeof(tek->value), &prk);
+    *out = tracer_expand_aemk(&prk);
+    hkdf_prk_free(&prk);
+}
+
 /**
  * @brief Derives an corresponding Associated Encrypted Metadata Key from a Temporary Exposure Key
  * 
@@ -243,12 +377,22 @@ tracer_metadata tracer_derive_metadata(int8_t tx_power) {
  */
 tracer_aemk tracer_derive_aemk(tracer_tek tek) {
     tracer_aemk out;
+    tracer_derive_aemk_v2(&tek, &out);
+    return out;
+}
 
-    uint8_t info[AES128_BLOCK_SIZE] = AEMK_STRING;
+/**
+ * @brief Encrypts metadata given an AEMK's AES context and Rolling Proximity Identifier
+ * 
+ * @param aemk_ctx A pointer to an AES context initialized with the Associated Encrypted Metadata Key
+ * @param rpi The RPI to associate the metadata with
+ * @param metadata The source metadata
+ * @return The 4-byte encrypted metadata
+ */
+tracer_aem tracer_derive_aem_keyed(aes_ctx * aemk_ctx, tracer_rpi rpi, tracer_metadata metadata) {
+    tracer_aem out;
 
-    hkdf(tek.value, sizeof(tek.value),
-        NULL, 0, 
-        info, sizeof(info), sizeof(out.value), out.value);
+    aes_ctx_flip_ctr(aemk_ctx, rpi.value, metadata.value, sizeof(metadata.value), out.value);
 
     return out;
 }
@@ -269,43 +413,206 @@ tracer_aem tracer_derive_aem(tracer_aemk aemk, tracer_rpi rpi, tracer_metadata m
     return out;
 }
 
+/**
+ * @brief Derives a tracer keypair for generating an RPI and AEM without copying the TEK or the keypair
+ * 
+ * @param tek A pointer to the Temporary Exposure Key to derive the keypair from
+ * @param out A pointer to the keypair to overwrite
+ */
+void tracer_derive_keypair_v2(const tracer_tek * tek, tracer_keypair * out) {
+    hkdf_prk prk;
+
+    hkdf_extract(tek->value, sizeof(tek->value), &prk);
+    out->rpik = tracer_expand_rpik(&prk);
+    out->aemk = tracer_expand_aemk(&prk);
+    hkdf_prk_free(&prk);
+}
+
 /**
  * @brief Derives a tracer keypair for generating an RPI and AEM
  * 
+ * Both keys are expanded from the same HKDF extraction of the TEK, so this costs about as much as deriving one of them.
+ * 
  * @param tek The Temporary Exposure Key to derive the keypair from
  * @return A keypair containing both an Rolling Proximity Identifier Key and Associated Encrypted Metadata Key
  */
 tracer_keypair tracer_derive_keypair(tracer_tek tek) {
     tracer_keypair out;
-    out.rpik = tracer_derive_rpik(tek);
-    out.aemk = tracer_derive_aemk(tek);
+    tracer_derive_keypair_v2(&tek, &out);
     return out;
 }
 
 /**
- * @brief Derives a new raw BLE payload given a datapair.
+ * @brief Expands the AES key schedules of a keypair
  * 
- * @param datapair The datapair to generate the BLE payload from
- * @return A raw bluetooth payload containing all required data
+ * @param ctx A pointer to the keypair context to initialize. It should be freed with tracer_keypair_ctx_free() after use.
+ * @param keypair The keypair to expand
  */
-tracer_ble_payload tracer_derive_ble_payload(tracer_datapair datapair) {
-    tracer_ble_payload out;
-    
+void tracer_keypair_ctx_init(tracer_keypair_ctx * ctx, tracer_keypair keypair) {
+    aes_ctx_init(&ctx->rpik, keypair.rpik.value, sizeof(keypair.rpik.value));
+    aes_ctx_init(&ctx->aemk, keypair.aemk.value, sizeof(keypair.aemk.value));
+}
+
+/**
+ * @brief Frees the AES key schedules of a keypair
+ * 
+ * @param ctx A pointer to the keypair context to free
+ */
+void tracer_keypair_ctx_free(tracer_keypair_ctx * ctx) {
+    aes_ctx_free(&ctx->rpik);
+    aes_ctx_free(&ctx->aemk);
+}
+
+/**
+ * @brief A TEK whose keys have been expanded, kept in the key cache
+ */
+typedef struct {
+    uint8_t tek[16];            /** The value of the TEK the keys were derived from */
+    tracer_keypair_ctx ctx;     /** The AES contexts of the TEK's keys. The AEMK context is only valid if has_aemk is set. */
+    bool has_aemk;              /** Whether or not the AEMK has been expanded. It is only needed for matches, so it is expanded lazily. */
+    uint32_t last_used;         /** The cache tick of the entry's last lookup, or 0 if the entry is unused */
+} tracer_key_cache_entry;
+
+/**
+ * @brief The hit-rate counters of the key cache
+ */
+typedef struct {
+    uint32_t hits;              /** The number of lookups that found their TEK in the cache */
+    uint32_t misses;            /** The number of lookups that had to expand their TEK's keys */
+    uint32_t evictions;         /** The number of entries dropped to make room for another TEK */
+} tracer_key_cache_stats;
+
+#if TRACER_KEY_CACHE_SIZE > 0
+
+tracer_key_cache_entry tracer_key_cache[TRACER_KEY_CACHE_SIZE];
+tracer_key_cache_stats tracer_key_cache_counters = { 0 };
+uint32_t _tracer_key_cache_tick = 0;
+
+/**
+ * @brief Finds a TEK in the key cache, expanding its RPIK into the least recently used entry if it isn't there.
+ * 
+ * The returned entry stays valid until the next lookup or tracer_key_cache_clear().
+ * 
+ * @param tek A pointer to the TEK to look up
+ * @return A pointer to the TEK's cache entry. Its RPIK context is always ready.
+ */
+tracer_key_cache_entry * tracer_key_cache_get(const tracer_tek * tek) {
+    tracer_key_cache_entry * lru = &tracer_key_cache[0];
+
+    _tracer_key_cache_tick++;
+
+    for (size_t i = 0; i < TRACER_KEY_CACHE_SIZE; i++) {
+        tracer_key_cache_entry * entry = &tracer_key_cache[i];
+        if (entry->last_used && memcmp(entry->tek, tek->value, sizeof(entry->tek)) == 0) {
+            entry->last_used = _tracer_key_cache_tick;
+            tracer_key_cache_counters.hits++;
+            return entry;
+        }
+        if (entry->last_used < lru->last_used) lru = entry;
+    }
+
+    tracer_key_cache_counters.misses++;
+
+    if (lru->last_used) {
+        tracer_key_cache_counters.evictions++;
+        tracer_keypair_ctx_free(&lru->ctx);
+    }
+
+    tracer_rpik rpik;
+    tracer_derive_rpik_v2(tek, &rpik);
+
+    memcpy(lru->tek, tek->value, sizeof(lru->tek));
+    aes_ctx_init(&lru->ctx.rpik, rpik.value, sizeof(rpik.value));
+    lru->has_aemk = false;
+    lru->last_used = _tracer_key_cache_tick;
+
+    return lru;
+}
+
+/**
+ * @brief Gets the AEMK context of a key cache entry, expanding it if needed.
+ * 
+ * @param entry A pointer to an entry from tracer_key_cache_get()
+ * @return A pointer to the entry's AEMK context
+ */
+aes_ctx * tracer_key_cache_aemk(tracer_key_cache_entry * entry) {
+    if (!entry->has_aemk) {
+        tracer_tek tek;
+        tracer_aemk aemk;
+
+        memcpy(tek.value, entry->tek, sizeof(tek.value));
+        tracer_derive_aemk_v2(&tek, &aemk);
+        aes_ctx_init(&entry->ctx.aemk, aemk.value, sizeof(aemk.value));
+        entry->has_aemk = true;
+    }
+
+    return &entry->ctx.aemk;
+}
+
+#endif
+
+/**
+ * @brief Empties the key cache, wiping the cached keys and resetting the hit-rate counters. Does nothing if the cache is disabled.
+ */
+void tracer_key_cache_clear() {
+#if TRACER_KEY_CACHE_SIZE > 0
+    for (size_t i = 0; i < TRACER_KEY_CACHE_SIZE; i++) {
+        tracer_key_cache_entry * entry = &tracer_key_cache[i];
+        if (entry->last_used) tracer_keypair_ctx_free(&entry->ctx);
+        memset(entry, 0, sizeof(tracer_key_cache_entry));
+    }
+
+    memset(&tracer_key_cache_counters, 0, sizeof(tracer_key_cache_counters));
+    _tracer_key_cache_tick = 0;
+#endif
+}
+
+/**
+ * @brief Gets the hit-rate counters of the key cache.
+ * 
+ * @return The counters since the last tracer_key_cache_clear(). Always zero if the cache is disabled.
+ */
+tracer_key_cache_stats tracer_key_cache_get_stats() {
+#if TRACER_KEY_CACHE_SIZE > 0
+    return tracer_key_cache_counters;
+#else
+    tracer_key_cache_stats out = { 0 };
+    return out;
+#endif
+}
+
+/**
+ * @brief Derives a new raw BLE payload given a pointer to a datapair.
+ * 
+ * @param datapair A pointer to the datapair to generate the BLE payload from
+ * @param out A pointer to the BLE payload to overwrite
+ */
+void tracer_derive_ble_payload_v2(const tracer_datapair * datapair, tracer_ble_payload * out) {
     uint8_t flags[]          =  { 0x1a };
     uint8_t uuid[]           =  { 0x6f, 0xfd };     // the ESP32 is little-endian, and so is BLE. However, human readable stuff is big-endian.
     uint8_t service_data[2 
-        + sizeof(datapair.rpi.value) 
-        + sizeof(datapair.aem.value)] =  { 0x6f, 0xfd };
+        + sizeof(datapair->rpi.value) 
+        + sizeof(datapair->aem.value)] =  { 0x6f, 0xfd };
     
-    memcpy(service_data + 2, datapair.rpi.value, sizeof(datapair.rpi.value));
-    memcpy(service_data + 2 + sizeof(datapair.rpi.value), datapair.aem.value, sizeof(datapair.aem.value));
+    memcpy(service_data + 2, datapair->rpi.value, sizeof(datapair->rpi.value));
+    memcpy(service_data + 2 + sizeof(datapair->rpi.value), datapair->aem.value, sizeof(datapair->aem.value));
     
-    out.len = 0;        // haha, it was YOU! darn you, uninitialized values!
+    out->len = 0;       // haha, it was YOU! darn you, uninitialized values!
 
-    tracer_ble_payload_add_record(&out, 0x01, flags,        sizeof(flags));         // set bluetooth flags
-    tracer_ble_payload_add_record(&out, 0x03, uuid,         sizeof(uuid));          // set service uuid
-    tracer_ble_payload_add_record(&out, 0x16, service_data, sizeof(service_data));  // set service data
+    tracer_ble_payload_add_record(out, 0x01, flags,        sizeof(flags));          // set bluetooth flags
+    tracer_ble_payload_add_record(out, 0x03, uuid,         sizeof(uuid));           // set service uuid
+    tracer_ble_payload_add_record(out, 0x16, service_data, sizeof(service_data));   // set service data
+}
 
+/**
+ * @brief Derives a new raw BLE payload given a datapair.
+ * 
+ * @param datapair The datapair to generate the BLE payload from
+ * @return A raw bluetooth payload containing all required data
+ */
+tracer_ble_payload tracer_derive_ble_payload(tracer_datapair datapair) {
+    tracer_ble_payload out;
+    tracer_derive_ble_payload_v2(&datapair, &out);
     return out;
 }
 
@@ -321,7 +628,10 @@ tracer_tek * tracer_derive_tek(uint32_t epoch) {
     out->epoch = epoch;
     rng_gen(sizeof(out->value), out->value);
 
-    tracer_current_keypair = tracer_derive_keypair(*out);
+    tracer_derive_keypair_v2(out, &tracer_current_keypair);
+
+    tracer_keypair_ctx_free(&tracer_current_keypair_ctx);
+    tracer_keypair_ctx_init(&tracer_current_keypair_ctx, tracer_current_keypair);
 
     return out;
 }
@@ -335,6 +645,80 @@ tracer_tek tracer_get_latest_tek() {
     return tracer_tek_array[(tracer_tek_array_head ? tracer_tek_array_head : TRACER_TEK_STORE_PERIOD) - 1];
 }
 
+#define TRACER_ADV_FAST_LEN     31      // the length of a payload laid out like tracer_derive_ble_payload_v2()'s
+#define TRACER_ADV_FAST_OFFSET  3       // where the uuid record starts in such a payload, right after the flags record
+
+// the uuid and service data record headers of a payload laid out like tracer_derive_ble_payload_v2()'s
+const uint8_t _tracer_adv_fast_header[] = { 0x03, 0x03, 0x6f, 0xfd, 0x17, 0x16, 0x6f, 0xfd };
+
+/**
+ * @brief Attempts to parse raw BLE advertising data in place, without copying it.
+ *
+ * Payloads laid out exactly like the ones from tracer_derive_ble_payload_v2() are checked at fixed offsets. Anything
+ * else is walked record by record, and rejected as soon as it has a service UUID list without the exposure notification UUID in it.
+ * Never reads past adv_data_len bytes.
+ *
+ * @param adv_data A pointer to the raw advertising data
+ * @param adv_data_len The length of the advertising data
+ * @param datapair A pointer to a datapair which will be overwritten with the drived datapair in the case that the data is valid. Can be NULL to only check the data.
+ * @return Whether or not the parsing was successful
+ */
+bool tracer_parse_adv_data(const uint8_t * adv_data, size_t adv_data_len, tracer_datapair * datapair) {
+    const size_t service_data_len = 2 + sizeof(datapair->rpi.value) + sizeof(datapair->aem.value);
+    const uint8_t * service_data = NULL;
+    bool uuid_valid = false;
+
+    if (adv_data_len == TRACER_ADV_FAST_LEN && adv_data[0] == 2 && adv_data[1] == 0x01
+        && memcmp(adv_data + TRACER_ADV_FAST_OFFSET, _tracer_adv_fast_header, sizeof(_tracer_adv_fast_header)) == 0) {
+        service_data = adv_data + TRACER_ADV_FAST_OFFSET + sizeof(_tracer_adv_fast_header) - 2;  // the header ends with the service data's uuid
+        uuid_valid = true;
+    } else {
+        for (size_t i = 0; i < adv_data_len;) {
+            uint8_t record_len = adv_data[i++];
+
+            if (record_len == 0) break;                         // a zero-length record ends the significant part of the payload
+            if (record_len > adv_data_len - i) return false;    // segfault bad. >:( this protects the parser from them.
+
+            uint8_t type = adv_data[i];
+            const uint8_t * data = adv_data + i + 1;
+            uint8_t data_len = record_len - 1;
+
+            switch (type) {
+                case 0x02:  // incomplete list of 16-bit service uuids
+                case 0x03:  // complete list of 16-bit service uuids
+                    // the exposure notification uuid doesn't have to come first in the list
+                    for (uint8_t j = 0; j + 1 < data_len && !uuid_valid; j += 2) uuid_valid = data[j] == 0x6f && data[j + 1] == 0xfd;
+                    if (!uuid_valid) return false;  // not the contact tracing standard, so stop looking
+                break;
+                case 0x16:  // service data
+                    if (data_len == service_data_len && data[0] == 0x6f && data[1] == 0xfd) service_data = data;
+                break;
+            }
+            i += record_len;
+        }
+
+        if (!uuid_valid || service_data == NULL) return false;
+    }
+
+    if (datapair) {
+        memcpy(datapair->rpi.value, service_data + 2, sizeof(datapair->rpi.value));
+        memcpy(datapair->aem.value, service_data + 2 + sizeof(datapair->rpi.value), sizeof(datapair->aem.value));
+    }
+
+    return true;
+}
+
+/**
+ * @brief Attempts to parse a raw BLE adverising payload without copying it
+ * 
+ * @param payload A pointer to the raw bluetooth payload to parse
+ * @param datapair A pointer to a datapair which will be overwritten with the drived datapair in the case that the data is valid.
+ * @return Whether or not the parsing was successful
+ */
+bool tracer_parse_ble_payload_v2(const tracer_ble_payload * payload, tracer_datapair * datapair) {
+    return tracer_parse_adv_data(payload->value, payload->len < sizeof(payload->value) ? payload->len : sizeof(payload->value), datapair);
+}
+
 /**
  * @brief Attempts to parse a raw BLE adverising payload
  * 
@@ -343,36 +727,7 @@ tracer_tek tracer_get_latest_tek() {
  * @return Whether or not the parsing was successful
  */
 bool tracer_parse_ble_payload(tracer_ble_payload payload, tracer_datapair * datapair) {
-
-    bool output_valid = false, payload_valid = false;
-    for (uint8_t i = 0; i < payload.len;) {
-        uint8_t record_len = payload.value[i++];
-
-        if (i + record_len > payload.len) return false; // segfault bad. >:( this protects the parser from them.
-
-        uint8_t type = payload.value[i++];
-
-        uint8_t * data = payload.value + i;
-        uint8_t data_len = record_len - 1;
-
-        switch (type) {
-            case 0x03:  // service uuid
-                payload_valid = *(uint16_t *)(data) == 0xFD6F; // check if the service id matches the contact tracing standard
-            break;
-            case 0x16:  // service data
-                if (data_len == 2 + sizeof(datapair->rpi.value) + sizeof(datapair->aem.value)) {    // check if the package is the right size
-                    if (datapair) {
-                        memcpy(datapair->rpi.value, data + 2, sizeof(datapair->rpi.value));
-                        memcpy(datapair->aem.value, data + 2 + sizeof(datapair->rpi.value), sizeof(datapair->aem.value));
-                    }
-                    output_valid = true;
-                }
-            break;
-        }
-        i += data_len;
-    }
-
-    return output_valid && payload_valid;
+    return tracer_parse_ble_payload_v2(&payload, datapair);
 }
 
 /**
@@ -409,6 +764,91 @@ bool tracer_detect_tek_rollover(uint32_t last_epoch, uint32_t current_epoch) {
     return ((current_enin > last_enin) && ((current_enin % TRACER_ENINS_PER_DAY) == 0)) || (current_enin - last_enin >= TRACER_ENINS_PER_DAY);
 }
 
+// checks if a decrypted rpi starts with the "EN-RPI" padding. the first 8 bytes of the padding are compared as one word instead of bytewise.
+bool _tracer_has_rpi_prefix(const uint8_t decrypted_rpi[AES128_BLOCK_SIZE]) {
+    const uint8_t padding[sizeof(uint64_t)] = RPI_STRING;   // the rest of the padding is zeroes
+    uint64_t expected, actual;
+
+    memcpy(&expected, padding, sizeof(expected));
+    memcpy(&actual, decrypted_rpi, sizeof(actual));
+
+    return actual == expected;
+}
+
+/**
+ * @brief Checks if a scanned RPI and AEM pair matches a TEK whose keys have already been expanded.
+ * 
+ * @param datapair A pointer to the input scanned datapair, which can derived from tracer_parse_ble_payload().
+ * @param rpik_ctx A pointer to an AES context initialized with the TEK's Rolling Proximity Identifier Key.
+ * @param aemk_ctx A pointer to an AES context initialized with the TEK's Associated Encrypted Metadata Key. Only required if @p output_metadata is not NULL.
+ * @param enin A pointer to a 32-bit unsigned integer which will be overwritten with the datapair's generation ENIntervalNumber in the case of a TEK match
+ * @param output_metadata A pointer to a metadata object which will be overwritten with the datapair's decrypted metadata in the case of a TEK match
+ * @return Whether or not the datapair was successfully decrypted
+ */
+bool tracer_verify_keyed(const tracer_datapair * datapair, aes_ctx * rpik_ctx, aes_ctx * aemk_ctx, uint32_t * enin, tracer_metadata * output_metadata) {
+    uint8_t decrypted_rpi[AES128_BLOCK_SIZE];
+
+    aes_ctx_decrypt_block(rpik_ctx, datapair->rpi.value, decrypted_rpi);
+
+    bool valid = _tracer_has_rpi_prefix(decrypted_rpi);
+
+    if (valid) {
+        if (enin) memcpy(enin, decrypted_rpi + AES128_BLOCK_SIZE - sizeof(uint32_t), sizeof(uint32_t));
+        if (output_metadata) aes_ctx_flip_ctr(aemk_ctx, datapair->rpi.value, datapair->aem.value, sizeof(datapair->aem.value), output_metadata->value);
+    }
+
+    return valid;
+}
+
+/**
+ * @brief Checks if a scanned RPI and AEM pair matches a downloaded TEK without copying either.
+ * 
+ * The TEK's expanded keys are kept in the key cache, so checking many datapairs against the same TEKs only derives each TEK's keys once.
+ * 
+ * @param datapair A pointer to the input scanned datapair, which can derived from tracer_parse_ble_payload().
+ * @param tek A pointer to the Temporary Exposure Key to test the datapair against.
+ * @param enin A pointer to a 32-bit unsigned integer which will be overwritten with the datapair's generation ENIntervalNumber in the case of a TEK match
+ * @param output_metadata A pointer to a metadata object which will be overwritten with the datapair's decrypted metadata in the case of a TEK match
+ * @return Whether or not the datapair was successfully decrypted
+ */
+bool tracer_verify_v2(const tracer_datapair * datapair, const tracer_tek * tek, uint32_t * enin, tracer_metadata * output_metadata) {
+#if TRACER_KEY_CACHE_SIZE > 0
+    tracer_key_cache_entry * entry = tracer_key_cache_get(tek);
+
+    bool valid = tracer_verify_keyed(datapair, &entry->ctx.rpik, NULL, enin, NULL);
+
+    if (valid && output_metadata) {
+        aes_ctx_flip_ctr(tracer_key_cache_aemk(entry), datapair->rpi.value, datapair->aem.value, sizeof(datapair->aem.value), output_metadata->value);
+    }
+
+    return valid;
+#else
+    hkdf_prk prk;
+    hkdf_extract(tek->value, sizeof(tek->value), &prk);
+
+    tracer_rpik rpik = tracer_expand_rpik(&prk);
+
+    aes_ctx rpik_ctx;
+    aes_ctx_init(&rpik_ctx, rpik.value, sizeof(rpik.value));
+
+    bool valid = tracer_verify_keyed(datapair, &rpik_ctx, NULL, enin, NULL);
+
+    if (valid && output_metadata) {
+        tracer_aemk aemk = tracer_expand_aemk(&prk);
+
+        aes_ctx aemk_ctx;
+        aes_ctx_init(&aemk_ctx, aemk.value, sizeof(aemk.value));
+        aes_ctx_flip_ctr(&aemk_ctx, datapair->rpi.value, datapair->aem.value, sizeof(datapair->aem.value), output_metadata->value);
+        aes_ctx_free(&aemk_ctx);
+    }
+
+    aes_ctx_free(&rpik_ctx);
+    hkdf_prk_free(&prk);
+
+    return valid;
+#endif
+}
+
 /**
  * @brief Checks if a scanned RPI and AEM pair matches a downloaded TEK.
  * 
@@ -419,39 +859,91 @@ bool tracer_detect_tek_rollover(uint32_t last_epoch, uint32_t current_epoch) {
  * @return Whether or not the datapair was successfully decrypted
  */
 bool tracer_verify(tracer_datapair datapair, tracer_tek tek, uint32_t * enin, tracer_metadata * output_metadata) {
-    tracer_rpik rpik = tracer_derive_rpik(tek);
+    return tracer_verify_v2(&datapair, &tek, enin, output_metadata);
+}
 
-    uint8_t * decrypted_rpi = (uint8_t *)decrypt_aes_block(rpik.value, sizeof(rpik.value), datapair.rpi.value, NULL);
+/**
+ * @brief Checks a run of scanned datapairs against one TEK whose RPIK has already been expanded.
+ * 
+ * The RPIs are decrypted TRACER_BATCH_SIZE at a time, which keeps several blocks in flight where the platform allows it.
+ * 
+ * @param datapairs A pointer to an array of scanned datapairs.
+ * @param len The number of datapairs in the array.
+ * @param rpik_ctx A pointer to an AES context initialized with the TEK's Rolling Proximity Identifier Key.
+ * @param matches A pointer to an array of @p len booleans which will be overwritten with whether or not each datapair matched.
+ * @param enins A pointer to an array of @p len 32-bit unsigned integers. The entries of matching datapairs will be overwritten with their generation ENIntervalNumber. Can be NULL.
+ * @return The number of datapairs which matched
+ */
+size_t tracer_verify_batch_keyed(const tracer_datapair * datapairs, size_t len, aes_ctx * rpik_ctx, bool * matches, uint32_t * enins) {
+    uint8_t blocks[TRACER_BATCH_SIZE][AES128_BLOCK_SIZE];
+    size_t match_count = 0;
 
-    bool valid = memcmp(decrypted_rpi, RPI_STRING, sizeof(RPI_STRING)) == 0;
+    for (size_t head = 0; head < len; head += TRACER_BATCH_SIZE) {
+        size_t batch_len = (len - head < TRACER_BATCH_SIZE) ? len - head : TRACER_BATCH_SIZE;
 
-    if (valid) {
-        if (enin) *enin = *(uint32_t*)(decrypted_rpi + AES128_BLOCK_SIZE - sizeof(uint32_t));
-        if (output_metadata) {
-            tracer_aemk aemk = tracer_derive_aemk(tek);
-            flip_aes_block_ctr(aemk.value, AES128_KEY_SIZE, datapair.rpi.value, datapair.aem.value, sizeof(datapair.aem.value), output_metadata->value);
+        for (size_t i = 0; i < batch_len; i++) memcpy(blocks[i], datapairs[head + i].rpi.value, AES128_BLOCK_SIZE);
+
+        aes_ctx_decrypt_blocks(rpik_ctx, blocks, blocks, batch_len);
+
+        for (size_t i = 0; i < batch_len; i++) {
+            matches[head + i] = _tracer_has_rpi_prefix(blocks[i]);
+            if (matches[head + i]) {
+                match_count++;
+                if (enins) memcpy(&enins[head + i], blocks[i] + AES128_BLOCK_SIZE - sizeof(uint32_t), sizeof(uint32_t));
+            }
         }
     }
 
-    free(decrypted_rpi);
+    return match_count;
+}
 
-    return valid;
+/**
+ * @brief Checks a run of scanned datapairs against one downloaded TEK.
+ * 
+ * @param datapairs A pointer to an array of scanned datapairs.
+ * @param len The number of datapairs in the array.
+ * @param tek A pointer to the Temporary Exposure Key to test the datapairs against.
+ * @param matches A pointer to an array of @p len booleans which will be overwritten with whether or not each datapair matched.
+ * @param enins A pointer to an array of @p len 32-bit unsigned integers. The entries of matching datapairs will be overwritten with their generation ENIntervalNumber. Can be NULL.
+ * @return The number of datapairs which matched
+ */
+size_t tracer_verify_batch(const tracer_datapair * datapairs, size_t len, const tracer_tek * tek, bool * matches, uint32_t * enins) {
+    tracer_rpik rpik;
+    tracer_derive_rpik_v2(tek, &rpik);
+
+    aes_ctx rpik_ctx;
+    aes_ctx_init(&rpik_ctx, rpik.value, sizeof(rpik.value));
+
+    size_t match_count = tracer_verify_batch_keyed(datapairs, len, &rpik_ctx, matches, enins);
+
+    aes_ctx_free(&rpik_ctx);
+
+    return match_count;
 }
 
 /**
- * @brief Derives a RPI-AEM pair given a unix epoch and tx power. This can be used to create bluetooth payloads.
+ * @brief Derives a RPI-AEM pair given a unix epoch and tx power into a caller-provided datapair.
  * 
  * @param epoch The UNIX epoch time, expressed as a 32-bit unsigned integer
  * @param tx_power The transmitting power of the transmitter in dBm, expressed as an 8-bit signed integer
+ * @param out A pointer to the datapair to overwrite
  */
-tracer_datapair tracer_derive_datapair(uint32_t epoch, int8_t tx_power) {
-    tracer_datapair out;
-
+void tracer_derive_datapair_v2(uint32_t epoch, int8_t tx_power, tracer_datapair * out) {
     tracer_metadata meta = tracer_derive_metadata(tx_power);
 
-    out.rpi = tracer_derive_rpi(tracer_current_keypair.rpik, epoch);
-    out.aem = tracer_derive_aem(tracer_current_keypair.aemk, out.rpi, meta);
+    out->rpi = tracer_derive_rpi_keyed(&tracer_current_keypair_ctx.rpik, epoch);
+    out->aem = tracer_derive_aem_keyed(&tracer_current_keypair_ctx.aemk, out->rpi, meta);
+}
 
+/**
+ * @brief Derives a RPI-AEM pair given a unix epoch and tx power. This can be used to create bluetooth payloads.
+ * 
+ * @param epoch The UNIX epoch time, expressed as a 32-bit unsigned integer
+ * @param tx_power The transmitting power of the transmitter in dBm, expressed as an 8-bit signed integer
+ */
+tracer_datapair tracer_derive_datapair(uint32_t epoch, int8_t tx_power) {
+    tracer_datapair out;
+    tracer_derive_datapair_v2(epoch, tx_power, &out);
     return out;
 }
 
@@ -1,13 +1,16 @@
-#include "esp_system.h"
+#include "tracer_crypto_backend.h"
+#include "tracer_crypto_mbedtls.h"
+#ifdef TRACER_CRYPTO_OPENSSL
+#include "tracer_crypto_openssl.h"
+#endif
+#include "tracer_crypto_x86.h"
 
-#include "mbedtls/sha256.h"
-#include "mbedtls/aes.h"
-#include "mbedtls/hkdf.h"
 #include "mbedtls/base64.h"
 
 #include "string.h"
 #include "stdlib.h"
 #include "stdint.h"
+#include "stdbool.h"
 
 #ifndef _TRACER_CRYPTO_H_
 #define _TRACER_CRYPTO_H_
@@ -15,11 +18,68 @@
 /**
  * @file 
  * @brief A standard API for all of the cryptographic functions outlined in the preliminary standard (v1.2)
+ * 
+ * The primitives are provided by one of the backends described in tracer_crypto_backend.h.
 **/
 
-#define SHA256_HASH_SIZE 32
-#define AES128_BLOCK_SIZE 16
-#define AES128_KEY_SIZE 16
+/**
+ * @brief Every crypto backend built into this binary, in order of preference.
+ */
+const tracer_crypto_backend * const tracer_crypto_backends[] = {
+#ifdef TRACER_CRYPTO_OPENSSL
+    &tracer_crypto_openssl,     // libcrypto ships its own hand-tuned assembly, so it wins wherever it is linked
+#endif
+#ifdef TRACER_CRYPTO_X86
+    &tracer_crypto_x86,
+#endif
+    &tracer_crypto_mbedtls,
+};
+
+#define TRACER_CRYPTO_BACKEND_COUNT (sizeof(tracer_crypto_backends) / sizeof(tracer_crypto_backends[0]))
+
+const tracer_crypto_backend * _tracer_crypto_backend = NULL;     // the backend used by new contexts. set by tracer_crypto_init().
+
+bool tracer_crypto_init();
+bool tracer_crypto_set_backend(const tracer_crypto_backend * backend);
+
+/**
+ * @brief Gets the crypto backend used by new AES contexts and HKDF keys.
+ * 
+ * If tracer_crypto_init() hasn't been called yet, it is called now, so the first use of any crypto function picks
+ * the backend. Doing that from several threads at once is a race, so call tracer_crypto_init() before starting them.
+ * 
+ * @return A pointer to the current backend.
+ */
+const tracer_crypto_backend * tracer_crypto_get_backend() {
+    if (_tracer_crypto_backend == NULL) tracer_crypto_init();
+    return _tracer_crypto_backend;
+}
+
+/**
+ * @brief A SHA-256 state of any of the built backends
+ */
+typedef union {
+    mbedtls_sha256_context mbedtls;
+#ifdef TRACER_CRYPTO_OPENSSL
+    SHA256_CTX openssl;
+#endif
+#ifdef TRACER_CRYPTO_X86
+    _x86_sha256_state x86;
+#endif
+} _sha256_state;
+
+/**
+ * @brief An AES key schedule of any of the built backends
+ */
+typedef union {
+    _mbedtls_aes_state mbedtls;
+#ifdef TRACER_CRYPTO_OPENSSL
+    _openssl_aes_state openssl;
+#endif
+#ifdef TRACER_CRYPTO_X86
+    _x86_aes_state x86;
+#endif
+} _aes_state;
 
 /**
  * @brief Fills or allocates a buffer with zeroes.
@@ -52,10 +112,181 @@ uint8_t * rng_gen(size_t len, void * output) {
     if (output == NULL) out = (uint8_t*)malloc(len);
     else out = (uint8_t*)output;
 
-    esp_fill_random(out, len);
+    tracer_crypto_get_backend()->rng(out, len);
+
     return out;
 }
 
+/**
+ * @brief An HKDF-SHA256 pseudorandom key, with its HMAC pads already absorbed into SHA-256 states.
+ * 
+ * This is the output of hkdf_extract(). Any number of keys can be expanded from it with hkdf_expand(),
+ * and each expansion skips both the extract step and the HMAC key setup.
+ */
+typedef struct {
+    const tracer_crypto_backend * backend;  /** The backend the states belong to */
+    _sha256_state ipad;                     /** The SHA-256 state after absorbing the key XOR'd with the inner pad */
+    _sha256_state opad;                     /** The SHA-256 state after absorbing the key XOR'd with the outer pad */
+} hkdf_prk;
+
+hkdf_prk _hkdf_zero_salt;               // hmac pad states of the empty salt. every tek is extracted with it, so it is only computed once per backend.
+bool _hkdf_zero_salt_ready = false;     // whether _hkdf_zero_salt holds states that have to be freed
+
+// absorbs an hmac-sha256 key into a pair of pad states with the current backend.
+void _hmac_sha256_setkey(hkdf_prk * out, const uint8_t * key, size_t key_len) {
+    const tracer_crypto_backend * backend = tracer_crypto_get_backend();
+    uint8_t pad[SHA256_BLOCK_SIZE], hashed_key[SHA256_HASH_SIZE];
+
+    out->backend = backend;
+
+    if (key_len > SHA256_BLOCK_SIZE) {     // long keys are hashed first
+        backend->sha256_start(&out->ipad);
+        backend->sha256_update(&out->ipad, key, key_len);
+        backend->sha256_finish(&out->ipad, hashed_key);
+        backend->sha256_free(&out->ipad);
+        key = hashed_key;
+        key_len = sizeof(hashed_key);
+    }
+
+    memset(pad, 0x36, sizeof(pad));
+    for (size_t i = 0; i < key_len; i++) pad[i] ^= key[i];
+    backend->sha256_start(&out->ipad);
+    backend->sha256_update(&out->ipad, pad, sizeof(pad));
+
+    memset(pad, 0x5c, sizeof(pad));
+    for (size_t i = 0; i < key_len; i++) pad[i] ^= key[i];
+    backend->sha256_start(&out->opad);
+    backend->sha256_update(&out->opad, pad, sizeof(pad));
+
+    memset(pad, 0, sizeof(pad));
+    memset(hashed_key, 0, sizeof(hashed_key));
+}
+
+// computes hmac-sha256 over up to three concatenated buffers, starting from a pair of pad states.
+void _hmac_sha256_finish(const hkdf_prk * key, const uint8_t * a, size_t a_len, const uint8_t * b, size_t b_len, const uint8_t * c, size_t c_len, uint8_t output[SHA256_HASH_SIZE]) {
+    const tracer_crypto_backend * backend = key->backend;
+    _sha256_state ctx;
+    uint8_t inner[SHA256_HASH_SIZE];
+
+    backend->sha256_clone(&ctx, &key->ipad);
+    if (a_len) backend->sha256_update(&ctx, a, a_len);
+    if (b_len) backend->sha256_update(&ctx, b, b_len);
+    if (c_len) backend->sha256_update(&ctx, c, c_len);
+    backend->sha256_finish(&ctx, inner);
+    backend->sha256_free(&ctx);
+
+    backend->sha256_clone(&ctx, &key->opad);
+    backend->sha256_update(&ctx, inner, sizeof(inner));
+    backend->sha256_finish(&ctx, output);
+    backend->sha256_free(&ctx);
+
+    memset(inner, 0, sizeof(inner));
+}
+
+// runs the extract step of hkdf-sha256 with the pad states of a salt.
+void _hkdf_extract_salted(const hkdf_prk * salt, const void * key, size_t key_len, hkdf_prk * prk) {
+    uint8_t prk_value[SHA256_HASH_SIZE];
+
+    _hmac_sha256_finish(salt, (const uint8_t *)key, key_len, NULL, 0, NULL, 0, prk_value);
+    _hmac_sha256_setkey(prk, prk_value, sizeof(prk_value));
+
+    memset(prk_value, 0, sizeof(prk_value));
+}
+
+/**
+ * @brief Frees a pseudorandom key from hkdf_extract().
+ * 
+ * @param prk A pointer to the pseudorandom key to free.
+ */
+void hkdf_prk_free(hkdf_prk * prk) {
+    prk->backend->sha256_free(&prk->ipad);
+    prk->backend->sha256_free(&prk->opad);
+}
+
+/**
+ * @brief Overrides the crypto backend used by new AES contexts and HKDF keys.
+ *
+ * Contexts and keys which have already been initialized keep using the backend they were initialized with.
+ * Like tracer_crypto_init(), this must not be called while other threads are using the crypto functions.
+ *
+ * @param backend A pointer to the backend to use.
+ * @return Whether or not the backend is supported by the cpu. If not, the current backend is kept.
+ */
+bool tracer_crypto_set_backend(const tracer_crypto_backend * backend) {
+    if (!backend->supported()) return false;
+    _tracer_crypto_backend = backend;
+
+    if (_hkdf_zero_salt_ready) hkdf_prk_free(&_hkdf_zero_salt);
+    _hmac_sha256_setkey(&_hkdf_zero_salt, NULL, 0);
+    _hkdf_zero_salt_ready = true;
+
+    return true;
+}
+
+/**
+ * @brief Picks the crypto backend and sets up the state shared by all keys.
+ *
+ * This picks the first backend in tracer_crypto_backends that is supported by the cpu. The crypto functions call it
+ * on first use if it hasn't been called yet, but it should be called once before any threads are started that use
+ * them. Otherwise, they can race to set it up.
+ *
+ * @return Whether or not a supported backend was found. mbedtls is always built and supported, so it always is.
+ */
+bool tracer_crypto_init() {
+    for (size_t i = 0; i < TRACER_CRYPTO_BACKEND_COUNT; i++) {
+        if (tracer_crypto_set_backend(tracer_crypto_backends[i])) return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Runs the extract step of HKDF-SHA256 with an empty salt.
+ * 
+ * Together with hkdf_expand(), this is equivalent to hkdf() with a NULL salt, but lets several keys
+ * be expanded from the same input key while only extracting it once.
+ * 
+ * @param key A pointer to a buffer containing the key.
+ * @param key_len The size of the key buffer, in bytes.
+ * @param prk A pointer to the pseudorandom key to initialize. It should be freed with hkdf_prk_free() after use.
+ */
+void hkdf_extract(const void * key, size_t key_len, hkdf_prk * prk) {
+    if (!_hkdf_zero_salt_ready) tracer_crypto_init();     // the salt is set up along with the backend
+    _hkdf_extract_salted(&_hkdf_zero_salt, key, key_len, prk);
+}
+
+/**
+ * @brief Runs the expand step of HKDF-SHA256.
+ * 
+ * @param prk A pointer to a pseudorandom key from hkdf_extract().
+ * @param info A pointer to a buffer containing the information to be encoded in the key.
+ * @param info_len The size of the info buffer, in bytes.
+ * @param out_len The size of the output buffer, in bytes. Must be at most 255 * SHA256_HASH_SIZE.
+ * @param output A pointer to where the output buffer is located. If NULL, the function will allocate a buffer of size @p out_len and write the key there.
+ * @return A pointer to a buffer containing the output key.
+ */
+uint8_t * hkdf_expand(const hkdf_prk * prk, const void * info, size_t info_len, size_t out_len, void * output) {
+
+    uint8_t * out;
+    if (output == NULL) out = (uint8_t*)malloc(out_len);
+    else out = (uint8_t*)output;
+
+    uint8_t t[SHA256_HASH_SIZE];        // T(i - 1)
+    size_t t_len = 0;
+
+    for (size_t head = 0; head < out_len; head += SHA256_HASH_SIZE) {
+        uint8_t counter = head / SHA256_HASH_SIZE + 1;
+
+        // T(i) = HMAC(PRK, T(i - 1) | info | i)
+        _hmac_sha256_finish(prk, t, t_len, (const uint8_t *)info, info_len, &counter, 1, t);
+
+        t_len = SHA256_HASH_SIZE;
+        memcpy(out + head, t, (out_len - head < SHA256_HASH_SIZE) ? out_len - head : SHA256_HASH_SIZE);
+    }
+
+    memset(t, 0, sizeof(t));
+
+    return out;
+}
 
 /**
  * @brief A simple key-derivation function.
@@ -74,47 +305,169 @@ uint8_t * rng_gen(size_t len, void * output) {
  */
 uint8_t * hkdf(void * key, size_t key_len, void * salt, size_t salt_len, void * info, size_t info_len, size_t out_len, void * output) {
 
-    uint8_t * hash;
-    if (output == NULL) hash = (uint8_t*)malloc(SHA256_HASH_SIZE);
-    else hash = (uint8_t*)output;
+    hkdf_prk salt_key, prk;
 
-    mbedtls_hkdf(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 
-        (const unsigned char *)salt, salt_len, 
-        (const unsigned char *)key, key_len, 
-        (const unsigned char *)info, info_len, 
-        hash, out_len);
+    _hmac_sha256_setkey(&salt_key, (const uint8_t *)salt, salt_len);
+    _hkdf_extract_salted(&salt_key, key, key_len, &prk);
+    hkdf_prk_free(&salt_key);
 
-    return hash;
+    uint8_t * out = hkdf_expand(&prk, info, info_len, out_len, output);
+    hkdf_prk_free(&prk);
+
+    return out;
 }
 
 /**
- * @brief Encrypts a single block in AES mode.
+ * @brief A reusable AES key schedule.
  * 
- * Defined as AES128(Key, Data) in the standard. It uses ECB mode because the IVs are not shared between devices.
+ * Expanding an AES key costs about as much as encrypting a block with it, so anything that uses the same key
+ * more than once should initialize one of these with aes_ctx_init() and keep it around.
+ */
+typedef struct {
+    const tracer_crypto_backend * backend;  /** The backend the key schedule belongs to */
+    _aes_state state;                       /** The backend-specific key schedule */
+} aes_ctx;
+
+/**
+ * @brief Initializes a reusable AES context with a key.
+ * 
+ * The context uses the current backend, or mbedtls if the backend does not support the key size.
  * 
+ * @param ctx A pointer to the context to initialize. It should be freed with aes_ctx_free() after use.
  * @param key A pointer to a buffer containing the key.
- * @param key_len The size of the key buffer, in bytes.
+ * @param key_len The size of the key buffer, in bytes. Must be 16, 24 or 32.
+ */
+void aes_ctx_init(aes_ctx * ctx, const void * key, size_t key_len) {
+    ctx->backend = tracer_crypto_get_backend();
+
+    if (!ctx->backend->aes_setkey(&ctx->state, (const uint8_t *)key, key_len)) {
+        ctx->backend = &tracer_crypto_mbedtls;
+        ctx->backend->aes_setkey(&ctx->state, (const uint8_t *)key, key_len);
+    }
+}
+
+/**
+ * @brief Frees a reusable AES context and wipes its key material.
+ * 
+ * Freeing a zero-initialized or already freed context does nothing.
+ * 
+ * @param ctx A pointer to the context to free.
+ */
+void aes_ctx_free(aes_ctx * ctx) {
+    if (ctx->backend == NULL) return;
+
+    ctx->backend->aes_free(&ctx->state);
+    ctx->backend = NULL;
+}
+
+/**
+ * @brief Encrypts a run of consecutive blocks in AES-ECB mode with a reusable context.
+ * 
+ * Backends with pipelined AES instructions keep AES_BATCH_WIDTH blocks in flight at once.
+ * 
+ * @param ctx A pointer to an initialized AES context.
+ * @param data A pointer to a buffer containing @p count 16-byte blocks to encrypt.
+ * @param output A pointer to a buffer of @p count 16-byte blocks to write the encrypted data to. May be the same as @p data.
+ * @param count The number of blocks.
+ */
+void aes_ctx_encrypt_blocks(aes_ctx * ctx, const void * data, void * output, size_t count) {
+    ctx->backend->aes_ecb(&ctx->state, true, (const uint8_t *)data, (uint8_t *)output, count);
+}
+
+/**
+ * @brief Decrypts a run of consecutive blocks in AES-ECB mode with a reusable context.
+ * 
+ * Backends with pipelined AES instructions keep AES_BATCH_WIDTH blocks in flight at once.
+ * 
+ * @param ctx A pointer to an initialized AES context.
+ * @param data A pointer to a buffer containing @p count 16-byte blocks to decrypt.
+ * @param output A pointer to a buffer of @p count 16-byte blocks to write the decrypted data to. May be the same as @p data.
+ * @param count The number of blocks.
+ */
+void aes_ctx_decrypt_blocks(aes_ctx * ctx, const void * data, void * output, size_t count) {
+    ctx->backend->aes_ecb(&ctx->state, false, (const uint8_t *)data, (uint8_t *)output, count);
+}
+
+/**
+ * @brief Encrypts a single block in AES-ECB mode with a reusable context.
+ * 
+ * @param ctx A pointer to an initialized AES context.
  * @param data A pointer to a 16-byte long buffer containing the data to encrypt.
  * @param output A pointer to where the output buffer is located. If NULL, the function will allocate a buffer of size 16 bytes and write the encrypted data there.
  * @return A pointer to a buffer containing the encrypted block.
  */
-uint8_t * encrypt_aes_block(void * key, size_t key_len, void * data, void * output) {
+uint8_t * aes_ctx_encrypt_block(aes_ctx * ctx, const void * data, void * output) {
 
     uint8_t * block;
     if (output == NULL) block = (uint8_t*)malloc(AES128_BLOCK_SIZE);
     else block = (uint8_t*)output;
-    
-    //uint8_t * iv = rng_gen(16, NULL);
 
-    mbedtls_aes_context ctx;
+    aes_ctx_encrypt_blocks(ctx, data, block, 1);
+
+    return block;
+}
+
+/**
+ * @brief Decrypts a single block in AES-ECB mode with a reusable context.
+ * 
+ * @param ctx A pointer to an initialized AES context.
+ * @param data A pointer to a 16-byte long buffer containing the data to decrypt.
+ * @param output A pointer to where the output buffer is located. If NULL, the function will allocate a buffer of size 16 bytes and write the decrypted data there.
+ * @return A pointer to a buffer containing the decrypted block.
+ */
+uint8_t * aes_ctx_decrypt_block(aes_ctx * ctx, const void * data, void * output) {
+
+    uint8_t * block;
+    if (output == NULL) block = (uint8_t*)malloc(AES128_BLOCK_SIZE);
+    else block = (uint8_t*)output;
+
+    aes_ctx_decrypt_blocks(ctx, data, block, 1);
+
+    return block;
+}
+
+/**
+ * @brief Performs a AES-CTR operation on a variable-length block with a reusable context.
+ * 
+ * Unlike mbedtls_aes_crypt_ctr(), this does not modify @p iv.
+ * 
+ * @param ctx A pointer to an initialized AES context.
+ * @param iv A pointer to a 16-byte buffer containing the initialization variable
+ * @param data A pointer to a buffer containing the data to flip.
+ * @param data_len The size of the data buffer, in bytes.
+ * @param output A pointer to where the output buffer is located. If NULL, the function will allocate a buffer of size @p data_len and write the flipped data there.
+ * @return A pointer to a buffer containing the flipped data.
+ */
+uint8_t * aes_ctx_flip_ctr(aes_ctx * ctx, const uint8_t iv[16], const void * data, size_t data_len, void * output) {
+
+    uint8_t * block;
+    if (output == NULL) block = (uint8_t*)malloc(data_len);
+    else block = (uint8_t*)output;
+
+    ctx->backend->aes_ctr(&ctx->state, iv, (const uint8_t *)data, data_len, block);
+
+    return block;
+}
+
+/**
+ * @brief Encrypts a single block in AES mode.
+ * 
+ * Defined as AES128(Key, Data) in the standard. It uses ECB mode because the IVs are not shared between devices.
+ * This expands the key on every call; use aes_ctx_encrypt_block() when encrypting more than one block with a key.
+ * 
+ * @param key A pointer to a buffer containing the key.
+ * @param key_len The size of the key buffer, in bytes.
+ * @param data A pointer to a 16-byte long buffer containing the data to encrypt.
+ * @param output A pointer to where the output buffer is located. If NULL, the function will allocate a buffer of size 16 bytes and write the encrypted data there.
+ * @return A pointer to a buffer containing the encrypted block.
+ */
+uint8_t * encrypt_aes_block(void * key, size_t key_len, void * data, void * output) {
 
-    mbedtls_aes_init(&ctx);
-    mbedtls_aes_setkey_enc(&ctx, (const unsigned char *)key, key_len*8);
-    //mbedtls_aes_crypt_cbc(&ctx, MBEDTLS_AES_ENCRYPT, AES128_BLOCK_SIZE, iv, data, block);
-    mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_ENCRYPT, (const unsigned char *)data, block);
-    mbedtls_aes_free(&ctx);
+    aes_ctx ctx;
 
-    //free(iv);
+    aes_ctx_init(&ctx, key, key_len);
+    uint8_t * block = aes_ctx_encrypt_block(&ctx, data, output);
+    aes_ctx_free(&ctx);
     
     return block;
 }
@@ -123,6 +476,7 @@ uint8_t * encrypt_aes_block(void * key, size_t key_len, void * data, void * outp
  * @brief Decrypts a single block in AES mode.
  * 
  * Defined as AES128(Key, Data) in the standard. It uses ECB mode because the IVs are not shared between devices.
+ * This expands the key on every call; use aes_ctx_decrypt_block() when decrypting more than one block with a key.
  * 
  * @param key A pointer to a buffer containing the key.
  * @param key_len The size of the key buffer, in bytes.
@@ -132,21 +486,11 @@ uint8_t * encrypt_aes_block(void * key, size_t key_len, void * data, void * outp
  */
 uint8_t * decrypt_aes_block(void * key, size_t key_len, void * data, void * output) {
 
-    uint8_t * block;
-    if (output == NULL) block = (uint8_t*)malloc(AES128_BLOCK_SIZE);
-    else block = (uint8_t*)output;
-    
-    //uint8_t * iv = rng_gen(16, NULL);
-
-    mbedtls_aes_context ctx;
-
-    mbedtls_aes_init(&ctx);
-    mbedtls_aes_setkey_enc(&ctx, (const unsigned char *)key, key_len*8);
-    //mbedtls_aes_crypt_cbc(&ctx, MBEDTLS_AES_ENCRYPT, AES128_BLOCK_SIZE, iv, data, block);
-    mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_DECRYPT, (const unsigned char *)data, block);
-    mbedtls_aes_free(&ctx);
+    aes_ctx ctx;
 
-    //free(iv);
+    aes_ctx_init(&ctx, key, key_len);
+    uint8_t * block = aes_ctx_decrypt_block(&ctx, data, output);
+    aes_ctx_free(&ctx);
     
     return block;
 }
@@ -169,19 +513,11 @@ uint8_t * decrypt_aes_block(void * key, size_t key_len, void * data, void * outp
  */
 uint8_t * flip_aes_block_ctr(void * key, size_t key_len, uint8_t iv[16], void * data, size_t data_len, void * output) {
     
-    uint8_t * block;
-    if (output == NULL) block = (uint8_t*)malloc(data_len);
-    else block = (uint8_t*)output;
-
-    mbedtls_aes_context ctx;
+    aes_ctx ctx;
 
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = "";
-
-    mbedtls_aes_init(&ctx);
-    mbedtls_aes_setkey_enc(&ctx, (const unsigned char *)key, key_len*8);
-    mbedtls_aes_crypt_ctr(&ctx, data_len, &nc_off, iv, stream_block, (const unsigned char *)data, block);
-    mbedtls_aes_free(&ctx);
+    aes_ctx_init(&ctx, key, key_len);
+    uint8_t * block = aes_ctx_flip_ctr(&ctx, iv, data, data_len, output);
+    aes_ctx_free(&ctx);
     
     return block;
 }
@@ -206,6 +542,43 @@ size_t b64_decoded_size(size_t src_size) {
     return ((src_size + 3) / 4) * 3;
 }
 
+/**
+ * @brief Converts a binary buffer to a null-terminated base64 string in a caller-provided buffer.
+ * 
+ * @param data A pointer to a buffer containing the data to encode.
+ * @param data_len The size of the data buffer, in bytes.
+ * @param output A pointer to the output string buffer.
+ * @param output_len The size of the output buffer, in bytes. It should be at least b64_encoded_size(data_len).
+ * @return The length of the encoded string, not including the null terminator, or 0 if the output buffer is too small.
+ */
+size_t b64_encode_to(const void * data, size_t data_len, char * output, size_t output_len) {
+
+    size_t written_bytes;
+
+    if (mbedtls_base64_encode((unsigned char *)output, output_len, &written_bytes, (const unsigned char *)data, data_len) != 0) return 0;
+
+    output[written_bytes] = '\0';
+
+    return written_bytes;
+}
+
+/**
+ * @brief Converts a null-teriminated base64 string into a caller-provided binary buffer.
+ * 
+ * @param data A pointer to a buffer containing the null-terminated base64 string to decode.
+ * @param output A pointer to the output buffer.
+ * @param output_len The size of the output buffer, in bytes.
+ * @return The number of decoded bytes, or 0 if the string is invalid or the output buffer is too small.
+ */
+size_t b64_decode_to(const char * data, void * output, size_t output_len) {
+
+    size_t written_bytes;
+
+    if (mbedtls_base64_decode((unsigned char *)output, output_len, &written_bytes, (const unsigned char *)data, strlen(data)) != 0) return 0;
+
+    return written_bytes;
+}
+
 /**
  * @brief Converts a binary buffer to a null-terminated base64 string.
  * 
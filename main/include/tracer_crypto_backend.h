@@ -0,0 +1,81 @@
+#ifdef ESP_PLATFORM
+#include "esp_system.h"
+#else
+#include <sys/random.h>
+#endif
+
+#include "string.h"
+#include "stdlib.h"
+#include "stdint.h"
+#include "stdbool.h"
+
+#ifndef _TRACER_CRYPTO_BACKEND_H_
+#define _TRACER_CRYPTO_BACKEND_H_
+
+/**
+ * @file
+ * @brief The interface implemented by every crypto backend.
+ *
+ * A backend provides the raw primitives (SHA-256, AES-ECB, AES-CTR and a CRNG) that tracer_crypto.h builds the
+ * standard's HKDF, AES and CRNG functions on. Every function works on a caller-owned state buffer, so backends
+ * never allocate on the hot path. OpenSSL's cipher contexts can only be allocated, so that backend reuses the contexts
+ * of freed AES states instead.
+ *
+ * Which backends exist is decided at build time:
+ *  - mbedtls is always built. It is the only backend on the ESP32, where it drives the hardware peripherals.
+ *  - OpenSSL is built if TRACER_CRYPTO_OPENSSL is defined. It is meant for host tooling, which must link libcrypto.
+ *  - x86 (AES-NI, and SHA-NI where the cpu has it) is built on x86 hosts compiled with GCC or Clang, unless TRACER_CRYPTO_NO_X86 is defined.
+ *
+ * Which one is used is decided at runtime by tracer_crypto_init(), which picks the first supported backend.
+ */
+
+#if !defined(ESP_PLATFORM) && !defined(TRACER_CRYPTO_NO_X86) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define TRACER_CRYPTO_X86
+#endif
+
+#define SHA256_HASH_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+#define AES128_BLOCK_SIZE 16
+#define AES128_KEY_SIZE 16
+
+#define AES_BATCH_WIDTH 8   // how many blocks the batched aes functions keep in flight
+
+/**
+ * @brief A table of the primitives a crypto backend provides.
+ */
+typedef struct {
+    const char * name;                                                                  /** A short name for the backend, used in logs */
+    bool (*supported)(void);                                                            /** Checks whether the backend can run on this cpu */
+
+    void (*rng)(void * output, size_t len);                                             /** Fills a buffer with cryptographically-secure random numbers */
+
+    void (*sha256_start)(void * state);                                                 /** Initializes a SHA-256 state */
+    void (*sha256_update)(void * state, const uint8_t * data, size_t len);              /** Absorbs data into a SHA-256 state */
+    void (*sha256_finish)(void * state, uint8_t output[SHA256_HASH_SIZE]);              /** Writes the hash of a SHA-256 state. The state must still be freed. */
+    void (*sha256_clone)(void * dst, const void * src);                                 /** Copies a SHA-256 state into an uninitialized one */
+    void (*sha256_free)(void * state);                                                  /** Frees and wipes a SHA-256 state */
+
+    bool (*aes_setkey)(void * state, const uint8_t * key, size_t key_len);              /** Expands an AES key into a state. Returns false if the key size is not supported. */
+    void (*aes_free)(void * state);                                                     /** Frees and wipes an AES state */
+    void (*aes_ecb)(void * state, bool encrypt, const uint8_t * data, uint8_t * output, size_t count);  /** Runs AES-ECB over a run of blocks. data and output may alias. */
+    void (*aes_ctr)(void * state, const uint8_t iv[16], const uint8_t * data, size_t len, uint8_t * output);   /** Runs AES-CTR over a buffer without modifying the iv */
+} tracer_crypto_backend;
+
+// fills a buffer with random numbers from the os.
+void _tracer_crypto_os_rng(void * output, size_t len) {
+#ifdef ESP_PLATFORM
+    esp_fill_random(output, len);
+#else
+    for (size_t head = 0; head < len;) {
+        ssize_t ret = getrandom((uint8_t *)output + head, len - head, 0);
+        if (ret > 0) head += ret;
+    }
+#endif
+}
+
+// increments a big-endian 128-bit ctr mode counter.
+void _tracer_crypto_ctr_increment(uint8_t counter[AES128_BLOCK_SIZE]) {
+    for (int i = AES128_BLOCK_SIZE - 1; i >= 0; i--) if (++counter[i] != 0) break;
+}
+
+#endif
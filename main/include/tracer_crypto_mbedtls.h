@@ -0,0 +1,125 @@
+#include "tracer_crypto_backend.h"
+
+#include "mbedtls/sha256.h"
+#include "mbedtls/aes.h"
+
+#ifndef _TRACER_CRYPTO_MBEDTLS_H_
+#define _TRACER_CRYPTO_MBEDTLS_H_
+
+/**
+ * @file
+ * @brief The mbedtls crypto backend.
+ *
+ * This is the reference backend. On the ESP32, mbedtls runs SHA-256 and AES on the hardware peripherals.
+ */
+
+/**
+ * @brief The AES state of the mbedtls backend
+ */
+typedef struct {
+    mbedtls_aes_context enc;    /** The encryption key schedule */
+    mbedtls_aes_context dec;    /** The decryption key schedule. Only valid if has_dec is set. */
+    uint8_t key[32];            /** A copy of the key, used to lazily expand the decryption key schedule */
+    size_t key_len;             /** The size of the key, in bytes */
+    bool has_dec;               /** Whether or not the decryption key schedule has been expanded */
+} _mbedtls_aes_state;
+
+bool _mbedtls_supported() {
+    return true;
+}
+
+void _mbedtls_sha256_start(void * state) {
+    mbedtls_sha256_init((mbedtls_sha256_context *)state);
+    mbedtls_sha256_starts_ret((mbedtls_sha256_context *)state, 0);
+}
+
+void _mbedtls_sha256_update(void * state, const uint8_t * data, size_t len) {
+    mbedtls_sha256_update_ret((mbedtls_sha256_context *)state, data, len);
+}
+
+void _mbedtls_sha256_finish(void * state, uint8_t output[SHA256_HASH_SIZE]) {
+    mbedtls_sha256_finish_ret((mbedtls_sha256_context *)state, output);
+}
+
+void _mbedtls_sha256_clone(void * dst, const void * src) {
+    mbedtls_sha256_init((mbedtls_sha256_context *)dst);
+    mbedtls_sha256_clone((mbedtls_sha256_context *)dst, (const mbedtls_sha256_context *)src);
+}
+
+void _mbedtls_sha256_free(void * state) {
+    mbedtls_sha256_free((mbedtls_sha256_context *)state);
+}
+
+bool _mbedtls_aes_setkey(void * state, const uint8_t * key, size_t key_len) {
+    _mbedtls_aes_state * s = (_mbedtls_aes_state *)state;
+    if (key_len > sizeof(s->key)) return false;
+
+    mbedtls_aes_init(&s->enc);
+    mbedtls_aes_init(&s->dec);
+    if (mbedtls_aes_setkey_enc(&s->enc, key, key_len*8) != 0) {
+        mbedtls_aes_free(&s->enc);
+        mbedtls_aes_free(&s->dec);
+        return false;
+    }
+
+    memcpy(s->key, key, key_len);
+    s->key_len = key_len;
+    s->has_dec = false;
+
+    return true;
+}
+
+void _mbedtls_aes_free(void * state) {
+    _mbedtls_aes_state * s = (_mbedtls_aes_state *)state;
+
+    mbedtls_aes_free(&s->enc);
+    mbedtls_aes_free(&s->dec);
+    memset(s->key, 0, sizeof(s->key));
+    s->has_dec = false;
+}
+
+void _mbedtls_aes_ecb(void * state, bool encrypt, const uint8_t * data, uint8_t * output, size_t count) {
+    _mbedtls_aes_state * s = (_mbedtls_aes_state *)state;
+    mbedtls_aes_context * ctx = &s->enc;
+
+    if (!encrypt) {
+        // the esp32 hardware aes accepts the encryption schedule for decryption, but software mbedtls does not.
+        if (!s->has_dec) {
+            mbedtls_aes_setkey_dec(&s->dec, s->key, s->key_len*8);
+            s->has_dec = true;
+        }
+        ctx = &s->dec;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        mbedtls_aes_crypt_ecb(ctx, encrypt ? MBEDTLS_AES_ENCRYPT : MBEDTLS_AES_DECRYPT, data + i * AES128_BLOCK_SIZE, output + i * AES128_BLOCK_SIZE);
+    }
+}
+
+void _mbedtls_aes_ctr(void * state, const uint8_t iv[16], const uint8_t * data, size_t len, uint8_t * output) {
+    _mbedtls_aes_state * s = (_mbedtls_aes_state *)state;
+
+    size_t nc_off = 0;
+    uint8_t nonce_counter[16], stream_block[16] = "";
+
+    memcpy(nonce_counter, iv, sizeof(nonce_counter));
+
+    mbedtls_aes_crypt_ctr(&s->enc, len, &nc_off, nonce_counter, stream_block, data, output);
+}
+
+const tracer_crypto_backend tracer_crypto_mbedtls = {
+    .name = "mbedtls",
+    .supported = _mbedtls_supported,
+    .rng = _tracer_crypto_os_rng,
+    .sha256_start = _mbedtls_sha256_start,
+    .sha256_update = _mbedtls_sha256_update,
+    .sha256_finish = _mbedtls_sha256_finish,
+    .sha256_clone = _mbedtls_sha256_clone,
+    .sha256_free = _mbedtls_sha256_free,
+    .aes_setkey = _mbedtls_aes_setkey,
+    .aes_free = _mbedtls_aes_free,
+    .aes_ecb = _mbedtls_aes_ecb,
+    .aes_ctr = _mbedtls_aes_ctr,
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "tracer_crypto_backend.h"
+
+#define OPENSSL_SUPPRESS_DEPRECATED     // the low-level sha256 api is deprecated, but it is the only one whose state can be copied without allocating
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <openssl/rand.h>
+
+#ifndef _TRACER_CRYPTO_OPENSSL_H_
+#define _TRACER_CRYPTO_OPENSSL_H_
+
+/**
+ * @file
+ * @brief The OpenSSL (libcrypto) crypto backend, for host tooling.
+ *
+ * Only built if TRACER_CRYPTO_OPENSSL is defined. Programs using it must link against libcrypto.
+ *
+ * EVP cipher contexts can only be allocated, so a freed AES state hands its contexts to a small per-thread list of
+ * spares, and the next state set up on that thread rekeys them. Once a thread has set up as many AES states at once
+ * as it ever will, the backend no longer allocates. The spares keep the last key schedule they were given until they
+ * are rekeyed, and are never freed.
+ */
+
+/**
+ * @brief The AES state of the OpenSSL backend
+ */
+typedef struct {
+    EVP_CIPHER_CTX * enc;       /** The ECB encryption context */
+    EVP_CIPHER_CTX * dec;       /** The ECB decryption context. Keyed the first time a block is decrypted. */
+    EVP_CIPHER_CTX * ctr;       /** The CTR context. Keyed the first time it is used. */
+    bool dec_keyed;             /** Whether dec holds this state's key yet */
+    bool ctr_keyed;             /** Whether ctr holds this state's key yet */
+    uint8_t key[32];            /** A copy of the key, used to lazily key the other contexts */
+    size_t key_len;             /** The size of the key, in bytes */
+} _openssl_aes_state;
+
+#define _OPENSSL_AES_SPARE_COUNT    8   // the contexts of this many freed aes states are kept per thread
+
+_Thread_local _openssl_aes_state _openssl_aes_spares[_OPENSSL_AES_SPARE_COUNT];
+_Thread_local size_t _openssl_aes_spare_count = 0;
+
+bool _openssl_supported() {
+    return true;
+}
+
+void _openssl_rng(void * output, size_t len) {
+    if (RAND_bytes((unsigned char *)output, len) != 1) _tracer_crypto_os_rng(output, len);
+}
+
+void _openssl_sha256_start(void * state) {
+    SHA256_Init((SHA256_CTX *)state);
+}
+
+void _openssl_sha256_update(void * state, const uint8_t * data, size_t len) {
+    SHA256_Update((SHA256_CTX *)state, data, len);
+}
+
+void _openssl_sha256_finish(void * state, uint8_t output[SHA256_HASH_SIZE]) {
+    SHA256_Final(output, (SHA256_CTX *)state);
+}
+
+void _openssl_sha256_clone(void * dst, const void * src) {
+    memcpy(dst, src, sizeof(SHA256_CTX));
+}
+
+void _openssl_sha256_free(void * state) {
+    memset(state, 0, sizeof(SHA256_CTX));
+}
+
+// keys a cipher context with the key of an aes state.
+void _openssl_aes_key(const _openssl_aes_state * s, EVP_CIPHER_CTX * ctx, bool ctr, bool encrypt) {
+    const EVP_CIPHER * cipher;
+    switch (s->key_len) {
+        case 16: cipher = ctr ? EVP_aes_128_ctr() : EVP_aes_128_ecb(); break;
+        case 24: cipher = ctr ? EVP_aes_192_ctr() : EVP_aes_192_ecb(); break;
+        default: cipher = ctr ? EVP_aes_256_ctr() : EVP_aes_256_ecb(); break;
+    }
+
+    // setting the cipher again would reallocate openssl's own state, so a context already running it only gets the key
+    if (EVP_CIPHER_CTX_get0_cipher(ctx) != NULL && EVP_CIPHER_CTX_get_nid(ctx) == EVP_CIPHER_get_nid(cipher)) cipher = NULL;
+
+    EVP_CipherInit_ex(ctx, cipher, NULL, s->key, NULL, encrypt);
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+}
+
+bool _openssl_aes_setkey(void * state, const uint8_t * key, size_t key_len) {
+    _openssl_aes_state * s = (_openssl_aes_state *)state;
+    if (key_len != 16 && key_len != 24 && key_len != 32) return false;
+
+    memcpy(s->key, key, key_len);
+    s->key_len = key_len;
+
+    // take a freed state's contexts, or allocate and key all three now, so that using them later doesn't allocate
+    if (_openssl_aes_spare_count > 0) {
+        _openssl_aes_state * spare = &_openssl_aes_spares[--_openssl_aes_spare_count];
+        s->enc = spare->enc;
+        s->dec = spare->dec;
+        s->ctr = spare->ctr;
+        s->dec_keyed = false;
+        s->ctr_keyed = false;
+    } else {
+        s->enc = EVP_CIPHER_CTX_new();
+        s->dec = EVP_CIPHER_CTX_new();
+        s->ctr = EVP_CIPHER_CTX_new();
+        _openssl_aes_key(s, s->dec, false, false);
+        _openssl_aes_key(s, s->ctr, true, true);
+        s->dec_keyed = true;
+        s->ctr_keyed = true;
+    }
+
+    _openssl_aes_key(s, s->enc, false, true);
+
+    return true;
+}
+
+void _openssl_aes_free(void * state) {
+    _openssl_aes_state * s = (_openssl_aes_state *)state;
+
+    if (_openssl_aes_spare_count < _OPENSSL_AES_SPARE_COUNT) {
+        _openssl_aes_state * spare = &_openssl_aes_spares[_openssl_aes_spare_count++];
+        spare->enc = s->enc;
+        spare->dec = s->dec;
+        spare->ctr = s->ctr;
+    } else {
+        EVP_CIPHER_CTX_free(s->enc);
+        EVP_CIPHER_CTX_free(s->dec);
+        EVP_CIPHER_CTX_free(s->ctr);
+    }
+
+    memset(s, 0, sizeof(_openssl_aes_state));
+}
+
+void _openssl_aes_ecb(void * state, bool encrypt, const uint8_t * data, uint8_t * output, size_t count) {
+    _openssl_aes_state * s = (_openssl_aes_state *)state;
+    int out_len;
+
+    if (encrypt) {
+        EVP_EncryptUpdate(s->enc, output, &out_len, data, count * AES128_BLOCK_SIZE);
+    } else {
+        if (!s->dec_keyed) _openssl_aes_key(s, s->dec, false, false);
+        s->dec_keyed = true;
+        EVP_DecryptUpdate(s->dec, output, &out_len, data, count * AES128_BLOCK_SIZE);
+    }
+}
+
+void _openssl_aes_ctr(void * state, const uint8_t iv[16], const uint8_t * data, size_t len, uint8_t * output) {
+    _openssl_aes_state * s = (_openssl_aes_state *)state;
+    int out_len;
+
+    if (!s->ctr_keyed) _openssl_aes_key(s, s->ctr, true, true);
+    s->ctr_keyed = true;
+
+    EVP_EncryptInit_ex(s->ctr, NULL, NULL, NULL, iv);      // only resets the counter
+    EVP_EncryptUpdate(s->ctr, output, &out_len, data, len);
+}
+
+const tracer_crypto_backend tracer_crypto_openssl = {
+    .name = "openssl",
+    .supported = _openssl_supported,
+    .rng = _openssl_rng,
+    .sha256_start = _openssl_sha256_start,
+    .sha256_update = _openssl_sha256_update,
+    .sha256_finish = _openssl_sha256_finish,
+    .sha256_clone = _openssl_sha256_clone,
+    .sha256_free = _openssl_sha256_free,
+    .aes_setkey = _openssl_aes_setkey,
+    .aes_free = _openssl_aes_free,
+    .aes_ecb = _openssl_aes_ecb,
+    .aes_ctr = _openssl_aes_ctr,
+};
+
+#endif
@@ -0,0 +1,317 @@
+#include "tracer_crypto_backend.h"
+
+#ifndef _TRACER_CRYPTO_X86_H_
+#define _TRACER_CRYPTO_X86_H_
+
+#ifdef TRACER_CRYPTO_X86
+
+#include <immintrin.h>
+
+/**
+ * @file
+ * @brief The x86 crypto backend, built on the AES-NI and SHA-NI instructions.
+ *
+ * Every function using the instructions is compiled with a target attribute and the backend is only selected after
+ * checking the cpu at runtime, so no extra compiler flags are needed. The backend only needs AES-NI. On cpus without
+ * SHA-NI, which includes most Intel parts from before Ice Lake, SHA-256 runs in plain C instead. Only AES-128 keys are
+ * supported; other key sizes fall back to mbedtls.
+ */
+
+#define _X86_AES_TARGET __attribute__((target("aes")))
+#define _X86_SHA_TARGET __attribute__((target("sha,sse4.1")))
+
+/**
+ * @brief The AES state of the x86 backend
+ */
+typedef struct {
+    __m128i enc[11];    /** The encryption round keys */
+    __m128i dec[11];    /** The decryption round keys */
+} _x86_aes_state;
+
+/**
+ * @brief The SHA-256 state of the x86 backend
+ */
+typedef struct {
+    uint32_t h[8];                      /** The chaining value */
+    uint8_t buf[SHA256_BLOCK_SIZE];     /** The partially-filled block */
+    size_t buf_len;                     /** The number of bytes in buf */
+    uint64_t total;                     /** The total number of bytes absorbed */
+} _x86_sha256_state;
+
+const uint32_t _x86_sha256_k[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+bool _x86_sha_ni = false;   // whether sha-256 runs on sha-ni. set by _x86_supported().
+
+bool _x86_supported() {
+    __builtin_cpu_init();
+    _x86_sha_ni = __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+    return __builtin_cpu_supports("aes");
+}
+
+// runs the sha-256 compression function over a run of blocks with sha-ni.
+_X86_SHA_TARGET
+void _x86_sha256_compress_ni(uint32_t h[8], const uint8_t * blocks, size_t count) {
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // the sha-ni instructions keep the state as ABEF/CDGH instead of ABCD/EFGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[0]), 0xb1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[4]), 0x1b);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    for (size_t b = 0; b < count; b++, blocks += SHA256_BLOCK_SIZE) {
+        __m128i abef = state0, cdgh = state1;
+        __m128i w[4];
+
+        for (int i = 0; i < 16; i++) {
+            if (i < 4) {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(blocks + i * 16)), bswap);
+            } else {
+                __m128i next = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                next = _mm_add_epi32(next, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(next, w[(i + 3) & 3]);
+            }
+
+            __m128i msg = _mm_add_epi32(w[i & 3], _mm_load_si128((const __m128i *)&_x86_sha256_k[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    _mm_storeu_si128((__m128i *)&h[0], _mm_blend_epi16(tmp, state1, 0xf0));
+    _mm_storeu_si128((__m128i *)&h[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+#define _X86_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// runs the sha-256 compression function over a run of blocks in plain c, for cpus without sha-ni.
+void _x86_sha256_compress_soft(uint32_t h[8], const uint8_t * blocks, size_t count) {
+    for (size_t n = 0; n < count; n++, blocks += SHA256_BLOCK_SIZE) {
+        uint32_t w[64];
+
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)blocks[i * 4] << 24 | (uint32_t)blocks[i * 4 + 1] << 16 | (uint32_t)blocks[i * 4 + 2] << 8 | blocks[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = _X86_ROTR(w[i - 15], 7) ^ _X86_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = _X86_ROTR(w[i - 2], 17) ^ _X86_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = hh + (_X86_ROTR(e, 6) ^ _X86_ROTR(e, 11) ^ _X86_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + _x86_sha256_k[i] + w[i];
+            uint32_t t2 = (_X86_ROTR(a, 2) ^ _X86_ROTR(a, 13) ^ _X86_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+            hh = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    }
+}
+
+#undef _X86_ROTR
+
+void _x86_sha256_compress(uint32_t h[8], const uint8_t * blocks, size_t count) {
+    if (_x86_sha_ni) _x86_sha256_compress_ni(h, blocks, count);
+    else _x86_sha256_compress_soft(h, blocks, count);
+}
+
+void _x86_sha256_start(void * state) {
+    const uint32_t iv[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    _x86_sha256_state * s = (_x86_sha256_state *)state;
+
+    memcpy(s->h, iv, sizeof(iv));
+    s->buf_len = 0;
+    s->total = 0;
+}
+
+void _x86_sha256_update(void * state, const uint8_t * data, size_t len) {
+    _x86_sha256_state * s = (_x86_sha256_state *)state;
+    if (len == 0) return;
+    s->total += len;
+
+    if (s->buf_len) {
+        size_t fill = SHA256_BLOCK_SIZE - s->buf_len;
+        if (fill > len) fill = len;
+
+        memcpy(s->buf + s->buf_len, data, fill);
+        s->buf_len += fill;
+        data += fill;
+        len -= fill;
+
+        if (s->buf_len < SHA256_BLOCK_SIZE) return;
+        _x86_sha256_compress(s->h, s->buf, 1);
+        s->buf_len = 0;
+    }
+
+    _x86_sha256_compress(s->h, data, len / SHA256_BLOCK_SIZE);
+
+    s->buf_len = len % SHA256_BLOCK_SIZE;
+    memcpy(s->buf, data + len - s->buf_len, s->buf_len);
+}
+
+void _x86_sha256_finish(void * state, uint8_t output[SHA256_HASH_SIZE]) {
+    _x86_sha256_state * s = (_x86_sha256_state *)state;
+    uint64_t bits = s->total * 8;
+
+    s->buf[s->buf_len++] = 0x80;
+    if (s->buf_len > SHA256_BLOCK_SIZE - sizeof(bits)) {
+        memset(s->buf + s->buf_len, 0, SHA256_BLOCK_SIZE - s->buf_len);
+        _x86_sha256_compress(s->h, s->buf, 1);
+        s->buf_len = 0;
+    }
+    memset(s->buf + s->buf_len, 0, SHA256_BLOCK_SIZE - sizeof(bits) - s->buf_len);
+    for (size_t i = 0; i < sizeof(bits); i++) s->buf[SHA256_BLOCK_SIZE - 1 - i] = bits >> (i * 8);
+    _x86_sha256_compress(s->h, s->buf, 1);
+
+    for (size_t i = 0; i < 8; i++) {
+        output[i * 4 + 0] = s->h[i] >> 24;
+        output[i * 4 + 1] = s->h[i] >> 16;
+        output[i * 4 + 2] = s->h[i] >> 8;
+        output[i * 4 + 3] = s->h[i];
+    }
+}
+
+void _x86_sha256_clone(void * dst, const void * src) {
+    memcpy(dst, src, sizeof(_x86_sha256_state));
+}
+
+void _x86_sha256_free(void * state) {
+    memset(state, 0, sizeof(_x86_sha256_state));
+}
+
+#define _X86_EXPAND_ROUND(rk, i, rcon) do { \
+        __m128i _key = rk[(i) - 1]; \
+        __m128i _gen = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(_key, rcon), 0xff); \
+        _key = _mm_xor_si128(_key, _mm_slli_si128(_key, 4)); \
+        _key = _mm_xor_si128(_key, _mm_slli_si128(_key, 4)); \
+        _key = _mm_xor_si128(_key, _mm_slli_si128(_key, 4)); \
+        rk[i] = _mm_xor_si128(_key, _gen); \
+    } while (0)
+
+// expands an aes-128 key into aes-ni encryption and decryption round keys.
+_X86_AES_TARGET
+bool _x86_aes_setkey(void * state, const uint8_t * key, size_t key_len) {
+    if (key_len != AES128_KEY_SIZE) return false;
+
+    _x86_aes_state * s = (_x86_aes_state *)state;
+    __m128i * rk = s->enc;
+
+    rk[0] = _mm_loadu_si128((const __m128i *)key);
+    _X86_EXPAND_ROUND(rk, 1, 0x01);
+    _X86_EXPAND_ROUND(rk, 2, 0x02);
+    _X86_EXPAND_ROUND(rk, 3, 0x04);
+    _X86_EXPAND_ROUND(rk, 4, 0x08);
+    _X86_EXPAND_ROUND(rk, 5, 0x10);
+    _X86_EXPAND_ROUND(rk, 6, 0x20);
+    _X86_EXPAND_ROUND(rk, 7, 0x40);
+    _X86_EXPAND_ROUND(rk, 8, 0x80);
+    _X86_EXPAND_ROUND(rk, 9, 0x1b);
+    _X86_EXPAND_ROUND(rk, 10, 0x36);
+
+    s->dec[0] = rk[10];
+    for (int i = 1; i < 10; i++) s->dec[i] = _mm_aesimc_si128(rk[10 - i]);
+    s->dec[10] = rk[0];
+
+    return true;
+}
+
+#undef _X86_EXPAND_ROUND
+
+void _x86_aes_free(void * state) {
+    memset(state, 0, sizeof(_x86_aes_state));
+}
+
+// runs aes-128 ecb over a run of blocks with aes-ni, AES_BATCH_WIDTH blocks at a time.
+_X86_AES_TARGET
+void _x86_aes_ecb(void * state, bool encrypt, const uint8_t * data, uint8_t * output, size_t count) {
+    const _x86_aes_state * s = (const _x86_aes_state *)state;
+    const __m128i * rk = encrypt ? s->enc : s->dec;
+    size_t i = 0;
+
+    for (; i + AES_BATCH_WIDTH <= count; i += AES_BATCH_WIDTH) {
+        __m128i b[AES_BATCH_WIDTH];
+
+        for (int j = 0; j < AES_BATCH_WIDTH; j++) b[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(data + (i + j) * 16)), rk[0]);
+
+        for (int r = 1; r < 10; r++) {
+            if (encrypt) for (int j = 0; j < AES_BATCH_WIDTH; j++) b[j] = _mm_aesenc_si128(b[j], rk[r]);
+            else for (int j = 0; j < AES_BATCH_WIDTH; j++) b[j] = _mm_aesdec_si128(b[j], rk[r]);
+        }
+
+        for (int j = 0; j < AES_BATCH_WIDTH; j++) {
+            b[j] = encrypt ? _mm_aesenclast_si128(b[j], rk[10]) : _mm_aesdeclast_si128(b[j], rk[10]);
+            _mm_storeu_si128((__m128i *)(output + (i + j) * 16), b[j]);
+        }
+    }
+
+    for (; i < count; i++) {
+        __m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(data + i * 16)), rk[0]);
+
+        for (int r = 1; r < 10; r++) b = encrypt ? _mm_aesenc_si128(b, rk[r]) : _mm_aesdec_si128(b, rk[r]);
+
+        b = encrypt ? _mm_aesenclast_si128(b, rk[10]) : _mm_aesdeclast_si128(b, rk[10]);
+        _mm_storeu_si128((__m128i *)(output + i * 16), b);
+    }
+}
+
+// runs aes-128 ctr by encrypting AES_BATCH_WIDTH counter blocks at a time.
+void _x86_aes_ctr(void * state, const uint8_t iv[16], const uint8_t * data, size_t len, uint8_t * output) {
+    uint8_t counter[AES128_BLOCK_SIZE], stream[AES_BATCH_WIDTH * AES128_BLOCK_SIZE];
+
+    memcpy(counter, iv, sizeof(counter));
+
+    for (size_t head = 0; head < len;) {
+        size_t blocks = (len - head + AES128_BLOCK_SIZE - 1) / AES128_BLOCK_SIZE;
+        if (blocks > AES_BATCH_WIDTH) blocks = AES_BATCH_WIDTH;
+
+        for (size_t i = 0; i < blocks; i++) {
+            memcpy(stream + i * AES128_BLOCK_SIZE, counter, sizeof(counter));
+            _tracer_crypto_ctr_increment(counter);
+        }
+        _x86_aes_ecb(state, true, stream, stream, blocks);
+
+        for (size_t i = 0; i < blocks * AES128_BLOCK_SIZE && head < len; i++, head++) output[head] = data[head] ^ stream[i];
+    }
+
+    memset(stream, 0, sizeof(stream));
+}
+
+const tracer_crypto_backend tracer_crypto_x86 = {
+    .name = "x86",
+    .supported = _x86_supported,
+    .rng = _tracer_crypto_os_rng,
+    .sha256_start = _x86_sha256_start,
+    .sha256_update = _x86_sha256_update,
+    .sha256_finish = _x86_sha256_finish,
+    .sha256_clone = _x86_sha256_clone,
+    .sha256_free = _x86_sha256_free,
+    .aes_setkey = _x86_aes_setkey,
+    .aes_free = _x86_aes_free,
+    .aes_ecb = _x86_aes_ecb,
+    .aes_ctr = _x86_aes_ctr,
+};
+
+#undef _X86_AES_TARGET
+#undef _X86_SHA_TARGET
+
+#endif
+
+#endif
@@ -0,0 +1,192 @@
+#include "tracer.h"
+
+#ifndef _TRACER_INDEX_H_
+#define _TRACER_INDEX_H_
+
+/**
+ * @file
+ * @brief An RPI hash index used to match scanned datapairs against a batch of downloaded TEKs.
+ *
+ * Every TEK in the batch is expanded into all of the RPIs it could have broadcast over its
+ * ENIntervalNumber range, once, and stored in an open-addressing hash table. Each scanned
+ * datapair then only needs a single lookup instead of a full verification against every TEK.
+ *
+ * The table is one allocation of 8-byte slots, a power of two of them and at least 1.5 per RPI. Each TEK therefore
+ * costs between 12 and 24 bytes per ENIntervalNumber, depending on where the batch lands between powers of two. At
+ * the standard 144 ENIntervalNumbers per day, that is 1.7 to 3.4 KB per TEK, so a batch of 128 TEKs needs a 256 KB
+ * block. That is more than the ESP32 heap has in one piece, so batches there should be sized with
+ * tracer_index_max_teks().
+ */
+
+#define TRACER_INDEX_EMPTY      UINT16_MAX  // marks an unused slot in the index
+#define TRACER_INDEX_MAX_TEKS   (TRACER_INDEX_EMPTY - 1)
+
+#if TRACER_ENINS_PER_DAY > UINT8_MAX + 1
+#error The tracer index can only hold up to 256 enintervals per tek!
+#endif
+
+/**
+ * @brief A single slot of the RPI index
+ */
+typedef struct {
+    uint32_t tag;       /** The first 4 bytes of the RPI. Since RPIs are AES outputs, this doubles as the hash. */
+    uint16_t tek;       /** The index of the source TEK in the TEK array, or TRACER_INDEX_EMPTY if the slot is unused */
+    uint8_t enin_off;   /** The ENIntervalNumber of the RPI, relative to the ENIntervalNumber of the TEK */
+    uint8_t reserved;
+} tracer_index_entry;
+
+/**
+ * @brief An open-addressing hash table of every RPI derivable from a batch of TEKs
+ */
+typedef struct {
+    tracer_index_entry * entries;   /** The slots of the table */
+    size_t capacity;                /** The number of slots in the table. Always a power of two. */
+    size_t len;                     /** The number of used slots in the table */
+    const tracer_tek * tek_array;   /** The TEK array the index was built from */
+    size_t tek_array_len;           /** The length of the TEK array */
+} tracer_index;
+
+// gets the first 4 bytes of an rpi as an integer.
+uint32_t _tracer_index_tag(const tracer_rpi * rpi) {
+    uint32_t out;
+    memcpy(&out, rpi->value, sizeof(out));
+    return out;
+}
+
+// inserts an rpi into the index. the index must have at least one free slot.
+void _tracer_index_insert(tracer_index * index, const tracer_rpi * rpi, uint16_t tek, uint8_t enin_off) {
+    uint32_t tag = _tracer_index_tag(rpi);
+    size_t mask = index->capacity - 1;
+    size_t slot = tag & mask;
+
+    while (index->entries[slot].tek != TRACER_INDEX_EMPTY) slot = (slot + 1) & mask;   // linear probing
+
+    index->entries[slot].tag = tag;
+    index->entries[slot].tek = tek;
+    index->entries[slot].enin_off = enin_off;
+    index->len++;
+}
+
+/**
+ * @brief Gets the number of bytes the table of an RPI index of a batch of TEKs takes
+ *
+ * @param tek_array_len The number of TEKs in the batch
+ * @return The size of the single allocation tracer_index_init() makes for the batch, in bytes
+ */
+size_t tracer_index_size(size_t tek_array_len) {
+    size_t rpi_count = tek_array_len * TRACER_ENINS_PER_DAY;
+    size_t capacity = 1;
+    while (capacity < rpi_count + (rpi_count >> 1) + 1) capacity <<= 1;    // keep the load factor under 2/3
+    return capacity * sizeof(tracer_index_entry);
+}
+
+/**
+ * @brief Gets the most TEKs an RPI index can be built from in a given amount of memory
+ *
+ * @param max_size The most bytes the index's table may take, such as the largest free block of the heap
+ * @return The largest batch whose table fits in @p max_size bytes, which can be 0. Never more than TRACER_INDEX_MAX_TEKS.
+ */
+size_t tracer_index_max_teks(size_t max_size) {
+    size_t capacity = 1;
+    while (capacity * 2 * sizeof(tracer_index_entry) <= max_size) capacity <<= 1;
+    if (capacity * sizeof(tracer_index_entry) > max_size) return 0;
+
+    // the most rpis a table of capacity slots takes while staying under the load factor tracer_index_size() keeps
+    size_t max_rpis = (capacity - 1) * 2 / 3 + 1;
+    while (max_rpis > 0 && max_rpis + (max_rpis >> 1) + 1 > capacity) max_rpis--;
+
+    size_t max_teks = max_rpis / TRACER_ENINS_PER_DAY;
+    return max_teks < TRACER_INDEX_MAX_TEKS ? max_teks : TRACER_INDEX_MAX_TEKS;
+}
+
+/**
+ * @brief Builds an RPI index from a batch of Temporary Exposure Keys
+ *
+ * Each TEK is expanded into the TRACER_ENINS_PER_DAY RPIs starting at the ENIntervalNumber of its epoch.
+ * The index keeps a reference to @p tek_array, so the array must outlive the index.
+ *
+ * @param index A pointer to the index to initialize
+ * @param tek_array A pointer to the TEKs to index
+ * @param tek_array_len The number of TEKs in the array. Must not exceed TRACER_INDEX_MAX_TEKS.
+ * @return Whether or not the index could be allocated
+ */
+bool tracer_index_init(tracer_index * index, const tracer_tek * tek_array, size_t tek_array_len) {
+    if (tek_array_len > TRACER_INDEX_MAX_TEKS) return false;
+
+    index->capacity = tracer_index_size(tek_array_len) / sizeof(tracer_index_entry);
+    index->entries = (tracer_index_entry *)malloc(index->capacity * sizeof(tracer_index_entry));
+    if (index->entries == NULL) return false;
+
+    for (size_t i = 0; i < index->capacity; i++) index->entries[i].tek = TRACER_INDEX_EMPTY;
+
+    index->len = 0;
+    index->tek_array = tek_array;
+    index->tek_array_len = tek_array_len;
+
+    for (size_t i = 0; i < tek_array_len; i++) {
+        tracer_rpik rpik;
+        tracer_derive_rpik_v2(&tek_array[i], &rpik);
+        uint32_t first_enin = tracer_epoch2enin(tek_array[i].epoch);
+
+        aes_ctx rpik_ctx;
+        aes_ctx_init(&rpik_ctx, rpik.value, sizeof(rpik.value));
+
+        tracer_rpi rpis[TRACER_ENINS_PER_DAY];
+        tracer_derive_rpi_batch(&rpik_ctx, first_enin, TRACER_ENINS_PER_DAY, rpis);
+
+        for (uint32_t j = 0; j < TRACER_ENINS_PER_DAY; j++) _tracer_index_insert(index, &rpis[j], i, j);
+
+        aes_ctx_free(&rpik_ctx);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Frees the memory held by an RPI index
+ *
+ * @param index A pointer to the index to free
+ */
+void tracer_index_free(tracer_index * index) {
+    free(index->entries);
+    index->entries = NULL;
+    index->capacity = 0;
+    index->len = 0;
+}
+
+/**
+ * @brief Looks up a scanned datapair in an RPI index
+ *
+ * Candidate slots are confirmed with tracer_verify_v2(), so a match is never reported on a partial RPI collision.
+ *
+ * @param index A pointer to the index to search
+ * @param datapair A pointer to the scanned datapair
+ * @param enin A pointer to a 32-bit unsigned integer which will be overwritten with the datapair's generation ENIntervalNumber in the case of a match. Can be NULL.
+ * @param tek A pointer to a TEK pointer which will be overwritten with the matching TEK in the case of a match. Can be NULL.
+ * @return Whether or not the datapair was generated by one of the indexed TEKs
+ */
+bool tracer_index_lookup(const tracer_index * index, const tracer_datapair * datapair, uint32_t * enin, const tracer_tek ** tek) {
+    if (index->capacity == 0) return false;
+
+    uint32_t tag = _tracer_index_tag(&datapair->rpi);
+    size_t mask = index->capacity - 1;
+
+    for (size_t slot = tag & mask; index->entries[slot].tek != TRACER_INDEX_EMPTY; slot = (slot + 1) & mask) {
+        const tracer_index_entry * entry = &index->entries[slot];
+        if (entry->tag != tag) continue;
+
+        const tracer_tek * candidate = &index->tek_array[entry->tek];
+        uint32_t decrypted_enin;
+
+        if (tracer_verify_v2(datapair, candidate, &decrypted_enin, NULL) &&
+            decrypted_enin == tracer_epoch2enin(candidate->epoch) + entry->enin_off) {
+            if (enin) *enin = decrypted_enin;
+            if (tek) *tek = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#endif
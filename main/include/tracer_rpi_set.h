@@ -0,0 +1,179 @@
+#include "tracer.h"
+
+#ifndef _TRACER_RPI_SET_H_
+#define _TRACER_RPI_SET_H_
+
+/**
+ * @file
+ * @brief A fixed-capacity hash set of scanned datapairs that merges repeated adverts into sightings.
+ *
+ * The set is allocated once and never grows, so adding to it never allocates. It is meant to be kept for a whole
+ * ENIntervalNumber, so a datapair received over several scan windows ends up as a single sighting.
+ * Sightings are stored densely in the order they were first seen, so the set can be written straight to a scanfile.
+ * Once the set is full, new datapairs are dropped and counted, while the ones already stored keep being merged.
+ */
+
+#define TRACER_RPI_SET_MAX_CAPACITY UINT16_MAX  // slots hold 16-bit item numbers
+
+/**
+ * @brief The result of adding a datapair to an RPI set
+ */
+typedef enum {
+    TRACER_RPI_SET_ADDED = 0,   /** The datapair was new and a sighting has been stored for it */
+    TRACER_RPI_SET_DUPLICATE,   /** The datapair was already in the set, and has been merged into its sighting */
+    TRACER_RPI_SET_FULL,        /** The datapair was new, but the set is full so it was dropped */
+} tracer_rpi_set_result;
+
+/**
+ * @brief An open-addressing hash set of sightings, keyed on their RPIs
+ */
+typedef struct {
+    tracer_sighting * items;    /** The stored sightings, in the order they were added */
+    int32_t * rssi_sums;        /** The sum of every RSSI of each sighting, used to keep their means exact */
+    uint16_t * slots;           /** The hash table. Each slot holds an index into items plus one, or 0 if the slot is unused. */
+    size_t capacity;            /** The maximum number of sightings the set can hold */
+    size_t slot_mask;           /** The number of slots minus one. The number of slots is always a power of two. */
+    uint32_t slot_shift;        /** 32 minus the log2 of the number of slots, so the top bits of a hash pick the slot */
+    size_t len;                 /** The number of stored sightings */
+    uint32_t seed;              /** A random value mixed into the hash, so adverts can't be crafted to collide */
+    uint32_t dropped;           /** The number of new datapairs dropped because the set was full */
+} tracer_rpi_set;
+
+// hashes the first 4 bytes of an rpi. rpis are aes outputs, but they are also received over the air, so they are mixed with a seed.
+size_t _tracer_rpi_set_hash(const tracer_rpi_set * set, const tracer_rpi * rpi) {
+    uint32_t tag;
+    memcpy(&tag, rpi->value, sizeof(tag));
+
+    tag ^= set->seed;
+    tag *= 0x9e3779b1;  // fibonacci hashing moves the mixed bits to the top
+
+    return tag >> set->slot_shift;     // there are always at least 2 slots, so this never shifts by 32
+}
+
+/**
+ * @brief Empties an RPI set and picks a new hash seed, without freeing it.
+ *
+ * @param set A pointer to the set to empty
+ */
+void tracer_rpi_set_clear(tracer_rpi_set * set) {
+    memset(set->slots, 0, (set->slot_mask + 1) * sizeof(uint16_t));
+    set->len = 0;
+    set->dropped = 0;
+    rng_gen(sizeof(set->seed), &set->seed);
+}
+
+/**
+ * @brief Allocates an empty RPI set
+ *
+ * @param set A pointer to the set to initialize
+ * @param capacity The maximum number of sightings the set can hold. Must not exceed TRACER_RPI_SET_MAX_CAPACITY.
+ * @return Whether or not the set could be allocated
+ */
+bool tracer_rpi_set_init(tracer_rpi_set * set, size_t capacity) {
+    if (capacity == 0 || capacity > TRACER_RPI_SET_MAX_CAPACITY) return false;
+
+    size_t slot_count = 1;
+    uint32_t slot_bits = 0;
+    while (slot_count < capacity * 2) {     // keep the load factor at or under 1/2
+        slot_count <<= 1;
+        slot_bits++;
+    }
+
+    set->items = (tracer_sighting *)malloc(capacity * sizeof(tracer_sighting));
+    set->rssi_sums = (int32_t *)malloc(capacity * sizeof(int32_t));
+    set->slots = (uint16_t *)malloc(slot_count * sizeof(uint16_t));
+
+    if (set->items == NULL || set->rssi_sums == NULL || set->slots == NULL) {
+        free(set->items);
+        free(set->rssi_sums);
+        free(set->slots);
+        set->items = NULL;
+        set->rssi_sums = NULL;
+        set->slots = NULL;
+        set->capacity = 0;
+        return false;
+    }
+
+    set->capacity = capacity;
+    set->slot_mask = slot_count - 1;
+    set->slot_shift = 32 - slot_bits;
+    tracer_rpi_set_clear(set);
+
+    return true;
+}
+
+/**
+ * @brief Frees the memory held by an RPI set
+ *
+ * @param set A pointer to the set to free
+ */
+void tracer_rpi_set_free(tracer_rpi_set * set) {
+    free(set->items);
+    free(set->rssi_sums);
+    free(set->slots);
+    set->items = NULL;
+    set->rssi_sums = NULL;
+    set->slots = NULL;
+    set->capacity = 0;
+    set->len = 0;
+}
+
+/**
+ * @brief Adds a received datapair to an RPI set, merging it into its sighting if it is already there.
+ *
+ * @param set A pointer to the set to add to
+ * @param datapair A pointer to the received datapair
+ * @param epoch The unix epoch the datapair was received at
+ * @param rssi The RSSI the datapair was received with, in dBm
+ * @return Whether the datapair was added, merged, or dropped because the set is full
+ */
+tracer_rpi_set_result tracer_rpi_set_add(tracer_rpi_set * set, const tracer_datapair * datapair, uint32_t epoch, int8_t rssi) {
+    if (set->capacity == 0) return TRACER_RPI_SET_FULL;    // not initialized, or already freed
+
+    size_t slot = _tracer_rpi_set_hash(set, &datapair->rpi);
+
+    for (; set->slots[slot] != 0; slot = (slot + 1) & set->slot_mask) {    // linear probing
+        size_t i = set->slots[slot] - 1;
+        tracer_sighting * sighting = &set->items[i];
+
+        if (!tracer_compare_datapairs_v2(&sighting->pair, datapair)) continue;
+
+        if (epoch > sighting->first_seen) {
+            uint32_t duration = epoch - sighting->first_seen;
+            if (duration > sighting->duration) sighting->duration = duration > UINT16_MAX ? UINT16_MAX : duration;
+        }
+
+        if (sighting->count < UINT16_MAX) {
+            sighting->count++;
+            set->rssi_sums[i] += rssi;
+            sighting->rssi_mean = set->rssi_sums[i] / (int32_t)sighting->count;
+        }
+
+        if (rssi < sighting->rssi_min) sighting->rssi_min = rssi;
+        if (rssi > sighting->rssi_max) sighting->rssi_max = rssi;
+
+        return TRACER_RPI_SET_DUPLICATE;
+    }
+
+    if (set->len == set->capacity) {
+        set->dropped++;
+        return TRACER_RPI_SET_FULL;
+    }
+
+    tracer_sighting * sighting = &set->items[set->len];
+    sighting->pair = *datapair;
+    sighting->first_seen = epoch;
+    sighting->duration = 0;
+    sighting->count = 1;
+    sighting->rssi_min = rssi;
+    sighting->rssi_max = rssi;
+    sighting->rssi_mean = rssi;
+    sighting->reserved = 0;
+    set->rssi_sums[set->len] = rssi;
+
+    set->slots[slot] = ++set->len;
+
+    return TRACER_RPI_SET_ADDED;
+}
+
+#endif
@@ -9,7 +9,8 @@
 #include "esp_sleep.h"
 #include "esp_task_wdt.h"
 #include "esp_system.h"
-#include "esp_spiffs.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
 #include "esp32/ulp.h"
 
 #include <driver/adc.h>
@@ -28,8 +29,24 @@
 #include "http_server.h"
 #include "streamop.h"
 #include "http.h"
+#include "tek_stream.h"
+#include "tek_export.h"
+#include "tek_sync.h"
 #include "tracer.h"
-#include "cvec.h"
+#include "tracer_index.h"
+#include "tracer_rpi_set.h"
+#include "scan_ring.h"
+#include "scan_sched.h"
+#include "scan_journal.h"
+#include "scan_log.h"
+#include "file_store.h"
+#include "tek_log.h"
+#include "match_export.h"
+#ifdef FILE_STORE_LITTLEFS
+#include "file_store_littlefs.h"
+#else
+#include "file_store_spiffs.h"
+#endif
 #include "test_cert.h"
 
 #define LED_PIN             2
@@ -39,19 +56,52 @@
 #define CONFIG_SUBMIT_FLAG  BIT(0)
 #define CONFIG_WIFI_FLAG    BIT(1)
 
-#define SPIFFS_ROOT         "/spiffs"
-#define TEKFILE_NAME        "tekfile"
+#define FILES_ROOT          "/files"
+#define FILES_PARTITION     "files"
+#ifdef FILE_STORE_LITTLEFS
+#define FILES_BACKEND       file_store_littlefs     // define FILE_STORE_LITTLEFS to build with littlefs, see file_store_littlefs.h
+#else
+#define FILES_BACKEND       file_store_spiffs
+#endif
 #define MATCHFILE_NAME      "matches"
+#define MATCH_READ_LEN      256     // how many matches are read from the matchfile at once
+#define MATCH_SEND_LEN      1436    // how many bytes go into each chunk of a /matches response, about a tcp segment
 
 #define TRACER_KEYSERVER    "10.0.0.173"
+#define TRACER_KEYSERVER_PORT 80
+//#define TRACER_KEYSERVER_CERT HOWSMYSSL_PEM   // talks to the keyserver over https, checked against this ca certificate. set TRACER_KEYSERVER_PORT to 443 too.
+//#define TEK_DOWNLOAD_DEFLATE      // asks for deflated tek exports. teks are random, so it only saves about 2% over tekx, for a 4 KB window and the time to inflate.
 
 #define POST_SSID_KEY_BEGIN "ssid["
 #define POST_PWD_KEY_BEGIN  "pwd["
 #define POST_KEY_END        ']'
 
+#define SCAN_SET_CAPACITY   512     // the most distinct peers stored per eninterval. once full, the sightings are written out early.
+#define SCAN_RING_CAPACITY  64      // the most adverts that can wait to be parsed
+#define INDEX_HEAP_SHARE    2       // an rpi index takes at most 1/this of the largest free heap block, leaving the rest to the download
+#define SCAN_BATCH_LEN      16      // the number of adverts parsed per ring pop
+#define SCAN_DRAIN_MS       50      // how often the scan ring is drained while scanning
+#define SCAN_READ_RUN_LEN   64      // the most sightings read from storage at once while matching
+
+#define SCAN_MIN_WINDOW_MS  300     // the scan window when nothing new has been heard for a while
+#define SCAN_MAX_WINDOW_MS  600     // the scan window in a crowd
+#define SCAN_MIN_INTERVAL_S 15      // the time between scans in a crowd
+#define SCAN_MAX_INTERVAL_S (4 * 60 * TRACER_SCAN_INTERVAL)    // the time between scans when alone. contacts at least this long always overlap a scan.
+#define SCAN_MAX_DUTY       20      // the most of the time spent scanning, in thousandths
+
 static const char * TAG = "app_main";
 
-tracer_datapair * scanned_data = NULL;
+scan_ring scan_queue;           // filled by the bluetooth task, drained by the main task
+tracer_rpi_set scanned_data;    // the sightings of the current eninterval. only touched by the main task.
+uint32_t scanned_data_epoch = 0; // the start of the first scan window merged into scanned_data
+scan_sched scan_schedule;
+file_store files;               // the files partition
+tek_log teklog;                 // the device's own teks
+scan_journal journal;           // where the sightings are stored when there is no scan log partition
+scan_log raw_log;               // where the sightings are stored, straight on flash
+bool use_raw_log = false;       // whether the scan log partition was found
+http_conn keyserver;            // kept open for as long as wifi is up, so every request in a wake shares it
+RTC_NOINIT_ATTR scan_journal_buffer scan_buffer;    // sightings waiting to be written. kept in rtc memory, so they survive a brown-out or crash reset.
 bool touch_wake = false;
 
 int64_t get_micros() {
@@ -65,99 +115,128 @@ uint32_t get_epoch() {
     return out;
 }
 
+// runs on the bluetooth task, so it only drops adverts that aren't exposure notifications and queues the rest for the main task.
 void scan_cb(ble_adapter_scan_result res) {
-    tracer_ble_payload payload;
-    payload.len = res.adv_data_len;
-    memcpy(payload.value, res.adv_data, payload.len);
-    
-    tracer_datapair pair;
+    if (!tracer_parse_adv_data(res.adv_data, res.adv_data_len, NULL)) return;
+    scan_ring_push(&scan_queue, res.adv_data, res.adv_data_len, res.mac_addr, res.rssi);
+}
 
-    if (tracer_parse_ble_payload(payload, &pair)) {
-        bool rpi_exists = false;
+// parses the queued adverts and merges their datapairs into scanned_data. returns the number of datapairs heard for the first time.
+size_t drain_scan_queue() {
+    scan_ring_record batch[SCAN_BATCH_LEN];
+    size_t len;
+    size_t added = 0;
+    uint32_t epoch = get_epoch();
 
-        for (size_t i = 0; i < cvec_len(scanned_data); i++) {
-            rpi_exists |= tracer_compare_datapairs(pair, scanned_data[i]);
-            if (rpi_exists) break;
-        }
+    while ((len = scan_ring_pop(&scan_queue, batch, SCAN_BATCH_LEN)) > 0) {
+        for (size_t i = 0; i < len; i++) {
+            tracer_datapair pair;
 
-        if (!rpi_exists) {
-            //ESP_LOGI(TAG, "rpi: %x\taem: %x", *(uint32_t *)pair.rpi.value, *(uint32_t *)pair.aem.value);
-            cvec_append(scanned_data, pair);
+            if (tracer_parse_adv_data(batch[i].adv_data, batch[i].adv_data_len, &pair)) {
+                //ESP_LOGI(TAG, "rpi: %x\taem: %x", *(uint32_t *)pair.rpi.value, *(uint32_t *)pair.aem.value);
+                added += tracer_rpi_set_add(&scanned_data, &pair, epoch, batch[i].rssi) == TRACER_RPI_SET_ADDED;
+            }
         }
     }
+
+    return added;
 }
 
 void http_get_cb(char * data, size_t len, void * user_data) {
     printf("%s", data);
 }
 
-void scan_for_peers(uint32_t epoch, uint32_t ms) {
-    uint32_t scanin = tracer_epoch2scanin(epoch);
+// writes the buffered sightings to the journal.
+void flush_scan_buffer() {
+    if (scan_buffer.len == 0) return;
 
-    scanned_data = cvec_arrayof(tracer_datapair);
+    size_t len = scan_buffer.len;
+    if (scan_journal_buffer_flush(&journal, &scan_buffer)) {
+        ESP_LOGI(TAG, "flushed %u bytes of sightings.", len);
+    } else {
+        ESP_LOGE(TAG, "couldn't write to the scan journal!");
+    }
+}
 
-    ble_adapter_start_scanning();
-    vTaskDelay(ms / portTICK_PERIOD_MS);
-    ble_adapter_stop_scanning();
+// buffers the sightings in scanned_data under the window they started in, then empties it. the buffer is only written out once it fills whole pages, or gets old.
+void write_sightings() {
+    // to save on storeage, the tracer api will now not write to a scanfile if no peers are found.
+    if (scanned_data.len > 0 && use_raw_log) {
+        // the raw log writes no metadata alongside the sightings, and only erases a sector every few hundred of them, so it doesn't need the buffer
+        if (scan_log_append(&raw_log, tracer_epoch2scanin(scanned_data_epoch), scanned_data.items, scanned_data.len)) {
+            ESP_LOGI(TAG, "logged %d sightings.", scanned_data.len);
+        } else {
+            ESP_LOGE(TAG, "couldn't write to the scan log!");
+        }
 
-    cvec_crunch(scanned_data);  // free up unused memory
+        if (scanned_data.dropped > 0) ESP_LOGW(TAG, "scan set full, dropped %u peers.", scanned_data.dropped);
+    } else if (scanned_data.len > 0) {
+        uint32_t epoch = get_epoch();
 
-    // to save on storeage, the tracer api will now not write to a scanfile if no peers are found.
-    if (cvec_len(scanned_data) > 0) {
-        char * fname = b64_encode(&scanin, sizeof(scanin));
-        fname = realloc(fname, strlen(SPIFFS_ROOT"/") + strlen(fname) + 1);
-        memmove(fname + strlen(SPIFFS_ROOT"/"), fname, strlen(fname) + 1);
-        memcpy(fname, SPIFFS_ROOT"/", strlen(SPIFFS_ROOT"/"));
+        if (scan_journal_buffer_append(&journal, &scan_buffer, tracer_epoch2scanin(scanned_data_epoch), scanned_data.items, scanned_data.len, epoch)) {
+            ESP_LOGI(TAG, "buffered %d sightings.", scanned_data.len);
+        } else {
+            ESP_LOGE(TAG, "couldn't write to the scan journal!");
+        }
+
+        if (scan_journal_buffer_due(&scan_buffer, epoch)) flush_scan_buffer();
 
-        ESP_LOGD(TAG, "writing to %s...", fname);
+        if (scanned_data.dropped > 0) ESP_LOGW(TAG, "scan set full, dropped %u peers.", scanned_data.dropped);
+    }
 
-        FILE * scan_record = fopen(fname, "w");
+    tracer_rpi_set_clear(&scanned_data);
+}
 
-        free(fname);
+// scans for ms milliseconds. returns the number of datapairs heard for the first time this eninterval.
+size_t scan_for_peers(uint32_t epoch, uint32_t ms) {
+    // sightings are merged across every scan window of an eninterval, and only written once it is over
+    if (tracer_epoch2enin(epoch) != tracer_epoch2enin(scanned_data_epoch)) write_sightings();
+    if (scanned_data.len == 0) scanned_data_epoch = epoch;
 
-        if (scan_record != NULL) {
-            fwrite(scanned_data, cvec_sizeof(scanned_data), 1, scan_record);
-        } else {
-            ESP_LOGE(TAG, "file null!");
-        }
+    scan_ring_clear(&scan_queue);     // throw away stragglers from the last window
+    scan_ring_take_dropped(&scan_queue);
 
-        ESP_LOGI(TAG, "found %d peers.", cvec_len(scanned_data));
+    size_t added = 0;
 
-        fclose(scan_record);
+    ble_adapter_start_scanning();
+
+    int64_t scan_end = get_micros() + (int64_t)ms * 1000;
+    while (get_micros() < scan_end) {
+        vTaskDelay(SCAN_DRAIN_MS / portTICK_PERIOD_MS);
+        added += drain_scan_queue();
+    }
+
+    ble_adapter_stop_scanning();
+    added += drain_scan_queue();
+
+    uint32_t ring_dropped = scan_ring_take_dropped(&scan_queue);
+    if (ring_dropped > 0) ESP_LOGW(TAG, "scan queue full, dropped %u adverts.", ring_dropped);
+
+    if (scanned_data.len > 0) {
+        ESP_LOGI(TAG, "found %d peers this eninterval.", scanned_data.len);
     } else {
         ESP_LOGI(TAG, "no peers found.");
     }
 
-    cvec_free(scanned_data);
+    if (scanned_data.len == scanned_data.capacity) write_sightings();  // write early so the next window's peers aren't dropped
+
+    return added;
 }
 
-// saves the teks to spiffs.
+// appends the newest tek to the tek log.
 void save_teks() {
-    FILE * tek_file = fopen(SPIFFS_ROOT "/" TEKFILE_NAME, "w");
-    if (tek_file) {
-        ESP_LOGI(TAG, "writing tek array to tekfile.");
-        fwrite(tracer_tek_array, 1, sizeof(tracer_tek_array), tek_file);
-        fclose(tek_file);
+    if (tek_log_append(&teklog, tracer_tek_array)) {
+        ESP_LOGI(TAG, "appended tek %u to the tek log.", teklog.next_seq - 1);
     } else {
-        ESP_LOGE(TAG, "error opening tekfile!");
+        ESP_LOGE(TAG, "couldn't write to the tek log!");
     }
 }
 
 void load_teks() {
-    FILE * tek_file = fopen(SPIFFS_ROOT "/" TEKFILE_NAME, "r");
-    if (tek_file) {
-        fread(tracer_tek_array, 1, sizeof(tracer_tek_array), tek_file);
-        uint32_t newest = 0;
-        for (size_t i = 0; i < TRACER_TEK_STORE_PERIOD; i++) {
-            if (tracer_tek_array[i].epoch > newest) {
-                newest = tracer_tek_array[i].epoch;
-                tracer_tek_array_head = i;
-            }
-        }
-        ESP_LOGI(TAG, "found tekfile, set head to %d.", tracer_tek_array_head);
-        fclose(tek_file);
+    if (tek_log_load(&teklog, &files, tracer_tek_array, &tracer_tek_array_head)) {
+        ESP_LOGI(TAG, "loaded tek log, set head to %d.", tracer_tek_array_head);
     } else {
-        ESP_LOGE(TAG, "error opening tekfile!");
+        ESP_LOGE(TAG, "couldn't load the tek log!");
     }
 }
 
@@ -191,24 +270,17 @@ void init_touch() {
     ESP_ERROR_CHECK(touch_pad_intr_enable());
 }
 
-// initialize spiffs fs
-void init_spiffs() {
-    esp_vfs_spiffs_conf_t spiffs_conf = {
-        .base_path = SPIFFS_ROOT,
-        .partition_label = NULL,
-        .max_files = 2,
-        .format_if_mount_failed = true,
-    };
-
-    //ESP_ERROR_CHECK(esp_spiffs_format(spiffs_conf.partition_label));
+// mounts the files partition.
+void init_files() {
+    int64_t start = get_micros();
 
-    ESP_ERROR_CHECK(esp_vfs_spiffs_register(&spiffs_conf));
+    ESP_ERROR_CHECK(file_store_mount(&files, &FILES_BACKEND, FILES_ROOT, FILES_PARTITION) ? ESP_OK : ESP_FAIL);
 
     size_t total = 0, used = 0;
 
-    ESP_ERROR_CHECK(esp_spiffs_info(spiffs_conf.partition_label, &total, &used));
+    ESP_ERROR_CHECK(file_store_info(&files, &total, &used) ? ESP_OK : ESP_FAIL);
 
-    ESP_LOGV(TAG, "spiffs used %d/%d bytes.", used, total);
+    ESP_LOGI(TAG, "mounted %s in %lld ms, used %d/%d bytes.", files.backend->name, (get_micros() - start) / 1000, used, total);
 }
 
 // randomizes the ble mac address
@@ -346,7 +418,7 @@ esp_err_t config_get_flash_state(httpd_req_t * req) {
     size_t total, used;
     ESP_LOGI(TAG, "getting flash usage...");
 
-    ESP_ERROR_CHECK(esp_spiffs_info(NULL, &total, &used));
+    ESP_ERROR_CHECK(file_store_info(&files, &total, &used) ? ESP_OK : ESP_FAIL);
 
     char datastring[64] = { 0 };
     sprintf(datastring, "%u/%u", used, total);
@@ -355,36 +427,93 @@ esp_err_t config_get_flash_state(httpd_req_t * req) {
     return ESP_OK;
 }
 
+// sends the matches, in chunks of about a tcp segment. takes an optional query of since and until, the range of epochs
+// to send, and format, which is either raw (the default, a uint32 per match) or delta (see match_export.h).
 esp_err_t config_get_exposure_handler(httpd_req_t * req) {
-    ESP_LOGI(TAG, "attempting to send matchfile to client...");
+    static uint32_t epochs[MATCH_READ_LEN];
+    static uint8_t out[MATCH_SEND_LEN];
+
+    uint32_t since = 0, until = UINT32_MAX;
+    match_export_format format = MATCH_EXPORT_RAW;
+
+    char query[64], value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "since", value, sizeof(value)) == ESP_OK) since = strtoul(value, NULL, 10);
+        if (httpd_query_key_value(query, "until", value, sizeof(value)) == ESP_OK) until = strtoul(value, NULL, 10);
+        if (httpd_query_key_value(query, "format", value, sizeof(value)) == ESP_OK && !match_export_parse_format(value, &format)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "unknown format");
+            return ESP_OK;
+        }
+    }
 
-    FILE * matchfile = fopen(SPIFFS_ROOT"/"MATCHFILE_NAME, "r");
+    FILE * matchfile = file_store_open(&files, MATCHFILE_NAME, "r");
 
-    if (matchfile) {
-        uint32_t match;
-        while (fread(&match, sizeof(uint32_t), 1, matchfile)) {
-            ESP_LOGI(TAG, "read 1 epoch");
-            httpd_resp_send_chunk(req, &match, sizeof(match));
+    httpd_resp_set_type(req, "application/octet-stream");
+
+    match_export ex;
+    match_export_init(&ex, since, until, format);
+
+    size_t out_len = 0, total_len = 0, read_len;
+    esp_err_t err = ESP_OK;
+
+    while (matchfile && err == ESP_OK && (read_len = fread(epochs, sizeof(uint32_t), MATCH_READ_LEN, matchfile)) > 0) {
+        for (size_t offset = 0, consumed; offset < read_len && err == ESP_OK; offset += consumed) {
+            out_len += match_export_encode(&ex, epochs + offset, read_len - offset, out + out_len, sizeof(out) - out_len, &consumed);
+
+            if (sizeof(out) - out_len < MATCH_EXPORT_MAX_ITEM_LEN) {
+                err = httpd_resp_send_chunk(req, (const char *)out, out_len);
+                total_len += out_len;
+                out_len = 0;
+            }
         }
-        httpd_resp_sendstr_chunk(req, NULL);
+    }
 
+    if (err == ESP_OK && out_len > 0) err = httpd_resp_send_chunk(req, (const char *)out, out_len);
+    if (err == ESP_OK) httpd_resp_send_chunk(req, NULL, 0);
+    total_len += out_len;
+
+    if (matchfile) {
         fclose(matchfile);
     } else {
-        ESP_LOGE(TAG, "matchfile not available for opening!");
+        ESP_LOGW(TAG, "no matchfile, sent no matches.");
     }
 
-    return ESP_OK;
+    ESP_LOGI(TAG, "sent %u matches in %u bytes.", ex.sent, total_len);
+
+    return err;
 }
 
 esp_err_t config_erase_flash_handler(httpd_req_t * req) {
-    ESP_ERROR_CHECK(esp_spiffs_format(NULL));
+    ESP_ERROR_CHECK(file_store_format(&files) ? ESP_OK : ESP_FAIL);
+    scan_journal_init(&journal, &files);   // the old manifest went with the rest of the partition
+    if (!tek_log_compact(&teklog, tracer_tek_array)) ESP_LOGE(TAG, "couldn't rewrite the tek log!");  // and so did the tek log, so the teks in memory are written back
+    scan_journal_buffer_reset(&scan_buffer);
+    if (use_raw_log && !scan_log_erase(&raw_log)) ESP_LOGE(TAG, "couldn't erase the scan log!");
     httpd_resp_sendstr(req, "ok");
     return ESP_OK;
 }
 
+// opens the keyserver connection, over https if TRACER_KEYSERVER_CERT is defined, resuming the tls session saved in nvs
+void keyserver_open() {
+#ifdef TRACER_KEYSERVER_CERT
+    http_tls_cache_load();
+    http_conn_init_tls(&keyserver, TRACER_KEYSERVER, TRACER_KEYSERVER_PORT, TRACER_KEYSERVER_CERT);
+#else
+    http_conn_init(&keyserver, TRACER_KEYSERVER, TRACER_KEYSERVER_PORT);
+#endif
+}
+
+// closes the keyserver connection, and saves the tls session if a new one was made
+void keyserver_close() {
+    http_conn_close(&keyserver);
+#ifdef TRACER_KEYSERVER_CERT
+    http_tls_cache_save();
+#endif
+}
+
 void config_submit_keys_http_cb(char * data, size_t len, void * user_dat) {
 
-    ESP_LOGI(TAG, "got response %s.", data);
+    if (len > 0) ESP_LOGI(TAG, "got response %.*s.", len, data);
 
     return;
 }
@@ -511,7 +640,10 @@ void enter_config(uint32_t time, uint8_t flags) {
             memcpy(post_buf, submit_ctx.data_buf, 7);                           // copy caseid from post request
             memcpy(post_buf + 7, tracer_tek_array, sizeof(tracer_tek_array));   // copy tracer tek array
 
-            http_req_ip("POST", TRACER_KEYSERVER, TRACER_KEYSERVER"/", post_buf, sizeof(post_buf), config_submit_keys_http_cb, NULL);
+            keyserver_open();
+            http_begin(&keyserver, "POST", "/");
+            http_send(&keyserver, post_buf, sizeof(post_buf), config_submit_keys_http_cb, NULL);
+            keyserver_close();
 
             wifi_adapter_disconnect();
         }
@@ -525,89 +657,132 @@ void enter_config(uint32_t time, uint8_t flags) {
 }
 
 // tests a chunk of teks against stored matches.
-void test_teks(tracer_tek * tek_array, size_t tek_array_len) {
-    ESP_LOGI(TAG, "validating %u teks.", tek_array_len);
+// appends the first time each sighting was seen to the matchfile if it came from one of the indexed teks.
+void test_sightings(tracer_index * index, const tracer_sighting * sightings, size_t len, FILE * matchfile) {
+    uint32_t match_enin;
+
+    for (size_t i = 0; i < len; i++) {
+        if (tracer_index_lookup(index, &sightings[i].pair, &match_enin, NULL)) {
+            ESP_LOGW(TAG, "tek match at enin %u, seen %u times over %u seconds at %d dBm!", match_enin, sightings[i].count, sightings[i].duration, sightings[i].rssi_mean);
+            fwrite(&sightings[i].first_seen, sizeof(uint32_t), 1, matchfile);
+        }
+    }
+}
 
-    DIR * root_dir = opendir(SPIFFS_ROOT);
-    struct dirent * de;
+// tests a batch of teks small enough to index in one piece against the stored sightings.
+void test_tek_chunk(tracer_tek * tek_array, size_t tek_array_len) {
+    tracer_index index;
 
-    FILE * matchfile = fopen(SPIFFS_ROOT"/"MATCHFILE_NAME, "a");
+    if (!tracer_index_init(&index, tek_array, tek_array_len)) {
+        ESP_LOGE(TAG, "couldn't allocate rpi index!");
+        return;
+    }
 
-    tracer_tek stream_tek;
-    //streamop_token tek_token = streamop_create_chunk_token(&stream_tek, sizeof(tracer_tek));
+    ESP_LOGI(TAG, "indexed %u rpis.", index.len);
 
-    while ((de = readdir(root_dir)) != NULL) {
-        if (strcmp(de->d_name, TEKFILE_NAME) == 0 || strcmp(de->d_name, MATCHFILE_NAME) == 0) {
-            ESP_LOGI(TAG, "found tekfile or matchfile");
-        } else {
-            uint32_t * decoded_scanin = (uint32_t *)b64_decode(de->d_name, NULL);
-            uint32_t file_scanin = *decoded_scanin;
-            uint32_t file_epoch = tracer_scanin2epoch(file_scanin);
-            free(decoded_scanin);
-
-            ESP_LOGD(TAG, "file: %s\tderived scanin: %u", de->d_name, file_scanin);
-
-            char ffullpath[strlen(de->d_name) + strlen(SPIFFS_ROOT"/") + 1];
-            memcpy(ffullpath, SPIFFS_ROOT"/", sizeof(SPIFFS_ROOT"/"));
-            strcat(ffullpath, de->d_name);
-
-            FILE * scanfile = fopen(ffullpath, "r");
-
-            if (scanfile == NULL) {
-                ESP_LOGE(TAG, "couldn't open file %s!", ffullpath);
-            } else {
-                tracer_datapair datapair;
-                while (fread(&datapair, sizeof(tracer_datapair), 1, scanfile)) {
-                    for (size_t i = 0; i < tek_array_len; i++) {
-                        if (tracer_verify(datapair, tek_array[i], NULL, NULL)) {
-                            ESP_LOGW(TAG, "tek match!");
-                            fwrite(&file_epoch, sizeof(uint32_t), 1, matchfile);
-                        }
-                    }
-                }
-                fclose(scanfile);
-            }
+    flush_scan_buffer();    // the reader only sees the journal
+
+    FILE * matchfile = file_store_open(&files, MATCHFILE_NAME, "a");
+
+    static tracer_sighting run_buffer[SCAN_READ_RUN_LEN];
+    const tracer_sighting * run;
+    size_t run_len, tested = 0;
+    int64_t start = get_micros();
+
+    // the journal can still hold sightings from before the scan log partition was added
+    scan_journal_reader reader;
+    scan_journal_reader_open(&reader, &journal, 0);
+    while ((run_len = scan_journal_read_run(&reader, run_buffer, SCAN_READ_RUN_LEN, NULL)) > 0) {
+        test_sightings(&index, run_buffer, run_len, matchfile);
+        tested += run_len;
+    }
+
+    if (use_raw_log) {
+        scan_log_reader log_reader;
+        scan_log_reader_open(&log_reader, &raw_log);     // read in place out of the flash cache when the partition can be mapped
+        while ((run_len = scan_log_read_run(&log_reader, run_buffer, SCAN_READ_RUN_LEN, &run)) > 0) {
+            test_sightings(&index, run, run_len, matchfile);
+            tested += run_len;
         }
+        scan_log_reader_close(&log_reader);
     }
 
+    ESP_LOGI(TAG, "tested %u sightings in %lld ms.", tested, (get_micros() - start) / 1000);
+
     fclose(matchfile);
 
-    closedir(root_dir);
+    tracer_index_free(&index);
+
+#if TRACER_KEY_CACHE_SIZE > 0
+    tracer_key_cache_stats cache_stats = tracer_key_cache_get_stats();
+    ESP_LOGI(TAG, "key cache: %u hits, %u misses, %u evictions.", cache_stats.hits, cache_stats.misses, cache_stats.evictions);
+    tracer_key_cache_clear();   // wipe the keys and give the memory back until the next batch
+#endif
+}
+
+// tests a batch of teks against the stored sightings, split into as many indexes as the heap needs.
+void test_teks(tracer_tek * tek_array, size_t tek_array_len) {
+    size_t max_teks = tracer_index_max_teks(heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) / INDEX_HEAP_SHARE);
+
+    ESP_LOGI(TAG, "validating %u teks, %u at a time.", tek_array_len, max_teks);
+
+    if (max_teks == 0) {
+        ESP_LOGE(TAG, "not enough heap to index a single tek!");
+        return;
+    }
+
+    for (size_t i = 0; i < tek_array_len; i += max_teks) {
+        test_tek_chunk(tek_array + i, tek_array_len - i < max_teks ? tek_array_len - i : max_teks);
+    }
 }
 
+void test_tek_batch(tracer_tek * teks, size_t len, void * user_data) {
+    test_teks(teks, len);
+}
+
+typedef struct {
+    tek_stream stream;
+    tek_export_decoder decoder;
+    bool whole;             // whether the whole export was decoded
+} tek_download;
+
+// decodes the tek export as it is downloaded, and tests the teks a batch at a time.
 void validate_tek_http_stream(char * data, size_t data_len, void * user_dat) {
+    tek_download * download = user_dat;
 
-    //ESP_LOGD(TAG, "scanning files...");
-    ESP_LOGI(TAG, "recieved chunk %u bytes long.", data_len);
-
-    struct {
-        tracer_tek tek_buffer[128];
-        size_t tek_buffer_head;
-        size_t expected_chunk_len;
-        tracer_tek current_tek;
-        streamop_token chunker;
-        streamop_token http_end;
-        bool body_valid;
-    } * stream_ctx = user_dat;
-
-    for (size_t i = 0; i < data_len; i++) {
-        char c = data[i];
-        if (stream_ctx->body_valid) {
-            //ESP_LOGI(TAG, "body now valid.");
-            if (streamop_chunk_character(&stream_ctx->chunker, c) == STREAMOP_CHUNK_OK) {
-                stream_ctx->tek_buffer[stream_ctx->tek_buffer_head++] = stream_ctx->current_tek;
-                if (stream_ctx->tek_buffer_head == 128) {
-                    test_teks(stream_ctx->tek_buffer, stream_ctx->tek_buffer_head);
-                    stream_ctx->tek_buffer_head = 0;
-                }
-            }
-        }
-        stream_ctx->body_valid |= streamop_match_character(&stream_ctx->http_end, c) == STREAMOP_MATCH;
+    if (data_len > 0) {
+        tek_export_feed(&download->decoder, data, data_len);
+    } else {    // the body is over
+        download->whole = tek_export_end(&download->decoder);
     }
-    if (stream_ctx->expected_chunk_len != data_len) {   // on the last chunk
-        test_teks(stream_ctx->tek_buffer, stream_ctx->tek_buffer_head);
-        stream_ctx->tek_buffer_head = 0;
+}
+
+// downloads the keyserver's teks from number since on, and tests them as they come in. returns the status code, or -1
+// if the export was cut short or malformed, and sets downloaded to the number of teks that were tested.
+int download_teks(uint32_t since, size_t * downloaded) {
+    static tek_download download;
+    char url[48];
+
+    tek_stream_init(&download.stream, test_tek_batch, NULL);
+    tek_export_init(&download.decoder, &download.stream);
+    download.whole = false;
+
+#ifdef TEK_DOWNLOAD_DEFLATE
+    snprintf(url, sizeof(url), "/?since=%u&format=tekx&deflate=1", since);
+#else
+    snprintf(url, sizeof(url), "/?since=%u&format=tekx", since);
+#endif
+
+    http_begin(&keyserver, "GET", url);
+    int status = http_send(&keyserver, NULL, 0, validate_tek_http_stream, &download);
+
+    if (!download.whole) tek_export_end(&download.decoder);     // frees the inflater if the response was cut short
+    *downloaded = download.stream.total;
+    if (status == 200 && !download.whole) {     // the teks are sorted by date, not number, so the cursor can't move on from part of them
+        ESP_LOGW(TAG, "tek export was cut short or malformed after %u teks.", *downloaded);
+        return -1;
     }
+    return status;
 }
 
 void check_teks() {
@@ -637,25 +812,28 @@ void check_teks() {
 
         ESP_LOGI(TAG, "time synced!");
 
-        struct {
-            tracer_tek tek_buffer[128];
-            size_t tek_buffer_head;
-            size_t expected_chunk_len;
-            tracer_tek current_tek;
-            streamop_token chunker;
-            streamop_token http_end;
-            bool body_valid;
-        } tek_stream_ctx;
+        // only the teks the keyserver has had since the last sync are downloaded
+        uint32_t cursor = tek_sync_load(&files);
+        size_t downloaded;
 
-        memset(tek_stream_ctx.tek_buffer, 0, sizeof(tek_stream_ctx.tek_buffer));
-        tek_stream_ctx.tek_buffer_head = 0;
-        tek_stream_ctx.expected_chunk_len = 64;
-        tek_stream_ctx.chunker = streamop_create_chunk_token(&tek_stream_ctx.current_tek, sizeof(tracer_tek));
+        keyserver_open();
+        int status = download_teks(cursor, &downloaded);
 
-        tek_stream_ctx.http_end = streamop_create_token_from_str("\r\n\r\n");
-        tek_stream_ctx.body_valid = false;
+        if (status == 416) {    // the keyserver has fewer teks than the cursor, so it was reset
+            ESP_LOGW(TAG, "keyserver was reset, downloading every tek.");
+            cursor = 0;
+            status = download_teks(cursor, &downloaded);
+        }
 
-        http_req_ip("GET", TRACER_KEYSERVER, TRACER_KEYSERVER"/", NULL, 0, validate_tek_http_stream, &tek_stream_ctx);
+        keyserver_close();
+
+        if (status == 200) {
+            cursor += downloaded;
+            if (!tek_sync_save(&files, cursor)) ESP_LOGE(TAG, "couldn't save the tek sync cursor!");
+            ESP_LOGI(TAG, "downloaded %u new teks, synced up to tek %u.", downloaded, cursor);
+        } else {
+            ESP_LOGE(TAG, "tek download failed with status %d.", status);
+        }
 
         wifi_adapter_disconnect();
     }
@@ -664,34 +842,39 @@ void check_teks() {
     wifi_adapter_deinit();    
 }
 
-// deletes scanfiles older than max_scanin_age
-void free_spiffs(uint32_t epoch, uint32_t max_scanin_age) {
+// deletes the per-minute scanfiles older firmware wrote before the scan journal. they are named after their scan interval
+// number in base64, and nothing reads or expires them any more, so they would otherwise fill the partition for good.
+void delete_legacy_scanfiles() {
+    DIR * root_dir = opendir(files.root);
+    if (root_dir == NULL) return;
 
-    DIR * root_dir = opendir(SPIFFS_ROOT);
     struct dirent * de;
-
-    uint32_t min_age = tracer_epoch2scanin(epoch) - max_scanin_age;
+    size_t deleted = 0;
 
     while ((de = readdir(root_dir)) != NULL) {
-        if (strcmp(de->d_name, TEKFILE_NAME) == 0 || strcmp(de->d_name, MATCHFILE_NAME) == 0) {
-            ESP_LOGI(TAG, "found tekfile or matchfile");
-        } else {
-            uint32_t * decoded_enin = (uint32_t *)b64_decode(de->d_name, NULL);
-            uint32_t file_enin = *decoded_enin;
-            free(decoded_enin);
+        uint32_t scanin;
 
-            char ffullpath[strlen(de->d_name) + strlen(SPIFFS_ROOT"/") + 1];
-            memcpy(ffullpath, SPIFFS_ROOT"/", sizeof(SPIFFS_ROOT"/"));
-            strcat(ffullpath, de->d_name);
+        if (strcmp(de->d_name, TEK_LOG_LEGACY_NAME) == 0 || strcmp(de->d_name, MATCHFILE_NAME) == 0) continue;
+        if (strlen(de->d_name) != b64_encoded_size(sizeof(scanin)) - 1 || b64_decode_to(de->d_name, &scanin, sizeof(scanin)) != sizeof(scanin)) continue;
 
-            if (file_enin < min_age) {
-                ESP_LOGI(TAG, "deleting file %s", de->d_name);
-                remove(ffullpath);
-            }
-        }
+        deleted += file_store_remove(&files, de->d_name);
     }
 
     closedir(root_dir);
+
+    if (deleted > 0) ESP_LOGI(TAG, "deleted %u legacy scanfiles.", deleted);
+}
+
+// deletes the days of scans older than max_scanin_age
+void free_scans(uint32_t epoch, uint32_t max_scanin_age) {
+    uint32_t min_day = scan_journal_scanin2day(tracer_epoch2scanin(epoch) - max_scanin_age);
+    size_t expired = scan_journal_expire(&journal, min_day);
+    if (expired > 0) ESP_LOGI(TAG, "deleted %u days of scans.", expired);
+
+    if (use_raw_log) {
+        expired = scan_log_expire(&raw_log, tracer_epoch2scanin(epoch) - max_scanin_age);
+        if (expired > 0) ESP_LOGI(TAG, "expired %u sectors of the scan log.", expired);
+    }
 }
 
 // initializes configuration 
@@ -736,6 +919,8 @@ void startup_config() {
 void app_main(void) {
     ESP_LOGI(TAG, "esp booted!");
 
+    if (!tracer_crypto_init()) ESP_LOGE(TAG, "no supported crypto backend!");
+
     ESP_ERROR_CHECK(nvs_flash_init());
     //ESP_ERROR_CHECK(nvs_flash_erase());
 
@@ -744,9 +929,27 @@ void app_main(void) {
 
     adc_power_off();        // turn off adc
 
-    //esp_spiffs_format(NULL);
+    init_files();           // mount the files partition
+
+    if (!scan_journal_init(&journal, &files)) ESP_LOGE(TAG, "couldn't open the scan journal!");
+    delete_legacy_scanfiles();
+
+    use_raw_log = scan_log_init(&raw_log, NULL);
+    if (use_raw_log) {
+        ESP_LOGI(TAG, "scan log has %u sectors, writing to sector %u slot %u.", raw_log.sector_count, raw_log.head, raw_log.head_slot);
+    } else {
+        ESP_LOGW(TAG, "no scan log partition, using the scan journal.");
+    }
+
+    // rtc memory is garbage after a power-on, but after any other reset it still holds the sightings that hadn't been written yet
+    if (esp_reset_reason() != ESP_RST_POWERON && scan_journal_buffer_valid(&scan_buffer)) {
+        ESP_LOGI(TAG, "recovered %u bytes of sightings from rtc memory.", scan_buffer.len);
+        flush_scan_buffer();
+    } else {
+        scan_journal_buffer_reset(&scan_buffer);
+    }
 
-    init_spiffs();          // initialize spiffs
+    ESP_ERROR_CHECK(esp_register_shutdown_handler(flush_scan_buffer));  // esp_restart() also has to keep them
 
     load_teks();
 
@@ -758,21 +961,34 @@ void app_main(void) {
 
     randomize_mac();        // randomly generate a new mac address
 
+    ESP_ERROR_CHECK(scan_ring_init(&scan_queue, SCAN_RING_CAPACITY) ? ESP_OK : ESP_ERR_NO_MEM);
+    ESP_ERROR_CHECK(tracer_rpi_set_init(&scanned_data, SCAN_SET_CAPACITY) ? ESP_OK : ESP_ERR_NO_MEM);
     ble_adapter_register_scan_callback(&scan_cb);
 
     // scan for peers
 
     uint32_t epoch = get_epoch();
 
-    scan_for_peers(epoch, 600);
+    scan_sched_bounds scan_bounds = {
+        .min_window_ms = SCAN_MIN_WINDOW_MS,
+        .max_window_ms = SCAN_MAX_WINDOW_MS,
+        .min_interval_s = SCAN_MIN_INTERVAL_S,
+        .max_interval_s = SCAN_MAX_INTERVAL_S,
+        .max_duty_permille = SCAN_MAX_DUTY,
+    };
+    scan_sched_init(&scan_schedule, &scan_bounds);
+
+    scan_sched_update(&scan_schedule, scan_for_peers(epoch, scan_schedule.window_ms));
 
     // generate ble payload
 
     tracer_tek tek = *tracer_derive_tek(epoch);
 
-    tracer_datapair pair = tracer_derive_datapair(epoch, ble_adapter_get_adv_tx_power());
+    tracer_datapair pair;
+    tracer_derive_datapair_v2(epoch, ble_adapter_get_adv_tx_power(), &pair);
 
-    tracer_ble_payload payload = tracer_derive_ble_payload(pair);
+    tracer_ble_payload payload;
+    tracer_derive_ble_payload_v2(&pair, &payload);
 
     ble_adapter_set_raw(payload.value, payload.len);
 
@@ -781,7 +997,7 @@ void app_main(void) {
     //delete_old_enins(epoch);
 
     uint32_t last_datapair_epoch = epoch;
-    uint32_t last_scan_epoch = epoch;
+    uint32_t next_scan_epoch = epoch + scan_schedule.interval_s;
 
     // advertising loop
     while (true) {
@@ -807,9 +1023,9 @@ void app_main(void) {
 
         if (tracer_detect_enin_rollover(last_datapair_epoch, epoch)) {
             ESP_LOGI(TAG, "enin rollover!");
-            pair = tracer_derive_datapair(epoch, ble_adapter_get_adv_tx_power());
+            tracer_derive_datapair_v2(epoch, ble_adapter_get_adv_tx_power(), &pair);
             //ESP_LOGI(TAG, "derived datapair, generating payload.");
-            payload = tracer_derive_ble_payload(pair);
+            tracer_derive_ble_payload_v2(&pair, &payload);
             //ESP_LOGI(TAG, "setting raw data.");
             ble_adapter_set_raw(payload.value, payload.len);
             last_datapair_epoch = epoch;
@@ -817,11 +1033,12 @@ void app_main(void) {
 
         ble_adapter_start_advertising();                            // start advertising
 
-        if (tracer_detect_scanin_rollover(last_scan_epoch, epoch)) {
-            ESP_LOGI(TAG, "scanin rollover!");
-            scan_for_peers(epoch, 600);
-            free_spiffs(epoch, TRACER_SCAN_EXPIRY);
-            last_scan_epoch = epoch;
+        if (epoch >= next_scan_epoch) {
+            ESP_LOGI(TAG, "scanning for %u ms.", scan_schedule.window_ms);
+            scan_sched_update(&scan_schedule, scan_for_peers(epoch, scan_schedule.window_ms));
+            free_scans(epoch, TRACER_SCAN_EXPIRY);
+            next_scan_epoch = epoch + scan_schedule.interval_s;
+            ESP_LOGD(TAG, "next scan in %u s.", scan_schedule.interval_s);
         }
 
         vTaskDelay(20 / portTICK_PERIOD_MS);                        // wait for 10ms (1 RTOS tick)
@@ -5,21 +5,30 @@ from typing import *
 from Crypto.Cipher import AES
 from Crypto.Util import Counter
 from enum import Enum
+import os
 import secrets
 import operator
 import urllib.parse
 import threading
 import random
 import shutil
+import bisect
 import base64
 import time
 import csv
+import zlib
 
 class settings():
     caseid_len = 7          # how many characters long a tek is
     caseid_purge_age = 14   # how long caseids last
     tek_life = 14           # how long a tek lasts (how many the server should expect)
     packed_tek_len = 20     # how long a packed tek is in bytes (4 bytes epoch, 16 bytes tek)
+    enin_len = 60           # how many seconds an eninterval (rolling start number) is. the same as TRACER_ENIN_INTERVAL on the devices.
+    legacy_enin_len = 600   # how many seconds the intervals older tekfiles stored instead of epochs were
+    legacy_enin_max = 10**8 # older tekfile rows are below this, and epochs from any time since 1973 above it
+    export_version = 1      # the version of the tekx export format, see tek_export.h
+    export_batch_len = 1024 # the most teks in a batch of the tekx export
+    export_window_bits = 12 # the deflate window of the tekx export. devices inflate through a buffer this size.
 
 def get_epoch() -> int:
     """gets the unix epoch time"""
@@ -30,18 +39,113 @@ def derive_enin(epoch : int):
     return epoch // (60 * 10)
 
 def unpack_tek(tek : bytes) -> Tuple[int, str]:
-    """splits a datapair into an epoch and tek string. can be used for storage."""
-    return derive_enin(int.from_bytes(tek[:4], "little")), base64.b64encode(tek[4:settings.packed_tek_len]).decode("utf-8")
+    """splits a datapair into an epoch and tek string. can be used for storage. the epoch is kept as-is, since devices derive the tek's enin range from it."""
+    return int.from_bytes(tek[:4], "little"), base64.b64encode(tek[4:settings.packed_tek_len]).decode("utf-8")
 
 def pack_tek(epoch : int, tek : str) -> bytes:
     """turns a tek tuple into its binary representation"""
     return epoch.to_bytes(4, "little") + base64.b64decode(tek)
 
+class TekIndex():
+    """the teks in the tekfile, packed the way they are served and numbered in the order they were committed. a device
+    asks for the teks from the number after the last one it has seen, which is a slice of the index, not a scan of the tekfile.
+    the teks are also kept in a bucket per day they were generated on, so skipping the old ones is a slice of each newer day."""
+    day_len = 24 * 60 * 60
+
+    def __init__(self):
+        self.packed = bytearray()
+        self.days = {}      # day -> (the numbers of the day's teks in commit order, the day's packed teks)
+        self.lock = threading.Lock()
+
+    def load(self, path : str):
+        """loads the index from a tekfile. rows from older keyservers, which stored the interval number instead of the
+        epoch, are converted to the epoch their interval starts at, and the tekfile is rewritten with them converted."""
+        with open(path, "r") as tek_file:
+            rows = [(int(row[0]), row[1]) for row in csv.reader(tek_file)]
+
+        legacy = sum(epoch < settings.legacy_enin_max for epoch, _ in rows)
+        if legacy:
+            rows = [(epoch * settings.legacy_enin_len if epoch < settings.legacy_enin_max else epoch, tek) for epoch, tek in rows]
+            with open(path + ".tmp", "w") as tek_file:
+                tek_file.writelines(map("%d,%s\n".__mod__, rows))
+            os.replace(path + ".tmp", path)
+            print("converted %d tekfile rows from interval numbers to epochs" % legacy)
+
+        self.append(rows)
+
+    def append(self, teks : Iterable[Tuple[int, str]]):
+        """adds newly committed teks to the end of the index"""
+        teks = [(epoch, pack_tek(epoch, tek)) for epoch, tek in teks]
+        with self.lock:
+            for epoch, packed in teks:
+                seqs, day = self.days.setdefault(epoch // self.day_len, ([], bytearray()))
+                seqs.append(len(self))
+                day += packed
+                self.packed += packed
+
+    def __len__(self) -> int:
+        return len(self.packed) // settings.packed_tek_len
+
+    def since(self, seq : int, oldest : int = 0) -> Optional[bytes]:
+        """returns the packed teks numbered seq and up, that are no older than oldest. returns None if seq is past the end of the index.
+        without oldest they come in commit order, and with it a day at a time, oldest day first."""
+        with self.lock:
+            if seq > len(self): return None
+            if not oldest: return bytes(self.packed[seq * settings.packed_tek_len:])
+
+            # the teks numbered seq and up from the day of oldest on. they come out a day at a time, and only the first
+            # day can hold teks from before oldest.
+            slices = []
+            for day in sorted(d for d in self.days if d >= oldest // self.day_len):
+                seqs, packed = self.days[day]
+                slices.append(bytes(packed[bisect.bisect_left(seqs, seq) * settings.packed_tek_len:]))
+
+        if slices:
+            first = slices[0]
+            slices[0] = b"".join(first[i:i + settings.packed_tek_len] for i in range(0, len(first), settings.packed_tek_len)
+                if int.from_bytes(first[i:i + 4], "little") >= oldest)
+        return b"".join(slices)
+
+def varint(value : int) -> bytes:
+    """encodes a little-endian base-128 varint"""
+    out = bytearray()
+    while value > 0x7f:
+        out.append((value & 0x7f) | 0x80)
+        value >>= 7
+    out.append(value)
+    return bytes(out)
+
+def pack_export(packed : bytes, deflate : bool = False) -> bytes:
+    """turns packed teks into the tekx export format that devices decode with tek_export.h. the teks are sorted by rolling
+    start number, and each is sent as the varint difference from the one before it plus its 16-byte key."""
+    teks = sorted((int.from_bytes(packed[i:i + 4], "little") // settings.enin_len, packed[i + 4:i + settings.packed_tek_len])
+        for i in range(0, len(packed), settings.packed_tek_len))
+
+    body = bytearray()
+    for start in range(0, len(teks), settings.export_batch_len):
+        batch = teks[start:start + settings.export_batch_len]
+        previous = batch[0][0]
+        body += varint(len(batch)) + varint(previous)
+        for rolling_start, key in batch:
+            body += varint(rolling_start - previous) + key
+            previous = rolling_start
+    body += varint(0)
+
+    flags = 0
+    if deflate:
+        compressor = zlib.compressobj(9, zlib.DEFLATED, settings.export_window_bits)
+        body = compressor.compress(bytes(body)) + compressor.flush()
+        flags |= 1
+
+    return b"TEKX" + bytes([settings.export_version, flags]) + bytes(body)
+
 def commit_teks(teks : Iterable[Tuple[int, str]]):
-    """appends an iterable of teks to the tekfile."""
-    global tek_file_path
+    """appends an iterable of teks to the tekfile and the index."""
+    global tek_file_path, tek_index
+    teks = list(teks)
     with open(tek_file_path, "a") as tek_file:
         tek_file.writelines(map("%d,%s\n".__mod__, teks))
+    tek_index.append(teks)
 
 def random_bytes(num : int) -> bytes:
     """generates random bytes of length num"""
@@ -88,6 +192,11 @@ def gen_caseid(epoch: int, caseid_array: Set[Tuple[int, str]]) -> str:
     return data
 
 class TracerServerHandler(BaseHTTPRequestHandler):
+    # http/1.1 keeps the connection open between requests, so a device can download and upload over one connection
+    protocol_version = "HTTP/1.1"
+    # the header and body are written separately, and waiting on the device's delayed ack for the header would stall every response
+    disable_nagle_algorithm = True
+
     def send_headers(self, code : int = 200, headers : dict = { "Content-Type" : "text/html" }) -> None:
         """sends a response code and a dictionary of headers"""
         self.send_response(code)
@@ -95,51 +204,68 @@ class TracerServerHandler(BaseHTTPRequestHandler):
             self.send_header(key, value)
         self.end_headers()
 
+    def send_body(self, body : bytes, code : int = 200, content_type : str = "text/html") -> None:
+        """sends a whole response. every response needs a length, or the connection can't be kept open."""
+        self.send_headers(code, { "Content-Type" : content_type, "Content-Length" : str(len(body)) })
+        self.wfile.write(body)
+
     def get_query(self, default : dict = {}) -> dict:
         """gets the query string as a dictionary"""
         return dict([*default.items()] + [*urllib.parse.parse_qs(urllib.parse.urlparse(self.path).query, False).items()])
 
     def do_GET(self):
-        """returns all of the valid binary TEKs"""
-        global tek_file_path
-        self.send_headers()
+        """returns the binary TEKs. ?since= skips the ones before a number in commit order, so a device that has seen
+        the first n TEKs asks for ?since=n and only downloads the new ones. ?oldest= skips the ones generated before an epoch.
+        ?format=tekx sends them in the compact export format, deflated if ?deflate=1 is given too."""
+        global tek_index
         query = self.get_query({ 
-            "oldest" : [0] 
+            "oldest" : [0],
+            "since" : [0],
+            "format" : ["raw"],
+            "deflate" : [0]
         })
 
         oldest_age = int(query["oldest"][0])
+        since = int(query["since"][0])
+        export_format = query["format"][0]
+        deflate = int(query["deflate"][0]) != 0
+
+        if export_format not in ("raw", "tekx"):
+            self.send_body(b"unknown format", 400)
+            return
 
-        with open(tek_file_path, "r") as tek_file:
-            tek_reader = csv.reader(tek_file)
-            for row in tek_reader:
-                epoch = int(row[0])
-                if epoch >= oldest_age:
-                    self.wfile.write(pack_tek(epoch, row[1]))
+        body = tek_index.since(since, oldest_age)
+        if body is None:
+            # the device has seen more teks than there are, so the tekfile was reset. it starts over from 0.
+            self.send_body(b"", 416)
+            return
+
+        if export_format == "tekx": body = pack_export(body, deflate)
+        self.send_body(body, content_type="application/octet-stream")
 
     def do_POST(self):
         """accepts a body consisting of a CaseID and 14 binary TEKs and saves them to a pending TEK array if the CaseID is valid."""
         global active_caseid_array, pending_teks
 
-        self.send_headers()
-        content_len = int(self.headers["Content-Length"])
-        content_len -= settings.caseid_len
+        # the whole body is read, even when it is thrown away, so the next request on the connection starts in the right place
+        body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        content_len = len(body) - settings.caseid_len
         if content_len // settings.packed_tek_len == settings.tek_life:
-            caseid = self.rfile.read(settings.caseid_len).decode("utf-8")
+            caseid = body[:settings.caseid_len].decode("utf-8")
             ret, match_caseid = burn_caseid(caseid, active_caseid_array)
             if ret == CaseIDType.VALID:
                 active_caseid_array.remove(match_caseid)
                 for i in range(settings.tek_life):
-                    chunk = self.rfile.read(settings.packed_tek_len)
-                    if not chunk: break
-                    tek = unpack_tek(chunk)
+                    offset = settings.caseid_len + i * settings.packed_tek_len
+                    tek = unpack_tek(body[offset:offset + settings.packed_tek_len])
                     if tek[0]: pending_teks.append(tek)
-                self.wfile.write(b"ok")
+                self.send_body(b"ok")
                 return
-            elif burn_caseid == CaseIDType.TOO_OLD:
-                self.wfile.write(b"expired")
+            elif ret == CaseIDType.TOO_OLD:
+                self.send_body(b"expired")
                 return
-        
-        self.wfile.write(b"invalid")
+
+        self.send_body(b"invalid")
 
     def log_message(self, format, *args):
         return
@@ -150,6 +276,9 @@ caseid_file_path = "caseid.csv"
 active_caseid_array = get_caseids()
 pending_teks = []
 
+tek_index = TekIndex()
+if os.path.exists(tek_file_path): tek_index.load(tek_file_path)     # a new keyserver has no tekfile until the first teks are committed
+
 http_server = HTTPServer(("", 80), TracerServerHandler)
 
 server_thread = threading.Thread(target=http_server.serve_forever, name="tracer webserver")